@@ -318,7 +318,7 @@ size_t get_xor_null_free_size(cs_insn *insn) {
         return 6;  // Standard XOR reg, imm32
     } else {
         // MOV EAX, imm + XOR reg, EAX
-        return get_mov_eax_imm_size(imm) + 2;  // MOV + XOR
+        return get_mov_eax_imm_size(imm) + 2 + get_temp_save_restore_size(X86_REG_EAX);  // MOV + XOR
     }
 }
 
@@ -388,8 +388,8 @@ void generate_xor_null_free(struct buffer *b, cs_insn *insn) {
             buffer_write_byte(b, 0x59);
         } else {
             // For non-EAX registers, use EAX as temporary
-            // PUSH EAX
-            buffer_write_byte(b, 0x50);
+            // PUSH EAX (unless EAX is scratch)
+            generate_temp_save(b, X86_REG_EAX);
 
             // MOV EAX, imm (using null-free construction)
             generate_mov_eax_imm(b, imm);
@@ -401,7 +401,7 @@ void generate_xor_null_free(struct buffer *b, cs_insn *insn) {
             buffer_write_byte(b, modrm);
 
             // POP EAX
-            buffer_write_byte(b, 0x58);
+            generate_temp_restore(b, X86_REG_EAX);
         }
     }
 }
@@ -624,6 +624,17 @@ int is_register_available(uint8_t reg, cs_insn *current_insn) {
  * Get an available temporary register (not the same as the source/dest registers)
  */
 uint8_t get_available_temp_register(cs_insn *insn) {
+    // Registers the caller declared clobbered (--clobber) and dead here need
+    // no save/restore, so they come first
+    static const x86_reg scratch_order[] = {
+        X86_REG_EAX, X86_REG_ECX, X86_REG_EDX, X86_REG_EBX, X86_REG_ESI, X86_REG_EDI
+    };
+    for (size_t i = 0; i < sizeof(scratch_order) / sizeof(scratch_order[0]); i++) {
+        if (is_scratch_register(scratch_order[i]) && is_register_available(scratch_order[i], insn)) {
+            return scratch_order[i];
+        }
+    }
+
     if (insn->detail->x86.op_count >= 1 && insn->detail->x86.operands[0].type == X86_OP_REG) {
         uint8_t dest_reg = insn->detail->x86.operands[0].reg;
         if (dest_reg != X86_REG_EAX && is_register_available(X86_REG_EAX, insn)) return X86_REG_EAX;
@@ -91,9 +91,11 @@ void generate_arithmetic_flag_preservation(struct buffer *b, cs_insn *insn) {
     cs_x86_op *src_op = &insn->detail->x86.operands[1];
     
     // Save flags or use alternate approach to maintain flag state
-    // PUSHFD to save flags (if needed)
-    uint8_t pushfd[] = {0x9C};
-    buffer_append(b, pushfd, 1);
+    // PUSHFD to save flags (not needed if the caller declared them clobbered)
+    int save_flags = !is_scratch_flags();
+    if (save_flags) {
+        buffer_write_byte(b, 0x9C);
+    }
     
     // We'll implement a generic approach that avoids the immediate with nulls
     // Use a temporary register to load the immediate value without nulls
@@ -144,8 +146,9 @@ void generate_arithmetic_flag_preservation(struct buffer *b, cs_insn *insn) {
     if (!recognized_op) {
         // If we don't recognize the op, fall back to original
         buffer_append(b, insn->bytes, insn->size);
-        uint8_t popfd[] = {0x9D};
-        buffer_append(b, popfd, 1);
+        if (save_flags) {
+            buffer_write_byte(b, 0x9D);  // POPFD
+        }
         return;
     }
     
@@ -157,8 +160,9 @@ void generate_arithmetic_flag_preservation(struct buffer *b, cs_insn *insn) {
     buffer_append(b, arithmetic_instr, 2);
     
     // Restore flags if needed (though this approach should maintain the same flag state)
-    uint8_t popfd[] = {0x9D};
-    buffer_append(b, popfd, 1);
+    if (save_flags) {
+        buffer_write_byte(b, 0x9D);  // POPFD
+    }
 }
 
 /*
@@ -0,0 +1,622 @@
+/*
+ * ARM64 Immediate Encoding Helpers Implementation
+ */
+
+#include "arm64_immediate_encoding.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "utils.h"  // For is_bad_byte_free
+#include "core.h"   // For the active bad-byte context
+
+#define A64_LOGICAL_IMMEDIATES 5334   // Distinct N:immr:imms values
+#define A64_SYNTH_CACHE_SIZE   64
+
+// Move-wide opc field
+#define A64_MOVN 0U
+#define A64_MOVZ 2U
+#define A64_MOVK 3U
+
+// Logical (immediate) opc field
+#define A64_AND 0U
+#define A64_ORR 1U
+#define A64_EOR 2U
+
+// Memo entry kinds
+#define A64_MEMO_CONSTANT 1
+#define A64_MEMO_MOVK     2
+
+typedef struct {
+    int count;
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+} a64_seq_t;
+
+typedef struct {
+    uint64_t value;
+    uint16_t field;        // N:immr:imms
+} a64_logical_entry_t;
+
+typedef struct {
+    unsigned int generation;   // 0 = empty
+    int kind;
+    uint64_t value;
+    uint8_t rd;
+    int is_32bit;
+    int count;
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+} a64_memo_entry_t;
+
+/*
+ * The logical-immediate table depends on nothing but the ISA: it is built
+ * once per process and only read afterwards. Memoized sequences are keyed by
+ * the generation of the active bad-byte context, so sequences found under
+ * another profile are never reused.
+ */
+static a64_logical_entry_t g_a64_logical[A64_LOGICAL_IMMEDIATES];
+static int g_a64_logical_count = 0;
+static pthread_once_t g_a64_logical_once = PTHREAD_ONCE_INIT;
+
+static __thread a64_memo_entry_t g_a64_memo[A64_SYNTH_CACHE_SIZE];
+
+static uint64_t a64_width_mask(int sf) {
+    return sf ? ~0ULL : 0xFFFFFFFFULL;
+}
+
+static uint32_t a64_chunk(uint64_t value, unsigned int hw) {
+    return (uint32_t)((value >> (16U * hw)) & 0xFFFFU);
+}
+
+static uint32_t a64_move_wide(uint32_t opc, int sf, uint32_t hw, uint32_t imm16, uint32_t rd) {
+    return ((uint32_t)(sf ? 1 : 0) << 31) | (opc << 29) | 0x12800000U |
+           (hw << 21) | ((imm16 & 0xFFFFU) << 5) | rd;
+}
+
+static uint32_t a64_logical(uint32_t opc, int sf, uint32_t field, uint32_t rn, uint32_t rd) {
+    return ((uint32_t)(sf ? 1 : 0) << 31) | (opc << 29) | 0x12000000U |
+           (field << 10) | (rn << 5) | rd;
+}
+
+static uint32_t a64_add_sub(int sub, int sf, int shift12, uint32_t imm12, uint32_t rn, uint32_t rd) {
+    return ((uint32_t)(sf ? 1 : 0) << 31) | ((uint32_t)(sub ? 1 : 0) << 30) | 0x11000000U |
+           ((uint32_t)(shift12 ? 1 : 0) << 22) | (imm12 << 10) | (rn << 5) | rd;
+}
+
+static int a64_seq_push(a64_seq_t *seq, uint32_t word) {
+    if (seq->count >= A64_SYNTH_MAX_WORDS || !is_bad_byte_free(word)) {
+        return 0;
+    }
+    seq->words[seq->count++] = word;
+    return 1;
+}
+
+// ============================================================================
+// Logical immediates
+// ============================================================================
+
+/*
+ * DecodeBitMasks: N:imms gives the element size and number of ones, immr the
+ * rotation. Rotations of immr >= size alias smaller ones and are rejected so
+ * that every value has exactly one field.
+ */
+static int a64_decode_logical(uint32_t field, int sf, uint64_t *value_out) {
+    uint32_t n = (field >> 12) & 1U;
+    uint32_t immr = (field >> 6) & 0x3FU;
+    uint32_t imms = field & 0x3FU;
+    uint32_t combined = (n << 6) | (~imms & 0x3FU);
+    unsigned int size, ones;
+    uint64_t element, value;
+
+    if (combined == 0 || (!sf && n)) {
+        return 0;
+    }
+    size = 64;
+    while (!(combined & 0x40U)) {
+        combined <<= 1;
+        size >>= 1;
+    }
+    ones = (imms & (size - 1)) + 1;
+    if (ones == size || immr >= size) {
+        return 0;
+    }
+
+    element = (1ULL << ones) - 1;
+    if (immr) {
+        element = (element >> immr) | (element << (size - immr));
+    }
+    if (size < 64) {
+        element &= (1ULL << size) - 1;
+    }
+    value = 0;
+    for (unsigned int pos = 0; pos < 64; pos += size) {
+        value |= element << pos;
+    }
+    *value_out = value & a64_width_mask(sf);
+    return 1;
+}
+
+static int compare_a64_logical_entry(const void *a, const void *b) {
+    const a64_logical_entry_t *x = (const a64_logical_entry_t *)a;
+    const a64_logical_entry_t *y = (const a64_logical_entry_t *)b;
+
+    if (x->value != y->value) {
+        return (x->value < y->value) ? -1 : 1;
+    }
+    return (int)x->field - (int)y->field;
+}
+
+static void a64_logical_table_build(void) {
+    int count = 0;
+
+    for (uint32_t field = 0; field < 0x2000U; field++) {
+        uint64_t value;
+        if (a64_decode_logical(field, 1, &value) && count < A64_LOGICAL_IMMEDIATES) {
+            g_a64_logical[count].value = value;
+            g_a64_logical[count].field = (uint16_t)field;
+            count++;
+        }
+    }
+    qsort(g_a64_logical, (size_t)count, sizeof(g_a64_logical[0]), compare_a64_logical_entry);
+    g_a64_logical_count = count;
+}
+
+void arm64_immediate_tables_build(void) {
+    pthread_once(&g_a64_logical_once, a64_logical_table_build);
+}
+
+int encode_arm64_logical_immediate(uint64_t value, int is_32bit) {
+    int lo = 0, hi = g_a64_logical_count;
+
+    if (is_32bit) {
+        if (value >> 32) {
+            return -1;
+        }
+        value |= value << 32;   // A W-form pattern repeats in both halves
+    }
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (g_a64_logical[mid].value < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == g_a64_logical_count || g_a64_logical[lo].value != value) {
+        return -1;
+    }
+    if (is_32bit && (g_a64_logical[lo].field & 0x1000U)) {
+        return -1;
+    }
+    return g_a64_logical[lo].field;
+}
+
+// ============================================================================
+// Decoding
+// ============================================================================
+
+int decode_arm64_constant_write(uint32_t word, uint64_t *value_out, uint8_t *rd_out, int *is_32bit_out) {
+    int sf = (int)(word >> 31);
+    uint32_t rd = word & 0x1FU;
+    uint64_t value;
+
+    if (!value_out || !rd_out || !is_32bit_out || rd == A64_REG_ZR) {
+        return 0;  // Writes to XZR are no-ops; ORR to register 31 writes SP
+    }
+
+    switch (word & 0x7F800000U) {
+        case 0x52800000U:   // MOVZ
+        case 0x12800000U: { // MOVN
+            uint32_t hw = (word >> 21) & 3U;
+            if (!sf && hw > 1) {
+                return 0;
+            }
+            value = (uint64_t)((word >> 5) & 0xFFFFU) << (16U * hw);
+            if ((word & 0x7F800000U) == 0x12800000U) {
+                value = ~value;
+            }
+            break;
+        }
+        case 0x32000000U:   // ORR (immediate)
+            if (((word >> 5) & 0x1FU) != A64_REG_ZR ||
+                !a64_decode_logical((word >> 10) & 0x1FFFU, sf, &value)) {
+                return 0;
+            }
+            break;
+        default:
+            return 0;
+    }
+
+    *value_out = value & a64_width_mask(sf);
+    *rd_out = (uint8_t)rd;
+    *is_32bit_out = !sf;
+    return 1;
+}
+
+int decode_arm64_movk(uint32_t word, uint8_t *rd_out, uint8_t *hw_out, uint16_t *imm16_out,
+                      int *is_32bit_out) {
+    int sf = (int)(word >> 31);
+    uint32_t hw = (word >> 21) & 3U;
+
+    if (!rd_out || !hw_out || !imm16_out || !is_32bit_out) {
+        return 0;
+    }
+    if ((word & 0x7F800000U) != 0x72800000U || (word & 0x1FU) == A64_REG_ZR || (!sf && hw > 1)) {
+        return 0;
+    }
+    *rd_out = (uint8_t)(word & 0x1FU);
+    *hw_out = (uint8_t)hw;
+    *imm16_out = (uint16_t)((word >> 5) & 0xFFFFU);
+    *is_32bit_out = !sf;
+    return 1;
+}
+
+// ============================================================================
+// Search
+// ============================================================================
+
+/*
+ * Replace one 16-bit chunk of Rd, leaving the rest alone. In order of length:
+ *   MOVK #d
+ *   MOVK #(d -+ k) ; ADD/SUB #k       (chunks 0 and 1, within the chunk)
+ *   MOVK #(d ^ run) ; EOR #run        (run: contiguous ones inside the chunk)
+ *   AND #~chunk ; ORR #run ...        (one ORR per run of ones in d)
+ */
+static int a64_insert_chunk(int sf, uint32_t hw, uint32_t d, uint32_t rd, a64_seq_t *out) {
+    unsigned int shift = 16U * hw;
+    a64_seq_t seq;
+    int field;
+
+    seq.count = 0;
+    if (a64_seq_push(&seq, a64_move_wide(A64_MOVK, sf, hw, d, rd))) {
+        *out = seq;
+        return 1;
+    }
+
+    if (hw <= 1) {
+        // Chunk 1 is reached by ADD/SUB #(k << 4), LSL #12
+        uint32_t limit = hw ? 0xFFU : 0xFFFU;
+        for (uint32_t k = 1; k <= limit; k++) {
+            uint32_t imm12 = hw ? (k << 4) : k;
+            for (int sub = 0; sub < 2; sub++) {
+                uint32_t start = sub ? d + k : d - k;
+                if ((!sub && d < k) || (sub && start > 0xFFFFU)) {
+                    continue;
+                }
+                seq.count = 0;
+                if (a64_seq_push(&seq, a64_move_wide(A64_MOVK, sf, hw, start, rd)) &&
+                    a64_seq_push(&seq, a64_add_sub(sub, sf, (int)hw, imm12, rd, rd))) {
+                    *out = seq;
+                    return 2;
+                }
+            }
+        }
+    }
+
+    for (unsigned int lo = 0; lo < 16; lo++) {
+        for (unsigned int len = 1; lo + len <= 16; len++) {
+            uint32_t run = ((1U << len) - 1U) << lo;
+            field = encode_arm64_logical_immediate((uint64_t)run << shift, !sf);
+            if (field < 0) {
+                continue;
+            }
+            seq.count = 0;
+            if (a64_seq_push(&seq, a64_move_wide(A64_MOVK, sf, hw, d ^ run, rd)) &&
+                a64_seq_push(&seq, a64_logical(A64_EOR, sf, (uint32_t)field, rd, rd))) {
+                *out = seq;
+                return 2;
+            }
+        }
+    }
+
+    field = encode_arm64_logical_immediate(~(0xFFFFULL << shift) & a64_width_mask(sf), !sf);
+    seq.count = 0;
+    if (field < 0 || !a64_seq_push(&seq, a64_logical(A64_AND, sf, (uint32_t)field, rd, rd))) {
+        return 0;
+    }
+    for (unsigned int bit = 0; bit < 16; ) {
+        unsigned int len = 0;
+        if (!(d & (1U << bit))) {
+            bit++;
+            continue;
+        }
+        while (bit + len < 16 && (d & (1U << (bit + len)))) {
+            len++;
+        }
+        field = encode_arm64_logical_immediate((uint64_t)(((1U << len) - 1U) << bit) << shift, !sf);
+        if (field < 0 || !a64_seq_push(&seq, a64_logical(A64_ORR, sf, (uint32_t)field, rd, rd))) {
+            return 0;
+        }
+        bit += len;
+    }
+    *out = seq;
+    return seq.count;
+}
+
+/*
+ * Cheapest MOVZ or MOVN base plus a clean MOVK per remaining chunk, within
+ * `limit` words (the inner step of the adjust-last search)
+ */
+static int a64_quick_build(uint64_t value, int sf, uint32_t rd, int limit, a64_seq_t *out) {
+    unsigned int chunks = sf ? 4 : 2;
+    uint32_t movk[4];
+    int movk_clean[4];
+    int best = 0;
+
+    for (unsigned int c = 0; c < chunks; c++) {
+        movk[c] = a64_move_wide(A64_MOVK, sf, c, a64_chunk(value, c), rd);
+        movk_clean[c] = is_bad_byte_free(movk[c]);
+    }
+
+    for (int inverted = 0; inverted < 2; inverted++) {
+        uint32_t fill = inverted ? 0xFFFFU : 0;   // What MOVZ/MOVN leave in the other chunks
+        for (unsigned int hw = 0; hw < chunks; hw++) {
+            uint32_t imm16 = inverted ? (~a64_chunk(value, hw) & 0xFFFFU) : a64_chunk(value, hw);
+            uint32_t base = a64_move_wide(inverted ? A64_MOVN : A64_MOVZ, sf, hw, imm16, rd);
+            int cost = 1;
+
+            if (!is_bad_byte_free(base)) {
+                continue;
+            }
+            for (unsigned int c = 0; c < chunks && cost <= limit; c++) {
+                if (c != hw && a64_chunk(value, c) != fill) {
+                    cost = movk_clean[c] ? cost + 1 : limit + 1;
+                }
+            }
+            if (cost > limit || (best && cost >= best)) {
+                continue;
+            }
+            best = cost;
+            out->count = 0;
+            out->words[out->count++] = base;
+            for (unsigned int c = 0; c < chunks; c++) {
+                if (c != hw && a64_chunk(value, c) != fill) {
+                    out->words[out->count++] = movk[c];
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/*
+ * Shortest clean sequence writing `value` to Rd with operand width sf:
+ *   1. a base (MOVZ, MOVN or ORR Rd, ZR, #bitmask) and a chunk insert for
+ *      every chunk the base gets wrong
+ *   2. a quick build of a nearby value and a final ADD/SUB #imm12{, LSL #12}
+ *      or EOR #bitmask
+ */
+static void a64_synth_direct(uint64_t value, int sf, uint32_t rd, a64_seq_t *best) {
+    unsigned int chunks = sf ? 4 : 2;
+    a64_seq_t fix[4];
+    int fix_cost[4];
+    a64_seq_t seq;
+
+    value &= a64_width_mask(sf);
+    for (unsigned int c = 0; c < chunks; c++) {
+        fix_cost[c] = -1;   // Computed on first use
+    }
+
+    for (int i = -8; i < g_a64_logical_count; i++) {
+        uint64_t start;
+        uint32_t base;
+        int cost = 1;
+
+        if (best->count == 1) {
+            return;
+        }
+        if (i < 0) {
+            // MOVZ (-8..-5) or MOVN (-4..-1) of chunk hw
+            unsigned int hw = (unsigned int)((i + 8) & 3);
+            int inverted = i >= -4;
+            uint32_t imm16;
+            if (hw >= chunks) {
+                continue;
+            }
+            imm16 = inverted ? (~a64_chunk(value, hw) & 0xFFFFU) : a64_chunk(value, hw);
+            start = (uint64_t)imm16 << (16U * hw);
+            start = (inverted ? ~start : start) & a64_width_mask(sf);
+            base = a64_move_wide(inverted ? A64_MOVN : A64_MOVZ, sf, hw, imm16, rd);
+        } else {
+            int field;
+            start = g_a64_logical[i].value;
+            if (!sf) {
+                if ((start >> 32) != (start & 0xFFFFFFFFULL)) {
+                    continue;
+                }
+                start &= 0xFFFFFFFFULL;
+            }
+            if (start != value && best->count == 2) {
+                continue;   // A bitmask base plus a fix cannot beat two words
+            }
+            field = encode_arm64_logical_immediate(start, !sf);
+            if (field < 0) {
+                continue;
+            }
+            base = a64_logical(A64_ORR, sf, (uint32_t)field, A64_REG_ZR, rd);
+        }
+        if (!is_bad_byte_free(base)) {
+            continue;
+        }
+
+        for (unsigned int c = 0; c < chunks; c++) {
+            if (a64_chunk(start, c) == a64_chunk(value, c)) {
+                continue;
+            }
+            if (fix_cost[c] < 0) {
+                fix_cost[c] = a64_insert_chunk(sf, c, a64_chunk(value, c), rd, &fix[c]);
+            }
+            cost = fix_cost[c] ? cost + fix_cost[c] : A64_SYNTH_MAX_WORDS + 1;
+        }
+        if (cost > A64_SYNTH_MAX_WORDS || (best->count && cost >= best->count)) {
+            continue;
+        }
+
+        seq.count = 0;
+        seq.words[seq.count++] = base;
+        for (unsigned int c = 0; c < chunks; c++) {
+            if (a64_chunk(start, c) != a64_chunk(value, c)) {
+                memcpy(&seq.words[seq.count], fix[c].words, (size_t)fix[c].count * sizeof(uint32_t));
+                seq.count += fix[c].count;
+            }
+        }
+        *best = seq;
+    }
+
+    if (best->count && best->count <= 2) {
+        return;
+    }
+
+    // Adjust-last: ADD/SUB (2 * 2 * 4095 candidates), then EOR (each bitmask)
+    for (int i = 0; i < 2 * 2 * 0xFFF + g_a64_logical_count; i++) {
+        uint64_t start;
+        uint32_t last;
+        int field;
+        int limit = (best->count ? best->count - 1 : A64_SYNTH_MAX_WORDS) - 1;
+
+        if (limit < 1) {
+            return;
+        }
+        if (i < 2 * 2 * 0xFFF) {
+            int sub = i & 1;
+            int shift12 = (i >> 1) & 1;
+            uint32_t imm12 = (uint32_t)(i >> 2) + 1;
+            uint64_t delta = (uint64_t)imm12 << (shift12 ? 12 : 0);
+            last = a64_add_sub(sub, sf, shift12, imm12, rd, rd);
+            start = sub ? value + delta : value - delta;
+        } else {
+            uint64_t mask = g_a64_logical[i - 2 * 2 * 0xFFF].value;
+            if (!sf) {
+                if ((mask >> 32) != (mask & 0xFFFFFFFFULL)) {
+                    continue;
+                }
+                mask &= 0xFFFFFFFFULL;
+            }
+            field = encode_arm64_logical_immediate(mask, !sf);
+            if (field < 0) {
+                continue;
+            }
+            last = a64_logical(A64_EOR, sf, (uint32_t)field, rd, rd);
+            start = value ^ mask;
+        }
+        if (!is_bad_byte_free(last)) {
+            continue;
+        }
+        if (a64_quick_build(start & a64_width_mask(sf), sf, rd, limit, &seq)) {
+            seq.words[seq.count++] = last;
+            *best = seq;
+        }
+    }
+}
+
+// Shortest direct sequence over the widths Rd allows
+static void a64_synth_register(uint64_t value, uint32_t rd, int is_32bit, a64_seq_t *best) {
+    best->count = 0;
+    if (!is_32bit) {
+        a64_synth_direct(value, 1, rd, best);
+    }
+    if ((value >> 32) == 0 && best->count != 1) {
+        a64_seq_t narrow;
+        narrow.count = 0;
+        a64_synth_direct(value, 0, rd, &narrow);   // W writes zero-extend
+        if (narrow.count && (!best->count || narrow.count < best->count)) {
+            *best = narrow;
+        }
+    }
+}
+
+static a64_memo_entry_t *a64_memo_slot(int kind, uint64_t value, uint8_t rd, int is_32bit) {
+    uint64_t hash = (value * 0x9E3779B97F4A7C15ULL) ^ ((uint64_t)rd << 7) ^
+                    ((uint64_t)kind << 13) ^ (uint64_t)is_32bit;
+    return &g_a64_memo[(hash >> 40) % A64_SYNTH_CACHE_SIZE];
+}
+
+static int a64_memo_find(int kind, uint64_t value, uint8_t rd, int is_32bit, uint32_t *words_out) {
+    a64_memo_entry_t *slot = a64_memo_slot(kind, value, rd, is_32bit);
+    unsigned int generation = current_bad_byte_context()->generation;
+
+    if (generation == 0 || slot->generation != generation || slot->kind != kind ||
+        slot->value != value || slot->rd != rd || slot->is_32bit != is_32bit) {
+        return -1;
+    }
+    memcpy(words_out, slot->words, (size_t)slot->count * sizeof(uint32_t));
+    return slot->count;
+}
+
+static int a64_memo_store(int kind, uint64_t value, uint8_t rd, int is_32bit, const a64_seq_t *seq,
+                          uint32_t *words_out) {
+    a64_memo_entry_t *slot = a64_memo_slot(kind, value, rd, is_32bit);
+
+    slot->generation = current_bad_byte_context()->generation;
+    slot->kind = kind;
+    slot->value = value;
+    slot->rd = rd;
+    slot->is_32bit = is_32bit;
+    slot->count = seq->count;
+    memcpy(slot->words, seq->words, (size_t)seq->count * sizeof(uint32_t));
+    memcpy(words_out, seq->words, (size_t)seq->count * sizeof(uint32_t));
+    return seq->count;
+}
+
+int arm64_synthesize_constant(uint64_t value, uint8_t rd, int is_32bit,
+                              uint32_t words_out[A64_SYNTH_MAX_WORDS]) {
+    a64_seq_t best, via;
+    int cached;
+
+    if (!words_out || rd >= A64_REG_ZR || g_a64_logical_count == 0) {
+        return 0;
+    }
+    if (is_32bit) {
+        value &= 0xFFFFFFFFULL;
+    }
+    if ((cached = a64_memo_find(A64_MEMO_CONSTANT, value, rd, is_32bit, words_out)) >= 0) {
+        return cached;
+    }
+
+    a64_synth_register(value, rd, is_32bit, &best);
+
+    /*
+     * Rd itself may be what keeps every sequence dirty (it shares byte 0 with
+     * the immediate). Build the constant in another register instead, saved
+     * around the rewrite: STR Xs, [SP, #-16]! ; ... ; MOV Rd, Rs ; LDR Xs, [SP], #16
+     */
+    for (uint32_t scratch = 0; scratch < A64_REG_ZR && best.count == 0; scratch++) {
+        a64_seq_t build;
+        uint32_t mov = (is_32bit ? 0x2A0003E0U : 0xAA0003E0U) | (scratch << 16) | rd;
+
+        if (scratch == rd) {
+            continue;
+        }
+        a64_synth_register(value, scratch, is_32bit, &build);
+        if (build.count == 0 || build.count + 3 > A64_SYNTH_MAX_WORDS) {
+            continue;
+        }
+        via.count = 0;
+        if (!a64_seq_push(&via, 0xF81F0FE0U | scratch)) {   // STR Xs, [SP, #-16]!
+            continue;
+        }
+        memcpy(&via.words[1], build.words, (size_t)build.count * sizeof(uint32_t));
+        via.count += build.count;
+        if (a64_seq_push(&via, mov) && a64_seq_push(&via, 0xF84107E0U | scratch)) {   // LDR Xs, [SP], #16
+            best = via;
+        }
+    }
+
+    return a64_memo_store(A64_MEMO_CONSTANT, value, rd, is_32bit, &best, words_out);
+}
+
+int arm64_synthesize_movk(uint8_t rd, uint8_t hw, uint16_t imm16, int is_32bit,
+                          uint32_t words_out[A64_SYNTH_MAX_WORDS]) {
+    uint64_t key = ((uint64_t)hw << 16) | imm16;
+    a64_seq_t seq;
+    int cached;
+
+    if (!words_out || rd >= A64_REG_ZR || hw > (is_32bit ? 1 : 3) || g_a64_logical_count == 0) {
+        return 0;
+    }
+    if ((cached = a64_memo_find(A64_MEMO_MOVK, key, rd, is_32bit, words_out)) >= 0) {
+        return cached;
+    }
+
+    seq.count = 0;
+    a64_insert_chunk(!is_32bit, hw, imm16, rd, &seq);
+    return a64_memo_store(A64_MEMO_MOVK, key, rd, is_32bit, &seq, words_out);
+}
@@ -0,0 +1,56 @@
+/*
+ * ARM64 Immediate Encoding Helpers
+ *
+ * Constant synthesis for AArch64. A constant can be written with move-wide
+ * instructions (MOVZ/MOVN/MOVK, one 16-bit chunk each), logical immediates
+ * (ORR/EOR/AND with a replicated, rotated run of ones) and ADD/SUB with a
+ * 12-bit immediate shifted by 0 or 12. The search combines them into the
+ * shortest sequence whose words are all bad-byte free.
+ */
+
+#ifndef ARM64_IMMEDIATE_ENCODING_H
+#define ARM64_IMMEDIATE_ENCODING_H
+
+#include <stdint.h>
+#include "cli.h"  // For bad_byte_config_t
+
+#define A64_SYNTH_MAX_WORDS 8    // Longest sequence the search returns
+#define A64_REG_ZR          31   // XZR/WZR (SP for ADD/SUB and loads/stores)
+
+// Build the logical-immediate table (once per process; called whenever a
+// bad-byte context is built)
+void arm64_immediate_tables_build(void);
+
+// Look up the N:immr:imms field of a logical immediate.
+// is_32bit: W form (N must be 0, value is 32 bits). Returns -1 if not encodable.
+int encode_arm64_logical_immediate(uint64_t value, int is_32bit);
+
+// Decode a constant write: MOVZ, MOVN or ORR Rd, ZR, #imm.
+// Returns 1 and fills the outputs if `word` is one of them.
+int decode_arm64_constant_write(uint32_t word, uint64_t *value_out, uint8_t *rd_out, int *is_32bit_out);
+
+// Decode MOVK Rd, #imm16, LSL #(16 * hw). Returns 1 if `word` is a MOVK.
+int decode_arm64_movk(uint32_t word, uint8_t *rd_out, uint8_t *hw_out, uint16_t *imm16_out,
+                      int *is_32bit_out);
+
+/*
+ * Shortest bad-byte-free sequence that leaves `value` in Rd.
+ * is_32bit: Rd is a W register. An X destination whose value fits in 32 bits
+ * may be written through its W view. When no sequence writes Rd directly, a
+ * saved scratch register (STR/LDR on the stack) carries the constant.
+ * Results are memoized per thread and profile.
+ * Returns the number of words stored in words_out, 0 if none is clean.
+ */
+int arm64_synthesize_constant(uint64_t value, uint8_t rd, int is_32bit,
+                              uint32_t words_out[A64_SYNTH_MAX_WORDS]);
+
+/*
+ * Shortest bad-byte-free replacement for MOVK Rd, #imm16, LSL #(16 * hw):
+ * MOVK of a nearby value corrected by ADD/SUB or EOR, or AND clearing the
+ * chunk followed by ORR of its runs of ones. Other bits of Rd are preserved.
+ * Returns the number of words stored in words_out, 0 if none is clean.
+ */
+int arm64_synthesize_movk(uint8_t rd, uint8_t hw, uint16_t imm16, int is_32bit,
+                          uint32_t words_out[A64_SYNTH_MAX_WORDS]);
+
+#endif /* ARM64_IMMEDIATE_ENCODING_H */
@@ -3,6 +3,7 @@
  */
 
 #include "arm64_strategies.h"
+#include "arm64_immediate_encoding.h"
 #include "utils.h"
 #include <capstone/capstone.h>
 
@@ -39,12 +40,133 @@ static strategy_t arm64_mov_original_strategy = {
     .target_arch = BYVAL_ARCH_ARM64
 };
 
+static uint32_t arm64_insn_word(cs_insn *insn) {
+    return (uint32_t)insn->bytes[0] |
+           ((uint32_t)insn->bytes[1] << 8) |
+           ((uint32_t)insn->bytes[2] << 16) |
+           ((uint32_t)insn->bytes[3] << 24);
+}
+
+static void append_arm64_words(struct buffer *b, const uint32_t *words, int count) {
+    for (int i = 0; i < count; i++) {
+        buffer_append(b, (const uint8_t*)&words[i], 4);
+    }
+}
+
+/**
+ * Strategy: ARM64 constant synthesis
+ * Rewrite a constant write (MOV Rd, #imm as MOVZ, MOVN or ORR Rd, ZR, #imm)
+ * whose encoding has bad bytes as the shortest clean sequence of
+ * MOVZ/MOVN/MOVK, ORR/EOR bitmask and ADD/SUB immediates
+ */
+static int arm64_constant_words(cs_insn *insn, uint32_t words[A64_SYNTH_MAX_WORDS]) {
+    uint64_t value;
+    uint8_t rd;
+    int is_32bit;
+
+    if (insn->size != 4 || is_bad_byte_free_buffer(insn->bytes, insn->size)) {
+        return 0;
+    }
+    if (!decode_arm64_constant_write(arm64_insn_word(insn), &value, &rd, &is_32bit)) {
+        return 0;
+    }
+    return arm64_synthesize_constant(value, rd, is_32bit, words);
+}
+
+static int can_handle_arm64_mov_synth(cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+
+    if (insn->id != ARM64_INS_MOV && insn->id != ARM64_INS_MOVZ &&
+        insn->id != ARM64_INS_MOVN && insn->id != ARM64_INS_ORR) {
+        return 0;
+    }
+    return arm64_constant_words(insn, words) > 0;
+}
+
+static size_t get_size_arm64_mov_synth(cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+    return 4 * (size_t)arm64_constant_words(insn, words);
+}
+
+static void generate_arm64_mov_synth(struct buffer *b, cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+    int count = arm64_constant_words(insn, words);
+
+    if (count == 0) {
+        buffer_append(b, insn->bytes, insn->size);
+        return;
+    }
+    append_arm64_words(b, words, count);
+}
+
+static strategy_t arm64_mov_synth_strategy = {
+    .name = "arm64_mov_synth",
+    .can_handle = can_handle_arm64_mov_synth,
+    .get_size = get_size_arm64_mov_synth,
+    .generate = generate_arm64_mov_synth,
+    .priority = 12,
+    .target_arch = BYVAL_ARCH_ARM64
+};
+
+/**
+ * Strategy: ARM64 MOVK synthesis
+ * Rewrite MOVK Rd, #imm16, LSL #shift with bad bytes: MOVK of a nearby value
+ * corrected by ADD/SUB or EOR, or AND/ORR on the chunk
+ */
+static int arm64_movk_words(cs_insn *insn, uint32_t words[A64_SYNTH_MAX_WORDS]) {
+    uint8_t rd, hw;
+    uint16_t imm16;
+    int is_32bit;
+
+    if (insn->size != 4 || is_bad_byte_free_buffer(insn->bytes, insn->size)) {
+        return 0;
+    }
+    if (!decode_arm64_movk(arm64_insn_word(insn), &rd, &hw, &imm16, &is_32bit)) {
+        return 0;
+    }
+    return arm64_synthesize_movk(rd, hw, imm16, is_32bit, words);
+}
+
+static int can_handle_arm64_movk_synth(cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+
+    if (insn->id != ARM64_INS_MOVK) return 0;
+    return arm64_movk_words(insn, words) > 0;
+}
+
+static size_t get_size_arm64_movk_synth(cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+    return 4 * (size_t)arm64_movk_words(insn, words);
+}
+
+static void generate_arm64_movk_synth(struct buffer *b, cs_insn *insn) {
+    uint32_t words[A64_SYNTH_MAX_WORDS];
+    int count = arm64_movk_words(insn, words);
+
+    if (count == 0) {
+        buffer_append(b, insn->bytes, insn->size);
+        return;
+    }
+    append_arm64_words(b, words, count);
+}
+
+static strategy_t arm64_movk_synth_strategy = {
+    .name = "arm64_movk_synth",
+    .can_handle = can_handle_arm64_movk_synth,
+    .get_size = get_size_arm64_movk_synth,
+    .generate = generate_arm64_movk_synth,
+    .priority = 12,
+    .target_arch = BYVAL_ARCH_ARM64
+};
+
 // ============================================================================
 // Registration Functions
 // ============================================================================
 
 void register_arm64_mov_strategies(void) {
     register_strategy(&arm64_mov_original_strategy);
+    register_strategy(&arm64_mov_synth_strategy);
+    register_strategy(&arm64_movk_synth_strategy);
 }
 
 void register_arm64_arithmetic_strategies(void) {
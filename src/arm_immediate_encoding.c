@@ -5,6 +5,7 @@
 #include "arm_immediate_encoding.h"
 #include <stdlib.h>
 #include "utils.h"  // For is_bad_byte_free
+#include "core.h"   // For the active bad-byte context
 
 /**
  * Check if a 32-bit value can be encoded as an ARM immediate.
@@ -63,40 +64,241 @@ int find_arm_mvn_immediate(uint32_t target, uint32_t *mvn_val_out) {
     return 0;
 }
 
-/**
- * Find a split target = part1 + part2 where both parts are immediate-encodable
- * and individually bad-byte-safe.
+/*
+ * Modified-immediate tables
+ *
+ * A modified immediate has 4096 encodings (rot:imm8). The imm8 byte lands
+ * unchanged in bits 7:0 of the word, so whether an encoding can ever be clean
+ * depends on the profile alone. The clean table keeps those encodings sorted
+ * by value: a split looks its remainder up by binary search instead of
+ * re-enumerating every rotation. Each bad-byte context owns its table, written
+ * once when the context is built and only read afterwards; the cache of recent
+ * splits is per thread and keyed by the context's generation.
  */
-int find_arm_addsub_split_immediate(uint32_t target, uint32_t *part1_out, uint32_t *part2_out) {
-    if (!part1_out || !part2_out) {
-        return 0;
+#define ARM_SPLIT_CACHE_SIZE  64
+
+typedef struct {
+    unsigned int generation;   // 0 = empty
+    uint32_t target;
+    uint32_t base_first;
+    uint32_t base_rest;
+    int max_terms;
+    int count;
+    uint32_t words[3];
+} arm_split_cache_entry_t;
+
+// can_handle, get_size and generate ask for the same split in turn
+static __thread arm_split_cache_entry_t g_arm_split_cache[ARM_SPLIT_CACHE_SIZE];
+
+static int compare_arm_imm_entry(const void *a, const void *b) {
+    const arm_imm_entry_t *x = (const arm_imm_entry_t *)a;
+    const arm_imm_entry_t *y = (const arm_imm_entry_t *)b;
+
+    if (x->value != y->value) {
+        return (x->value < y->value) ? -1 : 1;
     }
+    return (int)x->encoding - (int)y->encoding;
+}
 
-    // If target itself is already a "safe immediate", no split needed.
-    if (is_arm_immediate_encodable(target) && is_bad_byte_free(target)) {
-        return 0;
-    }
+void arm_immediate_tables_build(arm_imm_table_t *table, const bad_byte_config_t *profile) {
+    int count = 0;
 
-    // Enumerate all ARM-immediate values: ror(imm8, rot*2), imm8 != 0.
     for (uint32_t rot = 0; rot < 16; rot++) {
-        for (uint32_t imm8 = 1; imm8 <= 0xFF; imm8++) {
-            uint32_t part1 = ror32(imm8, rot * 2);
-            if (!is_bad_byte_free(part1) || part1 >= target) {
+        for (uint32_t imm8 = 1; imm8 <= 0xFF; imm8++) {   // Zero adds nothing to a split
+            if (profile && profile->bad_bytes[imm8]) {
                 continue;
             }
+            table->entries[count].value = ror32(imm8, rot * 2);
+            table->entries[count].encoding = (uint16_t)((rot << 8) | imm8);
+            count++;
+        }
+    }
+    qsort(table->entries, (size_t)count, sizeof(table->entries[0]), compare_arm_imm_entry);
+    table->count = count;
+}
 
-            uint32_t part2 = target - part1;
-            if (!is_bad_byte_free(part2) || !is_arm_immediate_encodable(part2)) {
-                continue;
-            }
+int arm_immediate_clean_count(void) {
+    return current_bad_byte_context()->arm_imm.count;
+}
+
+// Index of the first clean-table entry with a value >= `value`
+static int arm_imm_lower_bound(const arm_imm_table_t *table, uint32_t value) {
+    int lo = 0, hi = table->count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (table->entries[mid].value < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Rotations that keep bytes 3:1 of `base` | (rot << 8) clean, one bit per
+ * rotation. Byte 0 is imm8, which the clean table already guarantees.
+ */
+static uint16_t arm_imm_rotation_mask(uint32_t base) {
+    uint16_t mask = 0;
 
-            *part1_out = part1;
-            *part2_out = part2;
+    if (!is_bad_byte_free_byte((uint8_t)(base >> 16)) || !is_bad_byte_free_byte((uint8_t)(base >> 24))) {
+        return 0;
+    }
+    for (uint32_t rot = 0; rot < 16; rot++) {
+        if (is_bad_byte_free_byte((uint8_t)((base >> 8) | rot))) {
+            mask |= (uint16_t)(1U << rot);
+        }
+    }
+    return mask;
+}
+
+// Clean encoding of `value` under a rotation mask, from the clean table (-1 if none)
+static int arm_imm_clean_encoding(const arm_imm_table_t *table, uint32_t value, uint16_t rotations) {
+    for (int i = arm_imm_lower_bound(table, value);
+         i < table->count && table->entries[i].value == value; i++) {
+        if (rotations & (1U << (table->entries[i].encoding >> 8))) {
+            return table->entries[i].encoding;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Modified immediate for a data-processing word: every rotation that encodes
+ * `value`, preferring one that keeps the whole word clean.
+ */
+int encode_arm_immediate_word(uint32_t base, uint32_t value, uint32_t *word_out) {
+    int found = 0;
+
+    if (!word_out) {
+        return 0;
+    }
+    for (uint32_t rot = 0; rot < 16; rot++) {
+        uint32_t imm8 = ror32(value, 32U - 2U * rot);   // Rotate left to undo the rotation
+        if (imm8 > 0xFF) {
+            continue;
+        }
+        uint32_t word = base | (rot << 8) | imm8;
+        if (is_bad_byte_free(word)) {
+            *word_out = word;
             return 1;
         }
+        if (!found) {
+            *word_out = word;
+            found = 1;
+        }
     }
+    return found;
+}
 
-    return 0;
+/**
+ * Split target = part1 + part2 [+ part3] (mod 2^32, as the ALU computes it)
+ * into clean ADD/SUB words. One word is a clean rotation of target itself.
+ * Two words: every clean first part, the remainder by binary search,
+ * O(n log n). Three words: the remainder after each first part is cut along
+ * the 8-bit window of each rotation and both pieces are looked up, O(16 n log n).
+ */
+int find_arm_addsub_split_words(uint32_t target, uint32_t base_first, uint32_t base_rest,
+                                int max_terms, uint32_t words_out[3]) {
+    const bad_byte_context_t *context = current_bad_byte_context();
+    const arm_imm_table_t *table = &context->arm_imm;
+    arm_split_cache_entry_t *slot;
+    uint16_t first_rotations, rest_rotations;
+    int encodings[3];
+    uint32_t hash;
+    int count = 0;
+
+    if (!words_out || max_terms < 1) {
+        return 0;
+    }
+
+    hash = (target * 2654435761U) ^ base_first ^ (base_rest >> 12) ^ (uint32_t)max_terms;
+    slot = &g_arm_split_cache[(hash >> 16) % ARM_SPLIT_CACHE_SIZE];
+    if (slot->generation == context->generation && context->generation != 0 &&
+        slot->target == target && slot->base_first == base_first &&
+        slot->base_rest == base_rest && slot->max_terms == max_terms) {
+        for (int k = 0; k < slot->count; k++) {
+            words_out[k] = slot->words[k];
+        }
+        return slot->count;
+    }
+
+    first_rotations = arm_imm_rotation_mask(base_first);
+    rest_rotations = arm_imm_rotation_mask(base_rest);
+    if (first_rotations == 0) {
+        goto done;
+    }
+
+    encodings[0] = arm_imm_clean_encoding(table, target, first_rotations);
+    if (encodings[0] >= 0) {
+        count = 1;
+        goto done;
+    }
+    if (max_terms < 2 || rest_rotations == 0) {
+        goto done;
+    }
+
+    for (int i = 0; i < table->count; i++) {
+        const arm_imm_entry_t *part1 = &table->entries[i];
+
+        if (!(first_rotations & (1U << (part1->encoding >> 8)))) {
+            continue;
+        }
+        encodings[1] = arm_imm_clean_encoding(table, target - part1->value, rest_rotations);
+        if (encodings[1] >= 0) {
+            encodings[0] = part1->encoding;
+            count = 2;
+            goto done;
+        }
+    }
+    if (max_terms < 3) {
+        goto done;
+    }
+
+    for (int i = 0; i < table->count; i++) {
+        const arm_imm_entry_t *part1 = &table->entries[i];
+        uint32_t rest = target - part1->value;
+
+        if (!(first_rotations & (1U << (part1->encoding >> 8)))) {
+            continue;
+        }
+        if (i > 0 && table->entries[i - 1].value == part1->value &&
+            (first_rotations & (1U << (table->entries[i - 1].encoding >> 8)))) {
+            continue;   // Same remainder as the previous usable entry
+        }
+        for (uint32_t rot = 0; rot < 16; rot++) {
+            uint32_t window = ror32(0xFFU, rot * 2);
+            uint32_t part3 = rest & ~window;
+
+            if ((rest & window) == 0 || part3 == 0 || !is_arm_immediate_encodable(part3)) {
+                continue;   // A single remainder was covered by the two-word search
+            }
+            encodings[1] = arm_imm_clean_encoding(table, rest & window, rest_rotations);
+            encodings[2] = arm_imm_clean_encoding(table, part3, rest_rotations);
+            if (encodings[1] >= 0 && encodings[2] >= 0) {
+                encodings[0] = part1->encoding;
+                count = 3;
+                goto done;
+            }
+        }
+    }
+
+done:
+    for (int k = 0; k < count; k++) {
+        words_out[k] = ((k == 0) ? base_first : base_rest) | (uint32_t)encodings[k];
+    }
+    slot->generation = context->generation;
+    slot->target = target;
+    slot->base_first = base_first;
+    slot->base_rest = base_rest;
+    slot->max_terms = max_terms;
+    slot->count = count;
+    for (int k = 0; k < count; k++) {
+        slot->words[k] = words_out[k];
+    }
+    return count;
 }
 
 int is_arm_displacement_encodable(int32_t displacement) {
@@ -164,28 +366,21 @@ int plan_arm_displacement_rewrite(int32_t displacement, int32_t *pre_adjust_out,
 
 int encode_arm_dp_immediate(uint8_t cond, uint8_t opcode, uint8_t rn, uint8_t rd,
                             uint32_t imm, int set_flags, uint32_t *instruction_out) {
-    int encoded_imm;
     uint32_t instruction;
 
     if (!instruction_out || cond > 0xF) {
         return 0;
     }
 
-    encoded_imm = encode_arm_immediate(imm);
-    if (encoded_imm < 0) {
-        return 0;
-    }
-
     instruction = ((uint32_t)cond << 28) |
                   (1U << 25) |
                   ((uint32_t)(opcode & 0xF) << 21) |
                   ((uint32_t)(set_flags ? 1 : 0) << 20) |
                   ((uint32_t)(rn & 0xF) << 16) |
-                  ((uint32_t)(rd & 0xF) << 12) |
-                  (uint32_t)(encoded_imm & 0xFFF);
+                  ((uint32_t)(rd & 0xF) << 12);
 
-    *instruction_out = instruction;
-    return 1;
+    // Any rotation that encodes imm will do; prefer a clean one
+    return encode_arm_immediate_word(instruction, imm, instruction_out);
 }
 
 int encode_arm_ldr_str_immediate(uint8_t cond, int is_load, uint8_t rn, uint8_t rd,
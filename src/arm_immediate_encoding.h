@@ -22,9 +22,39 @@ int encode_arm_immediate(uint32_t value);
 // Returns 1 if found, 0 otherwise. Stores the MVN immediate value in *mvn_val_out
 int find_arm_mvn_immediate(uint32_t target, uint32_t *mvn_val_out);
 
-// Find two immediate values that sum to target and are each ARM-immediate encodable
-// Returns 1 if found, 0 otherwise. Stores parts in *part1_out and *part2_out.
-int find_arm_addsub_split_immediate(uint32_t target, uint32_t *part1_out, uint32_t *part2_out);
+#define ARM_IMM_ENCODINGS 4096   // rot:imm8
+
+typedef struct {
+    uint32_t value;
+    uint16_t encoding;     // rot:imm8
+} arm_imm_entry_t;
+
+// Clean modified immediates of one bad-byte profile (kept in its bad_byte_context_t)
+typedef struct {
+    arm_imm_entry_t entries[ARM_IMM_ENCODINGS];
+    int count;
+} arm_imm_table_t;
+
+// Build the modified-immediate table for a bad-byte profile (called by
+// bad_byte_context_build). Every one of the 4096 rot:imm8 encodings whose imm8
+// byte is clean is kept, sorted by value, so splits are found by binary search.
+void arm_immediate_tables_build(arm_imm_table_t *table, const bad_byte_config_t *profile);
+
+// Number of encodings in the active profile's clean table (0 before it is built)
+int arm_immediate_clean_count(void);
+
+// Place value into a data-processing word `base` (bits 11:0 clear), choosing the
+// rotation that keeps the whole word bad-byte free when there is one.
+// Returns 1 if value is encodable, 0 otherwise.
+int encode_arm_immediate_word(uint32_t base, uint32_t value, uint32_t *word_out);
+
+// Find an ADD/SUB immediate split target = part1 + part2 [+ part3] (mod 2^32)
+// whose words are all bad-byte free. base_first is the first word (Rn = source),
+// base_rest the following ones (Rn = Rd); both with bits 11:0 clear.
+// Tries two words, then three if max_terms allows. Returns the number of
+// words stored in words_out, 0 if there is no clean split.
+int find_arm_addsub_split_words(uint32_t target, uint32_t base_first, uint32_t base_rest,
+                                int max_terms, uint32_t words_out[3]);
 
 // Check if signed displacement fits ARM LDR/STR immediate offset form (+/- 4095)
 int is_arm_displacement_encodable(int32_t displacement);
@@ -0,0 +1,823 @@
+/*
+ * ARM, Thumb and AArch64 PC-relative encoders (see pc_relocation.h)
+ *
+ * Each ISA decodes its PC-relative instructions straight from the encoding
+ * and offers a small list of forms per reference kind, smallest first:
+ *
+ *   A32  B/BL/BLX             B<c> / BL<c> / BLX imm24 (+-32 MiB)
+ *        LDR{B} literal       LDR Rt, [PC, #+-imm12]
+ *                             ADD/SUB Rt, PC, #hi ; LDR Rt, [Rt, #+-lo]
+ *        ADR                  ADD/SUB Rd, PC, #imm
+ *                             ADD/SUB Rd, PC, #a ; ADD/SUB Rd, Rd, #b
+ *   T32  B<c>                 T1 (+-256) ; T3 (+-1 MiB) ; B<!c> +2 ; B.W (+-16 MiB)
+ *        B                    T2 (+-2 KiB) ; T4 (+-16 MiB)
+ *        BL/BLX               imm22 (+-16 MiB)
+ *        CBZ/CBNZ             CBZ (+126) ; CB!Z +2 ; B.W
+ *        LDR literal          T1 (+1020, low Rt) ; LDR.W (+-4095)
+ *        ADR                  T1 (+1020, low Rd) ; ADDW/SUBW Rd, PC (+-4095)
+ *   A64  B/BL                 imm26 (+-128 MiB)
+ *        B.cond/CBZ/TBZ       imm19 / imm14 ; inverted +8 ; B
+ *        ADR                  ADR ; ADR Xd, #a ; ADD/SUB Xd, Xd, #b{, LSL #12}
+ *        LDR literal          LDR literal ; ADR Xt, #a ; LDR Wt/Xt/LDRSW, [Xt, #b]
+ *
+ * Where an immediate can be split or rotated several ways, the encoders try
+ * the alternatives and return the first whose bytes are all clean. If none
+ * is clean they return a dirty one that reaches the target, and the solver
+ * decides what to do with it.
+ */
+
+#include "pc_relocation.h"
+#include "arm_immediate_encoding.h"
+#include "utils.h"
+#include <string.h>
+
+// ============================================================================
+// Bit helpers
+// ============================================================================
+
+static int64_t sign_extend(uint64_t value, int bits) {
+    uint64_t sign = 1ULL << (bits - 1);
+    value &= (sign << 1) - 1;
+    return (int64_t)(value ^ sign) - (int64_t)sign;
+}
+
+// Fits a `bits`-wide two's complement field
+static int fits_signed(int64_t value, int bits) {
+    int64_t limit = (int64_t)1 << (bits - 1);
+    return value >= -limit && value < limit;
+}
+
+static uint32_t ror32(uint32_t value, unsigned int shift) {
+    shift &= 31U;
+    return shift ? (value >> shift) | (value << (32U - shift)) : value;
+}
+
+static uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t load16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void put32(uint8_t *out, uint32_t w) {
+    out[0] = (uint8_t)w;
+    out[1] = (uint8_t)(w >> 8);
+    out[2] = (uint8_t)(w >> 16);
+    out[3] = (uint8_t)(w >> 24);
+}
+
+static void put16(uint8_t *out, uint16_t h) {
+    out[0] = (uint8_t)h;
+    out[1] = (uint8_t)(h >> 8);
+}
+
+static int clean16(uint16_t h) {
+    return is_bad_byte_free_byte((uint8_t)h) && is_bad_byte_free_byte((uint8_t)(h >> 8));
+}
+
+// ============================================================================
+// A32
+// ============================================================================
+
+#define A32_LOAD_BYTE 1   // pcrel_insn_t.load: LDRB instead of LDR
+
+static int a32_decode(const uint8_t *bytes, size_t size, uint64_t address, pcrel_insn_t *out) {
+    uint32_t w;
+    uint32_t cond;
+
+    (void)address;
+    if (size != 4) {
+        return 0;
+    }
+    w = load32(bytes);
+    cond = w >> 28;
+    memset(out, 0, sizeof(*out));
+    out->isa = PCREL_ISA_A32;
+    out->word = w;
+    out->size = 4;
+    out->cond = (uint8_t)cond;
+
+    if ((w & 0x0E000000U) == 0x0A000000U) {
+        int64_t imm = sign_extend(w & 0x00FFFFFFU, 24) * 4;
+        if (cond == 0xF) {
+            out->kind = PCREL_KIND_CALL;    // BLX <imm>: H supplies bit 1
+            out->exchange = 1;
+            imm += ((w >> 24) & 1U) * 2;
+        } else {
+            out->kind = (w & 0x01000000U) ? PCREL_KIND_CALL : PCREL_KIND_BRANCH;
+        }
+        out->disp = imm + 8;
+        return 1;
+    }
+    if (cond == 0xF) {
+        return 0;
+    }
+    if ((w & 0x0F3F0000U) == 0x051F0000U) {
+        int64_t imm = w & 0xFFFU;
+        out->kind = PCREL_KIND_LITERAL;
+        out->reg = (uint8_t)((w >> 12) & 0xF);
+        out->load = (w & 0x00400000U) ? A32_LOAD_BYTE : 0;
+        out->data_size = (w & 0x00400000U) ? 1 : 4;
+        out->disp = 8 + ((w & 0x00800000U) ? imm : -imm);
+        return 1;
+    }
+    if ((w & 0x0FFF0000U) == 0x028F0000U || (w & 0x0FFF0000U) == 0x024F0000U) {
+        int64_t imm = ror32(w & 0xFFU, 2U * ((w >> 8) & 0xFU));
+        out->kind = PCREL_KIND_ADDRESS;
+        out->reg = (uint8_t)((w >> 12) & 0xF);
+        out->disp = 8 + (((w & 0x0FFF0000U) == 0x028F0000U) ? imm : -imm);
+        return 1;
+    }
+    return 0;
+}
+
+static int a32_form_count(const pcrel_insn_t *insn) {
+    if (insn->kind == PCREL_KIND_LITERAL || insn->kind == PCREL_KIND_ADDRESS) {
+        return (insn->reg == 15) ? 1 : 2;   // Split forms need Rt/Rd as an address register
+    }
+    return 1;
+}
+
+static size_t a32_form_size(const pcrel_insn_t *insn, int form) {
+    (void)insn;
+    return form == 0 ? 4 : 8;
+}
+
+// ADD/SUB Rd, Rn, #value (value may be negative)
+static int a32_add_immediate(uint32_t cond, int rd, int rn, int64_t value, uint32_t *word_out) {
+    uint32_t base = (cond << 28) | ((value >= 0) ? 0x02800000U : 0x02400000U) |
+                    ((uint32_t)rn << 16) | ((uint32_t)rd << 12);
+    int64_t magnitude = (value >= 0) ? value : -value;
+
+    if (magnitude > 0xFFFFFFFFLL || !is_arm_immediate_encodable((uint32_t)magnitude)) {
+        return 0;
+    }
+    return encode_arm_immediate_word(base, (uint32_t)magnitude, word_out);
+}
+
+static uint32_t a32_literal_load(const pcrel_insn_t *insn, int rn, int64_t offset) {
+    uint32_t up = (offset >= 0) ? 0x00800000U : 0;
+    uint32_t magnitude = (uint32_t)((offset >= 0) ? offset : -offset);
+
+    return ((uint32_t)insn->cond << 28) | 0x05100000U | up |
+           ((insn->load == A32_LOAD_BYTE) ? 0x00400000U : 0) |
+           ((uint32_t)rn << 16) | ((uint32_t)insn->reg << 12) | magnitude;
+}
+
+/*
+ * Two-word split of `offset` (relative to PC = at + 8): a modified immediate
+ * `hi` in the first word, the rest in the second. For loads the rest is the
+ * +-4095 offset of LDR, for ADR it is another modified immediate.
+ */
+static size_t a32_encode_split(const pcrel_insn_t *insn, int64_t offset, uint8_t *out) {
+    uint32_t first_found = 0, second_found = 0;
+    int found = 0;
+
+    for (unsigned int rot = 0; rot < 16; rot++) {
+        for (uint32_t imm8 = 0; imm8 < 256; imm8++) {
+            if (rot > 0 && imm8 == 0) {
+                continue;
+            }
+            int64_t magnitude = ror32(imm8, 2U * rot);
+            for (int sign = 0; sign < 2; sign++) {
+                int64_t hi = sign ? -magnitude : magnitude;
+                int64_t rest = offset - hi;
+                uint32_t first, second;
+
+                if (sign && magnitude == 0) {
+                    continue;
+                }
+                if (!a32_add_immediate(insn->cond, insn->reg, 15, hi, &first)) {
+                    continue;
+                }
+                if (insn->kind == PCREL_KIND_LITERAL) {
+                    if (rest < -4095 || rest > 4095) {
+                        continue;
+                    }
+                    second = a32_literal_load(insn, insn->reg, rest);
+                } else if (!a32_add_immediate(insn->cond, insn->reg, insn->reg, rest, &second)) {
+                    continue;
+                }
+                if (is_bad_byte_free(first) && is_bad_byte_free(second)) {
+                    put32(out, first);
+                    put32(out + 4, second);
+                    return 8;
+                }
+                if (!found) {
+                    first_found = first;
+                    second_found = second;
+                    found = 1;
+                }
+            }
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+    put32(out, first_found);
+    put32(out + 4, second_found);
+    return 8;
+}
+
+static size_t a32_encode(const pcrel_insn_t *insn, int form, int64_t at, int64_t target, uint8_t *out) {
+    int64_t offset = target - (at + 8);
+    uint32_t word;
+
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:
+        case PCREL_KIND_CALL:
+            if (insn->exchange) {
+                if ((offset & 1) || !fits_signed(offset, 26)) {
+                    return 0;
+                }
+                word = 0xFA000000U | ((uint32_t)((offset >> 1) & 1) << 24) |
+                       ((uint32_t)(offset >> 2) & 0x00FFFFFFU);
+            } else {
+                if ((offset & 3) || !fits_signed(offset, 26)) {
+                    return 0;
+                }
+                word = (insn->word & 0xFF000000U) | ((uint32_t)(offset >> 2) & 0x00FFFFFFU);
+            }
+            put32(out, word);
+            return 4;
+
+        case PCREL_KIND_LITERAL:
+            if (form == 1) {
+                return a32_encode_split(insn, offset, out);
+            }
+            if (offset < -4095 || offset > 4095) {
+                return 0;
+            }
+            put32(out, a32_literal_load(insn, 15, offset));
+            return 4;
+
+        case PCREL_KIND_ADDRESS:
+            if (form == 1) {
+                return a32_encode_split(insn, offset, out);
+            }
+            if (!a32_add_immediate(insn->cond, insn->reg, 15, offset, &word)) {
+                return 0;
+            }
+            put32(out, word);
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+// MOV rN, rN
+static size_t a32_nop(uint8_t *out) {
+    for (uint32_t r = 0; r < 13; r++) {
+        uint32_t word = 0xE1A00000U | (r << 12) | r;
+        if (is_bad_byte_free(word)) {
+            put32(out, word);
+            return 4;
+        }
+    }
+    if (is_bad_byte_free(0xE320F000U)) {   // NOP
+        put32(out, 0xE320F000U);
+        return 4;
+    }
+    return 0;
+}
+
+// ============================================================================
+// T32
+// ============================================================================
+
+static int64_t t32_align4(int64_t value) {
+    return value & ~(int64_t)3;
+}
+
+static int t32_decode(const uint8_t *bytes, size_t size, uint64_t address, pcrel_insn_t *out) {
+    uint16_t h1, h2;
+    int64_t base;
+
+    if (size < 2) {
+        return 0;
+    }
+    h1 = load16(bytes);
+    base = t32_align4((int64_t)address + 4) - (int64_t)address;   // Align(PC, 4) - address
+    memset(out, 0, sizeof(*out));
+    out->isa = PCREL_ISA_T32;
+    out->word = h1;
+    out->cond = 0xE;
+
+    if ((h1 & 0xF800U) < 0xE800U) {
+        if (size != 2) {
+            return 0;
+        }
+        out->size = 2;
+        if ((h1 & 0xF000U) == 0xD000U && ((h1 >> 8) & 0xF) < 0xE) {
+            out->kind = PCREL_KIND_BRANCH;
+            out->cond = (uint8_t)((h1 >> 8) & 0xF);
+            out->disp = 4 + sign_extend(h1 & 0xFFU, 8) * 2;
+            return 1;
+        }
+        if ((h1 & 0xF800U) == 0xE000U) {
+            out->kind = PCREL_KIND_BRANCH;
+            out->disp = 4 + sign_extend(h1 & 0x7FFU, 11) * 2;
+            return 1;
+        }
+        if ((h1 & 0xF500U) == 0xB100U) {
+            out->kind = PCREL_KIND_COMPARE;
+            out->negate = (uint8_t)((h1 >> 11) & 1);
+            out->reg = (uint8_t)(h1 & 7);
+            out->disp = 4 + (int64_t)((((h1 >> 9) & 1U) << 5) | ((h1 >> 3) & 0x1FU)) * 2;
+            return 1;
+        }
+        if ((h1 & 0xF800U) == 0x4800U || (h1 & 0xF800U) == 0xA000U) {
+            out->kind = ((h1 & 0xF800U) == 0x4800U) ? PCREL_KIND_LITERAL : PCREL_KIND_ADDRESS;
+            out->reg = (uint8_t)((h1 >> 8) & 7);
+            out->data_size = (out->kind == PCREL_KIND_LITERAL) ? 4 : 0;
+            out->disp = base + (int64_t)(h1 & 0xFFU) * 4;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (size != 4) {
+        return 0;
+    }
+    h2 = load16(bytes + 2);
+    out->word = (uint32_t)h1 | ((uint32_t)h2 << 16);
+    out->size = 4;
+
+    if ((h1 & 0xF800U) == 0xF000U && (h2 & 0x8000U)) {
+        uint32_t s = (h1 >> 10) & 1U;
+        uint32_t j1 = (h2 >> 13) & 1U;
+        uint32_t j2 = (h2 >> 11) & 1U;
+
+        if ((h2 & 0xD000U) == 0x8000U) {
+            uint32_t cond = (h1 >> 6) & 0xFU;
+            if (cond >= 0xE) {
+                return 0;   // Miscellaneous control, not a branch
+            }
+            out->kind = PCREL_KIND_BRANCH;
+            out->cond = (uint8_t)cond;
+            out->disp = 4 + sign_extend((s << 20) | (j2 << 19) | (j1 << 18) |
+                                        ((uint32_t)(h1 & 0x3FU) << 12) | ((uint32_t)(h2 & 0x7FFU) << 1), 21);
+            return 1;
+        }
+
+        uint32_t i1 = (~(j1 ^ s)) & 1U;
+        uint32_t i2 = (~(j2 ^ s)) & 1U;
+        int64_t imm = sign_extend((s << 24) | (i1 << 23) | (i2 << 22) |
+                                  ((uint32_t)(h1 & 0x3FFU) << 12) | ((uint32_t)(h2 & 0x7FFU) << 1), 25);
+        if ((h2 & 0xD000U) == 0x9000U) {
+            out->kind = PCREL_KIND_BRANCH;
+            out->disp = 4 + imm;
+            return 1;
+        }
+        if ((h2 & 0xD000U) == 0xD000U) {
+            out->kind = PCREL_KIND_CALL;
+            out->disp = 4 + imm;
+            return 1;
+        }
+        if ((h2 & 0xD001U) == 0xC000U) {
+            out->kind = PCREL_KIND_CALL;   // BLX <imm>: ARM target off the aligned PC
+            out->exchange = 1;
+            out->disp = base + imm;
+            return 1;
+        }
+        return 0;
+    }
+    if ((h1 & 0xFF7FU) == 0xF85FU) {
+        int64_t imm = h2 & 0xFFFU;
+        out->kind = PCREL_KIND_LITERAL;
+        out->reg = (uint8_t)(h2 >> 12);
+        out->data_size = 4;
+        out->disp = base + ((h1 & 0x0080U) ? imm : -imm);
+        return 1;
+    }
+    if (((h1 & 0xFBFFU) == 0xF20FU || (h1 & 0xFBFFU) == 0xF2AFU) && !(h2 & 0x8000U)) {
+        int64_t imm = (int64_t)((((uint32_t)h1 >> 10) & 1U) << 11 | (((uint32_t)h2 >> 12) & 7U) << 8 | (h2 & 0xFFU));
+        out->kind = PCREL_KIND_ADDRESS;
+        out->reg = (uint8_t)((h2 >> 8) & 0xF);
+        out->disp = base + (((h1 & 0xFBFFU) == 0xF20FU) ? imm : -imm);
+        return 1;
+    }
+    return 0;
+}
+
+static int t32_form_count(const pcrel_insn_t *insn) {
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:   return (insn->cond < 0xE) ? 3 : 2;
+        case PCREL_KIND_COMPARE:  return 2;
+        case PCREL_KIND_LITERAL:
+        case PCREL_KIND_ADDRESS:  return 2;
+        default:                  return 1;
+    }
+}
+
+static size_t t32_form_size(const pcrel_insn_t *insn, int form) {
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:
+            return (form == 0) ? 2 : (form == 1) ? 4 : 6;
+        case PCREL_KIND_COMPARE:
+            return (form == 0) ? 2 : 6;
+        case PCREL_KIND_LITERAL:
+        case PCREL_KIND_ADDRESS:
+            return (form == 0) ? 2 : 4;
+        default:
+            return 4;
+    }
+}
+
+// 32-bit B.W / BL / BLX encoding with a +-16 MiB offset; `op` is the second halfword base
+static int t32_put_long_branch(uint8_t *out, uint16_t op, int64_t offset) {
+    if ((offset & 1) || !fits_signed(offset, 25)) {
+        return 0;
+    }
+    uint32_t s = (uint32_t)(offset >> 24) & 1U;
+    uint32_t i1 = (uint32_t)(offset >> 23) & 1U;
+    uint32_t i2 = (uint32_t)(offset >> 22) & 1U;
+    uint32_t j1 = (~i1 ^ s) & 1U;
+    uint32_t j2 = (~i2 ^ s) & 1U;
+    put16(out, (uint16_t)(0xF000U | (s << 10) | ((uint32_t)(offset >> 12) & 0x3FFU)));
+    put16(out + 2, (uint16_t)(op | (j1 << 13) | (j2 << 11) | ((uint32_t)(offset >> 1) & 0x7FFU)));
+    return 1;
+}
+
+static size_t t32_encode(const pcrel_insn_t *insn, int form, int64_t at, int64_t target, uint8_t *out) {
+    int64_t offset = target - (at + 4);
+    int64_t aligned = target - t32_align4(at + 4);
+
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:
+            if (offset & 1) {
+                return 0;
+            }
+            if (insn->cond >= 0xE) {
+                if (form == 0) {
+                    if (!fits_signed(offset, 12)) {
+                        return 0;
+                    }
+                    put16(out, (uint16_t)(0xE000U | ((uint32_t)(offset >> 1) & 0x7FFU)));
+                    return 2;
+                }
+                return t32_put_long_branch(out, 0x9000U, offset) ? 4 : 0;
+            }
+            if (form == 0) {
+                if (!fits_signed(offset, 9)) {
+                    return 0;
+                }
+                put16(out, (uint16_t)(0xD000U | ((uint32_t)insn->cond << 8) | ((uint32_t)(offset >> 1) & 0xFFU)));
+                return 2;
+            }
+            if (form == 1) {
+                if (!fits_signed(offset, 21)) {
+                    return 0;
+                }
+                put16(out, (uint16_t)(0xF000U | (((uint32_t)(offset >> 20) & 1U) << 10) |
+                                      ((uint32_t)insn->cond << 6) | ((uint32_t)(offset >> 12) & 0x3FU)));
+                put16(out + 2, (uint16_t)(0x8000U | (((uint32_t)(offset >> 18) & 1U) << 13) |
+                                          (((uint32_t)(offset >> 19) & 1U) << 11) |
+                                          ((uint32_t)(offset >> 1) & 0x7FFU)));
+                return 4;
+            }
+            // B<!c> over a B.W
+            put16(out, (uint16_t)(0xD000U | ((uint32_t)(insn->cond ^ 1U) << 8) | 1U));
+            return t32_put_long_branch(out + 2, 0x9000U, target - (at + 6)) ? 6 : 0;
+
+        case PCREL_KIND_CALL:
+            if (insn->exchange) {
+                return ((aligned & 3) == 0 && t32_put_long_branch(out, 0xC000U, aligned)) ? 4 : 0;
+            }
+            return t32_put_long_branch(out, 0xD000U, offset) ? 4 : 0;
+
+        case PCREL_KIND_COMPARE:
+            if (form == 0) {
+                if ((offset & 1) || offset < 0 || offset > 126) {
+                    return 0;
+                }
+                put16(out, (uint16_t)(0xB100U | ((uint32_t)insn->negate << 11) |
+                                      (((uint32_t)(offset >> 6) & 1U) << 9) |
+                                      (((uint32_t)(offset >> 1) & 0x1FU) << 3) | insn->reg));
+                return 2;
+            }
+            // CB!Z over a B.W
+            put16(out, (uint16_t)(0xB100U | ((uint32_t)(insn->negate ^ 1U) << 11) | (1U << 3) | insn->reg));
+            return t32_put_long_branch(out + 2, 0x9000U, target - (at + 6)) ? 6 : 0;
+
+        case PCREL_KIND_LITERAL:
+        case PCREL_KIND_ADDRESS:
+            if (form == 0) {
+                if (insn->reg > 7 || (aligned & 3) || aligned < 0 || aligned > 1020) {
+                    return 0;
+                }
+                put16(out, (uint16_t)(((insn->kind == PCREL_KIND_LITERAL) ? 0x4800U : 0xA000U) |
+                                      ((uint32_t)insn->reg << 8) | (uint32_t)(aligned >> 2)));
+                return 2;
+            }
+            if (aligned < -4095 || aligned > 4095) {
+                return 0;
+            }
+            {
+                uint32_t magnitude = (uint32_t)((aligned >= 0) ? aligned : -aligned);
+                if (insn->kind == PCREL_KIND_LITERAL) {
+                    put16(out, (uint16_t)((aligned >= 0) ? 0xF8DFU : 0xF85FU));
+                    put16(out + 2, (uint16_t)(((uint32_t)insn->reg << 12) | magnitude));
+                } else {
+                    put16(out, (uint16_t)(((aligned >= 0) ? 0xF20FU : 0xF2AFU) | ((magnitude >> 11) << 10)));
+                    put16(out + 2, (uint16_t)((((magnitude >> 8) & 7U) << 12) |
+                                              ((uint32_t)insn->reg << 8) | (magnitude & 0xFFU)));
+                }
+            }
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+// IT{x{y{z}}} <firstcond>: the lowest set mask bit ends the block
+static int t32_it_span(const uint8_t *bytes, size_t size) {
+    uint16_t h;
+
+    if (size != 2) {
+        return 0;
+    }
+    h = load16(bytes);
+    if ((h & 0xFF00U) != 0xBF00U || (h & 0xFU) == 0) {
+        return 0;   // Not IT (mask 0 is a hint: NOP, YIELD, WFE, ...)
+    }
+    for (int span = 4; span > 0; span--) {
+        if (h & (1U << (4 - span))) {
+            return span;
+        }
+    }
+    return 0;
+}
+
+// MOV rN, rN (16-bit) or NOP
+static size_t t32_nop(uint8_t *out) {
+    for (uint32_t r = 0; r < 13; r++) {
+        uint16_t h = (uint16_t)(0x4600U | ((r >> 3) << 7) | (r << 3) | (r & 7U));
+        if (clean16(h)) {
+            put16(out, h);
+            return 2;
+        }
+    }
+    if (clean16(0xBF00U)) {
+        put16(out, 0xBF00U);
+        return 2;
+    }
+    return 0;
+}
+
+// ============================================================================
+// A64
+// ============================================================================
+
+#define A64_B  0x14000000U
+
+static int a64_decode(const uint8_t *bytes, size_t size, uint64_t address, pcrel_insn_t *out) {
+    uint32_t w;
+
+    (void)address;
+    if (size != 4) {
+        return 0;
+    }
+    w = load32(bytes);
+    memset(out, 0, sizeof(*out));
+    out->isa = PCREL_ISA_A64;
+    out->word = w;
+    out->size = 4;
+    out->cond = 0xE;
+
+    if ((w & 0x7C000000U) == 0x14000000U) {
+        out->kind = (w & 0x80000000U) ? PCREL_KIND_CALL : PCREL_KIND_BRANCH;
+        out->disp = sign_extend(w & 0x03FFFFFFU, 26) * 4;
+        return 1;
+    }
+    if ((w & 0xFF000010U) == 0x54000000U) {
+        out->kind = PCREL_KIND_BRANCH;
+        out->cond = (uint8_t)(w & 0xF);
+        out->disp = sign_extend((w >> 5) & 0x7FFFFU, 19) * 4;
+        return 1;
+    }
+    if ((w & 0x7E000000U) == 0x34000000U || (w & 0x7E000000U) == 0x36000000U) {
+        int test = (w & 0x7E000000U) == 0x36000000U;
+        out->kind = test ? PCREL_KIND_TEST : PCREL_KIND_COMPARE;
+        out->negate = (uint8_t)((w >> 24) & 1);
+        out->reg = (uint8_t)(w & 0x1F);
+        out->bit = (uint8_t)(((w >> 31) << 5) | ((w >> 19) & 0x1F));
+        out->disp = test ? sign_extend((w >> 5) & 0x3FFFU, 14) * 4
+                         : sign_extend((w >> 5) & 0x7FFFFU, 19) * 4;
+        return 1;
+    }
+    if ((w & 0x1F000000U) == 0x10000000U) {
+        out->kind = (w & 0x80000000U) ? PCREL_KIND_PAGE : PCREL_KIND_ADDRESS;
+        out->reg = (uint8_t)(w & 0x1F);
+        out->disp = sign_extend((((w >> 5) & 0x7FFFFU) << 2) | ((w >> 29) & 3U), 21);
+        if (out->kind == PCREL_KIND_PAGE) {
+            out->disp = 0;   // Relative to the 4 KiB page, not to this instruction
+        }
+        return 1;
+    }
+    if ((w & 0x3B000000U) == 0x18000000U) {
+        static const uint8_t sizes[8] = {4, 8, 4, 0, 4, 8, 16, 0};  // [V:opc]
+        uint32_t load = (((w >> 26) & 1U) << 2) | (w >> 30);
+        if (load == 7) {
+            return 0;
+        }
+        out->kind = PCREL_KIND_LITERAL;
+        out->reg = (uint8_t)(w & 0x1F);
+        out->load = (uint8_t)load;
+        out->data_size = sizes[load];
+        out->disp = sign_extend((w >> 5) & 0x7FFFFU, 19) * 4;
+        return 1;
+    }
+    return 0;
+}
+
+static int a64_form_count(const pcrel_insn_t *insn) {
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:
+            return ((insn->word & 0xFF000010U) == 0x54000000U && insn->cond < 0xE) ? 2 : 1;
+        case PCREL_KIND_COMPARE:
+        case PCREL_KIND_TEST:
+            return 2;
+        case PCREL_KIND_ADDRESS:
+            return (insn->reg == 31) ? 1 : 2;
+        case PCREL_KIND_LITERAL:
+            // The split needs a general-purpose destination to hold the address
+            return (insn->load <= 2 && insn->reg != 31) ? 2 : 1;
+        default:
+            return 1;
+    }
+}
+
+static size_t a64_form_size(const pcrel_insn_t *insn, int form) {
+    (void)insn;
+    return form == 0 ? 4 : 8;
+}
+
+static uint32_t a64_adr(int reg, int64_t offset) {
+    return 0x10000000U | (((uint32_t)offset & 3U) << 29) |
+           (((uint32_t)(offset >> 2) & 0x7FFFFU) << 5) | (uint32_t)reg;
+}
+
+/*
+ * ADR Xd, #a followed by ADD/SUB Xd, Xd, #b{, LSL #12} (ADDRESS) or by an
+ * unsigned-offset LDR Wt/Xt/LDRSW Xt, [Xt, #b] (LITERAL), with a + b = offset
+ */
+static size_t a64_encode_split(const pcrel_insn_t *insn, int64_t offset, uint8_t *out) {
+    static const uint32_t load_ops[3] = {0xB9400000U, 0xF9400000U, 0xB9800000U};
+    uint32_t first_found = 0, second_found = 0;
+    int found = 0;
+    uint32_t reg = insn->reg;
+
+    if (insn->kind == PCREL_KIND_LITERAL) {
+        int64_t scale = (insn->load == 1) ? 8 : 4;
+        for (int64_t j = 0; j < 4096; j++) {
+            int64_t a = offset - j * scale;
+            if (!fits_signed(a, 21)) {
+                continue;
+            }
+            uint32_t first = a64_adr((int)reg, a);
+            uint32_t second = load_ops[insn->load] | ((uint32_t)j << 10) | (reg << 5) | reg;
+            if (is_bad_byte_free(first) && is_bad_byte_free(second)) {
+                put32(out, first);
+                put32(out + 4, second);
+                return 8;
+            }
+            if (!found) {
+                first_found = first;
+                second_found = second;
+                found = 1;
+            }
+        }
+    } else {
+        for (uint32_t k = 0; k < 4096; k++) {
+            for (int shift = 0; shift < 2; shift++) {
+                for (int sign = 0; sign < 2; sign++) {
+                    int64_t b = (int64_t)k << (shift * 12);
+                    int64_t a = offset - (sign ? -b : b);
+                    if (!fits_signed(a, 21) || (k == 0 && (shift || sign))) {
+                        continue;
+                    }
+                    uint32_t first = a64_adr((int)reg, a);
+                    uint32_t second = (sign ? 0xD1000000U : 0x91000000U) | ((uint32_t)shift << 22) |
+                                      (k << 10) | (reg << 5) | reg;
+                    if (is_bad_byte_free(first) && is_bad_byte_free(second)) {
+                        put32(out, first);
+                        put32(out + 4, second);
+                        return 8;
+                    }
+                    if (!found) {
+                        first_found = first;
+                        second_found = second;
+                        found = 1;
+                    }
+                }
+            }
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+    put32(out, first_found);
+    put32(out + 4, second_found);
+    return 8;
+}
+
+static size_t a64_encode(const pcrel_insn_t *insn, int form, int64_t at, int64_t target, uint8_t *out) {
+    int64_t offset = target - at;
+    uint32_t w = insn->word;
+
+    if (insn->kind == PCREL_KIND_ADDRESS) {
+        if (form == 1) {
+            return a64_encode_split(insn, offset, out);
+        }
+        if (!fits_signed(offset, 21)) {
+            return 0;
+        }
+        put32(out, a64_adr(insn->reg, offset));
+        return 4;
+    }
+    if (offset & 3) {
+        return 0;
+    }
+
+    switch (insn->kind) {
+        case PCREL_KIND_BRANCH:
+        case PCREL_KIND_CALL:
+            if ((w & 0x7C000000U) == 0x14000000U) {
+                if (!fits_signed(offset, 28)) {
+                    return 0;
+                }
+                put32(out, (w & 0xFC000000U) | ((uint32_t)(offset >> 2) & 0x03FFFFFFU));
+                return 4;
+            }
+            // fall through - B.cond takes the conditional forms below
+        case PCREL_KIND_COMPARE:
+        case PCREL_KIND_TEST: {
+            int bits = (insn->kind == PCREL_KIND_TEST) ? 14 : 19;
+            uint32_t mask = ((1U << bits) - 1U) << 5;
+
+            if (form == 0) {
+                if (!fits_signed(offset, bits + 2)) {
+                    return 0;
+                }
+                put32(out, (w & ~mask) | (((uint32_t)(offset >> 2) << 5) & mask));
+                return 4;
+            }
+            // Inverted condition over a B
+            uint32_t inverted = (insn->kind == PCREL_KIND_BRANCH) ? (w ^ 1U) : (w ^ 0x01000000U);
+            offset -= 4;
+            if (!fits_signed(offset, 28)) {
+                return 0;
+            }
+            put32(out, (inverted & ~mask) | ((2U << 5) & mask));
+            put32(out + 4, A64_B | ((uint32_t)(offset >> 2) & 0x03FFFFFFU));
+            return 8;
+        }
+
+        case PCREL_KIND_LITERAL:
+            if (form == 1) {
+                return a64_encode_split(insn, offset, out);
+            }
+            if (!fits_signed(offset, 21)) {
+                return 0;
+            }
+            put32(out, (w & ~(0x7FFFFU << 5)) | (((uint32_t)(offset >> 2) & 0x7FFFFU) << 5));
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+// NOP, or MOV xN, xN
+static size_t a64_nop(uint8_t *out) {
+    if (is_bad_byte_free(0xD503201FU)) {
+        put32(out, 0xD503201FU);
+        return 4;
+    }
+    for (uint32_t r = 0; r < 29; r++) {
+        uint32_t word = 0xAA0003E0U | (r << 16) | r;
+        if (is_bad_byte_free(word)) {
+            put32(out, word);
+            return 4;
+        }
+    }
+    return 0;
+}
+
+// ============================================================================
+// ISA table
+// ============================================================================
+
+static const pcrel_isa_ops_t pcrel_ops[] = {
+    {PCREL_ISA_A32, 4, a32_decode, a32_form_count, a32_form_size, a32_encode, a32_nop, NULL},
+    {PCREL_ISA_T32, 2, t32_decode, t32_form_count, t32_form_size, t32_encode, t32_nop, t32_it_span},
+    {PCREL_ISA_A64, 4, a64_decode, a64_form_count, a64_form_size, a64_encode, a64_nop, NULL},
+};
+
+const pcrel_isa_ops_t *pcrel_isa_ops(pcrel_isa_t isa) {
+    return &pcrel_ops[isa];
+}
@@ -5,7 +5,7 @@
 #include "arm_strategies.h"
 #include "arm_immediate_encoding.h"
 #include "utils.h"
-#include "core.h"  // For bad_byte_context_t
+#include "core.h"  // For get_bad_byte_config
 #include <capstone/capstone.h>
 
 static uint8_t arm_condition_from_insn(cs_insn *insn) {
@@ -39,8 +39,7 @@ static int can_handle_arm_mov_original(cs_insn *insn) {
     }
 
     // Check if original instruction has bad bytes
-    extern bad_byte_context_t g_bad_byte_context;
-    return !arm_has_bad_bytes(insn, &g_bad_byte_context.config);
+    return !arm_has_bad_bytes(insn, get_bad_byte_config());
 }
 
 static size_t get_size_arm_mov_original(cs_insn *insn) {
@@ -66,7 +65,25 @@ static strategy_t arm_mov_original_strategy = {
  * Strategy: ARM MOV with MVN transformation
  * Transform MOV using MVN (bitwise NOT) when MOV immediate isn't encodable
  */
+// MVN Rd, #~imm with the cleanest rotation; returns 1 if the word is bad-byte free
+static int arm_mov_mvn_word(cs_insn *insn, uint32_t *word_out) {
+    uint8_t rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
+    uint32_t imm = (uint32_t)insn->detail->arm.operands[1].imm;
+    uint32_t mvn_val;
+    uint32_t base;
+
+    if (!find_arm_mvn_immediate(imm, &mvn_val)) {
+        return 0;
+    }
+
+    // Opcode: MVN (0xF), I=1, S=0
+    base = ((uint32_t)arm_condition_from_insn(insn) << 28) | 0x03E00000U | ((uint32_t)rd << 12);
+    return encode_arm_immediate_word(base, mvn_val, word_out) && is_bad_byte_free(*word_out);
+}
+
 static int can_handle_arm_mov_mvn(cs_insn *insn) {
+    uint32_t instruction;
+
     if (insn->id != ARM_INS_MOV) return 0;
     if (insn->detail->arm.op_count != 2) return 0;
 
@@ -76,15 +93,12 @@ static int can_handle_arm_mov_mvn(cs_insn *insn) {
     }
 
     // Check if original has bad bytes
-    extern bad_byte_context_t g_bad_byte_context;
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;  // Original is fine
     }
 
-    // Check if MVN transformation would work
-    uint32_t imm = (uint32_t)insn->detail->arm.operands[1].imm;
-    uint32_t mvn_val;
-    return find_arm_mvn_immediate(imm, &mvn_val);
+    // Check if a clean MVN exists
+    return arm_mov_mvn_word(insn, &instruction);
 }
 
 static size_t get_size_arm_mov_mvn(cs_insn *insn) {
@@ -93,34 +107,14 @@ static size_t get_size_arm_mov_mvn(cs_insn *insn) {
 }
 
 static void generate_arm_mov_mvn(struct buffer *b, cs_insn *insn) {
-    uint8_t rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
-    uint32_t imm = (uint32_t)insn->detail->arm.operands[1].imm;
+    uint32_t instruction;
 
-    uint32_t mvn_val;
-    if (!find_arm_mvn_immediate(imm, &mvn_val)) {
+    if (!arm_mov_mvn_word(insn, &instruction)) {
         // Fallback to original (shouldn't happen if can_handle passed)
         buffer_append(b, insn->bytes, insn->size);
         return;
     }
-
-    int encoded_imm = encode_arm_immediate(mvn_val);
-    if (encoded_imm == -1) {
-        // Fallback
-        buffer_append(b, insn->bytes, insn->size);
-        return;
-    }
-
-    // Encode MVN instruction: MVN Rd, #imm
-    // Condition: AL (0xE), Opcode: MVN (0xF), I=1, S=0
-    uint32_t instruction = 0xE3E00000 | (rd << 12) | encoded_imm;
-
-    // Verify no bad bytes
-    if (is_bad_byte_free(instruction)) {
-        buffer_append(b, (uint8_t*)&instruction, 4);
-    } else {
-        // Fallback to original
-        buffer_append(b, insn->bytes, insn->size);
-    }
+    buffer_append(b, (uint8_t*)&instruction, 4);
 }
 
 static strategy_t arm_mov_mvn_strategy = {
@@ -143,8 +137,7 @@ static strategy_t arm_mov_mvn_strategy = {
 static int can_handle_arm_add_original(cs_insn *insn) {
     if (insn->id != ARM_INS_ADD) return 0;
 
-    extern bad_byte_context_t g_bad_byte_context;
-    return !arm_has_bad_bytes(insn, &g_bad_byte_context.config);
+    return !arm_has_bad_bytes(insn, get_bad_byte_config());
 }
 
 static size_t get_size_arm_add_original(cs_insn *insn) {
@@ -169,7 +162,20 @@ static strategy_t arm_add_original_strategy = {
  * Strategy: ARM ADD with SUB transformation
  * Transform ADD Rn, Rm, #imm -> SUB Rn, Rm, #-imm (if negative immediate works)
  */
+// SUB Rd, Rn, #-imm with the cleanest rotation; returns 1 if the word is bad-byte free
+static int arm_add_sub_word(cs_insn *insn, uint32_t *word_out) {
+    uint8_t rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
+    uint8_t rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
+    uint32_t imm = (uint32_t)insn->detail->arm.operands[2].imm;
+    uint32_t neg_imm = (uint32_t)(-(int32_t)imm);
+
+    return encode_arm_dp_immediate(arm_condition_from_insn(insn), 0x2, rn, rd, neg_imm, 0, word_out) &&
+           is_bad_byte_free(*word_out);
+}
+
 static int can_handle_arm_add_sub(cs_insn *insn) {
+    uint32_t instruction;
+
     if (insn->id != ARM_INS_ADD) return 0;
     if (insn->detail->arm.op_count != 3) return 0;
 
@@ -180,15 +186,12 @@ static int can_handle_arm_add_sub(cs_insn *insn) {
     }
 
     // Check if original has bad bytes
-    extern bad_byte_context_t g_bad_byte_context;
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;
     }
 
     // Check if SUB with negative immediate would work
-    uint32_t imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    uint32_t neg_imm = (uint32_t)(-(int32_t)imm);
-    return is_arm_immediate_encodable(neg_imm);
+    return arm_add_sub_word(insn, &instruction);
 }
 
 static size_t get_size_arm_add_sub(cs_insn *insn) {
@@ -197,28 +200,13 @@ static size_t get_size_arm_add_sub(cs_insn *insn) {
 }
 
 static void generate_arm_add_sub(struct buffer *b, cs_insn *insn) {
-    uint8_t rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
-    uint8_t rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
-    uint32_t imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    uint32_t neg_imm = (uint32_t)(-(int32_t)imm);
+    uint32_t instruction;
 
-    int encoded_imm = encode_arm_immediate(neg_imm);
-    if (encoded_imm == -1) {
+    if (!arm_add_sub_word(insn, &instruction)) {
         buffer_append(b, insn->bytes, insn->size);
         return;
     }
-
-    // Encode SUB instruction: SUB Rd, Rn, #imm
-    // Condition: AL (0xE), Opcode: SUB (0x4), I=1, S=0
-    uint32_t instruction = 0xE0400000 | (rd << 12) | (rn << 16) | encoded_imm;
-
-    // Verify no bad bytes
-    extern bad_byte_context_t g_bad_byte_context;
-    if (is_bad_byte_free(instruction)) {
-        buffer_append(b, (uint8_t*)&instruction, 4);
-    } else {
-        buffer_append(b, insn->bytes, insn->size);
-    }
+    buffer_append(b, (uint8_t*)&instruction, 4);
 }
 
 static strategy_t arm_add_sub_strategy = {
@@ -230,72 +218,71 @@ static strategy_t arm_add_sub_strategy = {
     .target_arch = BYVAL_ARCH_ARM
 };
 
-/**
- * Strategy: ARM ADD immediate split
- * Transform ADD Rd, Rn, #imm -> ADD Rd, Rn, #part1 ; ADD Rd, Rd, #part2
+/*
+ * ADD/SUB Rd, Rn, #imm (opcode: ADD=0x4, SUB=0x2) as one to three clean
+ * words from the profile's immediate tables: another rotation of imm, or
+ * Rd = Rn op part1 ; Rd = Rd op part2 [; Rd = Rd op part3].
+ * Returns the number of words, 0 if no split is clean.
  */
-static int can_handle_arm_add_split(cs_insn *insn) {
-    uint32_t imm, part1, part2;
-    uint8_t cond, rd, rn;
-    uint32_t instruction1, instruction2;
-    extern bad_byte_context_t g_bad_byte_context;
+static int arm_addsub_split(cs_insn *insn, uint8_t opcode, uint32_t words[3]) {
+    uint32_t imm, base;
+    uint8_t rd, rn;
 
-    if (insn->id != ARM_INS_ADD) return 0;
     if (insn->detail->arm.op_count != 3) return 0;
     if (insn->detail->arm.operands[0].type != ARM_OP_REG ||
         insn->detail->arm.operands[1].type != ARM_OP_REG ||
         insn->detail->arm.operands[2].type != ARM_OP_IMM) {
         return 0;
     }
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;
     }
 
     imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    if (imm == 0 || !find_arm_addsub_split_immediate(imm, &part1, &part2)) {
-        return 0;
-    }
-
-    cond = arm_condition_from_insn(insn);
     rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
     rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
+    if (imm == 0 || rd == 15 || rn == 15) {
+        return 0;  // Writing PC mid-sequence would branch; PC reads move with the words
+    }
 
-    if (!encode_arm_dp_immediate(cond, 0x4, rn, rd, part1, 0, &instruction1)) return 0;
-    if (!encode_arm_dp_immediate(cond, 0x4, rd, rd, part2, 0, &instruction2)) return 0;
+    base = ((uint32_t)arm_condition_from_insn(insn) << 28) | (1U << 25) | ((uint32_t)opcode << 21);
+    return find_arm_addsub_split_words(imm,
+                                       base | ((uint32_t)rn << 16) | ((uint32_t)rd << 12),
+                                       base | ((uint32_t)rd << 16) | ((uint32_t)rd << 12),
+                                       3, words);
+}
 
-    return is_bad_byte_free(instruction1) && is_bad_byte_free(instruction2);
+static void append_arm_words(struct buffer *b, const uint32_t *words, int count) {
+    for (int i = 0; i < count; i++) {
+        buffer_append(b, (const uint8_t*)&words[i], 4);
+    }
+}
+
+/**
+ * Strategy: ARM ADD immediate split
+ * Transform ADD Rd, Rn, #imm -> ADD Rd, Rn, #part1 ; ADD Rd, Rd, #part2 [; ADD Rd, Rd, #part3]
+ */
+static int can_handle_arm_add_split(cs_insn *insn) {
+    uint32_t words[3];
+
+    if (insn->id != ARM_INS_ADD) return 0;
+    return arm_addsub_split(insn, 0x4, words) > 0;
 }
 
 static size_t get_size_arm_add_split(cs_insn *insn) {
-    (void)insn;
-    return 8;
+    uint32_t words[3];
+    return 4 * (size_t)arm_addsub_split(insn, 0x4, words);
 }
 
 static void generate_arm_add_split(struct buffer *b, cs_insn *insn) {
-    uint32_t imm, part1, part2;
-    uint8_t cond, rd, rn;
-    uint32_t instruction1, instruction2;
-
-    imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    if (imm == 0 || !find_arm_addsub_split_immediate(imm, &part1, &part2)) {
-        buffer_append(b, insn->bytes, insn->size);
-        return;
-    }
-
-    cond = arm_condition_from_insn(insn);
-    rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
-    rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
+    uint32_t words[3];
+    int count = arm_addsub_split(insn, 0x4, words);
 
-    if (!encode_arm_dp_immediate(cond, 0x4, rn, rd, part1, 0, &instruction1) ||
-        !encode_arm_dp_immediate(cond, 0x4, rd, rd, part2, 0, &instruction2) ||
-        !is_bad_byte_free(instruction1) ||
-        !is_bad_byte_free(instruction2)) {
+    if (count == 0) {
         buffer_append(b, insn->bytes, insn->size);
         return;
     }
-
-    buffer_append(b, (uint8_t*)&instruction1, 4);
-    buffer_append(b, (uint8_t*)&instruction2, 4);
+    append_arm_words(b, words, count);
 }
 
 static strategy_t arm_add_split_strategy = {
@@ -309,77 +296,35 @@ static strategy_t arm_add_split_strategy = {
 
 /**
  * Strategy: ARM SUB immediate split
- * Transform SUB Rd, Rn, #imm -> SUB Rd, Rn, #part1 ; SUB Rd, Rd, #part2
+ * Transform SUB Rd, Rn, #imm -> SUB Rd, Rn, #part1 ; SUB Rd, Rd, #part2 [; SUB Rd, Rd, #part3]
  */
 static int can_handle_arm_sub_split(cs_insn *insn) {
-    uint32_t imm, part1, part2;
-    uint8_t cond, rd, rn;
-    uint32_t instruction1, instruction2;
-    extern bad_byte_context_t g_bad_byte_context;
+    uint32_t words[3];
 
     if (insn->id != ARM_INS_SUB) return 0;
-    if (insn->detail->arm.op_count != 3) return 0;
-    if (insn->detail->arm.operands[0].type != ARM_OP_REG ||
-        insn->detail->arm.operands[1].type != ARM_OP_REG ||
-        insn->detail->arm.operands[2].type != ARM_OP_IMM) {
-        return 0;
-    }
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
-        return 0;
-    }
-
-    if (insn->detail->arm.operands[2].imm < 0) {
+    if (insn->detail->arm.op_count == 3 && insn->detail->arm.operands[2].imm < 0) {
         return 0;  // keep scope conservative for this phase
     }
-    imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    if (imm == 0 || !find_arm_addsub_split_immediate(imm, &part1, &part2)) {
-        return 0;
-    }
-
-    cond = arm_condition_from_insn(insn);
-    rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
-    rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
-
-    if (!encode_arm_dp_immediate(cond, 0x2, rn, rd, part1, 0, &instruction1)) return 0;
-    if (!encode_arm_dp_immediate(cond, 0x2, rd, rd, part2, 0, &instruction2)) return 0;
-
-    return is_bad_byte_free(instruction1) && is_bad_byte_free(instruction2);
+    return arm_addsub_split(insn, 0x2, words) > 0;
 }
 
 static size_t get_size_arm_sub_split(cs_insn *insn) {
-    (void)insn;
-    return 8;
+    uint32_t words[3];
+    return 4 * (size_t)arm_addsub_split(insn, 0x2, words);
 }
 
 static void generate_arm_sub_split(struct buffer *b, cs_insn *insn) {
-    uint32_t imm, part1, part2;
-    uint8_t cond, rd, rn;
-    uint32_t instruction1, instruction2;
+    uint32_t words[3];
+    int count = 0;
 
-    if (insn->detail->arm.operands[2].imm < 0) {
-        buffer_append(b, insn->bytes, insn->size);
-        return;
+    if (insn->detail->arm.operands[2].imm >= 0) {
+        count = arm_addsub_split(insn, 0x2, words);
     }
-    imm = (uint32_t)insn->detail->arm.operands[2].imm;
-    if (imm == 0 || !find_arm_addsub_split_immediate(imm, &part1, &part2)) {
+    if (count == 0) {
         buffer_append(b, insn->bytes, insn->size);
         return;
     }
-
-    cond = arm_condition_from_insn(insn);
-    rd = get_arm_reg_index(insn->detail->arm.operands[0].reg);
-    rn = get_arm_reg_index(insn->detail->arm.operands[1].reg);
-
-    if (!encode_arm_dp_immediate(cond, 0x2, rn, rd, part1, 0, &instruction1) ||
-        !encode_arm_dp_immediate(cond, 0x2, rd, rd, part2, 0, &instruction2) ||
-        !is_bad_byte_free(instruction1) ||
-        !is_bad_byte_free(instruction2)) {
-        buffer_append(b, insn->bytes, insn->size);
-        return;
-    }
-
-    buffer_append(b, (uint8_t*)&instruction1, 4);
-    buffer_append(b, (uint8_t*)&instruction2, 4);
+    append_arm_words(b, words, count);
 }
 
 static strategy_t arm_sub_split_strategy = {
@@ -402,8 +347,7 @@ static strategy_t arm_sub_split_strategy = {
 static int can_handle_arm_ldr_original(cs_insn *insn) {
     if (insn->id != ARM_INS_LDR) return 0;
 
-    extern bad_byte_context_t g_bad_byte_context;
-    return !arm_has_bad_bytes(insn, &g_bad_byte_context.config);
+    return !arm_has_bad_bytes(insn, get_bad_byte_config());
 }
 
 static size_t get_size_arm_ldr_original(cs_insn *insn) {
@@ -431,8 +375,7 @@ static strategy_t arm_ldr_original_strategy = {
 static int can_handle_arm_str_original(cs_insn *insn) {
     if (insn->id != ARM_INS_STR) return 0;
 
-    extern bad_byte_context_t g_bad_byte_context;
-    return !arm_has_bad_bytes(insn, &g_bad_byte_context.config);
+    return !arm_has_bad_bytes(insn, get_bad_byte_config());
 }
 
 static size_t get_size_arm_str_original(cs_insn *insn) {
@@ -462,7 +405,6 @@ static int can_handle_arm_ldr_displacement_split(cs_insn *insn) {
     uint32_t pre_magnitude;
     uint8_t pre_opcode, cond, rd, rn;
     uint32_t instruction1, instruction2;
-    extern bad_byte_context_t g_bad_byte_context;
 
     if (insn->id != ARM_INS_LDR) return 0;
     if (insn->detail->arm.op_count != 2) return 0;
@@ -471,7 +413,7 @@ static int can_handle_arm_ldr_displacement_split(cs_insn *insn) {
         insn->detail->arm.operands[1].type != ARM_OP_MEM) {
         return 0;
     }
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;
     }
 
@@ -552,7 +494,6 @@ static int can_handle_arm_str_displacement_split(cs_insn *insn) {
     uint8_t pre_opcode, restore_opcode, cond, rt, rn;
     uint32_t instruction1, instruction2, instruction3;
     const uint8_t scratch = 12;  // R12/IP
-    extern bad_byte_context_t g_bad_byte_context;
 
     if (insn->id != ARM_INS_STR) return 0;
     if (insn->detail->arm.op_count != 2) return 0;
@@ -561,7 +502,7 @@ static int can_handle_arm_str_displacement_split(cs_insn *insn) {
         insn->detail->arm.operands[1].type != ARM_OP_MEM) {
         return 0;
     }
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;
     }
 
@@ -652,8 +593,7 @@ static strategy_t arm_str_displacement_split_strategy = {
 static int can_handle_arm_branch_original(cs_insn *insn) {
     if (insn->id != ARM_INS_B && insn->id != ARM_INS_BL) return 0;
 
-    extern bad_byte_context_t g_bad_byte_context;
-    return !arm_has_bad_bytes(insn, &g_bad_byte_context.config);
+    return !arm_has_bad_bytes(insn, get_bad_byte_config());
 }
 
 static size_t get_size_arm_branch_original(cs_insn *insn) {
@@ -736,11 +676,10 @@ static int build_arm_branch_conditional_alt(cs_insn *insn,
  */
 static int can_handle_arm_branch_conditional_alt(cs_insn *insn) {
     uint32_t skip_instruction, branch_instruction;
-    extern bad_byte_context_t g_bad_byte_context;
 
     if (insn->id != ARM_INS_B) return 0;  // branch-first only (no BL/predicated ALU or memory)
 
-    if (!arm_has_bad_bytes(insn, &g_bad_byte_context.config)) {
+    if (!arm_has_bad_bytes(insn, get_bad_byte_config())) {
         return 0;
     }
 
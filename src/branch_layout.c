@@ -0,0 +1,1981 @@
+/*
+ * Branch Layout Solver
+ *
+ * PROBLEM: After Pass 2 rewrites instructions, every relative branch has to be
+ * re-encoded against the new offsets. The old relocation step converted any
+ * rel8/rel32 whose new displacement contained a bad byte into
+ * MOV EAX, target; JMP/CALL EAX, which costs 7-20 bytes and clobbers EAX.
+ * Very often a couple of bytes of padding somewhere between the branch and its
+ * target is enough to make the displacement clean.
+ *
+ * SOLUTION: Treat branch encoding as a global layout problem:
+ *   1. All non-branch instructions are rewritten first, so their sizes are exact.
+ *   2. Branches start in the smallest form and are relaxed (rel8 -> rel32) until
+ *      every displacement is in range.
+ *   3. For every branch whose encoding still contains bad bytes, the solver
+ *      tries small padding insertions at block boundaries between the branch and
+ *      its target, plus the alternative rel8/rel32 form, cheapest first. A trial
+ *      is kept only if it lowers the total number of dirty branches.
+ *   4. A branch that padding could not repair is routed through a branch
+ *      island: a JMP to its target placed at a dead block boundary (after an
+ *      unconditional transfer, so it costs no runtime), reachable with a clean
+ *      displacement. Later branches to the same target reuse the island.
+ *   5. Branches that cannot be repaired within LAYOUT_PAD_BUDGET fall back to an
+ *      indirect form. On x86 that is the absolute MOV EAX / JMP EAX conversion.
+ *      On x64 an absolute imm32 would truncate the address, so the target is
+ *      materialized RIP-relative (LEA r64,[rip+disp], split into two LEAs when
+ *      the displacement itself is dirty) and reached with JMP/CALL r64. The
+ *      scratch register is one proven dead at the target by a short forward
+ *      scan; when none is, it is saved with PUSH and the transfer is done with
+ *      XCHG [RSP],r / RET so every register survives.
+ *
+ * x64 RIP-relative memory references go through the same machinery: their
+ * displacement is re-encoded against the final offsets, padding may repair
+ * it, and what stays dirty is addressed off the shared GetPC base
+ * (getpc_base.h), whose value the solver picks last. Constant-pool loads
+ * (constant_pool.h) use the same base; one that the chosen base value cannot
+ * keep clean falls back to its inline rewrite.
+ *
+ * Padding placed after an unconditional JMP/RET is never executed, so any
+ * bad-byte-free filler works there. Padding on a fall-through path uses a
+ * bad-byte-free no-op (NOP, or MOV reg,reg when 0x90 is itself a bad byte).
+ */
+
+#include "branch_layout.h"
+#include "getpc_base.h"
+#include "constant_pool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    struct instruction_node *node;
+    layout_branch_kind_t kind;
+    uint8_t cond;                  // Jcc condition nibble (LAYOUT_BRANCH_JCC only)
+    size_t reserved;               // Largest indirect-form size seen, keeps relaxation monotonic
+    uint16_t dead_mask;            // x64: GPR families dead at the target (bit n = family n)
+} layout_branch_t;
+
+typedef struct {
+    layout_branch_t *branches;
+    int count;
+    int have_dead_fill;
+    uint8_t dead_fill;             // Filler for unreachable padding
+    uint8_t nop_unit[4];           // Executed padding unit
+    size_t nop_unit_len;           // 0 if no bad-byte-free no-op exists
+    byval_arch_t arch;
+    struct instruction_node *head;
+    size_t old_end;                // Input payload size
+    size_t new_end;                // Output payload size (without the constant pool)
+    struct instruction_node *base_setup;  // Shared GetPC base load, NULL if none
+    int base_users;                // References currently addressed off the base
+    struct instruction_node *islands[LAYOUT_MAX_ISLANDS];  // Nodes hosting a branch island
+    int island_count;
+} layout_ctx_t;
+
+// ============================================================================
+// Padding primitives
+// ============================================================================
+
+static void layout_select_fillers(layout_ctx_t *ctx) {
+    static const uint8_t dead_candidates[] = {0xCC, 0x90, 0xF4, 0x41, 0x42, 0x43};
+
+    ctx->have_dead_fill = 0;
+    for (size_t i = 0; i < sizeof(dead_candidates); i++) {
+        if (is_bad_byte_free_byte(dead_candidates[i])) {
+            ctx->dead_fill = dead_candidates[i];
+            ctx->have_dead_fill = 1;
+            break;
+        }
+    }
+    for (int v = 1; !ctx->have_dead_fill && v < 256; v++) {
+        if (is_bad_byte_free_byte((uint8_t)v)) {
+            ctx->dead_fill = (uint8_t)v;
+            ctx->have_dead_fill = 1;
+        }
+    }
+
+    // Executed padding: NOP, else MOV reg,reg (REX.W on x64 so the upper half survives)
+    ctx->nop_unit_len = 0;
+    if (is_bad_byte_free_byte(0x90)) {
+        ctx->nop_unit[0] = 0x90;
+        ctx->nop_unit_len = 1;
+        return;
+    }
+    for (uint8_t reg = 0; reg < 8; reg++) {
+        uint8_t modrm = (uint8_t)(0xC0 | (reg << 3) | reg);
+        if (reg == 4) {
+            continue;  // Leave ESP/RSP alone
+        }
+        if (ctx->arch == BYVAL_ARCH_X64) {
+            uint8_t unit[3] = {0x48, 0x89, modrm};
+            if (is_bad_byte_free_buffer(unit, 3)) {
+                memcpy(ctx->nop_unit, unit, 3);
+                ctx->nop_unit_len = 3;
+                return;
+            }
+        } else {
+            uint8_t unit[2] = {0x89, modrm};
+            if (is_bad_byte_free_buffer(unit, 2)) {
+                memcpy(ctx->nop_unit, unit, 2);
+                ctx->nop_unit_len = 2;
+                return;
+            }
+        }
+    }
+}
+
+static int layout_can_pad(const layout_ctx_t *ctx, size_t amount, int dead) {
+    if (amount == 0) {
+        return 1;
+    }
+    if (dead) {
+        return ctx->have_dead_fill;
+    }
+    return ctx->nop_unit_len > 0 && (amount % ctx->nop_unit_len) == 0;
+}
+
+static void layout_write_padding(struct buffer *b, const layout_ctx_t *ctx, size_t amount, int dead) {
+    if (dead && ctx->have_dead_fill) {
+        for (size_t i = 0; i < amount; i++) {
+            buffer_write_byte(b, ctx->dead_fill);
+        }
+        return;
+    }
+    size_t written = 0;
+    while (ctx->nop_unit_len > 0 && written + ctx->nop_unit_len <= amount) {
+        buffer_append(b, ctx->nop_unit, ctx->nop_unit_len);
+        written += ctx->nop_unit_len;
+    }
+    // Remainder cannot be expressed with the no-op unit; keep sizes exact anyway
+    for (; written < amount; written++) {
+        buffer_write_byte(b, 0x90);
+    }
+}
+
+// A node is a dead boundary if control can only reach it through a branch
+static int layout_is_unconditional(cs_insn *insn) {
+    return insn->id == X86_INS_JMP || insn->id == X86_INS_RET ||
+           insn->id == X86_INS_RETF || insn->id == X86_INS_LJMP;
+}
+
+// Forms owned by relative branches (as opposed to data references)
+static int layout_is_branch_form(int form) {
+    return form >= LAYOUT_FORM_SHORT && form <= LAYOUT_FORM_EXTERNAL;
+}
+
+// ============================================================================
+// Branch decoding and encoding
+// ============================================================================
+
+static int layout_is_prefix(uint8_t b, byval_arch_t arch) {
+    switch (b) {
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x64: case 0x65: case 0x66: case 0x67:
+        case 0xF2: case 0xF3:
+            return 1;
+        default:
+            return arch == BYVAL_ARCH_X64 && (b & 0xF0) == 0x40;
+    }
+}
+
+static int layout_decode_branch(cs_insn *insn, byval_arch_t arch,
+                                layout_branch_kind_t *kind, uint8_t *cond) {
+    *cond = 0;
+    if (insn->id == X86_INS_JMP) {
+        *kind = LAYOUT_BRANCH_JMP;
+        return 1;
+    }
+    if (insn->id == X86_INS_CALL) {
+        *kind = LAYOUT_BRANCH_CALL;
+        return 1;
+    }
+    if (insn->id == X86_INS_JRCXZ) {
+        *kind = LAYOUT_BRANCH_JRCXZ;
+        return 1;
+    }
+
+    for (int i = 0; i < insn->size; i++) {
+        uint8_t b = insn->bytes[i];
+        if (b >= 0x70 && b <= 0x7F) {
+            *kind = LAYOUT_BRANCH_JCC;
+            *cond = b & 0x0F;
+            return 1;
+        }
+        if (b == 0x0F && i + 1 < insn->size && (insn->bytes[i + 1] & 0xF0) == 0x80) {
+            *kind = LAYOUT_BRANCH_JCC;
+            *cond = insn->bytes[i + 1] & 0x0F;
+            return 1;
+        }
+        if (!layout_is_prefix(b, arch)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+int layout_is_branch(cs_insn *insn, byval_arch_t arch) {
+    layout_branch_kind_t kind;
+    uint8_t cond;
+
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        return 0;
+    }
+    if (!is_relative_jump(insn)) {
+        return 0;
+    }
+    if (insn->detail->x86.op_count == 0 || insn->detail->x86.operands[0].type != X86_OP_IMM) {
+        return 0;
+    }
+    return layout_decode_branch(insn, arch, &kind, &cond);
+}
+
+// Offset (from the start of the encoding) at which the displacement is measured
+static size_t layout_rel_end(layout_branch_kind_t kind, layout_form_t form) {
+    if (form == LAYOUT_FORM_SHORT) {
+        return 2;
+    }
+    switch (kind) {
+        case LAYOUT_BRANCH_JCC:   return 6;
+        case LAYOUT_BRANCH_JRCXZ: return 9;   // JRCXZ +2; JMP SHORT +5; JMP rel32
+        default:                  return 5;
+    }
+}
+
+/*
+ * Encode a relative form for a branch located at `at` targeting `target`.
+ * Returns the encoding length, or 0 if the form cannot express the displacement.
+ */
+static size_t layout_encode_rel(layout_branch_kind_t kind, uint8_t cond, layout_form_t form,
+                                size_t at, int64_t target, uint8_t *out) {
+    int64_t disp = target - (int64_t)(at + layout_rel_end(kind, form));
+
+    if (form == LAYOUT_FORM_SHORT) {
+        if (kind == LAYOUT_BRANCH_CALL || disp < -128 || disp > 127) {
+            return 0;
+        }
+        switch (kind) {
+            case LAYOUT_BRANCH_JMP:   out[0] = 0xEB; break;
+            case LAYOUT_BRANCH_JCC:   out[0] = (uint8_t)(0x70 | cond); break;
+            case LAYOUT_BRANCH_JRCXZ: out[0] = 0xE3; break;
+            default: return 0;
+        }
+        out[1] = (uint8_t)(int8_t)disp;
+        return 2;
+    }
+
+    if (form == LAYOUT_FORM_NEAR) {
+        if (disp < INT32_MIN || disp > INT32_MAX) {
+            return 0;
+        }
+        int32_t rel32 = (int32_t)disp;
+        switch (kind) {
+            case LAYOUT_BRANCH_JMP:
+                out[0] = 0xE9;
+                memcpy(out + 1, &rel32, 4);
+                return 5;
+            case LAYOUT_BRANCH_CALL:
+                out[0] = 0xE8;
+                memcpy(out + 1, &rel32, 4);
+                return 5;
+            case LAYOUT_BRANCH_JCC:
+                out[0] = 0x0F;
+                out[1] = (uint8_t)(0x80 | cond);
+                memcpy(out + 2, &rel32, 4);
+                return 6;
+            case LAYOUT_BRANCH_JRCXZ:
+                // JRCXZ has no rel32 form: hop through a near JMP
+                out[0] = 0xE3; out[1] = 0x02;
+                out[2] = 0xEB; out[3] = 0x05;
+                out[4] = 0xE9;
+                memcpy(out + 5, &rel32, 4);
+                return 9;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+// Bytes in front of the absolute sequence (skip jump for conditional branches)
+static size_t layout_absolute_header(layout_branch_kind_t kind) {
+    switch (kind) {
+        case LAYOUT_BRANCH_JCC:   return 2;   // Jncc skip
+        case LAYOUT_BRANCH_JRCXZ: return 4;   // JRCXZ +2; JMP SHORT skip
+        default:                  return 0;
+    }
+}
+
+static void layout_write_absolute_body(struct buffer *b, layout_branch_kind_t kind, uint32_t target) {
+    generate_mov_eax_imm(b, target);
+    if (kind == LAYOUT_BRANCH_CALL) {
+        uint8_t call_eax[] = {0xFF, 0xD0};
+        buffer_append(b, call_eax, 2);
+    } else {
+        uint8_t jmp_eax[] = {0xFF, 0xE0};
+        buffer_append(b, jmp_eax, 2);
+    }
+}
+
+static size_t layout_absolute_body_size(layout_branch_kind_t kind, uint32_t target) {
+    struct buffer scratch;
+    buffer_init(&scratch);
+    layout_write_absolute_body(&scratch, kind, target);
+    size_t size = scratch.size;
+    buffer_free(&scratch);
+    return size;
+}
+
+/*
+ * Smallest absolute-form size >= minimum that can be emitted for this branch.
+ * Conditional forms need a clean skip byte; CALL needs executable padding.
+ */
+static size_t layout_absolute_fit(const layout_ctx_t *ctx, layout_branch_kind_t kind,
+                                  uint32_t target, size_t minimum) {
+    size_t header = layout_absolute_header(kind);
+    size_t natural = header + layout_absolute_body_size(kind, target);
+    size_t size = (minimum > natural) ? minimum : natural;
+
+    for (size_t tries = 0; tries < 128; tries++, size++) {
+        size_t fill = size - natural;
+        if (kind == LAYOUT_BRANCH_CALL) {
+            if (layout_can_pad(ctx, fill, 0)) {
+                return size;
+            }
+            continue;
+        }
+        if (fill > 0 && !ctx->have_dead_fill) {
+            continue;
+        }
+        if (header == 0) {
+            return size;
+        }
+        size_t skip = size - header;
+        if (skip <= 127 && is_bad_byte_free_byte((uint8_t)skip)) {
+            return size;
+        }
+    }
+    return natural;
+}
+
+static void layout_write_absolute(struct buffer *b, const layout_ctx_t *ctx, layout_branch_kind_t kind,
+                                  uint8_t cond, uint32_t target, size_t size) {
+    size_t header = layout_absolute_header(kind);
+    size_t natural = header + layout_absolute_body_size(kind, target);
+    size_t fill = (size > natural) ? size - natural : 0;
+    uint8_t skip = (uint8_t)(natural + fill - header);
+
+    if (kind == LAYOUT_BRANCH_CALL) {
+        // Padding in front of the CALL is executed
+        layout_write_padding(b, ctx, fill, 0);
+        layout_write_absolute_body(b, kind, target);
+        return;
+    }
+
+    if (kind == LAYOUT_BRANCH_JCC) {
+        uint8_t jncc[] = {(uint8_t)(0x70 | (cond ^ 0x01)), skip};
+        buffer_append(b, jncc, 2);
+    } else if (kind == LAYOUT_BRANCH_JRCXZ) {
+        uint8_t hop[] = {0xE3, 0x02, 0xEB, skip};
+        buffer_append(b, hop, 4);
+    }
+    layout_write_absolute_body(b, kind, target);
+    // Everything after JMP EAX is unreachable (the skip jump lands past it)
+    layout_write_padding(b, ctx, fill, 1);
+}
+
+// ============================================================================
+// x64 RIP-relative indirect form
+// ============================================================================
+
+#define LAYOUT_RIP_BODY_MAX 64
+
+// Every GPR alias, grouped by family (index = hardware register number)
+static const x86_reg layout_gpr_aliases[16][5] = {
+    {X86_REG_RAX, X86_REG_EAX, X86_REG_AX, X86_REG_AL, X86_REG_AH},
+    {X86_REG_RCX, X86_REG_ECX, X86_REG_CX, X86_REG_CL, X86_REG_CH},
+    {X86_REG_RDX, X86_REG_EDX, X86_REG_DX, X86_REG_DL, X86_REG_DH},
+    {X86_REG_RBX, X86_REG_EBX, X86_REG_BX, X86_REG_BL, X86_REG_BH},
+    {X86_REG_RSP, X86_REG_ESP, X86_REG_SP, X86_REG_SPL, X86_REG_INVALID},
+    {X86_REG_RBP, X86_REG_EBP, X86_REG_BP, X86_REG_BPL, X86_REG_INVALID},
+    {X86_REG_RSI, X86_REG_ESI, X86_REG_SI, X86_REG_SIL, X86_REG_INVALID},
+    {X86_REG_RDI, X86_REG_EDI, X86_REG_DI, X86_REG_DIL, X86_REG_INVALID},
+    {X86_REG_R8,  X86_REG_R8D,  X86_REG_R8W,  X86_REG_R8B,  X86_REG_INVALID},
+    {X86_REG_R9,  X86_REG_R9D,  X86_REG_R9W,  X86_REG_R9B,  X86_REG_INVALID},
+    {X86_REG_R10, X86_REG_R10D, X86_REG_R10W, X86_REG_R10B, X86_REG_INVALID},
+    {X86_REG_R11, X86_REG_R11D, X86_REG_R11W, X86_REG_R11B, X86_REG_INVALID},
+    {X86_REG_R12, X86_REG_R12D, X86_REG_R12W, X86_REG_R12B, X86_REG_INVALID},
+    {X86_REG_R13, X86_REG_R13D, X86_REG_R13W, X86_REG_R13B, X86_REG_INVALID},
+    {X86_REG_R14, X86_REG_R14D, X86_REG_R14W, X86_REG_R14B, X86_REG_INVALID},
+    {X86_REG_R15, X86_REG_R15D, X86_REG_R15W, X86_REG_R15B, X86_REG_INVALID},
+};
+
+// Scratch candidates in preference order. RSP and R12 are never used: [reg+disp]
+// needs a SIB byte for them.
+static const int layout_scratch_order[] = {0, 1, 2, 11, 10, 9, 8, 6, 7, 3, 5, 13, 14, 15};
+#define LAYOUT_SCRATCH_COUNT ((int)(sizeof(layout_scratch_order) / sizeof(layout_scratch_order[0])))
+
+int layout_gpr_family(unsigned int reg, int *full_width) {
+    if (reg == X86_REG_INVALID) {
+        return -1;
+    }
+    for (int fam = 0; fam < 16; fam++) {
+        for (int w = 0; w < 5; w++) {
+            if ((unsigned int)layout_gpr_aliases[fam][w] == reg) {
+                if (full_width) {
+                    // 32-bit writes zero-extend, so they kill the whole register
+                    *full_width = (w <= 1);
+                }
+                return fam;
+            }
+        }
+    }
+    return -1;
+}
+
+unsigned int layout_gpr_alias(unsigned int reg, int fam) {
+    if (reg == X86_REG_INVALID || fam < 0 || fam > 15) {
+        return X86_REG_INVALID;
+    }
+    for (int f = 0; f < 16; f++) {
+        for (int w = 0; w < 5; w++) {
+            if ((unsigned int)layout_gpr_aliases[f][w] == reg) {
+                return layout_gpr_aliases[fam][w];
+            }
+        }
+    }
+    return X86_REG_INVALID;
+}
+
+typedef enum {
+    LAYOUT_REG_UNTOUCHED = 0,
+    LAYOUT_REG_READ,          // Value is (or may be) consumed
+    LAYOUT_REG_KILLED         // Fully overwritten before any read
+} layout_reg_effect_t;
+
+static layout_reg_effect_t layout_reg_effect(cs_insn *insn, int fam) {
+    cs_detail *detail = insn->detail;
+    cs_x86 *x86 = &detail->x86;
+    int write_only = 0;
+    int full = 0;
+
+    switch (insn->id) {
+        case X86_INS_MOV: case X86_INS_MOVABS: case X86_INS_MOVZX:
+        case X86_INS_MOVSX: case X86_INS_MOVSXD: case X86_INS_LEA: case X86_INS_POP:
+            write_only = 1;
+            break;
+        case X86_INS_XOR: case X86_INS_SUB:
+            // Zeroing idiom: the result does not depend on the old value
+            if (x86->op_count == 2 && x86->operands[0].type == X86_OP_REG &&
+                x86->operands[1].type == X86_OP_REG &&
+                x86->operands[0].reg == x86->operands[1].reg &&
+                layout_gpr_family(x86->operands[0].reg, &full) == fam) {
+                return full ? LAYOUT_REG_KILLED : LAYOUT_REG_READ;
+            }
+            break;
+        default:
+            break;
+    }
+
+    for (int i = 0; i < detail->regs_read_count; i++) {
+        if (layout_gpr_family(detail->regs_read[i], NULL) == fam) {
+            return LAYOUT_REG_READ;
+        }
+    }
+    for (int i = 0; i < x86->op_count; i++) {
+        cs_x86_op *op = &x86->operands[i];
+        if (op->type == X86_OP_REG) {
+            if (i == 0 && write_only) {
+                continue;
+            }
+            if (layout_gpr_family(op->reg, NULL) == fam) {
+                return LAYOUT_REG_READ;
+            }
+        } else if (op->type == X86_OP_MEM) {
+            if (layout_gpr_family(op->mem.base, NULL) == fam ||
+                layout_gpr_family(op->mem.index, NULL) == fam) {
+                return LAYOUT_REG_READ;
+            }
+        }
+    }
+
+    if (write_only && x86->op_count > 0 && x86->operands[0].type == X86_OP_REG &&
+        layout_gpr_family(x86->operands[0].reg, &full) == fam) {
+        // Partial writes keep the rest of the register live
+        return full ? LAYOUT_REG_KILLED : LAYOUT_REG_READ;
+    }
+    return LAYOUT_REG_UNTOUCHED;
+}
+
+// Control transfers the scan cannot follow (the register may be live beyond them)
+int layout_is_opaque_transfer(cs_insn *insn) {
+    switch (insn->id) {
+        case X86_INS_JMP: case X86_INS_CALL: case X86_INS_RET: case X86_INS_RETF:
+        case X86_INS_LJMP: case X86_INS_LCALL: case X86_INS_SYSCALL: case X86_INS_SYSENTER:
+        case X86_INS_INT: case X86_INS_INT3: case X86_INS_IRET: case X86_INS_IRETD:
+        case X86_INS_IRETQ: case X86_INS_LOOP: case X86_INS_LOOPE: case X86_INS_LOOPNE:
+        case X86_INS_JECXZ: case X86_INS_JRCXZ: case X86_INS_HLT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int layout_node_ptr_cmp(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(struct instruction_node * const *)a;
+    uintptr_t y = (uintptr_t)*(struct instruction_node * const *)b;
+    return (x > y) - (x < y);
+}
+
+int layout_collect_branch_targets(struct instruction_node *head, byval_arch_t arch,
+                                  struct instruction_node ***targets, size_t *count) {
+    struct instruction_node **list = NULL;
+    size_t capacity = 0;
+
+    *targets = NULL;
+    *count = 0;
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (!n->target || !layout_is_branch(n->insn, arch)) {
+            continue;
+        }
+        if (*count == capacity) {
+            size_t cap = capacity ? capacity * 2 : 64;
+            struct instruction_node **grown = realloc(list, cap * sizeof(*list));
+            if (!grown) {
+                free(list);
+                *count = 0;
+                return -1;
+            }
+            list = grown;
+            capacity = cap;
+        }
+        list[(*count)++] = n->target;
+    }
+    if (*count > 1) {
+        qsort(list, *count, sizeof(*list), layout_node_ptr_cmp);
+    }
+    *targets = list;
+    return 0;
+}
+
+int layout_is_branch_target(struct instruction_node **targets, size_t count, struct instruction_node *n) {
+    return count > 0 && bsearch(&n, targets, count, sizeof(*targets), layout_node_ptr_cmp) != NULL;
+}
+
+// Instructions execution never falls through (an external JMP/CALL target or
+// interrupt handler is assumed to come back only for CALL and INT)
+static int layout_ends_flow(cs_insn *insn) {
+    switch (insn->id) {
+        case X86_INS_JMP: case X86_INS_LJMP: case X86_INS_RET: case X86_INS_RETF:
+        case X86_INS_IRET: case X86_INS_IRETD: case X86_INS_IRETQ: case X86_INS_HLT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static struct instruction_node **layout_push_node(struct instruction_node **list, size_t *count,
+                                                  size_t *capacity, struct instruction_node *n) {
+    if (*count == *capacity) {
+        size_t cap = *capacity ? *capacity * 2 : 64;
+        struct instruction_node **grown = realloc(list, cap * sizeof(*list));
+        if (!grown) {
+            free(list);
+            return NULL;
+        }
+        list = grown;
+        *capacity = cap;
+    }
+    list[(*count)++] = n;
+    return list;
+}
+
+int layout_mark_internal_returns(struct instruction_node *head, byval_arch_t arch) {
+    struct instruction_node **work = NULL;
+    size_t count = 0, capacity = 0;
+    int failed = 0;
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        n->in_callee = 0;
+    }
+    for (struct instruction_node *c = head; c != NULL && !failed; c = c->next) {
+        layout_branch_kind_t kind;
+        uint8_t cond;
+
+        if (!layout_is_branch_form(c->branch_form) || !c->target || c->target->in_callee ||
+            !layout_decode_branch(c->insn, arch, &kind, &cond) || kind != LAYOUT_BRANCH_CALL) {
+            continue;
+        }
+        // Everything reachable from the callee's entry, until its returns
+        c->target->in_callee = 1;
+        work = layout_push_node(work, &count, &capacity, c->target);
+        failed = (work == NULL);
+        while (!failed && count > 0) {
+            struct instruction_node *n = work[--count];
+            struct instruction_node *succ[2] = {NULL, NULL};
+
+            if (layout_is_branch_form(n->branch_form)) {
+                layout_decode_branch(n->insn, arch, &kind, &cond);
+                succ[0] = n->target;
+                succ[1] = (kind == LAYOUT_BRANCH_JMP) ? NULL : n->next;
+            } else if (!layout_ends_flow(n->insn)) {
+                succ[0] = n->next;
+            }
+            for (int i = 0; i < 2 && !failed; i++) {
+                if (succ[i] && !succ[i]->in_callee) {
+                    succ[i]->in_callee = 1;
+                    work = layout_push_node(work, &count, &capacity, succ[i]);
+                    failed = (work == NULL);
+                }
+            }
+        }
+    }
+    free(work);
+
+    if (failed) {
+        // Out of memory: every RET may return into the payload
+        for (struct instruction_node *n = head; n != NULL; n = n->next) {
+            n->in_callee = 1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Conservative liveness: 1 only if every path from `n` overwrites the register
+ * family before reading it within LAYOUT_LIVENESS_WINDOW instructions.
+ */
+int layout_reg_dead_at(struct instruction_node *n, int fam, int depth) {
+    for (int steps = 0; steps < LAYOUT_LIVENESS_WINDOW; steps++) {
+        layout_reg_effect_t effect;
+        layout_branch_kind_t kind;
+        uint8_t cond;
+
+        // Payload exit: the caller may only ignore registers it declared clobbered.
+        // A RET of an internal callee returns into the payload (opaque below)
+        if (n == NULL || (n->insn->id == X86_INS_RET && !n->in_callee)) {
+            return (current_rewrite_options()->clobber_mask >> fam) & 1;
+        }
+
+        effect = layout_reg_effect(n->insn, fam);
+        if (effect == LAYOUT_REG_READ) {
+            return 0;
+        }
+        if (effect == LAYOUT_REG_KILLED) {
+            return 1;
+        }
+
+        if (layout_is_branch_form(n->branch_form)) {
+            layout_decode_branch(n->insn, BYVAL_ARCH_X64, &kind, &cond);
+            if (kind == LAYOUT_BRANCH_CALL || !n->target) {
+                return 0;
+            }
+            if (kind == LAYOUT_BRANCH_JMP) {
+                n = n->target;
+                continue;
+            }
+            // Conditional: both successors must agree
+            if (depth <= 0 || !layout_reg_dead_at(n->target, fam, depth - 1)) {
+                return 0;
+            }
+        } else if (layout_is_opaque_transfer(n->insn)) {
+            return 0;
+        }
+        n = n->next;
+    }
+    return 0;
+}
+
+// Flags overwritten (all status flags, without reading them) before any read
+int layout_flags_dead_at(struct instruction_node *n) {
+    for (int steps = 0; steps < LAYOUT_LIVENESS_WINDOW; steps++) {
+        if (n == NULL || (n->insn->id == X86_INS_RET && !n->in_callee)) {
+            return (current_rewrite_options()->clobber_mask & CLOBBER_FLAGS) != 0;
+        }
+        switch (n->insn->id) {
+            case X86_INS_ADD: case X86_INS_SUB: case X86_INS_AND: case X86_INS_OR:
+            case X86_INS_XOR: case X86_INS_CMP: case X86_INS_TEST: case X86_INS_NEG:
+                return 1;
+            case X86_INS_MOV: case X86_INS_MOVABS: case X86_INS_MOVZX: case X86_INS_MOVSX:
+            case X86_INS_MOVSXD: case X86_INS_LEA: case X86_INS_PUSH: case X86_INS_POP:
+            case X86_INS_XCHG: case X86_INS_NOT: case X86_INS_BSWAP: case X86_INS_NOP:
+                break;
+            case X86_INS_JMP:
+                if (n->branch_form == LAYOUT_FORM_NONE || !n->target) {
+                    return 0;
+                }
+                n = n->target;
+                continue;
+            default:
+                return 0;
+        }
+        n = n->next;
+    }
+    return 0;
+}
+
+uint32_t layout_scratch_after(struct instruction_node *n, byval_arch_t arch) {
+    uint32_t clobber = current_rewrite_options()->clobber_mask;
+    uint32_t reserved = current_rewrite_options()->reserved_mask;
+    uint32_t mask = 0;
+    int mentioned[16] = {0};
+    cs_detail *detail = n->insn->detail;
+    int fam;
+
+    if (clobber == 0 || (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64)) {
+        return 0;
+    }
+
+    // Registers the instruction itself uses are never handed out
+    for (int i = 0; i < detail->regs_read_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_read[i], NULL)) >= 0) {
+            mentioned[fam] = 1;
+        }
+    }
+    for (int i = 0; i < detail->regs_write_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_write[i], NULL)) >= 0) {
+            mentioned[fam] = 1;
+        }
+    }
+    for (int i = 0; i < detail->x86.op_count; i++) {
+        cs_x86_op *op = &detail->x86.operands[i];
+        if (op->type == X86_OP_REG && (fam = layout_gpr_family(op->reg, NULL)) >= 0) {
+            mentioned[fam] = 1;
+        } else if (op->type == X86_OP_MEM) {
+            if ((fam = layout_gpr_family(op->mem.base, NULL)) >= 0) {
+                mentioned[fam] = 1;
+            }
+            if ((fam = layout_gpr_family(op->mem.index, NULL)) >= 0) {
+                mentioned[fam] = 1;
+            }
+        }
+    }
+
+    for (fam = 0; fam < ((arch == BYVAL_ARCH_X64) ? 16 : 8); fam++) {
+        if (fam != 4 && ((clobber >> fam) & 1) && !((reserved >> fam) & 1) && !mentioned[fam] &&
+            layout_reg_dead_at(n->next, fam, 2)) {
+            mask |= 1u << fam;
+        }
+    }
+    if ((clobber & CLOBBER_FLAGS) && layout_flags_dead_at(n->next)) {
+        mask |= CLOBBER_FLAGS;
+    }
+    return mask;
+}
+
+static uint16_t layout_scratch_dead_mask(struct instruction_node *n, layout_branch_kind_t kind) {
+    uint32_t reserved = current_rewrite_options()->reserved_mask;
+    uint16_t mask = 0;
+
+    if (!n->target) {
+        return 0;
+    }
+    for (int i = 0; i < LAYOUT_SCRATCH_COUNT; i++) {
+        int fam = layout_scratch_order[i];
+        // Registers the rewrite holds are read by code liveness does not see
+        if (((reserved >> fam) & 1) || !layout_reg_dead_at(n->target, fam, 2)) {
+            continue;
+        }
+        // A call also returns: the caller must not expect the register either
+        if (kind == LAYOUT_BRANCH_CALL && !layout_reg_dead_at(n->next, fam, 2)) {
+            continue;
+        }
+        mask |= (uint16_t)(1u << fam);
+    }
+    return mask;
+}
+
+static size_t layout_put_rip_lea(uint8_t *out, int fam, int32_t disp) {
+    out[0] = (uint8_t)(0x48 | ((fam & 8) ? 0x04 : 0));
+    out[1] = 0x8D;
+    out[2] = (uint8_t)(0x05 | ((fam & 7) << 3));
+    memcpy(out + 3, &disp, 4);
+    return 7;
+}
+
+static size_t layout_put_adjust_lea(uint8_t *out, int fam, int32_t disp, int wide) {
+    out[0] = (uint8_t)(0x48 | ((fam & 8) ? 0x05 : 0));
+    out[1] = 0x8D;
+    out[2] = (uint8_t)((wide ? 0x80 : 0x40) | ((fam & 7) << 3) | (fam & 7));
+    if (wide) {
+        memcpy(out + 3, &disp, 4);
+        return 7;
+    }
+    out[3] = (uint8_t)(int8_t)disp;
+    return 4;
+}
+
+/*
+ * Load the address `target` into register family `fam` with code starting at
+ * output offset `at`. LEA never touches flags, so the adjustment LEA is safe
+ * even when the target inspects flags set before the branch.
+ */
+static size_t layout_encode_rip_address(uint8_t *out, int fam, size_t at, int64_t target, int *clean) {
+    int64_t total = target - (int64_t)(at + 7);
+    size_t len;
+
+    *clean = 1;
+
+    // 1. LEA r64, [rip+disp32]
+    if (total >= INT32_MIN && total <= INT32_MAX) {
+        len = layout_put_rip_lea(out, fam, (int32_t)total);
+        if (is_bad_byte_free_buffer(out, len)) {
+            return len;
+        }
+    }
+
+    // 2. LEA r64, [rip+disp32]; LEA r64, [r64+disp8]
+    for (int i = 1; i < 256; i++) {
+        int k = (i < 128) ? i : 127 - i;
+        int64_t first = total - k;
+        if (first < INT32_MIN || first > INT32_MAX) {
+            continue;
+        }
+        len = layout_put_rip_lea(out, fam, (int32_t)first);
+        len += layout_put_adjust_lea(out + len, fam, k, 0);
+        if (is_bad_byte_free_buffer(out, len)) {
+            return len;
+        }
+    }
+
+    // 3. Same with a disp32 adjustment built from one repeated clean byte
+    for (int v = 1; v < 256; v++) {
+        if (!is_bad_byte_free_byte((uint8_t)v)) {
+            continue;
+        }
+        int32_t k = (int32_t)((uint32_t)v * 0x01010101u);
+        int64_t first = total - k;
+        if (first < INT32_MIN || first > INT32_MAX) {
+            continue;
+        }
+        len = layout_put_rip_lea(out, fam, (int32_t)first);
+        len += layout_put_adjust_lea(out + len, fam, k, 1);
+        if (is_bad_byte_free_buffer(out, len)) {
+            return len;
+        }
+    }
+
+    *clean = 0;
+    return layout_put_rip_lea(out, fam, (int32_t)total);
+}
+
+static size_t layout_put_reg_op(uint8_t *out, int fam, uint8_t opcode, uint8_t modrm_base) {
+    size_t len = 0;
+    if (fam & 8) {
+        out[len++] = 0x41;
+    }
+    if (opcode) {
+        out[len++] = opcode;
+    }
+    out[len++] = (uint8_t)(modrm_base | (fam & 7));
+    return len;
+}
+
+// XCHG [RSP], r64
+static size_t layout_put_xchg_stack(uint8_t *out, int fam) {
+    out[0] = (uint8_t)(0x48 | ((fam & 8) ? 0x04 : 0));
+    out[1] = 0x87;
+    out[2] = (uint8_t)(0x04 | ((fam & 7) << 3));
+    out[3] = 0x24;
+    return 4;
+}
+
+// Transfer through a dead scratch register: LEA ...; JMP/CALL r64
+static size_t layout_encode_rip_dead(uint8_t *out, layout_branch_kind_t kind, int fam,
+                                     size_t at, int64_t target, int *clean) {
+    size_t len = layout_encode_rip_address(out, fam, at, target, clean);
+    len += layout_put_reg_op(out + len, fam, 0xFF, (kind == LAYOUT_BRANCH_CALL) ? 0xD0 : 0xE0);
+    if (!is_bad_byte_free_buffer(out, len)) {
+        *clean = 0;
+    }
+    return len;
+}
+
+/*
+ * Transfer with a live scratch register.
+ *   JMP:  PUSH r; LEA r,target; XCHG [RSP],r; RET
+ *   CALL: LEA RSP,[RSP-8]; PUSH r; LEA r,return; MOV [RSP+8],r;
+ *         LEA r,target; XCHG [RSP],r; RET
+ */
+static size_t layout_encode_rip_saved(uint8_t *out, layout_branch_kind_t kind, int fam,
+                                      size_t at, int64_t target, int *clean) {
+    static const uint8_t reserve_slot[] = {0x48, 0x8D, 0x64, 0x24, 0xF8};
+    int64_t ret_addr = (int64_t)at;
+    size_t len = 0;
+    int ok = 1;
+    int part;
+
+    if (kind != LAYOUT_BRANCH_CALL) {
+        len = layout_put_reg_op(out, fam, 0, 0x50);
+        len += layout_encode_rip_address(out + len, fam, at + len, target, &ok);
+        len += layout_put_xchg_stack(out + len, fam);
+        out[len++] = 0xC3;
+        *clean = ok && is_bad_byte_free_buffer(out, len);
+        return len;
+    }
+
+    // The return address is the end of the sequence, whose length depends on it
+    for (int iter = 0; iter < 4; iter++) {
+        ok = 1;
+        memcpy(out, reserve_slot, sizeof(reserve_slot));
+        len = sizeof(reserve_slot);
+        len += layout_put_reg_op(out + len, fam, 0, 0x50);
+        len += layout_encode_rip_address(out + len, fam, at + len, ret_addr, &part);
+        ok &= part;
+        out[len++] = (uint8_t)(0x48 | ((fam & 8) ? 0x04 : 0));
+        out[len++] = 0x89;
+        out[len++] = (uint8_t)(0x44 | ((fam & 7) << 3));
+        out[len++] = 0x24;
+        out[len++] = 0x08;
+        len += layout_encode_rip_address(out + len, fam, at + len, target, &part);
+        ok &= part;
+        len += layout_put_xchg_stack(out + len, fam);
+        out[len++] = 0xC3;
+        if ((int64_t)(at + len) == ret_addr) {
+            break;
+        }
+        ret_addr = (int64_t)(at + len);
+    }
+    *clean = ok && (int64_t)(at + len) == ret_addr && is_bad_byte_free_buffer(out, len);
+    return len;
+}
+
+/*
+ * Build the transfer body at offset `at`: dead scratch registers first, then
+ * the register-preserving variants. Returns the first clean encoding, or the
+ * first candidate if nothing is clean.
+ */
+static size_t layout_encode_rip_body(uint8_t *out, layout_branch_kind_t kind, uint16_t dead_mask,
+                                     size_t at, int64_t target, int *saved) {
+    uint8_t trial[LAYOUT_RIP_BODY_MAX];
+    size_t first_len = 0;
+    int first_saved = 0;
+    int clean;
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < LAYOUT_SCRATCH_COUNT; i++) {
+            int fam = layout_scratch_order[i];
+            size_t len;
+
+            if (pass == 0 && !(dead_mask & (1u << fam))) {
+                continue;
+            }
+            len = (pass == 0) ? layout_encode_rip_dead(trial, kind, fam, at, target, &clean)
+                              : layout_encode_rip_saved(trial, kind, fam, at, target, &clean);
+            if (clean) {
+                memcpy(out, trial, len);
+                *saved = pass;
+                return len;
+            }
+            if (first_len == 0) {
+                memcpy(out, trial, len);
+                first_len = len;
+                first_saved = pass;
+            }
+        }
+    }
+    *saved = first_saved;
+    return first_len;
+}
+
+/*
+ * Smallest RIP-form size >= minimum for a branch at `at`. Non-call forms keep
+ * their body at a fixed position and add unreachable fill after it; CALL puts
+ * executed padding in front, which moves the body.
+ */
+static size_t layout_rip_fit(const layout_ctx_t *ctx, layout_branch_kind_t kind, uint16_t dead_mask,
+                             size_t at, int64_t target, size_t minimum) {
+    uint8_t body[LAYOUT_RIP_BODY_MAX];
+    size_t header = layout_absolute_header(kind);
+    int saved;
+
+    if (kind == LAYOUT_BRANCH_CALL) {
+        size_t natural = layout_encode_rip_body(body, kind, dead_mask, at, target, &saved);
+        for (size_t fill = 0; fill < 128; fill++) {
+            size_t size = fill + layout_encode_rip_body(body, kind, dead_mask, at + fill, target, &saved);
+            if (size >= minimum && layout_can_pad(ctx, fill, 0)) {
+                return size;
+            }
+        }
+        return natural;
+    }
+
+    size_t natural = header + layout_encode_rip_body(body, kind, dead_mask, at + header, target, &saved);
+    size_t size = (minimum > natural) ? minimum : natural;
+    for (size_t tries = 0; tries < 128; tries++, size++) {
+        size_t skip = size - header;
+        if (size > natural && !ctx->have_dead_fill) {
+            continue;
+        }
+        if (header == 0 || (skip <= 127 && is_bad_byte_free_byte((uint8_t)skip))) {
+            return size;
+        }
+    }
+    return natural;
+}
+
+static void layout_write_rip(struct buffer *b, const layout_ctx_t *ctx, layout_branch_kind_t kind,
+                             uint8_t cond, uint16_t dead_mask, size_t at, int64_t target, size_t size) {
+    uint8_t body[LAYOUT_RIP_BODY_MAX];
+    size_t header = layout_absolute_header(kind);
+    size_t len;
+    int saved;
+
+    if (kind == LAYOUT_BRANCH_CALL) {
+        for (size_t fill = 0; fill < 128; fill++) {
+            len = layout_encode_rip_body(body, kind, dead_mask, at + fill, target, &saved);
+            if (fill + len == size && layout_can_pad(ctx, fill, 0)) {
+                layout_write_padding(b, ctx, fill, 0);
+                buffer_append(b, body, len);
+                return;
+            }
+        }
+        len = layout_encode_rip_body(body, kind, dead_mask, at, target, &saved);
+        buffer_append(b, body, len);
+        return;
+    }
+
+    uint8_t skip = (uint8_t)(size - header);
+    if (kind == LAYOUT_BRANCH_JCC) {
+        uint8_t jncc[] = {(uint8_t)(0x70 | (cond ^ 0x01)), skip};
+        buffer_append(b, jncc, 2);
+    } else if (kind == LAYOUT_BRANCH_JRCXZ) {
+        uint8_t hop[] = {0xE3, 0x02, 0xEB, skip};
+        buffer_append(b, hop, 4);
+    }
+    len = layout_encode_rip_body(body, kind, dead_mask, at + header, target, &saved);
+    buffer_append(b, body, len);
+    if (size > header + len) {
+        // Unreachable: the body ends in JMP r64 or RET
+        layout_write_padding(b, ctx, size - header - len, 1);
+    }
+}
+
+// ============================================================================
+// Layout state
+// ============================================================================
+
+static uint32_t layout_absolute_target(const layout_branch_t *br) {
+    if (br->node->branch_form == LAYOUT_FORM_EXTERNAL || !br->node->target) {
+        return (uint32_t)br->node->insn->detail->x86.operands[0].imm;
+    }
+    return (uint32_t)br->node->target->new_offset;
+}
+
+// x64: keep an external target at the same distance from the payload edge or
+// from the instruction it pointed into
+static int64_t layout_map_external(const layout_ctx_t *ctx, int64_t target) {
+    struct instruction_node *containing = NULL;
+
+    if (target < 0) {
+        return target;
+    }
+    if ((uint64_t)target >= ctx->old_end) {
+        return (int64_t)ctx->new_end + (target - (int64_t)ctx->old_end);
+    }
+    for (struct instruction_node *n = ctx->head; n != NULL && n->offset <= (size_t)target; n = n->next) {
+        containing = n;
+    }
+    if (!containing) {
+        return target;
+    }
+    return (int64_t)containing->new_offset + (target - (int64_t)containing->offset);
+}
+
+// Branch islands: a JMP emitted ahead of the host node's padding
+static size_t layout_island_size(const struct instruction_node *host) {
+    if (!host->island) {
+        return 0;
+    }
+    return (host->island_form == LAYOUT_FORM_SHORT) ? 2 : 5;
+}
+
+static size_t layout_island_offset(const struct instruction_node *host) {
+    return host->new_offset - host->pad_before - layout_island_size(host);
+}
+
+static size_t layout_encode_island(const struct instruction_node *host, uint8_t *out) {
+    return layout_encode_rel(LAYOUT_BRANCH_JMP, 0, (layout_form_t)host->island_form,
+                             layout_island_offset(host), (int64_t)host->island->new_offset, out);
+}
+
+static int layout_island_dirty(const struct instruction_node *host) {
+    uint8_t enc[8];
+    size_t len = layout_encode_island(host, enc);
+    return len == 0 || !is_bad_byte_free_buffer(enc, len);
+}
+
+// Output offset a relative branch must reach
+static int64_t layout_target_offset(const layout_ctx_t *ctx, const struct instruction_node *n) {
+    if (n->via) {
+        return (int64_t)layout_island_offset(n->via);
+    }
+    if (n->target) {
+        return (int64_t)n->target->new_offset;
+    }
+    if (n->branch_form == LAYOUT_FORM_RIP_DATA || n->branch_form == LAYOUT_FORM_BASE_DATA) {
+        // The address comes from the RIP operand, which need not be operand 0
+        return layout_map_external(ctx, getpc_base_reference_target(n->insn));
+    }
+    return layout_map_external(ctx, n->insn->detail->x86.operands[0].imm);
+}
+
+// Fallback form once rel8/rel32 are exhausted
+static int layout_indirect_form(const layout_ctx_t *ctx) {
+    return (ctx->arch == BYVAL_ARCH_X64) ? LAYOUT_FORM_RIP_INDIRECT : LAYOUT_FORM_ABSOLUTE;
+}
+
+static size_t layout_branch_size(const layout_ctx_t *ctx, layout_branch_t *br) {
+    switch (br->node->branch_form) {
+        case LAYOUT_FORM_SHORT:
+            return 2;
+        case LAYOUT_FORM_NEAR:
+            return layout_rel_end(br->kind, LAYOUT_FORM_NEAR);
+        case LAYOUT_FORM_RIP_INDIRECT:
+            br->reserved = layout_rip_fit(ctx, br->kind, br->dead_mask, br->node->new_offset,
+                                          layout_target_offset(ctx, br->node), br->reserved);
+            return br->reserved;
+        case LAYOUT_FORM_ABSOLUTE:
+        case LAYOUT_FORM_EXTERNAL:
+            br->reserved = layout_absolute_fit(ctx, br->kind, layout_absolute_target(br), br->reserved);
+            return br->reserved;
+        case LAYOUT_FORM_BASE_DATA:
+            return getpc_base_based_size(br->node->insn, getpc_base_setup_register(ctx->base_setup));
+        case LAYOUT_FORM_BASE_SETUP:
+            return (ctx->base_users > 0) ? getpc_base_setup_size(ctx->arch) : 0;
+        case LAYOUT_FORM_POOL_LOAD:
+            return constant_pool_load_size(br->node, getpc_base_setup_register(ctx->base_setup));
+        case LAYOUT_FORM_POOL_INLINE:
+        case LAYOUT_FORM_POOL_DATA:
+            return br->node->code.size;
+        default:
+            return br->node->insn->size;
+    }
+}
+
+static int layout_uses_base(int form) {
+    return form == LAYOUT_FORM_BASE_DATA || form == LAYOUT_FORM_POOL_LOAD;
+}
+
+static size_t layout_encode_based(const layout_ctx_t *ctx, struct instruction_node *n, uint8_t *out) {
+    x86_reg base = getpc_base_setup_register(ctx->base_setup);
+    int64_t base_value = getpc_base_value(ctx->base_setup, ctx->arch);
+
+    if (n->branch_form == LAYOUT_FORM_POOL_LOAD) {
+        return constant_pool_encode_load(n, base, (int64_t)(n->target->new_offset + n->pool_offset) - base_value, out);
+    }
+    return getpc_base_encode_based(n->insn, base, layout_target_offset(ctx, n) - base_value, out);
+}
+
+/*
+ * Pick the base displacement that leaves the fewest based references dirty.
+ * Sizes do not depend on it, so no relaxation is needed afterwards.
+ * Returns 0 if no displacement gives a clean base load.
+ */
+static int layout_choose_base(layout_ctx_t *ctx) {
+    struct instruction_node *setup = ctx->base_setup;
+    uint8_t enc[24];
+    int best_dirty = -1;
+    int32_t best_disp = 0;
+
+    if (!setup || ctx->base_users == 0) {
+        return 1;
+    }
+
+    for (int cand = 0; cand < 512 && best_dirty != 0; cand++) {
+        // Repeated clean byte, then small negative values (FF FF FF xx)
+        uint8_t v = (uint8_t)(cand & 0xFF);
+        int32_t disp = (cand < 256) ? (int32_t)((uint32_t)v * 0x01010101u)
+                                    : (int32_t)(0xFFFFFF00u | v);
+        int dirty = 0;
+
+        getpc_base_set_disp(setup, ctx->arch, disp);
+        if (!is_bad_byte_free_buffer(setup->code.data, setup->code.size)) {
+            continue;
+        }
+
+        for (int i = 0; i < ctx->count; i++) {
+            struct instruction_node *n = ctx->branches[i].node;
+            size_t len;
+            if (!layout_uses_base(n->branch_form)) {
+                continue;
+            }
+            len = layout_encode_based(ctx, n, enc);
+            dirty += (len == 0 || !is_bad_byte_free_buffer(enc, len));
+        }
+        if (best_dirty < 0 || dirty < best_dirty) {
+            best_dirty = dirty;
+            best_disp = disp;
+        }
+    }
+
+    getpc_base_set_disp(setup, ctx->arch, best_disp);
+    return best_dirty >= 0;
+}
+
+/*
+ * Revert pool loads the base cannot serve to their inline rewrite (all of
+ * them if the base load itself could not be made clean). Returns 1 if any
+ * size changed.
+ */
+static int layout_revert_pool_loads(layout_ctx_t *ctx, int base_clean) {
+    int reverted = 0;
+    uint8_t enc[24];
+
+    for (int i = 0; i < ctx->count; i++) {
+        struct instruction_node *n = ctx->branches[i].node;
+        size_t len;
+        if (n->branch_form != LAYOUT_FORM_POOL_LOAD) {
+            continue;
+        }
+        len = base_clean ? layout_encode_based(ctx, n, enc) : 0;
+        if (len == 0 || !is_bad_byte_free_buffer(enc, len)) {
+            n->branch_form = LAYOUT_FORM_POOL_INLINE;
+            reverted = 1;
+        }
+    }
+    return reverted;
+}
+
+// Recompute offsets; returns 1 if any node changed size
+static int layout_assign_offsets(layout_ctx_t *ctx, struct instruction_node *head) {
+    int changed = 0;
+    int bi = 0;
+    size_t offset = 0;
+
+    ctx->base_users = 0;
+    for (int i = 0; i < ctx->count; i++) {
+        ctx->base_users += layout_uses_base(ctx->branches[i].node->branch_form);
+    }
+
+    ctx->new_end = 0;
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        size_t size;
+        offset += layout_island_size(n) + n->pad_before;
+        n->new_offset = offset;
+        if (n->branch_form == LAYOUT_FORM_POOL_DATA) {
+            ctx->new_end = offset;
+        }
+        if (n->branch_form != LAYOUT_FORM_NONE) {
+            size = layout_branch_size(ctx, &ctx->branches[bi++]);
+        } else {
+            size = n->code.size;
+        }
+        if (size != n->new_size) {
+            changed = 1;
+        }
+        n->new_size = size;
+        offset += size;
+    }
+    if (ctx->new_end == 0) {
+        ctx->new_end = offset;
+    }
+    return changed;
+}
+
+static int layout_branch_dirty(const layout_ctx_t *ctx, const layout_branch_t *br) {
+    struct instruction_node *n = br->node;
+    uint8_t enc[24];
+    size_t len;
+
+    if (n->branch_form == LAYOUT_FORM_RIP_DATA) {
+        len = getpc_base_encode_direct(n->insn, n->new_offset, layout_target_offset(ctx, n), enc);
+        return len == 0 || !is_bad_byte_free_buffer(enc, len);
+    }
+    if (n->branch_form != LAYOUT_FORM_SHORT && n->branch_form != LAYOUT_FORM_NEAR) {
+        return 0;
+    }
+    len = layout_encode_rel(br->kind, br->cond, (layout_form_t)n->branch_form,
+                            n->new_offset, layout_target_offset(ctx, n), enc);
+    return len == 0 || !is_bad_byte_free_buffer(enc, len);
+}
+
+static int layout_count_dirty(const layout_ctx_t *ctx) {
+    int dirty = 0;
+    for (int i = 0; i < ctx->count; i++) {
+        dirty += layout_branch_dirty(ctx, &ctx->branches[i]);
+    }
+    for (int i = 0; i < ctx->island_count; i++) {
+        dirty += layout_island_dirty(ctx->islands[i]);
+    }
+    return dirty;
+}
+
+/*
+ * Relax until stable: promote rel8 branches that went out of range and let
+ * indirect forms settle on their final size.
+ */
+static int layout_relax(layout_ctx_t *ctx, struct instruction_node *head, int *passes) {
+    for (int pass = 0; pass < LAYOUT_MAX_RELAX_PASSES; pass++) {
+        int changed = layout_assign_offsets(ctx, head);
+
+        for (int i = 0; i < ctx->count; i++) {
+            layout_branch_t *br = &ctx->branches[i];
+            struct instruction_node *n = br->node;
+            uint8_t enc[16];
+
+            if (n->branch_form != LAYOUT_FORM_SHORT && n->branch_form != LAYOUT_FORM_NEAR) {
+                continue;
+            }
+            if (layout_encode_rel(br->kind, br->cond, (layout_form_t)n->branch_form,
+                                  n->new_offset, layout_target_offset(ctx, n), enc) == 0) {
+                n->branch_form = (n->branch_form == LAYOUT_FORM_SHORT) ? LAYOUT_FORM_NEAR
+                                                                       : layout_indirect_form(ctx);
+                changed = 1;
+            }
+        }
+        for (int i = 0; i < ctx->island_count; i++) {
+            struct instruction_node *host = ctx->islands[i];
+            uint8_t enc[8];
+            if (host->island_form == LAYOUT_FORM_SHORT && layout_encode_island(host, enc) == 0) {
+                host->island_form = LAYOUT_FORM_NEAR;
+                changed = 1;
+            }
+        }
+
+        if (passes) {
+            (*passes)++;
+        }
+        if (!changed) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// ============================================================================
+// Padding search
+// ============================================================================
+
+typedef struct {
+    struct instruction_node *node;
+    int dead;
+} layout_candidate_t;
+
+static int layout_collect_candidates(struct instruction_node *head, const layout_branch_t *br,
+                                     layout_candidate_t *out, int max) {
+    struct instruction_node *branch = br->node;
+    struct instruction_node *target = branch->target;
+    struct instruction_node *first;
+    struct instruction_node *last;
+    struct instruction_node *prev = NULL;
+    int count = 0;
+
+    if (!target) {
+        return 0;  // External target: only the form swap can help
+    }
+
+    // Padding must sit between the branch and its target to change the displacement
+    if (target->new_offset > branch->new_offset) {
+        first = branch->next;
+        last = target;
+    } else {
+        first = target->next;
+        last = branch;
+    }
+    if (!first) {
+        return 0;
+    }
+
+    for (struct instruction_node *n = head; n != NULL && n != first; n = n->next) {
+        prev = n;
+    }
+
+    // Dead boundaries (after an unconditional transfer) cost nothing at runtime
+    int scanned = 0;
+    for (struct instruction_node *n = first; n != NULL && count < max - 1; n = n->next) {
+        if (prev && layout_is_unconditional(prev->insn)) {
+            out[count].node = n;
+            out[count].dead = 1;
+            count++;
+        }
+        if (n == last || ++scanned > 4096) {
+            break;
+        }
+        prev = n;
+    }
+
+    // Otherwise pad right in front of the forward target or the backward branch
+    int have_last = 0;
+    for (int i = 0; i < count; i++) {
+        if (out[i].node == last) {
+            have_last = 1;
+        }
+    }
+    if (!have_last && count < max) {
+        out[count].node = last;
+        out[count].dead = 0;
+        count++;
+    }
+    return count;
+}
+
+typedef struct {
+    int *forms;
+    size_t *reserved;
+    int island_forms[LAYOUT_MAX_ISLANDS];
+} layout_snapshot_t;
+
+static void layout_snapshot_save(const layout_ctx_t *ctx, layout_snapshot_t *snap) {
+    for (int i = 0; i < ctx->count; i++) {
+        snap->forms[i] = ctx->branches[i].node->branch_form;
+        snap->reserved[i] = ctx->branches[i].reserved;
+    }
+    for (int i = 0; i < ctx->island_count; i++) {
+        snap->island_forms[i] = ctx->islands[i]->island_form;
+    }
+}
+
+static void layout_snapshot_restore(layout_ctx_t *ctx, const layout_snapshot_t *snap) {
+    for (int i = 0; i < ctx->count; i++) {
+        ctx->branches[i].node->branch_form = snap->forms[i];
+        ctx->branches[i].reserved = snap->reserved[i];
+    }
+    for (int i = 0; i < ctx->island_count; i++) {
+        ctx->islands[i]->island_form = snap->island_forms[i];
+    }
+}
+
+static void layout_search_padding(layout_ctx_t *ctx, struct instruction_node *head,
+                                  size_t node_count, layout_stats_t *stats) {
+    layout_snapshot_t snap;
+    size_t budget = LAYOUT_PAD_BUDGET;
+    unsigned long work = 0;
+    int dirty = layout_count_dirty(ctx);
+
+    if (dirty == 0) {
+        return;
+    }
+
+    snap.forms = malloc(sizeof(int) * (size_t)ctx->count);
+    snap.reserved = malloc(sizeof(size_t) * (size_t)ctx->count);
+    if (!snap.forms || !snap.reserved) {
+        free(snap.forms);
+        free(snap.reserved);
+        return;
+    }
+
+    for (int i = 0; i < ctx->count && dirty > 0; i++) {
+        layout_branch_t *br = &ctx->branches[i];
+        layout_candidate_t cands[LAYOUT_MAX_CANDIDATES];
+        int ncand;
+        int repaired = 0;
+
+        if (!layout_branch_dirty(ctx, br)) {
+            continue;
+        }
+        if (work > LAYOUT_SEARCH_WORK_LIMIT) {
+            break;
+        }
+
+        ncand = layout_collect_candidates(head, br, cands, LAYOUT_MAX_CANDIDATES);
+        layout_snapshot_save(ctx, &snap);
+
+        // Trials in order of byte cost: padding of `cost` bytes, or a rel8 <-> rel32 swap
+        for (size_t cost = 1; cost <= LAYOUT_PAD_MAX_PER_BRANCH && !repaired; cost++) {
+            size_t form_cost = layout_rel_end(br->kind, LAYOUT_FORM_NEAR) - 2;
+
+            if (cost == form_cost && br->node->branch_form == LAYOUT_FORM_SHORT) {
+                br->node->branch_form = LAYOUT_FORM_NEAR;
+                layout_relax(ctx, head, NULL);
+                work += node_count;
+                int after = layout_count_dirty(ctx);
+                if (after < dirty && !layout_branch_dirty(ctx, br)) {
+                    dirty = after;
+                    repaired = 1;
+                    break;
+                }
+                layout_snapshot_restore(ctx, &snap);
+                layout_relax(ctx, head, NULL);
+                work += node_count;
+            }
+
+            if (cost > budget) {
+                continue;
+            }
+
+            for (int c = 0; c < ncand && !repaired; c++) {
+                if (!layout_can_pad(ctx, cost, cands[c].dead)) {
+                    continue;
+                }
+                cands[c].node->pad_before += cost;
+                layout_relax(ctx, head, NULL);
+                work += node_count;
+
+                int after = layout_count_dirty(ctx);
+                if (after < dirty && !layout_branch_dirty(ctx, br)) {
+                    dirty = after;
+                    budget -= cost;
+                    stats->pad_bytes += cost;
+                    repaired = 1;
+                } else {
+                    cands[c].node->pad_before -= cost;
+                    layout_snapshot_restore(ctx, &snap);
+                    layout_relax(ctx, head, NULL);
+                    work += node_count;
+                }
+            }
+        }
+
+        if (repaired) {
+            stats->padded_branches++;
+        }
+    }
+
+    free(snap.forms);
+    free(snap.reserved);
+}
+
+// ============================================================================
+// Branch islands
+// ============================================================================
+
+typedef struct {
+    struct instruction_node *node;
+    size_t distance;
+} layout_host_t;
+
+// Nodes only reachable through a branch that can host a new island, nearest first
+static int layout_collect_island_hosts(const layout_ctx_t *ctx, const layout_branch_t *br,
+                                       layout_host_t *out, int max) {
+    struct instruction_node *prev = NULL;
+    size_t at = br->node->new_offset;
+    int count = 0;
+
+    for (struct instruction_node *n = ctx->head; n != NULL; prev = n, n = n->next) {
+        size_t distance;
+        int pos;
+
+        if (!prev || !layout_is_unconditional(prev->insn) || n->island) {
+            continue;
+        }
+        distance = (n->new_offset > at) ? n->new_offset - at : at - n->new_offset;
+        for (pos = count; pos > 0 && distance < out[pos - 1].distance; pos--) {
+        }
+        if (pos >= max) {
+            continue;
+        }
+        if (count < max) {
+            count++;
+        }
+        memmove(&out[pos + 1], &out[pos], (size_t)(count - 1 - pos) * sizeof(*out));
+        out[pos].node = n;
+        out[pos].distance = distance;
+    }
+    return count;
+}
+
+/*
+ * Route a dirty branch through the island at `host` (created if the host has
+ * none yet). Kept only if the branch and the island end up clean and the
+ * total number of dirty encodings drops; otherwise the island is removed
+ * again and the caller restores the forms.
+ */
+static int layout_try_island(layout_ctx_t *ctx, struct instruction_node *head, layout_branch_t *br,
+                             struct instruction_node *host, int *dirty) {
+    int created = (host->island == NULL);
+    int after;
+
+    if (created) {
+        if (ctx->island_count == LAYOUT_MAX_ISLANDS) {
+            return 0;
+        }
+        host->island = br->node->target;
+        host->island_form = LAYOUT_FORM_SHORT;
+        ctx->islands[ctx->island_count++] = host;
+    }
+    br->node->via = host;
+    if (br->kind != LAYOUT_BRANCH_CALL) {
+        br->node->branch_form = LAYOUT_FORM_SHORT;
+    }
+    layout_relax(ctx, head, NULL);
+
+    after = layout_count_dirty(ctx);
+    if (after < *dirty && !layout_branch_dirty(ctx, br) && !layout_island_dirty(host)) {
+        *dirty = after;
+        return 1;
+    }
+    br->node->via = NULL;
+    if (created) {
+        host->island = NULL;
+        ctx->island_count--;
+    }
+    return 0;
+}
+
+static void layout_place_islands(layout_ctx_t *ctx, struct instruction_node *head, size_t node_count) {
+    layout_snapshot_t snap;
+    unsigned long work = 0;
+    int dirty = layout_count_dirty(ctx);
+
+    if (dirty == 0) {
+        return;
+    }
+
+    snap.forms = malloc(sizeof(int) * (size_t)ctx->count);
+    snap.reserved = malloc(sizeof(size_t) * (size_t)ctx->count);
+    if (!snap.forms || !snap.reserved) {
+        free(snap.forms);
+        free(snap.reserved);
+        return;
+    }
+
+    for (int i = 0; i < ctx->count && dirty > 0 && work <= LAYOUT_SEARCH_WORK_LIMIT; i++) {
+        layout_branch_t *br = &ctx->branches[i];
+        struct instruction_node *n = br->node;
+        layout_host_t hosts[LAYOUT_MAX_CANDIDATES];
+        int nhosts;
+        int placed = 0;
+
+        if (!n->target || (n->branch_form != LAYOUT_FORM_SHORT && n->branch_form != LAYOUT_FORM_NEAR) ||
+            !layout_branch_dirty(ctx, br)) {
+            continue;
+        }
+        layout_snapshot_save(ctx, &snap);
+
+        // Share an island that already jumps to this target...
+        for (int h = 0; h < ctx->island_count && !placed; h++) {
+            if (ctx->islands[h]->island != n->target) {
+                continue;
+            }
+            placed = layout_try_island(ctx, head, br, ctx->islands[h], &dirty);
+            if (!placed) {
+                layout_snapshot_restore(ctx, &snap);
+                layout_relax(ctx, head, NULL);
+            }
+            work += 2 * node_count;
+        }
+
+        // ...or open a new one at the nearest dead boundaries
+        nhosts = placed ? 0 : layout_collect_island_hosts(ctx, br, hosts, LAYOUT_MAX_CANDIDATES);
+        for (int h = 0; h < nhosts && !placed; h++) {
+            placed = layout_try_island(ctx, head, br, hosts[h].node, &dirty);
+            if (!placed) {
+                layout_snapshot_restore(ctx, &snap);
+                layout_relax(ctx, head, NULL);
+            }
+            work += 2 * node_count;
+        }
+    }
+
+    free(snap.forms);
+    free(snap.reserved);
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+static int layout_build_context(layout_ctx_t *ctx, struct instruction_node *head,
+                                byval_arch_t arch, size_t *node_count) {
+    int count = 0;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->arch = arch;
+    ctx->head = head;
+    layout_select_fillers(ctx);
+
+    // Undo a previous solve so the layout can be re-run after code changes
+    *node_count = 0;
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        (*node_count)++;
+        n->pad_before = 0;
+        n->island = NULL;
+        n->via = NULL;
+        if (n->branch_form == LAYOUT_FORM_BASE_DATA) {
+            n->branch_form = LAYOUT_FORM_RIP_DATA;
+        } else if (n->branch_form == LAYOUT_FORM_POOL_INLINE) {
+            n->branch_form = LAYOUT_FORM_POOL_LOAD;
+        }
+        if (n->branch_form != LAYOUT_FORM_NONE) {
+            count++;
+        }
+        ctx->old_end = n->offset + n->insn->size;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    ctx->branches = calloc((size_t)count, sizeof(layout_branch_t));
+    if (!ctx->branches) {
+        return -1;
+    }
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (n->branch_form == LAYOUT_FORM_NONE) {
+            continue;
+        }
+        layout_branch_t *br = &ctx->branches[ctx->count++];
+        br->node = n;
+        if (n->branch_form == LAYOUT_FORM_BASE_SETUP) {
+            br->kind = LAYOUT_BRANCH_BASE_SETUP;
+            ctx->base_setup = n;
+            continue;
+        }
+        if (n->branch_form == LAYOUT_FORM_RIP_DATA) {
+            br->kind = LAYOUT_BRANCH_DATA_REF;
+            continue;
+        }
+        if (n->branch_form == LAYOUT_FORM_POOL_LOAD || n->branch_form == LAYOUT_FORM_POOL_DATA) {
+            br->kind = (n->branch_form == LAYOUT_FORM_POOL_LOAD) ? LAYOUT_BRANCH_POOL_LOAD
+                                                                  : LAYOUT_BRANCH_POOL_DATA;
+            continue;
+        }
+        layout_decode_branch(n->insn, arch, &br->kind, &br->cond);
+        if (arch == BYVAL_ARCH_X64) {
+            br->dead_mask = layout_scratch_dead_mask(n, br->kind);
+        }
+        if (!n->target && arch != BYVAL_ARCH_X64) {
+            n->branch_form = LAYOUT_FORM_EXTERNAL;
+        } else {
+            n->branch_form = (br->kind == LAYOUT_BRANCH_CALL) ? LAYOUT_FORM_NEAR : LAYOUT_FORM_SHORT;
+        }
+    }
+    return 0;
+}
+
+int layout_solve(struct instruction_node *head, byval_arch_t arch, layout_stats_t *stats) {
+    layout_ctx_t ctx;
+    layout_stats_t local;
+    size_t node_count = 0;
+    int result = 0;
+
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    if (layout_build_context(&ctx, head, arch, &node_count) != 0) {
+        return -1;
+    }
+
+    // 1. Range relaxation from the smallest forms
+    if (layout_relax(&ctx, head, &stats->relax_passes) != 0) {
+        result = -1;
+    }
+
+    // 2. Repair dirty displacements with padding / form changes, then route
+    //    what is left through branch islands
+    if (result == 0) {
+        layout_search_padding(&ctx, head, node_count, stats);
+        layout_place_islands(&ctx, head, node_count);
+    }
+
+    // 3. Whatever is still dirty goes indirect (branches) or off the shared
+    //    base (references), and islands that turned dirty are dissolved;
+    //    repeat until nothing new turns dirty
+    for (int round = 0; round < LAYOUT_MAX_RELAX_PASSES; round++) {
+        int converted = 0;
+        for (int i = 0; i < ctx.island_count; i++) {
+            struct instruction_node *host = ctx.islands[i];
+            if (!layout_island_dirty(host)) {
+                continue;
+            }
+            for (int j = 0; j < ctx.count; j++) {
+                if (ctx.branches[j].node->via == host) {
+                    ctx.branches[j].node->via = NULL;
+                }
+            }
+            host->island = NULL;
+            ctx.islands[i--] = ctx.islands[--ctx.island_count];
+            converted = 1;
+        }
+        for (int i = 0; i < ctx.count; i++) {
+            layout_branch_t *br = &ctx.branches[i];
+            if (!layout_branch_dirty(&ctx, br)) {
+                continue;
+            }
+            if (br->kind != LAYOUT_BRANCH_DATA_REF) {
+                br->node->branch_form = layout_indirect_form(&ctx);
+                br->node->via = NULL;
+                converted = 1;
+            } else if (ctx.base_setup &&
+                       getpc_base_based_size(br->node->insn,
+                                             getpc_base_setup_register(ctx.base_setup)) > 0) {
+                br->node->branch_form = LAYOUT_FORM_BASE_DATA;
+                converted = 1;
+            }
+        }
+        if (layout_relax(&ctx, head, &stats->relax_passes) != 0) {
+            result = -1;
+        }
+        if (!converted) {
+            break;
+        }
+    }
+
+    // 4. With every size fixed, pick the base value; pool loads it cannot
+    //    serve go back inline, which moves offsets, so pick again
+    for (int round = 0; round < LAYOUT_MAX_RELAX_PASSES; round++) {
+        int base_clean = layout_choose_base(&ctx);
+        if (!layout_revert_pool_loads(&ctx, base_clean)) {
+            break;
+        }
+        if (layout_relax(&ctx, head, &stats->relax_passes) != 0) {
+            result = -1;
+        }
+    }
+
+    for (int i = 0; i < ctx.count; i++) {
+        layout_branch_t *br = &ctx.branches[i];
+        struct instruction_node *n = br->node;
+
+        if (br->kind == LAYOUT_BRANCH_BASE_SETUP) {
+            stats->base_setup_bytes = n->new_size;
+            continue;
+        }
+        if (br->kind == LAYOUT_BRANCH_POOL_DATA) {
+            stats->pool_constants = constant_pool_entry_count(n);
+            stats->pool_bytes = n->new_size;
+            continue;
+        }
+        if (br->kind == LAYOUT_BRANCH_POOL_LOAD) {
+            stats->pool_loads += (n->branch_form == LAYOUT_FORM_POOL_LOAD);
+            stats->pool_inline += (n->branch_form == LAYOUT_FORM_POOL_INLINE);
+            continue;
+        }
+        if (br->kind == LAYOUT_BRANCH_DATA_REF) {
+            uint8_t enc[24];
+            size_t len;
+            stats->data_refs++;
+            if (n->branch_form == LAYOUT_FORM_BASE_DATA) {
+                stats->based_refs++;
+                len = layout_encode_based(&ctx, n, enc);
+                stats->dirty_refs += (len == 0 || !is_bad_byte_free_buffer(enc, len));
+            } else {
+                stats->dirty_refs += layout_branch_dirty(&ctx, br);
+            }
+            continue;
+        }
+
+        stats->branches++;
+        stats->island_branches += (n->via != NULL);
+        if (!n->target) {
+            stats->external++;
+        }
+        switch (n->branch_form) {
+            case LAYOUT_FORM_SHORT:    stats->short_form++; break;
+            case LAYOUT_FORM_NEAR:     stats->near_form++; break;
+            case LAYOUT_FORM_ABSOLUTE: stats->absolute_form++; break;
+            case LAYOUT_FORM_RIP_INDIRECT: {
+                uint8_t body[LAYOUT_RIP_BODY_MAX];
+                int saved = 0;
+                size_t at = n->new_offset + ((br->kind == LAYOUT_BRANCH_CALL) ? 0 : layout_absolute_header(br->kind));
+                layout_encode_rip_body(body, br->kind, br->dead_mask, at,
+                                       layout_target_offset(&ctx, n), &saved);
+                stats->rip_form++;
+                stats->rip_saved_scratch += saved;
+                break;
+            }
+            default: break;
+        }
+    }
+
+    stats->islands = ctx.island_count;
+    for (int i = 0; i < ctx.island_count; i++) {
+        stats->island_bytes += layout_island_size(ctx.islands[i]);
+    }
+
+    free(ctx.branches);
+    return result;
+}
+
+void layout_emit(struct buffer *out, struct instruction_node *head, byval_arch_t arch) {
+    layout_ctx_t ctx;
+    struct instruction_node *prev = NULL;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.arch = arch;
+    ctx.head = head;
+    layout_select_fillers(&ctx);
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (n->branch_form == LAYOUT_FORM_POOL_DATA) {
+            break;
+        }
+        ctx.old_end = n->offset + n->insn->size;
+        ctx.new_end = n->new_offset + n->new_size;
+        if (n->branch_form == LAYOUT_FORM_BASE_SETUP) {
+            ctx.base_setup = n;
+        }
+    }
+
+    for (struct instruction_node *n = head; n != NULL; prev = n, n = n->next) {
+        int dead = prev != NULL && layout_is_unconditional(prev->insn);
+        size_t before = out->size;
+
+        if (n->island) {
+            uint8_t enc[8];
+            buffer_append(out, enc, layout_encode_island(n, enc));
+        }
+        layout_write_padding(out, &ctx, n->pad_before, dead);
+
+        if (n->branch_form == LAYOUT_FORM_NONE) {
+            buffer_append(out, n->code.data, n->code.size);
+            continue;
+        }
+
+        layout_branch_kind_t kind = LAYOUT_BRANCH_JMP;
+        uint8_t cond;
+        layout_decode_branch(n->insn, arch, &kind, &cond);
+
+        if (n->branch_form == LAYOUT_FORM_BASE_SETUP) {
+            if (n->new_size > 0) {
+                buffer_append(out, n->code.data, n->code.size);
+            }
+        } else if (n->branch_form == LAYOUT_FORM_POOL_INLINE || n->branch_form == LAYOUT_FORM_POOL_DATA) {
+            buffer_append(out, n->code.data, n->code.size);
+        } else if (n->branch_form == LAYOUT_FORM_POOL_LOAD) {
+            uint8_t enc[24];
+            buffer_append(out, enc, layout_encode_based(&ctx, n, enc));
+        } else if (n->branch_form == LAYOUT_FORM_RIP_DATA || n->branch_form == LAYOUT_FORM_BASE_DATA) {
+            uint8_t enc[24];
+            size_t len = (n->branch_form == LAYOUT_FORM_RIP_DATA)
+                             ? getpc_base_encode_direct(n->insn, n->new_offset, layout_target_offset(&ctx, n), enc)
+                             : layout_encode_based(&ctx, n, enc);
+            buffer_append(out, enc, len);
+        } else if (n->branch_form == LAYOUT_FORM_SHORT || n->branch_form == LAYOUT_FORM_NEAR) {
+            uint8_t enc[16];
+            size_t len = layout_encode_rel(kind, cond, (layout_form_t)n->branch_form,
+                                           n->new_offset, layout_target_offset(&ctx, n), enc);
+            buffer_append(out, enc, len);
+        } else if (n->branch_form == LAYOUT_FORM_RIP_INDIRECT) {
+            layout_write_rip(out, &ctx, kind, cond, layout_scratch_dead_mask(n, kind),
+                             n->new_offset, layout_target_offset(&ctx, n), n->new_size);
+        } else {
+            uint32_t target = (n->branch_form == LAYOUT_FORM_EXTERNAL || !n->target)
+                                  ? (uint32_t)n->insn->detail->x86.operands[0].imm
+                                  : (uint32_t)n->target->new_offset;
+            layout_write_absolute(out, &ctx, kind, cond, target, n->new_size);
+        }
+
+        if (out->size - before != layout_island_size(n) + n->pad_before + n->new_size) {
+            log_diagnostic("[LAYOUT] WARNING: %s %s emitted %zu bytes, planned %zu\n",
+                           n->insn->mnemonic, n->insn->op_str,
+                           out->size - before, layout_island_size(n) + n->pad_before + n->new_size);
+        }
+    }
+}
+
+void layout_print_stats(const layout_stats_t *stats) {
+    log_diagnostic("[LAYOUT] %d branches: %d rel8, %d rel32, %d rip-indirect (%d saved scratch), "
+                   "%d absolute, %d external; %d repaired by padding (%zu pad bytes), %d relax passes\n",
+                   stats->branches, stats->short_form, stats->near_form, stats->rip_form,
+                   stats->rip_saved_scratch, stats->absolute_form, stats->external,
+                   stats->padded_branches, stats->pad_bytes, stats->relax_passes);
+    if (stats->islands > 0) {
+        log_diagnostic("[LAYOUT] %d branch islands (%zu bytes) serve %d branches\n",
+                       stats->islands, stats->island_bytes, stats->island_branches);
+    }
+    if (stats->data_refs > 0) {
+        log_diagnostic("[LAYOUT] %d RIP-relative references: %d via shared GetPC base "
+                       "(%zu-byte setup), %d still dirty\n",
+                       stats->data_refs, stats->based_refs, stats->base_setup_bytes, stats->dirty_refs);
+    }
+    if (stats->pool_constants > 0) {
+        log_diagnostic("[LAYOUT] constant pool: %d constants (%zu bytes), %d pooled loads, "
+                       "%d reverted inline\n",
+                       stats->pool_constants, stats->pool_bytes, stats->pool_loads, stats->pool_inline);
+    }
+}
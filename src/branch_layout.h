@@ -0,0 +1,231 @@
+#ifndef BRANCH_LAYOUT_H
+#define BRANCH_LAYOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file branch_layout.h
+ * @brief Global branch layout solver for the Pass 2 rewrite pipeline
+ *
+ * Every relative branch (JMP/CALL/Jcc/JRCXZ) is assigned an encoding form
+ * after all other instructions have been rewritten, so displacements are
+ * computed against exact output offsets. When a displacement contains a
+ * bad byte the solver first tries to make it clean by inserting a few
+ * bytes of padding at block boundaries (or by switching between the rel8
+ * and rel32 forms), then by routing it through a branch island - a clean
+ * JMP to the same target placed at a dead block boundary and shared by every
+ * branch to that target that can reach it. Only branches that cannot be
+ * repaired either way fall back to an indirect form: MOV EAX / JMP EAX on x86,
+ * LEA r64,[rip+disp] / JMP r64 on x64 (addresses are never truncated to
+ * 32 bits, and the scratch register is either dead or saved on the stack).
+ */
+
+// Padding search limits
+#define LAYOUT_PAD_BUDGET          256   // Total padding bytes the solver may insert
+#define LAYOUT_PAD_MAX_PER_BRANCH  16    // Largest single padding insertion tried
+#define LAYOUT_MAX_CANDIDATES      8     // Insertion points examined per dirty branch
+#define LAYOUT_MAX_RELAX_PASSES    64    // Relaxation iterations before giving up
+#define LAYOUT_SEARCH_WORK_LIMIT   50000000UL  // Node visits spent on padding search
+#define LAYOUT_LIVENESS_WINDOW     32    // Instructions scanned when proving a scratch register dead
+#define LAYOUT_MAX_ISLANDS         64    // Branch islands placed per layout
+
+// Encoding forms, ordered by size. The solver only ever moves a branch to a
+// later form, which guarantees that relaxation terminates.
+typedef enum {
+    LAYOUT_FORM_NONE = 0,      // Not a branch
+    LAYOUT_FORM_SHORT,         // rel8  (EB / 7x / E3)
+    LAYOUT_FORM_NEAR,          // rel32 (E9 / E8 / 0F 8x)
+    LAYOUT_FORM_RIP_INDIRECT,  // x64: LEA r64,[rip+disp]; JMP/CALL r64
+    LAYOUT_FORM_ABSOLUTE,      // x86: MOV EAX, target; JMP/CALL EAX
+    LAYOUT_FORM_EXTERNAL,      // x86: target outside the payload, absolute conversion
+    LAYOUT_FORM_RIP_DATA,      // x64 RIP-relative data reference, displacement re-encoded
+    LAYOUT_FORM_BASE_DATA,     // ...addressed as [base+disp32] off the shared GetPC base
+    LAYOUT_FORM_BASE_SETUP,    // The shared base load itself (empty until a reference uses it)
+    LAYOUT_FORM_POOL_LOAD,     // MOV reg, imm loaded off the base from the constant pool
+    LAYOUT_FORM_POOL_INLINE,   // ...reverted to its inline rewrite (load stayed dirty)
+    LAYOUT_FORM_POOL_DATA,     // The constant pool itself (see constant_pool.h)
+    LAYOUT_FORM_PC_RELATIVE    // ARM/Thumb/A64 PC-relative node (see pc_relocation.h)
+} layout_form_t;
+
+// Branch families (and other position-dependent nodes) understood by the solver
+typedef enum {
+    LAYOUT_BRANCH_JMP = 0,
+    LAYOUT_BRANCH_CALL,
+    LAYOUT_BRANCH_JCC,
+    LAYOUT_BRANCH_JRCXZ,
+    LAYOUT_BRANCH_DATA_REF,    // RIP-relative memory operand (see getpc_base.h)
+    LAYOUT_BRANCH_BASE_SETUP,  // Shared GetPC base load
+    LAYOUT_BRANCH_POOL_LOAD,   // Constant-pool load
+    LAYOUT_BRANCH_POOL_DATA    // Constant-pool data block
+} layout_branch_kind_t;
+
+// Result summary for one layout run
+typedef struct {
+    int branches;              // Relative branches seen
+    int short_form;            // Emitted as rel8
+    int near_form;             // Emitted as rel32
+    int rip_form;              // x64 RIP-relative indirect forms
+    int rip_saved_scratch;     // ...of which had to save their scratch register
+    int absolute_form;         // Fell back to absolute conversion
+    int external;              // Targets outside the payload
+    int data_refs;             // x64 RIP-relative references relocated
+    int based_refs;            // ...of which address off the shared GetPC base
+    int dirty_refs;            // ...still containing bad bytes
+    size_t base_setup_bytes;   // Size of the shared base load (0 if unused)
+    int pool_constants;        // Distinct constants in the constant pool
+    int pool_loads;            // Immediates loaded from the pool
+    int pool_inline;           // ...reverted to their inline rewrite
+    size_t pool_bytes;         // Size of the pool data block
+    int padded_branches;       // Dirty branches repaired by padding / form change
+    size_t pad_bytes;          // Padding bytes inserted
+    int islands;               // Branch islands placed
+    int island_branches;       // Branches routed through an island
+    size_t island_bytes;       // Size of all islands
+    int relax_passes;          // Relaxation iterations used
+} layout_stats_t;
+
+/**
+ * Check whether an instruction is a relative branch handled by the layout solver
+ * @param insn: Capstone instruction
+ * @param arch: Target architecture
+ * @return: 1 if the layout solver owns this instruction, 0 otherwise
+ */
+int layout_is_branch(cs_insn *insn, byval_arch_t arch);
+
+/**
+ * Assign branch forms, padding and final offsets to every node
+ *
+ * Non-branch nodes must already hold their rewritten bytes in node->code;
+ * branch and RIP-relative reference nodes must have node->target resolved
+ * (NULL for external targets). A LAYOUT_FORM_BASE_SETUP node, if present,
+ * provides the shared base for references whose displacement stays dirty and
+ * for constant-pool loads; a LAYOUT_FORM_POOL_DATA node, if present, must be
+ * the last node.
+ * On x64 external targets are kept payload-relative: a target past the end
+ * of the input keeps its distance from the end of the output. The solve may
+ * be repeated after node->code changes; it starts over from scratch.
+ *
+ * @param head: First instruction node
+ * @param arch: Target architecture
+ * @param stats: Optional statistics output
+ * @return: 0 on success, -1 if the layout did not converge
+ */
+int layout_solve(struct instruction_node *head, byval_arch_t arch, layout_stats_t *stats);
+
+/**
+ * Emit the solved layout into an output buffer
+ * @param out: Destination buffer
+ * @param head: First instruction node (after layout_solve)
+ * @param arch: Target architecture
+ */
+void layout_emit(struct buffer *out, struct instruction_node *head, byval_arch_t arch);
+
+/**
+ * Map any x86/x64 general-purpose register alias to its family (0-15)
+ * @param reg: Capstone register id
+ * @param full_width: Optional output, 1 if a write to reg replaces the whole
+ *                    64-bit register (64-bit, or 32-bit which zero-extends)
+ * @return: Hardware register number, or -1 for non-GPRs
+ */
+int layout_gpr_family(unsigned int reg, int *full_width);
+
+/**
+ * Same-width alias of a GPR in another family (EBX, 6 -> ESI; R9W, 3 -> BX)
+ * @param reg: Capstone register id
+ * @param fam: Destination family (0-15)
+ * @return: Register id, or X86_REG_INVALID if reg is not a GPR or the
+ *          destination has no such alias (AH-style high bytes)
+ */
+unsigned int layout_gpr_alias(unsigned int reg, int fam);
+
+/**
+ * Mark every node reachable from the target of an in-payload CALL (in_callee)
+ *
+ * A RET there returns into the payload, so the liveness scans treat it as an
+ * opaque transfer rather than the payload exit. Run after branch
+ * classification and again if branch targets change.
+ *
+ * @param head: First instruction node (branches already classified)
+ * @param arch: Target architecture
+ * @return: 0 on success, -1 on allocation failure (every node is then marked)
+ */
+int layout_mark_internal_returns(struct instruction_node *head, byval_arch_t arch);
+
+/**
+ * Conservative register liveness over the instruction list
+ *
+ * Follows JMPs and both successors of conditional branches (up to `depth`
+ * levels of branching); calls, interrupts and external targets end the scan
+ * as "live". The end of the payload, and returns not reachable from an
+ * in-payload CALL (see layout_mark_internal_returns()), end it as "dead" only
+ * for registers in the --clobber set. Branch nodes must already carry their
+ * branch_form.
+ *
+ * @param n: Node the register is queried at (before it executes)
+ * @param fam: Register family from layout_gpr_family()
+ * @param depth: Conditional branches whose both paths may be followed
+ * @return: 1 if the register is overwritten before any read on every path
+ *          within LAYOUT_LIVENESS_WINDOW instructions, 0 otherwise
+ */
+int layout_reg_dead_at(struct instruction_node *n, int fam, int depth);
+
+/**
+ * Check that the flags are dead before a node: every status flag is
+ * overwritten before any read, or the payload ends and CLOBBER_FLAGS is in
+ * the --clobber set
+ * @param n: Node the flags are queried at (before it executes)
+ * @return: 1 if the flags may be destroyed, 0 otherwise
+ */
+int layout_flags_dead_at(struct instruction_node *n);
+
+/**
+ * Scratch registers for rewriting one instruction (--clobber)
+ *
+ * Members of the caller's clobber set that the instruction does not use,
+ * that the rewrite does not hold (rewrite_options_t.reserved_mask) and that
+ * are dead right after it, plus CLOBBER_FLAGS if the flags are clobbered
+ * and overwritten before any read. Strategies may destroy these without a
+ * save/restore (see set_scratch_registers()).
+ *
+ * @param n: Node about to be rewritten
+ * @param arch: Target architecture
+ * @return: Scratch mask (bit per GPR family, CLOBBER_FLAGS), 0 without --clobber
+ */
+uint32_t layout_scratch_after(struct instruction_node *n, byval_arch_t arch);
+
+/**
+ * Check for control transfers whose continuation is unknown to the solver
+ * (calls, returns, far/indirect transfers, interrupts, system calls, LOOP/JECXZ)
+ * @param insn: Capstone instruction
+ * @return: 1 if register state beyond the instruction cannot be reasoned about
+ */
+int layout_is_opaque_transfer(cs_insn *insn);
+
+/**
+ * Collect the in-payload targets of relative branches (region boundaries for
+ * the straight-line passes), sorted for layout_is_branch_target()
+ * @param head: First instruction node (branches already classified)
+ * @param arch: Target architecture
+ * @param targets: Output array, released with free() (NULL if empty)
+ * @param count: Output number of entries
+ * @return: 0 on success, -1 on allocation failure
+ */
+int layout_collect_branch_targets(struct instruction_node *head, byval_arch_t arch,
+                                  struct instruction_node ***targets, size_t *count);
+
+/**
+ * Check whether a node is a branch target
+ * @return: 1 if `n` is in the array from layout_collect_branch_targets()
+ */
+int layout_is_branch_target(struct instruction_node **targets, size_t count, struct instruction_node *n);
+
+/**
+ * Print a one-line summary of a layout run to stderr
+ * @param stats: Statistics from layout_solve()
+ */
+void layout_print_stats(const layout_stats_t *stats);
+
+#endif // BRANCH_LAYOUT_H
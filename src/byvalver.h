@@ -1,10 +1,15 @@
 /**
  * @file byvalver.h
- * @brief Public API for byvalver null-byte elimination library
+ * @brief Public API for the byvalver bad-byte elimination library
  *
- * This header provides a simple C API for removing null bytes from
- * shellcode while preserving functional equivalence. It uses advanced
- * transformation strategies based on x86/x64 instruction semantics.
+ * The library runs the CLI's rewrite pipeline in process. A context holds a
+ * target architecture, a bad-byte set and processing options; each call to
+ * byval_transform() rewrites one payload with them. Contexts share no mutable
+ * state: any number of them may transform concurrently from different threads,
+ * and a single context may be used by several threads at once.
+ *
+ * Build with `make lib` (bin/libbyvalver.a, bin/libbyvalver.so) and link with
+ * -lcapstone -lm -pthread.
  */
 
 #ifndef BYVALVER_H
@@ -27,26 +32,50 @@ extern "C" {
 typedef enum {
     BYVAL_SUCCESS = 0,                  /**< Operation succeeded */
     BYVAL_ERROR_INVALID_INPUT = 1,      /**< Invalid input parameters */
-    BYVAL_ERROR_DISASSEMBLY_FAILED = 2, /**< Disassembly failed */
+    BYVAL_ERROR_DISASSEMBLY_FAILED = 2, /**< Input does not disassemble for the target */
     BYVAL_ERROR_NO_STRATEGY = 3,        /**< No strategy found for instruction */
     BYVAL_ERROR_MEMORY = 4,             /**< Memory allocation failed */
-    BYVAL_ERROR_NULLS_REMAIN = 5,       /**< Null bytes remain after processing */
-    BYVAL_ERROR_PROCESSING_FAILED = 6   /**< General processing failure */
+    BYVAL_ERROR_NULLS_REMAIN = 5,       /**< Bad bytes remain after processing */
+    BYVAL_ERROR_PROCESSING_FAILED = 6,  /**< General processing failure */
+    BYVAL_ERROR_ENCODING_FAILED = 7     /**< No clean decoder stub or Thumb entry stub */
 } ByvalError;
 
+/**
+ * @brief Target architectures (the CLI's --arch values)
+ */
+typedef enum {
+    BYVAL_TARGET_X86 = 0,               /**< 32-bit x86 */
+    BYVAL_TARGET_X64 = 1,               /**< 64-bit x86-64 */
+    BYVAL_TARGET_ARM = 2,               /**< 32-bit ARM */
+    BYVAL_TARGET_ARM64 = 3,             /**< 64-bit ARM (AArch64) */
+    BYVAL_TARGET_THUMB = 4              /**< 32-bit ARM in Thumb-2 state */
+} ByvalArch;
+
 /* ============================================================================
  * Structures
  * ============================================================================ */
 
 /**
  * @brief Processing options
+ *
+ * Fill with byval_init_options() first: fields added in later versions then
+ * keep their defaults.
  */
 typedef struct {
-    int verbose;              /**< Enable verbose output (0 = off, 1 = on) */
-    int verify_output;        /**< Verify null-byte elimination (0 = off, 1 = on) */
-    int max_passes;           /**< Maximum number of processing passes (default: 3) */
-    int xor_encode;           /**< XOR encode output with key (0 = off, 1 = on) */
-    uint32_t xor_key;         /**< XOR encoding key (used if xor_encode = 1) */
+    int verbose;              /**< Print a summary of each transform to stdout and the engine's
+                                   diagnostics to stderr (0 = silent, the default; 1 = on) */
+    int verify_output;        /**< Fail if bad bytes remain in the output (0 = off, 1 = on) */
+    int max_passes;           /**< Unused: the rewrite is a single pass */
+    int xor_encode;           /**< Put the output behind a decoder stub (--xor-encode) */
+    uint32_t xor_key;         /**< 4-byte XOR key for the stub; 0 = search keys and templates */
+    int optimize_size;        /**< Smallest expansion per instruction (--optimize-size) */
+    size_t max_output_size;   /**< Output size budget in bytes, 0 = none (--max-output-size) */
+    int constant_pool;        /**< Pool dirty MOV immediates (--constant-pool) */
+    int constant_reuse;       /**< Serve repeated constants from registers (--constant-reuse) */
+    int rebase_displacements; /**< Share base adjustments (--rebase-displacements) */
+    int rename_registers;     /**< Whole-payload register permutation (--rename-registers) */
+    int thumb_entry_stub;     /**< Thumb: ARM->Thumb entry stub in front (default: 1) */
+    int threads;              /**< Generation threads per transform (default: 1, 0 = one per CPU) */
 } ByvalOptions;
 
 /**
@@ -58,13 +87,81 @@ typedef struct {
 typedef struct {
     uint8_t *data;            /**< Cleaned shellcode (caller must free with byval_free_result) */
     size_t size;              /**< Size of cleaned shellcode in bytes */
-    int nulls_removed;        /**< Number of null bytes removed */
+    int nulls_removed;        /**< Number of bad bytes in the input */
     int strategies_applied;   /**< Number of transformation strategies applied */
     int passes_completed;     /**< Number of processing passes completed */
 } ByvalResult;
 
+/**
+ * @brief Statistics of a context since its creation
+ */
+typedef struct {
+    unsigned long transforms;          /**< byval_transform() calls that succeeded */
+    unsigned long failures;            /**< byval_transform() calls that returned an error */
+    size_t input_bytes;                /**< Input bytes of the successful calls */
+    size_t output_bytes;               /**< Output bytes of the successful calls */
+    unsigned long strategies_applied;  /**< Instructions rewritten by a strategy */
+    unsigned long strategy_rollbacks;  /**< Strategy outputs rejected for bad bytes (fallback used) */
+    ByvalError last_error;             /**< Result of the most recent call */
+} ByvalStats;
+
+/**
+ * @brief Opaque processing context (see byval_context_create)
+ */
+typedef struct ByvalContext ByvalContext;
+
 /* ============================================================================
- * Public API Functions
+ * Context API
+ * ============================================================================ */
+
+/**
+ * @brief Create a processing context
+ *
+ * Copies the bad-byte set and options and builds the tables derived from
+ * them, so later transforms skip all per-payload initialization.
+ *
+ * @param arch Target architecture
+ * @param bad_bytes Bytes the output must not contain (NULL = 0x00 only)
+ * @param bad_byte_count Number of entries in bad_bytes
+ * @param options Processing options (may be NULL for defaults)
+ * @return New context, or NULL on invalid arguments or allocation failure
+ */
+ByvalContext *byval_context_create(ByvalArch arch, const uint8_t *bad_bytes,
+                                   size_t bad_byte_count, const ByvalOptions *options);
+
+/**
+ * @brief Rewrite a payload with a context
+ *
+ * Safe to call concurrently, on the same context or on different ones.
+ *
+ * @param ctx Context from byval_context_create()
+ * @param input Input shellcode buffer (must not be NULL)
+ * @param input_size Size of input shellcode in bytes
+ * @param result Output result structure (must not be NULL)
+ * @return BYVAL_SUCCESS on success, error code otherwise
+ */
+ByvalError byval_transform(ByvalContext *ctx, const uint8_t *input, size_t input_size,
+                           ByvalResult *result);
+
+/**
+ * @brief Get the statistics of a context
+ *
+ * @param ctx Context from byval_context_create()
+ * @param stats Output statistics (must not be NULL)
+ */
+void byval_get_stats(ByvalContext *ctx, ByvalStats *stats);
+
+/**
+ * @brief Destroy a context
+ *
+ * No transform may be running on it.
+ *
+ * @param ctx Context to destroy (may be NULL)
+ */
+void byval_context_destroy(ByvalContext *ctx);
+
+/* ============================================================================
+ * One-Shot API (x64, null bytes only)
  * ============================================================================ */
 
 /**
@@ -97,8 +194,12 @@ ByvalError byval_clean(const uint8_t *input, size_t input_size,
 ByvalError byval_clean_to_file(const uint8_t *input, size_t input_size,
                                const char *output_path, const ByvalOptions *options);
 
+/* ============================================================================
+ * Utilities
+ * ============================================================================ */
+
 /**
- * @brief Free resources allocated by byval_clean
+ * @brief Free resources allocated by byval_transform or byval_clean
  *
  * Frees all memory allocated in a ByvalResult structure, including the
  * data buffer.
@@ -149,7 +250,7 @@ size_t byval_count_nulls(const uint8_t *data, size_t size);
 /**
  * @brief Get number of registered strategies
  *
- * Returns the number of transformation strategies available in the library.
+ * Returns the number of x64 transformation strategies available in the library.
  *
  * @return Number of strategies
  */
@@ -11,15 +11,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int pic_counter = 0;
-static int pic_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Helper: Check if instruction involves absolute addressing
@@ -46,12 +43,6 @@ static int uses_absolute_address(cs_insn *insn) {
 // ============================================================================
 
 int can_handle_call_pop_pic_delta(cs_insn *insn) {
-    // Initialize once
-    if (!pic_initialized) {
-        srand((unsigned int)time(NULL) ^ 0xC0DE);
-        pic_initialized = 1;
-    }
-
     // Target MOV instructions with immediate values or absolute addresses
     if (insn->id != X86_INS_MOV && insn->id != X86_INS_LEA) {
         return 0;
@@ -63,8 +54,7 @@ int can_handle_call_pop_pic_delta(cs_insn *insn) {
     }
 
     // Apply to approximately 5% of such instructions (PIC is expensive)
-    pic_counter++;
-    return (pic_counter % 20 == 0);
+    return thread_rng_below(20) == 0;
 }
 
 size_t get_call_pop_pic_delta_size(cs_insn *insn) {
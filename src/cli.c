@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
 #include "cli.h"
 #include "badbyte_profiles.h"
+#include "obfuscation_budget.h"
 #include <unistd.h>
 #include <time.h>
 #include <stdlib.h>
@@ -93,6 +94,101 @@ bad_byte_config_t* parse_bad_bytes_string(const char *input) {
     return config;
 }
 
+/**
+ * Parse a pipeline mode name
+ * @param input: "rewrite", "encode" or "auto"
+ * @param mode: Receives the mode
+ * @return: 0 on success, -1 on an unknown name
+ */
+int parse_pipeline_mode(const char *input, pipeline_mode_t *mode) {
+    if (strcmp(input, "rewrite") == 0) {
+        *mode = PIPELINE_MODE_REWRITE;
+    } else if (strcmp(input, "encode") == 0) {
+        *mode = PIPELINE_MODE_ENCODE;
+    } else if (strcmp(input, "auto") == 0) {
+        *mode = PIPELINE_MODE_AUTO;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Parse a clobber set from a comma-separated register list
+ * @param input: String like "eax,ecx,edx,flags" (any operand size names the
+ *               whole register; "flags", "eflags" and "rflags" name the flags)
+ * @param mask: Receives bit N for GPR number N, plus CLOBBER_FLAGS
+ * @return: 0 on success, -1 on an unknown or disallowed name
+ */
+int parse_clobber_string(const char *input, uint32_t *mask) {
+    static const char *names[4][16] = {
+        {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+         "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"},
+        {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+         "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"},
+        {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+         "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"},
+        {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+         "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"}
+    };
+
+    *mask = 0;
+    if (!input) {
+        return 0;
+    }
+
+    char *input_copy = strdup(input);
+    if (!input_copy) {
+        return -1;
+    }
+
+    for (char *token = strtok(input_copy, ","); token; token = strtok(NULL, ",")) {
+        while (*token && isspace((unsigned char)*token)) {
+            token++;
+        }
+        char *end = token + strlen(token);
+        while (end > token && isspace((unsigned char)end[-1])) {
+            *--end = '\0';
+        }
+        for (char *p = token; *p; p++) {
+            *p = (char)tolower((unsigned char)*p);
+        }
+        if (*token == '\0' || strcmp(token, "none") == 0) {
+            continue;
+        }
+
+        if (strcmp(token, "flags") == 0 || strcmp(token, "eflags") == 0 ||
+            strcmp(token, "rflags") == 0) {
+            *mask |= CLOBBER_FLAGS;
+            continue;
+        }
+
+        int fam = -1;
+        for (int size = 0; size < 4 && fam < 0; size++) {
+            for (int i = 0; i < 16; i++) {
+                if (strcmp(token, names[size][i]) == 0) {
+                    fam = i;
+                    break;
+                }
+            }
+        }
+        if (fam < 0) {
+            fprintf(stderr, "Error: Unknown register in clobber list: '%s'\n", token);
+            free(input_copy);
+            return -1;
+        }
+        if (fam == 4) {
+            fprintf(stderr, "Error: The stack pointer cannot be clobbered\n");
+            free(input_copy);
+            return -1;
+        }
+        *mask |= 1u << fam;
+    }
+
+    free(input_copy);
+    return 0;
+}
+
 // Create and initialize default configuration
 byvalver_config_t* config_create_default(void) {
     byvalver_config_t *config = malloc(sizeof(byvalver_config_t));
@@ -112,6 +208,25 @@ byvalver_config_t* config_create_default(void) {
     config->use_pic_generation = 0;
     config->encode_shellcode = 0;
     config->xor_key = 0;
+    config->xor_key_auto = 0;
+    config->constant_pool = 0;
+    config->constant_reuse = 0;
+    config->rebase_displacements = 0;
+    config->rename_registers = 0;
+    config->clobber_mask = 0;
+    config->optimize_size = 0;
+    config->max_output_size = 0;
+    config->pipeline_mode = PIPELINE_MODE_REWRITE;
+    config->compress_payload = 0;
+    config->variants = 0;
+    config->variant_seed = 0;
+    config->variant_seed_set = 0;
+    config->keep_smallest = 0;
+    config->obfuscation_budget_kind = OBFUSCATION_BUDGET_NONE;
+    config->obfuscation_budget = 0;
+    config->flatten_control_flow = 0;
+    config->threads = 0;
+    config->thumb_entry_stub = 1;
     config->output_format = "raw";
     config->target_arch = BYVAL_ARCH_X64;
     config->strategy_limit = 0; // unlimited by default
@@ -203,7 +318,22 @@ void print_detailed_help(FILE *stream, const char *program_name) {
     fprintf(stream, "      --biphasic                    Enable biphasic processing (obfuscation + null-elimination)\n");
     fprintf(stream, "      --pic                         Generate position-independent code\n");
     fprintf(stream, "      --ml                          Use ML strategy selection\n");
-    fprintf(stream, "      --xor-encode KEY              XOR encode output with 4-byte key (hex)\n");
+    fprintf(stream, "      --constant-pool               Load dirty MOV immediates from an encoded constant pool\n");
+    fprintf(stream, "      --constant-reuse              Reuse repeated dirty constants from (dead) registers\n");
+    fprintf(stream, "      --rebase-displacements        Adjust the base once per run of bad [reg+disp] accesses\n");
+    fprintf(stream, "      --rename-registers            Permute registers so ModR/M/SIB bytes avoid bad bytes\n");
+    fprintf(stream, "      --clobber REGS                Registers/flags free for scratch use (e.g. eax,ecx,edx,flags)\n");
+    fprintf(stream, "      --optimize-size               Pick the smallest strategy expansion for every instruction\n");
+    fprintf(stream, "      --max-output-size N           Fit the output in N bytes, preferring higher-priority strategies\n");
+    fprintf(stream, "      --xor-encode KEY              XOR encode output with 4-byte key (hex, or 'auto' to search one)\n");
+    fprintf(stream, "      --pipeline MODE               rewrite (default), encode (whole input behind a stub), or auto (smaller wins)\n");
+    fprintf(stream, "      --compress                    LZ-compress the payload behind the decoder stub when smaller (x86/x64)\n");
+    fprintf(stream, "      --variants N                  Generate N obfuscated variants concurrently (out.000.bin, ...)\n");
+    fprintf(stream, "      --seed S                      Seed obfuscation choices for reproducible output/variants\n");
+    fprintf(stream, "      --keep-smallest K             With --variants, write only the K smallest variants\n");
+    fprintf(stream, "      --obfuscation-budget N|P%%     Cap biphasic growth at N bytes or P%% of the input\n");
+    fprintf(stream, "      --flatten                     Flatten control flow behind a table dispatcher (x86/x64)\n");
+    fprintf(stream, "      --threads N                   Rewrite large payloads on N threads (default: one per CPU)\n");
     fprintf(stream, "      --format FORMAT               Output format: raw, c, python, powershell, hexstring\n\n");
 
     fprintf(stream, "    Bad Character Elimination (v3.0):\n");
@@ -237,10 +367,11 @@ void print_detailed_help(FILE *stream, const char *program_name) {
 
     fprintf(stream, "    Architecture Options:\n");
     fprintf(stream, "      --arch ARCH                   Target architecture\n");
-    fprintf(stream, "                                   Values: x86, x64, arm, arm64 (default: x64)\n");
-    fprintf(stream, "                                   ARM/ARM64 path is experimental (warn-and-continue)\n");
+    fprintf(stream, "                                   Values: x86, x64, arm, thumb, arm64 (default: x64)\n");
+    fprintf(stream, "                                   ARM/Thumb/ARM64 path is experimental (warn-and-continue)\n");
     fprintf(stream, "                                   Recommended: run --dry-run first, then verify output\n");
-    fprintf(stream, "                                   Fallback: retry with explicit --arch if mismatch warnings appear\n\n");
+    fprintf(stream, "                                   Fallback: retry with explicit --arch if mismatch warnings appear\n");
+    fprintf(stream, "      --no-thumb-stub               Thumb: omit the ARM->Thumb entry stub (payload entered in Thumb state)\n\n");
 
     fprintf(stream, "    Output Options:\n");
     fprintf(stream, "      -o, --output FILE             Output file (alternative to positional argument)\n");
@@ -333,9 +464,25 @@ int parse_arguments(int argc, char *argv[], byvalver_config_t *config) {
         // Processing options
         {"biphasic", no_argument, 0, 0},
         {"pic", no_argument, 0, 0},
+        {"constant-pool", no_argument, 0, 0},
+        {"constant-reuse", no_argument, 0, 0},
+        {"rebase-displacements", no_argument, 0, 0},
+        {"rename-registers", no_argument, 0, 0},
+        {"clobber", required_argument, 0, 0},
+        {"optimize-size", no_argument, 0, 0},
+        {"max-output-size", required_argument, 0, 0},
         {"xor-encode", required_argument, 0, 0},
+        {"pipeline", required_argument, 0, 0},
+        {"compress", no_argument, 0, 0},
+        {"variants", required_argument, 0, 0},
+        {"seed", required_argument, 0, 0},
+        {"keep-smallest", required_argument, 0, 0},
+        {"obfuscation-budget", required_argument, 0, 0},
+        {"flatten", no_argument, 0, 0},
+        {"threads", required_argument, 0, 0},
         {"format", required_argument, 0, 0},
         {"arch", required_argument, 0, 0},
+        {"no-thumb-stub", no_argument, 0, 0},
         {"ml", no_argument, 0, 0},  // EXPERIMENTAL: Known to degrade performance
         {"bad-bytes", required_argument, 0, 0},  // NEW in v3.0: Generic bad byte elimination
         {"profile", required_argument, 0, 0},    // NEW in v3.0: Use predefined bad-byte profile
@@ -416,6 +563,90 @@ int parse_arguments(int argc, char *argv[], byvalver_config_t *config) {
                     else if (strcmp(opt_name, "pic") == 0) {
                         config->use_pic_generation = 1;
                     }
+                    else if (strcmp(opt_name, "constant-pool") == 0) {
+                        config->constant_pool = 1;
+                    }
+                    else if (strcmp(opt_name, "constant-reuse") == 0) {
+                        config->constant_reuse = 1;
+                    }
+                    else if (strcmp(opt_name, "rebase-displacements") == 0) {
+                        config->rebase_displacements = 1;
+                    }
+                    else if (strcmp(opt_name, "rename-registers") == 0) {
+                        config->rename_registers = 1;
+                    }
+                    else if (strcmp(opt_name, "clobber") == 0) {
+                        if (parse_clobber_string(optarg, &config->clobber_mask) != 0) {
+                            fprintf(stderr, "Error: Invalid --clobber value: %s\n", optarg);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                    }
+                    else if (strcmp(opt_name, "optimize-size") == 0) {
+                        config->optimize_size = 1;
+                    }
+                    else if (strcmp(opt_name, "max-output-size") == 0) {
+                        char *endptr;
+                        long long limit = strtoll(optarg, &endptr, 0);
+                        if (*endptr != '\0' || limit <= 0) {
+                            fprintf(stderr, "Error: Invalid --max-output-size value: %s\n", optarg);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                        config->max_output_size = (size_t)limit;
+                    }
+                    else if (strcmp(opt_name, "pipeline") == 0) {
+                        if (parse_pipeline_mode(optarg, &config->pipeline_mode) != 0) {
+                            fprintf(stderr, "Error: Invalid --pipeline value: %s (use rewrite, encode or auto)\n", optarg);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                    }
+                    else if (strcmp(opt_name, "compress") == 0) {
+                        config->compress_payload = 1;
+                    }
+                    else if (strcmp(opt_name, "variants") == 0 ||
+                             strcmp(opt_name, "keep-smallest") == 0) {
+                        char *endptr;
+                        long value = strtol(optarg, &endptr, 0);
+                        if (*endptr != '\0' || value <= 0 || value > BYVAL_MAX_VARIANTS) {
+                            fprintf(stderr, "Error: Invalid --%s value: %s (1-%d)\n",
+                                    opt_name, optarg, BYVAL_MAX_VARIANTS);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                        if (opt_name[0] == 'v') {
+                            config->variants = (int)value;
+                        } else {
+                            config->keep_smallest = (int)value;
+                        }
+                    }
+                    else if (strcmp(opt_name, "seed") == 0) {
+                        char *endptr;
+                        config->variant_seed = (uint64_t)strtoull(optarg, &endptr, 0);
+                        if (*endptr != '\0' || optarg[0] == '\0') {
+                            fprintf(stderr, "Error: Invalid --seed value: %s\n", optarg);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                        config->variant_seed_set = 1;
+                    }
+                    else if (strcmp(opt_name, "obfuscation-budget") == 0) {
+                        if (obfuscation_budget_parse(optarg, &config->obfuscation_budget_kind,
+                                                     &config->obfuscation_budget) != 0) {
+                            fprintf(stderr, "Error: Invalid --obfuscation-budget value: %s (bytes or N%%)\n",
+                                    optarg);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                    }
+                    else if (strcmp(opt_name, "flatten") == 0) {
+                        config->flatten_control_flow = 1;
+                    }
+                    else if (strcmp(opt_name, "threads") == 0) {
+                        char *endptr;
+                        long value = strtol(optarg, &endptr, 0);
+                        if (*endptr != '\0' || optarg[0] == '\0' || value < 0 || value > BYVAL_MAX_THREADS) {
+                            fprintf(stderr, "Error: Invalid --threads value: %s (0-%d, 0 = one per CPU)\n",
+                                    optarg, BYVAL_MAX_THREADS);
+                            return EXIT_INVALID_ARGUMENTS;
+                        }
+                        config->threads = (int)value;
+                    }
                     else if (strcmp(opt_name, "ml") == 0) {
                         config->use_ml_strategist = 1;
                     }
@@ -440,11 +671,14 @@ int parse_arguments(int argc, char *argv[], byvalver_config_t *config) {
                     }
                     else if (strcmp(opt_name, "xor-encode") == 0) {
                         config->encode_shellcode = 1;
-                        char *endptr;
-                        config->xor_key = (uint32_t)strtol(optarg, &endptr, 16);
-                        if (*endptr != '\0') {
-                            fprintf(stderr, "Error: Invalid XOR key format: %s\n", optarg);
-                            return EXIT_INVALID_ARGUMENTS;
+                        config->xor_key_auto = (strcmp(optarg, "auto") == 0);
+                        if (!config->xor_key_auto) {
+                            char *endptr;
+                            config->xor_key = (uint32_t)strtoul(optarg, &endptr, 16);
+                            if (*endptr != '\0') {
+                                fprintf(stderr, "Error: Invalid XOR key format: %s\n", optarg);
+                                return EXIT_INVALID_ARGUMENTS;
+                            }
                         }
                     }
                     else if (strcmp(opt_name, "bad-bytes") == 0) {
@@ -508,14 +742,19 @@ int parse_arguments(int argc, char *argv[], byvalver_config_t *config) {
                             config->target_arch = BYVAL_ARCH_X64;
                         } else if (strcmp(optarg, "arm") == 0) {
                             config->target_arch = BYVAL_ARCH_ARM;
+                        } else if (strcmp(optarg, "thumb") == 0 || strcmp(optarg, "thumb2") == 0) {
+                            config->target_arch = BYVAL_ARCH_THUMB;
                         } else if (strcmp(optarg, "arm64") == 0 || strcmp(optarg, "aarch64") == 0) {
                             config->target_arch = BYVAL_ARCH_ARM64;
                         } else {
                             fprintf(stderr, "Error: Invalid target architecture: %s\n", optarg);
-                            fprintf(stderr, "Valid architectures: x86, x64, arm, arm64\n");
+                            fprintf(stderr, "Valid architectures: x86, x64, arm, thumb, arm64\n");
                             return EXIT_INVALID_ARGUMENTS;
                         }
                     }
+                    else if (strcmp(opt_name, "no-thumb-stub") == 0) {
+                        config->thumb_entry_stub = 0;
+                    }
                     else if (strcmp(opt_name, "strategy-limit") == 0) {
                         char *endptr;
                         long limit = strtol(optarg, &endptr, 10);
@@ -680,7 +919,43 @@ int load_config_file(const char *config_path, byvalver_config_t *config) {
             if (strcmp(key, "use_biphasic") == 0) config->use_biphasic = atoi(value);
             else if (strcmp(key, "use_pic_generation") == 0) config->use_pic_generation = atoi(value);
             else if (strcmp(key, "encode_shellcode") == 0) config->encode_shellcode = atoi(value);
-            else if (strcmp(key, "xor_key") == 0) config->xor_key = (uint32_t)strtol(value, NULL, 16);
+            else if (strcmp(key, "constant_pool") == 0) config->constant_pool = atoi(value);
+            else if (strcmp(key, "constant_reuse") == 0) config->constant_reuse = atoi(value);
+            else if (strcmp(key, "rebase_displacements") == 0) config->rebase_displacements = atoi(value);
+            else if (strcmp(key, "rename_registers") == 0) config->rename_registers = atoi(value);
+            else if (strcmp(key, "clobber") == 0) {
+                if (parse_clobber_string(value, &config->clobber_mask) != 0) {
+                    fprintf(stderr, "Warning: Ignoring invalid clobber list in config: %s\n", value);
+                    config->clobber_mask = 0;
+                }
+            }
+            else if (strcmp(key, "optimize_size") == 0) config->optimize_size = atoi(value);
+            else if (strcmp(key, "max_output_size") == 0) config->max_output_size = (size_t)atoll(value);
+            else if (strcmp(key, "pipeline") == 0) {
+                if (parse_pipeline_mode(value, &config->pipeline_mode) != 0) {
+                    fprintf(stderr, "Warning: Ignoring invalid pipeline mode in config: %s\n", value);
+                }
+            }
+            else if (strcmp(key, "compress") == 0) config->compress_payload = atoi(value);
+            else if (strcmp(key, "variants") == 0) config->variants = atoi(value);
+            else if (strcmp(key, "keep_smallest") == 0) config->keep_smallest = atoi(value);
+            else if (strcmp(key, "seed") == 0) {
+                config->variant_seed = (uint64_t)strtoull(value, NULL, 0);
+                config->variant_seed_set = 1;
+            }
+            else if (strcmp(key, "obfuscation_budget") == 0) {
+                if (obfuscation_budget_parse(value, &config->obfuscation_budget_kind,
+                                             &config->obfuscation_budget) != 0) {
+                    fprintf(stderr, "Warning: Ignoring invalid obfuscation budget in config: %s\n", value);
+                }
+            }
+            else if (strcmp(key, "flatten") == 0) config->flatten_control_flow = atoi(value);
+            else if (strcmp(key, "threads") == 0) config->threads = atoi(value);
+            else if (strcmp(key, "thumb_stub") == 0) config->thumb_entry_stub = atoi(value);
+            else if (strcmp(key, "xor_key") == 0) {
+                config->xor_key_auto = (strcmp(value, "auto") == 0);
+                if (!config->xor_key_auto) config->xor_key = (uint32_t)strtoul(value, NULL, 16);
+            }
             else if (strcmp(key, "strategy_limit") == 0) config->strategy_limit = atoi(value);
             else if (strcmp(key, "timeout_seconds") == 0) config->timeout_seconds = atoi(value);
             else if (strcmp(key, "max_size") == 0) config->max_size = (size_t)atoll(value);
@@ -12,9 +12,12 @@ typedef enum {
     BYVAL_ARCH_X86 = 0,    // 32-bit x86
     BYVAL_ARCH_X64 = 1,    // 64-bit x86-64
     BYVAL_ARCH_ARM = 2,    // 32-bit ARM
-    BYVAL_ARCH_ARM64 = 3   // 64-bit ARM (AArch64)
+    BYVAL_ARCH_ARM64 = 3,  // 64-bit ARM (AArch64)
+    BYVAL_ARCH_THUMB = 4   // 32-bit ARM in Thumb-2 state
 } byval_arch_t;
 
+#define BYVAL_ARCH_COUNT 5     // Number of byval_arch_t values
+
 // Application version information
 #define BYVALVER_VERSION_MAJOR 4
 #define BYVALVER_VERSION_MINOR 0
@@ -31,6 +34,22 @@ typedef enum {
 #define EXIT_TIMEOUT_EXCEEDED 6
 #define EXIT_CONFIG_ERROR 7
 
+// Pipeline selection (--pipeline)
+typedef enum {
+    PIPELINE_MODE_REWRITE = 0,  // Per-instruction rewriting (default)
+    PIPELINE_MODE_ENCODE,       // Whole input behind a generated decoder stub
+    PIPELINE_MODE_AUTO          // Run both, keep the smaller clean result
+} pipeline_mode_t;
+
+// Clobber masks (--clobber): bit N = GPR number N (0 = EAX/RAX ... 15 = R15)
+#define CLOBBER_FLAGS (1u << 16)  // The flags register
+
+// Upper bound for --variants / --keep-smallest
+#define BYVAL_MAX_VARIANTS 100000
+
+// Upper bound for --threads
+#define BYVAL_MAX_THREADS 1024
+
 // Bad byte configuration structure
 // Uses bitmap for O(1) lookup performance
 typedef struct {
@@ -54,7 +73,26 @@ typedef struct {
     int use_pic_generation;
     int encode_shellcode;
     uint32_t xor_key;
+    int xor_key_auto;       // Search a profile-clean key (--xor-encode auto)
     int use_ml_strategist;  // Whether to use ML-enhanced strategy selection
+    int constant_pool;      // Load dirty immediates from an encoded constant pool
+    int constant_reuse;     // Serve repeated dirty constants from registers
+    int rebase_displacements; // One base adjustment per run of bad displacements
+    int rename_registers;   // Permute registers to avoid bad ModR/M/SIB bytes
+    uint32_t clobber_mask;  // Registers/flags free for scratch use (see CLOBBER_FLAGS)
+    int optimize_size;      // Choose the smallest expansion for every instruction
+    size_t max_output_size; // Hard output size limit in bytes (0 = none)
+    pipeline_mode_t pipeline_mode; // Rewrite, encode, or pick the smaller (--pipeline)
+    int compress_payload;   // LZ-pack the payload behind the decoder stub when smaller (--compress)
+    int variants;           // Polymorphic variants to generate (--variants, 0 = one output)
+    uint64_t variant_seed;  // Base seed for obfuscation choices (--seed)
+    int variant_seed_set;   // --seed given: reproducible output
+    int keep_smallest;      // Write only the K smallest variants (--keep-smallest, 0 = all)
+    int obfuscation_budget_kind; // OBFUSCATION_BUDGET_* (--obfuscation-budget)
+    size_t obfuscation_budget;   // Bytes, or percent of the input size
+    int flatten_control_flow;    // Route blocks through a table dispatcher (--flatten)
+    int threads;                 // Instruction generation threads (--threads, 0 = one per CPU)
+    int thumb_entry_stub;        // Prefix Thumb output with the ARM->Thumb entry stub (--no-thumb-stub)
 
     // ML Metrics options
     int metrics_enabled;          // Enable ML metrics tracking
@@ -103,4 +141,10 @@ void print_detailed_help(FILE *stream, const char *program_name);
 // Bad byte configuration functions
 bad_byte_config_t* parse_bad_bytes_string(const char *input);
 
+// Clobber set parsing (--clobber)
+int parse_clobber_string(const char *input, uint32_t *mask);
+
+// Pipeline mode parsing (--pipeline)
+int parse_pipeline_mode(const char *input, pipeline_mode_t *mode);
+
 #endif
\ No newline at end of file
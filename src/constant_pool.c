@@ -0,0 +1,380 @@
+/*
+ * Encoded Constant Pool
+ *
+ * PROBLEM: A MOV reg, imm whose immediate contains bad bytes is rebuilt inline
+ * (MOV+NOT, MOV+XOR, byte-wise construction...). Payloads that load the same
+ * few constants over and over pay for that rewrite at every use.
+ *
+ * SOLUTION: Store each distinct constant once, encoded with one XOR key that
+ * keeps every stored byte clean, in a data block after the payload, and load
+ * it off the shared GetPC base:
+ *     MOV reg, [base+disp32]
+ *     XOR reg, key
+ * The key is searched lane by lane (byte i of the key only has to clean byte i
+ * of each entry). 8-byte entries are decoded with the sign-extended imm32 of
+ * XOR r64, so their upper four lanes all see the same 0x00/0xFF byte chosen
+ * by the top bit of the key. Constants that save nothing are left inline, and
+ * if no key fits the remaining set the least profitable constant is dropped.
+ * The layout solver places the loads and reverts any whose displacement it
+ * cannot keep clean to their inline rewrite.
+ *
+ * The decode XOR destroys the flags; where they are still live after the
+ * MOV (layout_flags_dead_at), the load is wrapped in PUSHF/POPF, as the
+ * flattening dispatcher does.
+ */
+
+#include "constant_pool.h"
+#include "branch_layout.h"
+#include "getpc_base.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t value;
+    int width;                 // 4 or 8 bytes
+    int uses;
+    size_t inline_bytes;       // Bytes spent by the inline rewrites
+    size_t use_bytes;          // Bytes the pooled loads would take
+    long savings;              // inline_bytes - use_bytes - width
+    size_t offset;             // Offset in the pool
+    int kept;
+} constant_pool_entry_t;
+
+// MOV reg32/reg64, imm with a GPR destination; 64-bit constants that fit in
+// 32 bits are loaded through the zero-extending 32-bit form
+static int constant_pool_operand(cs_insn *insn, int *fam, int *wide, uint64_t *value) {
+    cs_x86 *x86 = &insn->detail->x86;
+
+    if ((insn->id != X86_INS_MOV && insn->id != X86_INS_MOVABS) || x86->op_count != 2 ||
+        x86->operands[0].type != X86_OP_REG || x86->operands[1].type != X86_OP_IMM) {
+        return 0;
+    }
+    if (x86->operands[0].size != 4 && x86->operands[0].size != 8) {
+        return 0;
+    }
+    *fam = layout_gpr_family(x86->operands[0].reg, NULL);
+    if (*fam < 0 || *fam == 4) {
+        return 0;
+    }
+    *value = (uint64_t)x86->operands[1].imm;
+    if (x86->operands[0].size == 4 || *value <= 0xFFFFFFFFu) {
+        *value &= 0xFFFFFFFFu;
+        *wide = 0;
+    } else {
+        *wide = 1;
+    }
+    return 1;
+}
+
+// MOV reg, [base+disp32]; XOR reg, key - returns the length and where the
+// displacement and the key sit
+static size_t constant_pool_encode_use(int fam, int base_fam, int wide, int32_t disp, uint32_t key,
+                                       uint8_t *out, size_t *disp_at, size_t *key_at) {
+    size_t len = 0;
+    uint8_t rex = (uint8_t)(0x40 | (wide ? 0x08 : 0) | ((fam & 8) ? 0x04 : 0) | ((base_fam & 8) ? 0x01 : 0));
+
+    if (rex != 0x40) {
+        out[len++] = rex;
+    }
+    out[len++] = 0x8B;
+    out[len++] = (uint8_t)(0x80 | ((fam & 7) << 3) | (base_fam & 7));
+    *disp_at = len;
+    memcpy(out + len, &disp, 4);
+    len += 4;
+
+    rex = (uint8_t)(0x40 | (wide ? 0x08 : 0) | ((fam & 8) ? 0x01 : 0));
+    if (rex != 0x40) {
+        out[len++] = rex;
+    }
+    if (fam == 0) {
+        out[len++] = 0x35;                          // XOR eAX, imm32
+    } else {
+        out[len++] = 0x81;                          // XOR r/m, imm32
+        out[len++] = (uint8_t)(0xF0 | (fam & 7));
+    }
+    *key_at = len;
+    memcpy(out + len, &key, 4);
+    len += 4;
+    return len;
+}
+
+// Every byte of the use other than the displacement and the key is clean;
+// save_flags adds the PUSHF/POPF around it
+static size_t constant_pool_use_template(cs_insn *insn, x86_reg base, int save_flags,
+                                         int *fam, int *wide, uint64_t *value) {
+    uint8_t enc[16];
+    size_t disp_at, key_at;
+    size_t len;
+
+    if (!constant_pool_operand(insn, fam, wide, value)) {
+        return 0;
+    }
+    if (save_flags && (!is_bad_byte_free_byte(0x9C) || !is_bad_byte_free_byte(0x9D))) {
+        return 0;
+    }
+    len = constant_pool_encode_use(*fam, layout_gpr_family(base, NULL), *wide, 0, 0, enc, &disp_at, &key_at);
+    if (!is_bad_byte_free_buffer(enc, disp_at) ||
+        !is_bad_byte_free_buffer(enc + disp_at + 4, key_at - disp_at - 4)) {
+        return 0;
+    }
+    return len + (save_flags ? 2 : 0);
+}
+
+size_t constant_pool_load_size(const struct instruction_node *node, x86_reg base) {
+    int fam, wide;
+    uint64_t value;
+    return constant_pool_use_template(node->insn, base, node->pool_save_flags, &fam, &wide, &value);
+}
+
+size_t constant_pool_encode_load(const struct instruction_node *node, x86_reg base,
+                                 int64_t disp, uint8_t *out) {
+    int fam, wide;
+    uint64_t value;
+    size_t disp_at, key_at;
+    size_t len = 0;
+
+    if (!node->target || disp < INT32_MIN || disp > INT32_MAX ||
+        !constant_pool_operand(node->insn, &fam, &wide, &value)) {
+        return 0;
+    }
+    if (node->pool_save_flags) {
+        out[len++] = 0x9C;                          // PUSHF
+    }
+    len += constant_pool_encode_use(fam, layout_gpr_family(base, NULL), wide, (int32_t)disp,
+                                    node->pool_key, out + len, &disp_at, &key_at);
+    if (node->pool_save_flags) {
+        out[len++] = 0x9D;                          // POPF
+    }
+    return len;
+}
+
+int constant_pool_entry_count(const struct instruction_node *node) {
+    return node->pool_index;
+}
+
+// Byte-wise: entry lane i is stored as value[i] ^ key[i]; for 8-byte entries
+// lanes 4-7 see the sign extension of the key
+static int constant_pool_find_key(const constant_pool_entry_t *entries, int count, uint32_t *key_out) {
+    for (int top = 0; top < 2; top++) {
+        uint8_t ext = top ? 0xFF : 0x00;
+        uint32_t key = 0;
+        int ok = 1;
+
+        for (int e = 0; ok && e < count; e++) {
+            if (!entries[e].kept || entries[e].width != 8) {
+                continue;
+            }
+            for (int lane = 4; ok && lane < 8; lane++) {
+                ok = is_bad_byte_free_byte((uint8_t)((entries[e].value >> (lane * 8)) ^ ext));
+            }
+        }
+
+        for (int lane = 0; ok && lane < 4; lane++) {
+            int found = 0;
+            for (int k = 0; k < 256 && !found; k++) {
+                if ((lane == 3 && (k >> 7) != top) || !is_bad_byte_free_byte((uint8_t)k)) {
+                    continue;
+                }
+                found = 1;
+                for (int e = 0; found && e < count; e++) {
+                    if (entries[e].kept) {
+                        found = is_bad_byte_free_byte((uint8_t)((entries[e].value >> (lane * 8)) ^ (uint64_t)k));
+                    }
+                }
+                if (found) {
+                    key |= (uint32_t)k << (lane * 8);
+                }
+            }
+            ok = found;
+        }
+
+        if (ok) {
+            *key_out = key;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int constant_pool_lookup(const constant_pool_entry_t *entries, int count, uint64_t value, int width) {
+    for (int i = 0; i < count; i++) {
+        if (entries[i].value == value && entries[i].width == width) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static struct instruction_node *constant_pool_create_node(const constant_pool_entry_t *entries, int count,
+                                                          uint32_t key, size_t offset) {
+    struct instruction_node *node = calloc(1, sizeof(struct instruction_node));
+    cs_insn *insn = calloc(1, sizeof(cs_insn));
+    cs_detail *detail = calloc(1, sizeof(cs_detail));
+    int kept = 0;
+
+    if (!node || !insn || !detail) {
+        free(node);
+        free(insn);
+        free(detail);
+        return NULL;
+    }
+
+    // Zero-sized in the input, placed at its end
+    insn->id = X86_INS_INVALID;
+    insn->size = 0;
+    insn->address = offset;
+    insn->detail = detail;
+    strcpy(insn->mnemonic, "db");
+    strcpy(insn->op_str, "<constant pool>");
+
+    // The key and entry count live on the node; the record has no operands
+    node->insn = insn;
+    node->offset = offset;
+    node->branch_form = LAYOUT_FORM_POOL_DATA;
+    buffer_init(&node->code);
+
+    for (int i = 0; i < count; i++) {
+        uint64_t mask = entries[i].width == 8 ? (uint64_t)(int64_t)(int32_t)key : (uint64_t)key;
+        uint64_t stored = entries[i].value ^ mask;
+        uint8_t bytes[8];
+
+        if (!entries[i].kept) {
+            continue;
+        }
+        for (int b = 0; b < entries[i].width; b++) {
+            bytes[b] = (uint8_t)(stored >> (b * 8));
+        }
+        buffer_append(&node->code, bytes, (size_t)entries[i].width);
+        kept++;
+    }
+    node->pool_key = key;
+    node->pool_index = kept;
+    return node;
+}
+
+struct instruction_node *constant_pool_build(struct instruction_node *head, byval_arch_t arch,
+                                             x86_reg base, int setup_paid) {
+    constant_pool_entry_t *entries;
+    int count = 0;
+    int kept = 0;
+    int loads = 0;
+    long total = 0;
+    size_t end = 0;
+    size_t offset = 0;
+    uint32_t key = 0;
+    struct instruction_node *pool;
+
+    if ((arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) || base == X86_REG_INVALID) {
+        return NULL;
+    }
+    entries = calloc(CONSTANT_POOL_MAX_ENTRIES, sizeof(constant_pool_entry_t));
+    if (!entries) {
+        return NULL;
+    }
+
+    // 1. Collect dirty immediates with their inline cost
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        int fam, wide, idx;
+        uint64_t value;
+        size_t use_size;
+
+        end = n->offset + n->insn->size;
+        if (n->branch_form != LAYOUT_FORM_NONE || n->code.size == 0 || n->code_fixed ||
+            is_bad_byte_free_buffer(n->insn->bytes, n->insn->size)) {
+            continue;
+        }
+        n->pool_save_flags = !layout_flags_dead_at(n->next);
+        use_size = constant_pool_use_template(n->insn, base, n->pool_save_flags, &fam, &wide, &value);
+        if (use_size == 0) {
+            continue;
+        }
+        idx = constant_pool_lookup(entries, count, value, wide ? 8 : 4);
+        if (idx < 0) {
+            if (count == CONSTANT_POOL_MAX_ENTRIES) {
+                continue;
+            }
+            idx = count++;
+            entries[idx].value = value;
+            entries[idx].width = wide ? 8 : 4;
+        }
+        entries[idx].uses++;
+        entries[idx].inline_bytes += n->code.size;
+        entries[idx].use_bytes += use_size;
+    }
+
+    // 2. Per-constant cost model
+    for (int i = 0; i < count; i++) {
+        entries[i].savings = (long)entries[i].inline_bytes - (long)entries[i].use_bytes - entries[i].width;
+        entries[i].kept = entries[i].savings > 0;
+        kept += entries[i].kept;
+    }
+
+    // 3. One key for the whole pool; shed the least profitable constants until it exists
+    while (kept > 0 && !constant_pool_find_key(entries, count, &key)) {
+        int worst = -1;
+        for (int i = 0; i < count; i++) {
+            if (entries[i].kept && (worst < 0 || entries[i].savings < entries[worst].savings)) {
+                worst = i;
+            }
+        }
+        entries[worst].kept = 0;
+        kept--;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (entries[i].kept) {
+            entries[i].offset = offset;
+            offset += (size_t)entries[i].width;
+            total += entries[i].savings;
+        }
+    }
+    if (!setup_paid) {
+        total -= (long)getpc_base_setup_size(arch);
+    }
+    if (kept == 0 || total <= 0) {
+        free(entries);
+        return NULL;
+    }
+
+    // 4. Build the pool and point every use at its entry
+    pool = constant_pool_create_node(entries, count, key, end);
+    if (!pool) {
+        free(entries);
+        return NULL;
+    }
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        int fam, wide, idx;
+        uint64_t value;
+
+        if (n->branch_form != LAYOUT_FORM_NONE || n->code.size == 0 || n->code_fixed ||
+            is_bad_byte_free_buffer(n->insn->bytes, n->insn->size) ||
+            constant_pool_use_template(n->insn, base, n->pool_save_flags, &fam, &wide, &value) == 0) {
+            continue;
+        }
+        idx = constant_pool_lookup(entries, count, value, wide ? 8 : 4);
+        if (idx >= 0 && entries[idx].kept) {
+            n->branch_form = LAYOUT_FORM_POOL_LOAD;
+            n->target = pool;
+            n->pool_offset = entries[idx].offset;
+            n->pool_index = idx;
+            n->pool_key = key;
+            loads++;
+        }
+    }
+
+    log_diagnostic("[POOL] %d constants (%zu bytes, key 0x%08x) serve %d loads, ~%ld bytes saved\n",
+                   kept, pool->code.size, key, loads, total);
+    free(entries);
+    return pool;
+}
+
+void constant_pool_free(struct instruction_node *node) {
+    if (!node || !node->insn) {
+        return;
+    }
+    free(node->insn->detail);
+    free(node->insn);
+    node->insn = NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef CONSTANT_POOL_H
+#define CONSTANT_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file constant_pool.h
+ * @brief Encoded constant pool for dirty MOV immediates (--constant-pool)
+ *
+ * Immediates that contain bad bytes are normally rebuilt inline by the MOV
+ * strategies, at a cost of 8-20 bytes each. With the pool enabled, every
+ * distinct such constant is stored once, XORed with a single pool-wide key,
+ * in a data block appended after the payload. Each use becomes
+ *     MOV reg, [base+disp32]      ; base = shared GetPC base (getpc_base.h)
+ *     XOR reg, key                ; one-instruction decode
+ * A constant is only pooled when that is cheaper than its inline rewrites,
+ * and the pool as a whole only when it also pays for the base setup (unless
+ * RIP-relative references already need the base).
+ *
+ * The decode XOR clobbers the flags, so a load after which they are still
+ * live is wrapped in PUSHF/POPF.
+ */
+
+#define CONSTANT_POOL_MAX_ENTRIES 256   // Distinct constants kept in one pool
+
+/**
+ * Select the dirty immediates worth pooling and build the pool node
+ *
+ * Must run after the first rewrite pass (node->code holds each inline
+ * rewrite, used as the cost baseline). Selected nodes are switched to
+ * LAYOUT_FORM_POOL_LOAD, with node->target pointing at the returned pool
+ * node and node->pool_offset at their entry.
+ *
+ * @param head: First instruction node
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @param base: Register from getpc_base_select_register()
+ * @param setup_paid: 1 if the base setup is emitted anyway (RIP references)
+ * @return: Pool node to append after the last instruction, or NULL if
+ *          pooling does not pay off
+ */
+struct instruction_node *constant_pool_build(struct instruction_node *head, byval_arch_t arch,
+                                             x86_reg base, int setup_paid);
+
+/**
+ * Release the instruction record of a pool node (the node itself is freed
+ * with the rest of the list)
+ * @param node: Node from constant_pool_build()
+ */
+void constant_pool_free(struct instruction_node *node);
+
+/**
+ * Size of a pooled load plus its decode (and PUSHF/POPF, if it saves the flags)
+ * @param node: LAYOUT_FORM_POOL_LOAD node
+ * @param base: Shared base register
+ * @return: Encoding length, 0 if the instruction cannot be pooled
+ */
+size_t constant_pool_load_size(const struct instruction_node *node, x86_reg base);
+
+/**
+ * Encode a pooled load plus its decode
+ * @param node: LAYOUT_FORM_POOL_LOAD node
+ * @param base: Shared base register
+ * @param disp: Entry offset minus base value
+ * @param out: Destination (at least 20 bytes)
+ * @return: Encoding length, 0 on failure
+ */
+size_t constant_pool_encode_load(const struct instruction_node *node, x86_reg base,
+                                 int64_t disp, uint8_t *out);
+
+/**
+ * Number of distinct constants held by a pool node
+ * @param node: Node from constant_pool_build()
+ */
+int constant_pool_entry_count(const struct instruction_node *node);
+
+#endif // CONSTANT_POOL_H
@@ -0,0 +1,388 @@
+/*
+ * Constant Reuse via Register Caching
+ *
+ * PROBLEM: Shellcode loads the same constants again and again - PUSH 0 before
+ * every API argument, MOV reg, 0x100 per call, the same hash compared in a
+ * loop. Each occurrence whose immediate contains bad bytes is expanded by its
+ * strategy on its own, at 3-20 bytes apiece.
+ *
+ * SOLUTION: Walk each straight-line region forward, tracking the constant
+ * every register holds (from MOV reg, imm and zeroing idioms). A dirty
+ * MOV reg, imm / PUSH imm is then rewritten as
+ *     MOV reg, holder     (2-3 bytes)     or     PUSH holder   (1-2 bytes)
+ * When no register will still hold the value at its next use in the region,
+ * the first use materializes it in a register that is provably dead there
+ * (layout_reg_dead_at: overwritten before any read on every path), and the
+ * later uses copy from it. A dead register's old value is never observed
+ * again, so no register the original code relies on - in the region or past
+ * its exits - changes. Liveness cannot see the copies' reads, so holders and
+ * caches are reserved for the rest of the rewrite (no strategy or branch
+ * thunk takes them as scratch).
+ *
+ * Regions end at branch targets and at control transfers whose continuation
+ * is unknown (calls, returns, interrupts, system calls); all knowledge is
+ * dropped there.
+ */
+
+#include "constant_reuse.h"
+#include "branch_layout.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int valid;
+    uint64_t value;            // Full register contents (zero-extended for 32-bit writes)
+} constant_reuse_reg_t;
+
+static const x86_reg constant_reuse_regs32[16] = {
+    X86_REG_EAX, X86_REG_ECX, X86_REG_EDX, X86_REG_EBX,
+    X86_REG_ESP, X86_REG_EBP, X86_REG_ESI, X86_REG_EDI,
+    X86_REG_R8D, X86_REG_R9D, X86_REG_R10D, X86_REG_R11D,
+    X86_REG_R12D, X86_REG_R13D, X86_REG_R14D, X86_REG_R15D
+};
+static const x86_reg constant_reuse_regs64[16] = {
+    X86_REG_RAX, X86_REG_RCX, X86_REG_RDX, X86_REG_RBX,
+    X86_REG_RSP, X86_REG_RBP, X86_REG_RSI, X86_REG_RDI,
+    X86_REG_R8,  X86_REG_R9,  X86_REG_R10, X86_REG_R11,
+    X86_REG_R12, X86_REG_R13, X86_REG_R14, X86_REG_R15
+};
+
+// Cache registers tried for materialization, volatile ones first
+static const int constant_reuse_cache_order[] = {0, 1, 2, 11, 10, 9, 8, 6, 7, 3, 5, 13, 14, 15, 12};
+
+#define CONSTANT_REUSE_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// A register holding `full` can stand in for the constant
+static int constant_reuse_serves(uint64_t full, int wide, uint64_t value) {
+    return wide ? full == value : (uint32_t)full == (uint32_t)value;
+}
+
+/*
+ * Constant written to a register: MOV r32/r64, imm (any bytes) or a full-width
+ * zeroing idiom. Returns the register family, or -1.
+ */
+static int constant_reuse_sets(cs_insn *insn, uint64_t *full) {
+    cs_x86 *x86 = &insn->detail->x86;
+    int is_full = 0;
+    int fam;
+
+    if (x86->op_count != 2 || x86->operands[0].type != X86_OP_REG) {
+        return -1;
+    }
+    fam = layout_gpr_family(x86->operands[0].reg, &is_full);
+    if (fam < 0 || !is_full) {
+        return -1;
+    }
+    if ((insn->id == X86_INS_MOV || insn->id == X86_INS_MOVABS) && x86->operands[1].type == X86_OP_IMM) {
+        *full = (uint64_t)x86->operands[1].imm;
+        if (x86->operands[0].size == 4) {
+            *full &= 0xFFFFFFFFu;
+        }
+        return fam;
+    }
+    if ((insn->id == X86_INS_XOR || insn->id == X86_INS_SUB) && x86->operands[1].type == X86_OP_REG &&
+        x86->operands[1].reg == x86->operands[0].reg) {
+        *full = 0;
+        return fam;
+    }
+    return -1;
+}
+
+/*
+ * Dirty constant use: MOV r32/r64, imm (dst = family) or PUSH imm (dst = -1).
+ * `wide` is set when all 64 bits of the value matter.
+ */
+static int constant_reuse_use(cs_insn *insn, byval_arch_t arch, int *dst, int *wide, uint64_t *value) {
+    cs_x86 *x86 = &insn->detail->x86;
+
+    if (is_bad_byte_free_buffer(insn->bytes, insn->size)) {
+        return 0;
+    }
+    if (insn->id == X86_INS_PUSH && x86->op_count == 1 && x86->operands[0].type == X86_OP_IMM &&
+        insn->bytes[0] != 0x66) {
+        *dst = -1;
+        *wide = (arch == BYVAL_ARCH_X64);
+        *value = *wide ? (uint64_t)(int64_t)(int32_t)x86->operands[0].imm
+                       : (uint64_t)(uint32_t)x86->operands[0].imm;
+        return 1;
+    }
+    *dst = constant_reuse_sets(insn, value);
+    if (*dst < 0 || *dst == 4 || x86->operands[1].type != X86_OP_IMM) {
+        return 0;
+    }
+    *wide = (x86->operands[0].size == 8);
+    return 1;
+}
+
+// Conservative: any register operand counts as written unless the instruction only reads
+static int constant_reuse_may_write(cs_insn *insn, int fam) {
+    cs_detail *detail = insn->detail;
+
+    for (int i = 0; i < detail->regs_write_count; i++) {
+        if (layout_gpr_family(detail->regs_write[i], NULL) == fam) {
+            return 1;
+        }
+    }
+    switch (insn->id) {
+        case X86_INS_CMP: case X86_INS_TEST: case X86_INS_PUSH: case X86_INS_BT:
+            return 0;
+        default:
+            break;
+    }
+    for (int i = 0; i < detail->x86.op_count; i++) {
+        cs_x86_op *op = &detail->x86.operands[i];
+        if (op->type == X86_OP_REG && layout_gpr_family(op->reg, NULL) == fam) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Register state after the instruction is unknown to the pass
+static int constant_reuse_ends_region(struct instruction_node *n, byval_arch_t arch) {
+    if (layout_is_branch(n->insn, arch)) {
+        return n->insn->id == X86_INS_JMP || n->insn->id == X86_INS_CALL;
+    }
+    return layout_is_opaque_transfer(n->insn);
+}
+
+// MOV dst, src (register to register) or PUSH src
+static size_t constant_reuse_encode_copy(int dst, int src, int wide, uint8_t *out) {
+    size_t len = 0;
+    uint8_t rex;
+
+    if (dst < 0) {
+        if (src & 8) {
+            out[len++] = 0x41;
+        }
+        out[len++] = (uint8_t)(0x50 | (src & 7));
+        return len;
+    }
+    rex = (uint8_t)(0x40 | (wide ? 0x08 : 0) | ((src & 8) ? 0x04 : 0) | ((dst & 8) ? 0x01 : 0));
+    if (rex != 0x40) {
+        out[len++] = rex;
+    }
+    out[len++] = 0x89;
+    out[len++] = (uint8_t)(0xC0 | ((src & 7) << 3) | (dst & 7));
+    return len;
+}
+
+// Synthetic MOV fam, value for the strategy generator
+static void constant_reuse_make_mov(cs_insn *insn, cs_detail *detail, int fam, int wide, uint64_t value) {
+    cs_x86 *x86 = &detail->x86;
+    size_t len = 0;
+
+    memset(insn, 0, sizeof(*insn));
+    memset(detail, 0, sizeof(*detail));
+    insn->detail = detail;
+    insn->id = X86_INS_MOV;
+    x86->op_count = 2;
+    x86->operands[0].type = X86_OP_REG;
+    x86->operands[1].type = X86_OP_IMM;
+
+    if (!wide) {
+        uint32_t imm = (uint32_t)value;
+        if (fam & 8) {
+            insn->bytes[len++] = 0x41;
+        }
+        insn->bytes[len++] = (uint8_t)(0xB8 | (fam & 7));
+        memcpy(insn->bytes + len, &imm, 4);
+        len += 4;
+        x86->operands[0].reg = constant_reuse_regs32[fam];
+        x86->operands[0].size = 4;
+        x86->operands[1].imm = (int64_t)imm;
+        x86->operands[1].size = 4;
+    } else if ((int64_t)value == (int64_t)(int32_t)value) {
+        int32_t imm = (int32_t)value;
+        insn->bytes[len++] = (uint8_t)(0x48 | ((fam & 8) ? 0x01 : 0));
+        insn->bytes[len++] = 0xC7;
+        insn->bytes[len++] = (uint8_t)(0xC0 | (fam & 7));
+        memcpy(insn->bytes + len, &imm, 4);
+        len += 4;
+        x86->operands[0].reg = constant_reuse_regs64[fam];
+        x86->operands[0].size = 8;
+        x86->operands[1].imm = imm;
+        x86->operands[1].size = 4;
+    } else {
+        insn->id = X86_INS_MOVABS;
+        insn->bytes[len++] = (uint8_t)(0x48 | ((fam & 8) ? 0x01 : 0));
+        insn->bytes[len++] = (uint8_t)(0xB8 | (fam & 7));
+        memcpy(insn->bytes + len, &value, 8);
+        len += 8;
+        x86->operands[0].reg = constant_reuse_regs64[fam];
+        x86->operands[0].size = 8;
+        x86->operands[1].imm = (int64_t)value;
+        x86->operands[1].size = 8;
+    }
+    insn->size = (uint16_t)len;
+    strcpy(insn->mnemonic, insn->id == X86_INS_MOVABS ? "movabs" : "mov");
+    snprintf(insn->op_str, sizeof(insn->op_str), "<reuse cache>, 0x%llx", (unsigned long long)value);
+}
+
+/*
+ * Next use of the same constant within the region. Sets *dst_clobbered when
+ * the use's own destination register is overwritten before it.
+ */
+static struct instruction_node *constant_reuse_next_use(struct instruction_node *n, byval_arch_t arch,
+                                                        struct instruction_node **targets, size_t target_count,
+                                                        int dst, uint64_t full, int *dst_clobbered) {
+    struct instruction_node *m = n->next;
+
+    *dst_clobbered = (dst < 0);
+    if (constant_reuse_ends_region(n, arch)) {
+        return NULL;
+    }
+    for (int steps = 0; m != NULL && steps < CONSTANT_REUSE_WINDOW; steps++, m = m->next) {
+        int m_dst, m_wide;
+        uint64_t m_value;
+
+        if (layout_is_branch_target(targets, target_count, m)) {
+            return NULL;
+        }
+        if (m->branch_form == LAYOUT_FORM_NONE &&
+            constant_reuse_use(m->insn, arch, &m_dst, &m_wide, &m_value) &&
+            constant_reuse_serves(full, m_wide, m_value)) {
+            return m;
+        }
+        if (dst >= 0 && constant_reuse_may_write(m->insn, dst)) {
+            *dst_clobbered = 1;
+        }
+        if (constant_reuse_ends_region(m, arch)) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Dead register that stays untouched until `until`, or -1
+static int constant_reuse_pick_cache(struct instruction_node *n, struct instruction_node *until,
+                                     byval_arch_t arch, int dst, uint32_t reserved) {
+    for (size_t i = 0; i < CONSTANT_REUSE_COUNT(constant_reuse_cache_order); i++) {
+        int fam = constant_reuse_cache_order[i];
+        int untouched = 1;
+
+        if (fam == dst || (arch != BYVAL_ARCH_X64 && fam >= 8) || ((reserved >> fam) & 1) ||
+            !layout_reg_dead_at(n, fam, 2)) {
+            continue;
+        }
+        for (struct instruction_node *m = n->next; m != NULL && m != until && untouched; m = m->next) {
+            untouched = !constant_reuse_may_write(m->insn, fam);
+        }
+        if (untouched) {
+            return fam;
+        }
+    }
+    return -1;
+}
+
+int constant_reuse_apply(struct instruction_node *head, byval_arch_t arch,
+                         constant_reuse_generate_fn generate, uint32_t *reserved) {
+    constant_reuse_reg_t regs[16];
+    struct instruction_node **targets = NULL;
+    size_t target_count = 0;
+    int reused = 0;
+    int materialized = 0;
+
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        return 0;
+    }
+
+    // Branch targets start new regions
+    if (layout_collect_branch_targets(head, arch, &targets, &target_count) != 0) {
+        return 0;
+    }
+
+    memset(regs, 0, sizeof(regs));
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        int dst = -1, wide = 0, holder = -1, cache = -1;
+        uint64_t value = 0;
+        int is_use;
+        uint64_t set_value = 0;
+        int set_fam;
+
+        if (layout_is_branch_target(targets, target_count, n)) {
+            memset(regs, 0, sizeof(regs));
+        }
+
+        is_use = n->branch_form == LAYOUT_FORM_NONE && constant_reuse_use(n->insn, arch, &dst, &wide, &value);
+        if (is_use) {
+            uint8_t copy[4];
+            size_t copy_len;
+
+            for (int fam = 0; fam < 16 && holder < 0; fam++) {
+                if (fam != dst && regs[fam].valid && constant_reuse_serves(regs[fam].value, wide, value)) {
+                    holder = fam;
+                }
+            }
+
+            if (holder >= 0) {
+                // Served by a register that already holds the value
+                copy_len = constant_reuse_encode_copy(dst, holder, wide, copy);
+                if (is_bad_byte_free_buffer(copy, copy_len)) {
+                    buffer_append(&n->code, copy, copy_len);
+                    n->code_fixed = 1;
+                    *reserved |= 1u << holder;
+                    reused++;
+                }
+            } else {
+                // Worth caching only if the value is needed again and the
+                // destination itself will not hold it by then
+                int dst_clobbered;
+                uint64_t full = wide ? value : (uint32_t)value;
+                struct instruction_node *next_use = constant_reuse_next_use(n, arch, targets, target_count,
+                                                                            dst, full, &dst_clobbered);
+                if (next_use && dst_clobbered) {
+                    cache = constant_reuse_pick_cache(n, next_use, arch, dst, *reserved);
+                }
+                if (cache >= 0) {
+                    cs_insn mov;
+                    cs_detail mov_detail;
+                    struct buffer code;
+
+                    buffer_init(&code);
+                    constant_reuse_make_mov(&mov, &mov_detail, cache, wide, value);
+                    generate(&code, &mov, arch);
+                    copy_len = constant_reuse_encode_copy(dst, cache, wide, copy);
+                    buffer_append(&code, copy, copy_len);
+                    if (code.size > copy_len && is_bad_byte_free_buffer(code.data, code.size)) {
+                        buffer_append(&n->code, code.data, code.size);
+                        n->code_fixed = 1;
+                        *reserved |= 1u << cache;
+                        materialized++;
+                    } else {
+                        cache = -1;
+                    }
+                    buffer_free(&code);
+                }
+            }
+        }
+
+        // Track what the original instruction leaves behind
+        for (int fam = 0; fam < 16; fam++) {
+            if (regs[fam].valid && constant_reuse_may_write(n->insn, fam)) {
+                regs[fam].valid = 0;
+            }
+        }
+        set_fam = (n->branch_form == LAYOUT_FORM_NONE) ? constant_reuse_sets(n->insn, &set_value) : -1;
+        if (set_fam >= 0) {
+            regs[set_fam].valid = 1;
+            regs[set_fam].value = set_value;
+        }
+        if (cache >= 0) {
+            regs[cache].valid = 1;
+            regs[cache].value = wide ? value : (uint32_t)value;
+        }
+        if (constant_reuse_ends_region(n, arch)) {
+            memset(regs, 0, sizeof(regs));
+        }
+    }
+
+    if (reused + materialized > 0) {
+        log_diagnostic("[REUSE] %d constant uses served from registers, %d cached in dead registers\n",
+                       reused, materialized);
+    }
+    free(targets);
+    return reused + materialized;
+}
@@ -0,0 +1,51 @@
+#ifndef CONSTANT_REUSE_H
+#define CONSTANT_REUSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file constant_reuse.h
+ * @brief Constant reuse through register caching (--constant-reuse)
+ *
+ * A forward pass over each straight-line region (no branch target inside,
+ * ended by any control transfer) tracks which registers hold which constant.
+ * A later MOV reg, imm or PUSH imm whose immediate contains bad bytes is then
+ * served from a register that already holds the value (MOV reg, reg / PUSH
+ * reg) instead of being rebuilt. When no register will still hold the value
+ * at its next use, it is materialized once in a register proven dead at that
+ * point and reused from there.
+ *
+ * Registers are only ever overwritten where the original code no longer
+ * needs their value, so register state at region exits is unchanged.
+ */
+
+#define CONSTANT_REUSE_WINDOW 32   // Instructions scanned ahead for another use of a constant
+
+/**
+ * Generator for instructions the pass does not rewrite itself
+ * (core.c's strategy-based first-pass generator)
+ */
+typedef void (*constant_reuse_generate_fn)(struct buffer *out, cs_insn *insn, byval_arch_t arch);
+
+/**
+ * Serve repeated bad-byte constants from registers
+ *
+ * Must run after branch nodes are classified (branch_form and target set)
+ * and before the other nodes are rewritten. Nodes it handles get their final
+ * node->code and code_fixed = 1; all others are left untouched.
+ *
+ * @param head: First instruction node
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @param generate: Generator used to materialize a constant in a dead register
+ * @param reserved: Register families never used as a cache (bit per family);
+ *                  every holder and cache the rewritten nodes read is added,
+ *                  since liveness does not see those reads
+ * @return: Number of constant uses rewritten
+ */
+int constant_reuse_apply(struct instruction_node *head, byval_arch_t arch,
+                         constant_reuse_generate_fn generate, uint32_t *reserved);
+
+#endif // CONSTANT_REUSE_H
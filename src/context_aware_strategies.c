@@ -54,7 +54,7 @@ strategy_t** get_context_aware_strategies_for_instruction(cs_insn *insn, int *co
     // For now, we'll validate each strategy to ensure it doesn't introduce nulls
     // This is a basic form of context-awareness
     
-    static strategy_t* validated_strategies[200];  // Same size as the main registry
+    static __thread strategy_t* validated_strategies[200];  // Same size as the main registry; per thread
     int validated_count = 0;
     
     for (int i = 0; i < *count && i < 200; i++) {
@@ -1,19 +1,679 @@
 /*
  * BYVALVER - Control Flow Dispatcher Obfuscation (Priority 77)
- * STUB IMPLEMENTATION
+ *
+ * Control-flow flattening (see control_flow_dispatcher_obfuscation.h).
+ *
+ * Layout is emitted in one pass. The dispatcher, the table and the
+ * trampolines come before every block, so all jumps to the dispatcher and
+ * all calls to trampolines go backwards. Backward displacements are
+ * negative, which keeps them free of the zero high bytes a short forward
+ * rel32 would carry. The table is filled once every block has been placed.
  */
 
+#include "control_flow_dispatcher_obfuscation.h"
 #include "obfuscation_strategy_registry.h"
+#include "thread_rng.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
 
-// TODO: Implement control flow dispatcher generation
-// This requires:
-// 1. Basic block identification and extraction
-// 2. CFG (Control Flow Graph) construction
-// 3. Dispatcher loop generation
-// 4. State variable management
-// 5. Block reordering and randomization
+#define CFF_ATTEMPTS 64             // Redraws of codes, key and order before giving up
+#define CFF_WIDE_CODES 0x10000
+#define CFF_MAX_PADDING 16          // Filler bytes tried in front of a block or jump
+
+typedef struct {
+    int first;                      // First instruction
+    int last;                       // Last instruction
+    int next;                       // Block reached by falling off `last`, -1 if none
+    int code;                       // State code
+    long trampoline;                // CALL target: trampoline offset, -1 otherwise
+    size_t out_offset;
+} cff_block_t;
+
+typedef struct {
+    const uint8_t *code;
+    const cff_insn_t *insns;
+    int count;
+    int x64;
+    cff_block_t *blocks;
+    int block_count;
+    int *block_at;                  // Instruction -> block it starts, -1 if none
+    int tail;                       // Block that runs off the end of the payload, -1 if none
+    int wide;                       // 16-bit state codes
+    int code_min;
+    int code_max;
+    uint32_t key;
+    size_t dispatcher;              // Dispatcher offset
+    size_t anchor;                  // Table entries are block offsets from here, XOR key
+} cff_state_t;
+
+static int cff_find_insn(const cff_insn_t *insns, int count, size_t offset) {
+    int lo = 0, hi = count - 1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (insns[mid].offset == offset) {
+            return mid;
+        }
+        if (insns[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static int cff_has_target(const cff_insn_t *insn) {
+    return insn->kind == CFF_INSN_JUMP || insn->kind == CFF_INSN_BRANCH ||
+           insn->kind == CFF_INSN_CALL;
+}
+
+// Split the instructions into basic blocks
+static int cff_build_blocks(cff_state_t *s, size_t size, const char **reason) {
+    char *leader = calloc((size_t)s->count, 1);
+    size_t expected = 0;
+
+    if (!leader) {
+        *reason = "out of memory";
+        return -1;
+    }
+    leader[0] = 1;
+    for (int i = 0; i < s->count; i++) {
+        const cff_insn_t *insn = &s->insns[i];
+
+        if (insn->offset != expected || insn->size == 0) {
+            *reason = "bytes that do not decode";
+            free(leader);
+            return -1;
+        }
+        expected += insn->size;
+        if (cff_has_target(insn)) {
+            int t = (insn->target < size) ? cff_find_insn(s->insns, s->count, insn->target) : -1;
+            if (t < 0) {
+                *reason = (insn->target < size) ? "a branch into the middle of an instruction"
+                                                 : "a branch that leaves the payload";
+                free(leader);
+                return -1;
+            }
+            leader[t] = 1;
+        }
+        if ((insn->kind == CFF_INSN_JUMP || insn->kind == CFF_INSN_BRANCH ||
+             insn->kind == CFF_INSN_END) && i + 1 < s->count) {
+            leader[i + 1] = 1;
+        }
+    }
+    if (expected != size) {
+        *reason = "bytes that do not decode";
+        free(leader);
+        return -1;
+    }
+
+    s->block_count = 0;
+    for (int i = 0; i < s->count; i++) {
+        s->block_count += leader[i];
+    }
+    if (s->block_count > CFF_MAX_BLOCKS) {
+        *reason = "too many basic blocks";
+        free(leader);
+        return -1;
+    }
+    s->blocks = calloc((size_t)s->block_count, sizeof(*s->blocks));
+    s->block_at = malloc((size_t)s->count * sizeof(*s->block_at));
+    if (!s->blocks || !s->block_at) {
+        *reason = "out of memory";
+        free(leader);
+        return -1;
+    }
+
+    int b = -1;
+    for (int i = 0; i < s->count; i++) {
+        s->block_at[i] = -1;
+        if (leader[i]) {
+            b++;
+            s->blocks[b].first = i;
+            s->blocks[b].trampoline = -1;
+            s->block_at[i] = b;
+        }
+        s->blocks[b].last = i;
+    }
+    free(leader);
+
+    s->tail = -1;
+    for (b = 0; b < s->block_count; b++) {
+        cff_insn_kind_t kind = s->insns[s->blocks[b].last].kind;
+
+        s->blocks[b].next = (b + 1 < s->block_count) ? b + 1 : -1;
+        if (kind == CFF_INSN_JUMP || kind == CFF_INSN_END) {
+            s->blocks[b].next = -1;
+        } else if (b + 1 == s->block_count) {
+            s->tail = b;     // Runs off the end: stays last
+        }
+    }
+    return 0;
+}
+
+static int cff_target_block(const cff_state_t *s, const cff_insn_t *insn) {
+    return s->block_at[cff_find_insn(s->insns, s->count, insn->target)];
+}
+
+static int cff_code_clean(int code, int wide) {
+    return is_bad_byte_free_byte((uint8_t)code) &&
+           (!wide || is_bad_byte_free_byte((uint8_t)(code >> 8)));
+}
+
+// Draw a contiguous run of clean state codes and deal them out to the blocks
+static int cff_assign_codes(cff_state_t *s) {
+    int limit = s->wide ? CFF_WIDE_CODES : 0x100;
+    int *codes = malloc((size_t)limit * sizeof(*codes));
+    int clean = 0;
+
+    if (!codes) {
+        return -1;
+    }
+    for (int c = 0; c < limit; c++) {
+        if (cff_code_clean(c, s->wide)) {
+            codes[clean++] = c;
+        }
+    }
+    if (clean < s->block_count) {
+        free(codes);
+        return -1;
+    }
+
+    // Start low in the clean range so the table stays small
+    int spare = clean - s->block_count;
+    int start = (int)thread_rng_below((uint32_t)((spare < 64 ? spare : 64) + 1));
+    int *run = codes + start;
+
+    for (int i = s->block_count - 1; i > 0; i--) {
+        int j = (int)thread_rng_below((uint32_t)i + 1);
+        int t = run[i];
+        run[i] = run[j];
+        run[j] = t;
+    }
+    s->code_min = limit;
+    s->code_max = -1;
+    for (int b = 0; b < s->block_count; b++) {
+        s->blocks[b].code = run[b];
+        if (run[b] < s->code_min) s->code_min = run[b];
+        if (run[b] > s->code_max) s->code_max = run[b];
+    }
+    free(codes);
+    return 0;
+}
+
+static uint8_t cff_clean_byte(void) {
+    uint8_t v;
+    int tries = 0;
+
+    do {
+        v = (uint8_t)thread_rng_next();
+    } while (!is_bad_byte_free_byte(v) && ++tries < 1024);
+    return v;
+}
+
+static void cff_set32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void cff_put32(struct buffer *out, uint32_t v) {
+    uint8_t b[4];
+    cff_set32(b, v);
+    buffer_append(out, b, 4);
+}
+
+/*
+ * Relative JMP or CALL to an earlier offset. NOPs are placed in front while
+ * the displacement contains bad bytes; if that does not help, the final
+ * check of the layout rejects it.
+ */
+static void cff_emit_backward(struct buffer *out, uint8_t short_op, uint8_t long_op, size_t target) {
+    static const uint8_t nop = 0x90;
+
+    for (int pad = 0; ; pad++) {
+        long rel8 = (long)target - (long)(out->size + 2);
+        uint32_t rel32 = (uint32_t)((long)target - (long)(out->size + 5));
+        int use_short = short_op && rel8 >= -128;
+        int clean = use_short ? is_bad_byte_free_byte((uint8_t)rel8) : is_bad_byte_free(rel32);
+
+        if (clean || pad == CFF_MAX_PADDING || !is_bad_byte_free_byte(nop)) {
+            if (use_short) {
+                uint8_t jmp[2] = {short_op, (uint8_t)rel8};
+                buffer_append(out, jmp, sizeof(jmp));
+            } else {
+                buffer_append(out, &long_op, 1);
+                cff_put32(out, rel32);
+            }
+            return;
+        }
+        buffer_append(out, &nop, 1);
+    }
+}
+
+// PUSH <state code>, then JMP back to the dispatcher
+static void cff_emit_transition(struct buffer *out, const cff_state_t *s, int block) {
+    int code = s->blocks[block].code;
+
+    if (s->wide) {
+        // PUSH imm32: the dispatcher only reads the low word
+        uint8_t push[5] = {0x68, (uint8_t)code, (uint8_t)(code >> 8), cff_clean_byte(), cff_clean_byte()};
+        buffer_append(out, push, sizeof(push));
+    } else {
+        uint8_t push[2] = {0x6A, (uint8_t)code};
+        buffer_append(out, push, sizeof(push));
+    }
+    cff_emit_backward(out, 0xEB, 0xE9, s->dispatcher);
+}
+
+/*
+ * Emit the dispatcher at the current end of `out` and set the table anchor.
+ * Returns the table offset.
+ */
+static size_t cff_emit_dispatcher(struct buffer *out, cff_state_t *s) {
+    static const uint8_t save[] = {0x9C, 0x50, 0x51};              // pushf; push rax; push rcx
+    static const uint8_t restore[] = {0x59, 0x58, 0x9D, 0xC3};     // pop rcx; pop rax; popf; ret
+    uint8_t slot = s->x64 ? 0x18 : 0x0C;                           // State code: 3 pushes up
+    size_t start = out->size;
+    size_t before_load;   // Dispatcher bytes before the table load
+    size_t after_load = 6 + (s->x64 ? 3 : 2) + (s->x64 ? 5 : 4) + sizeof(restore);
+
+    s->dispatcher = start;
+    before_load = sizeof(save) + 5 + (s->x64 ? 7 : 10);
+    s->anchor = s->x64 ? 0 : start + before_load;
+
+    // Table slot address = anchor + code*4 + disp; try the short displacement first
+    long table = (long)(start + before_load + 4 + after_load);
+    long disp = table - (long)s->anchor - 4L * s->code_min;
+    int disp8 = (disp >= -128 && disp <= 127);
+    if (!disp8) {
+        table += 3;
+        disp += 3;
+    }
+
+    buffer_append(out, save, sizeof(save));
+    uint8_t movzx[5] = {0x0F, (uint8_t)(s->wide ? 0xB7 : 0xB6), 0x4C, 0x24, slot};
+    buffer_append(out, movzx, sizeof(movzx));
+    if (s->x64) {
+        // lea rax, [rip - lea_end]: anchor is the start of the payload
+        uint8_t lea[3] = {0x48, 0x8D, 0x05};
+        buffer_append(out, lea, sizeof(lea));
+        cff_put32(out, (uint32_t)-(long)(out->size + 4));
+    } else {
+        // jmp .call; .pop: pop eax; jmp .anchor; .call: call .pop; .anchor:
+        static const uint8_t getpc[] = {0xEB, 0x03, 0x58, 0xEB, 0x05, 0xE8, 0xF8, 0xFF, 0xFF, 0xFF};
+        buffer_append(out, getpc, sizeof(getpc));
+    }
+    if (disp8) {
+        uint8_t load[4] = {0x8B, 0x4C, 0x88, (uint8_t)disp};       // mov ecx, [rax+rcx*4+disp8]
+        buffer_append(out, load, sizeof(load));
+    } else {
+        uint8_t load[3] = {0x8B, 0x8C, 0x88};                      // mov ecx, [rax+rcx*4+disp32]
+        buffer_append(out, load, sizeof(load));
+        cff_put32(out, (uint32_t)disp);
+    }
+    uint8_t xor_key[2] = {0x81, 0xF1};                             // xor ecx, key
+    buffer_append(out, xor_key, sizeof(xor_key));
+    cff_put32(out, s->key);
+    if (s->x64) {
+        static const uint8_t tail[] = {0x48, 0x01, 0xC8,           // add rax, rcx
+                                       0x48, 0x89, 0x44, 0x24, 0x18};  // mov [rsp+24], rax
+        buffer_append(out, tail, sizeof(tail));
+    } else {
+        static const uint8_t tail[] = {0x01, 0xC8,                 // add eax, ecx
+                                       0x89, 0x44, 0x24, 0x0C};    // mov [esp+12], eax
+        buffer_append(out, tail, sizeof(tail));
+    }
+    buffer_append(out, restore, sizeof(restore));
+    return (size_t)table;
+}
+
+static void cff_emit_block(struct buffer *out, cff_state_t *s, int b) {
+    cff_block_t *block = &s->blocks[b];
+
+    // Nothing falls into a block, so junk in front of it keeps its table entry clean
+    for (int pad = 0; pad < CFF_MAX_PADDING &&
+                      !is_bad_byte_free((uint32_t)(out->size - s->anchor) ^ s->key); pad++) {
+        uint8_t junk = cff_clean_byte();
+        buffer_append(out, &junk, 1);
+    }
+    block->out_offset = out->size;
+    for (int i = block->first; i <= block->last; i++) {
+        const cff_insn_t *insn = &s->insns[i];
+
+        if (insn->kind == CFF_INSN_CALL) {
+            cff_emit_backward(out, 0, 0xE8, (size_t)s->blocks[cff_target_block(s, insn)].trampoline);
+        } else if (insn->kind == CFF_INSN_JUMP) {
+            cff_emit_transition(out, s, cff_target_block(s, insn));
+            return;
+        } else if (insn->kind == CFF_INSN_BRANCH) {
+            // Bcc taken; <fall-through transition>; taken: <target transition>
+            uint8_t rel8 = 0;
+            size_t rel_at;
+            buffer_append(out, insn->opcode, insn->opcode_len);
+            rel_at = out->size;
+            buffer_append(out, &rel8, 1);
+            if (block->next >= 0) {
+                static const uint8_t nop = 0x90;
+                for (int pad = 0; ; pad++) {
+                    out->size = rel_at + 1;
+                    for (int i = 0; i < pad; i++) {
+                        buffer_append(out, &nop, 1);
+                    }
+                    cff_emit_transition(out, s, block->next);
+                    out->data[rel_at] = (uint8_t)(out->size - rel_at - 1);
+                    if (is_bad_byte_free_byte(out->data[rel_at]) || pad == 4 ||
+                        !is_bad_byte_free_byte(nop)) {
+                        break;
+                    }
+                }
+                cff_emit_transition(out, s, cff_target_block(s, insn));
+            } else {
+                // Runs off the end when not taken (tail block)
+                uint8_t skip[2] = {0xEB, 0x00};
+                size_t skip_at;
+                out->data[rel_at] = 2;
+                buffer_append(out, skip, sizeof(skip));
+                skip_at = out->size;
+                cff_emit_transition(out, s, cff_target_block(s, insn));
+                out->data[skip_at - 1] = (uint8_t)(out->size - skip_at);
+            }
+            return;
+        } else {
+            buffer_append(out, s->code + insn->offset, insn->size);
+        }
+    }
+    if (block->next >= 0 && s->insns[block->last].kind != CFF_INSN_END) {
+        cff_emit_transition(out, s, block->next);
+    }
+}
+
+// One layout with freshly drawn codes, key and block order
+static int cff_emit(cff_state_t *s, int *order, struct buffer *out, cff_info_t *info) {
+    size_t table;
+    int slots;
+
+    if (cff_assign_codes(s) != 0) {
+        return -1;
+    }
+    do {
+        s->key = thread_rng_next();
+    } while (!is_bad_byte_free(s->key));
+
+    for (int i = s->block_count - 1; i > 0; i--) {
+        int j = (int)thread_rng_below((uint32_t)i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; s->tail >= 0 && i < s->block_count; i++) {
+        if (order[i] == s->tail) {
+            order[i] = order[s->block_count - 1];
+            order[s->block_count - 1] = s->tail;
+            break;
+        }
+    }
+
+    // Entry: PUSH the first block's code and fall into the dispatcher
+    if (s->wide) {
+        uint8_t push[5] = {0x68, (uint8_t)s->blocks[0].code, (uint8_t)(s->blocks[0].code >> 8),
+                           cff_clean_byte(), cff_clean_byte()};
+        buffer_append(out, push, sizeof(push));
+    } else {
+        uint8_t push[2] = {0x6A, (uint8_t)s->blocks[0].code};
+        buffer_append(out, push, sizeof(push));
+    }
+    table = cff_emit_dispatcher(out, s);
+    info->dispatcher_size = out->size - s->dispatcher;
+    info->transition_insns = s->x64 ? 15 : 18;
+
+    slots = s->code_max - s->code_min + 1;
+    for (int i = 0; i < slots; i++) {
+        cff_put32(out, 0);
+    }
+    for (int b = 0; b < s->block_count; b++) {
+        s->blocks[b].trampoline = -1;
+    }
+    for (int i = 0; i < s->count; i++) {
+        if (s->insns[i].kind == CFF_INSN_CALL) {
+            int t = cff_target_block(s, &s->insns[i]);
+            if (s->blocks[t].trampoline < 0) {
+                s->blocks[t].trampoline = (long)out->size;
+                cff_emit_transition(out, s, t);
+            }
+        }
+    }
+    for (int i = 0; i < s->block_count; i++) {
+        cff_emit_block(out, s, order[i]);
+    }
+
+    // Fill the table; unused codes get random entries
+    for (int i = 0; i < slots; i++) {
+        uint32_t v = thread_rng_next();
+        for (int tries = 0; !is_bad_byte_free(v) && tries < 1024; tries++) {
+            v = thread_rng_next();
+        }
+        cff_set32(out->data + table + 4 * (size_t)i, v);
+    }
+    for (int b = 0; b < s->block_count; b++) {
+        cff_set32(out->data + table + 4 * (size_t)(s->blocks[b].code - s->code_min),
+                  (uint32_t)(s->blocks[b].out_offset - s->anchor) ^ s->key);
+    }
+    info->blocks = s->block_count;
+    info->table_slots = slots;
+    return is_bad_byte_free_buffer(out->data, out->size) ? 0 : -1;
+}
+
+int cff_flatten(const uint8_t *code, size_t size, const cff_insn_t *insns, int count, int x64,
+                struct buffer *out, cff_info_t *info, const char **reason) {
+    cff_state_t s;
+    int *order = NULL;
+    int result = -1;
+
+    memset(&s, 0, sizeof(s));
+    memset(info, 0, sizeof(*info));
+    s.code = code;
+    s.insns = insns;
+    s.count = count;
+    s.x64 = x64;
+    *reason = NULL;
+
+    if (count <= 0 || !is_bad_byte_free_buffer(code, size)) {
+        *reason = (count <= 0) ? "empty payload" : "the payload still contains bad bytes";
+        return -1;
+    }
+    if (cff_build_blocks(&s, size, reason) != 0) {
+        goto done;
+    }
+    order = malloc((size_t)s.block_count * sizeof(*order));
+    if (!order) {
+        *reason = "out of memory";
+        goto done;
+    }
+    for (int i = 0; i < s.block_count; i++) {
+        order[i] = i;
+    }
+
+    for (int attempt = 0; attempt < CFF_ATTEMPTS && result != 0; attempt++) {
+        struct buffer candidate;
+
+        // 8-bit codes while they last, then 16-bit codes
+        s.wide = (attempt >= CFF_ATTEMPTS / 2);
+        buffer_init(&candidate);
+        if (cff_emit(&s, order, &candidate, info) == 0) {
+            buffer_append(out, candidate.data, candidate.size);
+            result = 0;
+        }
+        buffer_free(&candidate);
+    }
+    if (result != 0) {
+        *reason = "no bad-byte-free dispatcher layout was found";
+    }
+
+done:
+    free(order);
+    free(s.blocks);
+    free(s.block_at);
+    return result;
+}
+
+// Rel8 form of a conditional branch, from its Capstone encoding
+static int cff_branch_opcode(const cs_insn *insn, cff_insn_t *out) {
+    const uint8_t *b = insn->bytes;
+
+    if (insn->size >= 6 && b[insn->size - 6] == 0x0F && (b[insn->size - 5] & 0xF0) == 0x80) {
+        out->opcode[0] = (uint8_t)(0x70 | (b[insn->size - 5] & 0x0F));   // Jcc rel32 -> Jcc rel8
+        out->opcode_len = 1;
+        return 0;
+    }
+    if (insn->size < 2 || insn->size > 3) {
+        return -1;
+    }
+    // Jcc/LOOPcc/JECXZ rel8, possibly with an address-size prefix
+    memcpy(out->opcode, b, insn->size - 1u);
+    out->opcode_len = (uint8_t)(insn->size - 1);
+    return 0;
+}
+
+static const cs_insn *cff_insn_at(const cs_insn *insns, size_t count, size_t offset) {
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (insns[mid].address == (uint64_t)offset) {
+            return &insns[mid];
+        }
+        if (insns[mid].address < (uint64_t)offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Classify one decoded instruction; returns 0 or -1 with *reason set
+static int cff_classify(const cs_insn *insns, size_t count, size_t i, cff_insn_t *out,
+                        const char **reason) {
+    const cs_insn *insn = &insns[i];
+    const cs_x86 *x86 = &insn->detail->x86;
+
+    out->offset = (size_t)insn->address;
+    out->size = insn->size;
+    out->kind = CFF_INSN_PLAIN;
+    for (int k = 0; k < x86->op_count; k++) {
+        if (x86->operands[k].type == X86_OP_MEM && x86->operands[k].mem.base == X86_REG_RIP) {
+            *reason = "RIP-relative operands";
+            return -1;
+        }
+    }
+
+    switch (insn->id) {
+        case X86_INS_FNSTENV:
+            *reason = "FNSTENV self-location";
+            return -1;
+        case X86_INS_JMP:
+        case X86_INS_CALL:
+            if (x86->op_count != 1 || x86->operands[0].type != X86_OP_IMM) {
+                out->kind = (insn->id == X86_INS_JMP) ? CFF_INSN_END : CFF_INSN_PLAIN;
+                return 0;
+            }
+            out->kind = (insn->id == X86_INS_JMP) ? CFF_INSN_JUMP : CFF_INSN_CALL;
+            out->target = (size_t)x86->operands[0].imm;
+            if (insn->id == X86_INS_CALL) {
+                // CALL/POP: the callee reads its own address
+                const cs_insn *callee = cff_insn_at(insns, count, out->target);
+                if (callee && callee->id == X86_INS_POP) {
+                    *reason = "CALL/POP self-location";
+                    return -1;
+                }
+            }
+            return 0;
+        case X86_INS_LOOP:
+        case X86_INS_LOOPE:
+        case X86_INS_LOOPNE:
+        case X86_INS_JCXZ:
+        case X86_INS_JECXZ:
+            break;
+        case X86_INS_RET:
+        case X86_INS_RETF:
+        case X86_INS_IRET:
+        case X86_INS_IRETD:
+        case X86_INS_IRETQ:
+        case X86_INS_LJMP:
+        case X86_INS_HLT:
+        case X86_INS_UD2:
+            out->kind = CFF_INSN_END;
+            return 0;
+        default:
+            if (!is_relative_jump((cs_insn *)insn)) {
+                return 0;
+            }
+            break;
+    }
+
+    // Conditional branch
+    if (x86->op_count != 1 || x86->operands[0].type != X86_OP_IMM ||
+        cff_branch_opcode(insn, out) != 0) {
+        *reason = "an unsupported branch encoding";
+        return -1;
+    }
+    out->kind = CFF_INSN_BRANCH;
+    out->target = (size_t)x86->operands[0].imm;
+    return 0;
+}
+
+int flatten_control_flow(const uint8_t *code, size_t size, byval_arch_t arch,
+                         struct buffer *out, cff_info_t *info, const char **reason) {
+    cs_arch cs_arch;
+    cs_mode cs_mode;
+    csh handle;
+    cs_insn *insns = NULL;
+    cff_insn_t *classified = NULL;
+    size_t count;
+    int result = -1;
+
+    memset(info, 0, sizeof(*info));
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        *reason = "only x86 and x64 payloads are supported";
+        return -1;
+    }
+    get_capstone_arch_mode(arch, &cs_arch, &cs_mode);
+    if (cs_open(cs_arch, cs_mode, &handle) != CS_ERR_OK) {
+        *reason = "the disassembler could not be opened";
+        return -1;
+    }
+    cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
+
+    count = cs_disasm(handle, code, size, 0, 0, &insns);
+    if (count == 0 || count > (size_t)CFF_MAX_BLOCKS * 64) {
+        *reason = (count == 0) ? "bytes that do not decode" : "too many instructions";
+        goto done;
+    }
+    classified = calloc(count, sizeof(*classified));
+    if (!classified) {
+        *reason = "out of memory";
+        goto done;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (cff_classify(insns, count, i, &classified[i], reason) != 0) {
+            goto done;
+        }
+    }
+    result = cff_flatten(code, size, classified, (int)count, arch == BYVAL_ARCH_X64, out, info, reason);
+
+done:
+    free(classified);
+    if (insns) {
+        cs_free(insns, count);
+    }
+    cs_close(&handle);
+    return result;
+}
 
 void register_control_flow_dispatcher_obfuscation() {
-    // STUB: Not yet implemented
-    // Future implementation will register strategies here
+    // Whole-payload transform: applied by --flatten after the rewrite, see flatten_control_flow()
 }
@@ -1,19 +1,95 @@
 /*
  * BYVALVER - Control Flow Dispatcher Obfuscation (Priority 77)
  *
- * Implements state-machine dispatcher for CFG flattening.
- * STUB IMPLEMENTATION - Requires CFG reconstruction and basic block extraction.
+ * Control-flow flattening behind a table-driven dispatcher (--flatten).
  *
- * Future implementation will:
- * - Extract basic blocks from linear code
- * - Build CFG (control flow graph)
- * - Generate central dispatcher loop
- * - Flatten CFG into star-shaped pattern
+ * The payload is split into basic blocks, which are emitted in random order.
+ * Every transition between blocks pushes the state code of its successor and
+ * jumps to a single dispatcher. The dispatcher looks the code up in a table
+ * of block offsets and returns into the block, so every transition costs the
+ * same few instructions whatever the number of blocks:
+ *
+ *   entry:       push  <code of the first block>
+ *   dispatcher:  pushf / push rax / push rcx
+ *                movzx ecx, byte|word [rsp+24]     ; state code
+ *                rax = anchor                      ; LEA [rip] on x64, CALL/POP on x86
+ *                mov   ecx, [rax + rcx*4 + disp]   ; table slot
+ *                xor   ecx, key
+ *                add   rax, rcx                    ; block address
+ *                mov   [rsp+24], rax
+ *                pop rcx / pop rax / popf / ret
+ *   table:       one 32-bit slot per state code in [lowest, highest]
+ *   trampolines: push <code> / jmp dispatcher, one per CALL target
+ *   blocks
+ *
+ * State codes, the table key and the block order come from the thread RNG
+ * (see thread_rng.h). They are redrawn until every emitted byte is clean.
+ * Registers, flags and the stack are the same on entry to every block as in
+ * the original code. Transitions briefly use four stack slots below the
+ * stack pointer.
+ *
+ * Flattening runs on the rewritten payload, so it only has to keep its own
+ * bytes clean. It is refused when the payload locates itself (CALL/POP,
+ * FNSTENV, RIP-relative operands), branches outside itself, or contains
+ * bytes that do not decode.
  */
 
 #ifndef CONTROL_FLOW_DISPATCHER_OBFUSCATION_H
 #define CONTROL_FLOW_DISPATCHER_OBFUSCATION_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+
+#define CFF_MAX_BLOCKS 4096
+
+typedef enum {
+    CFF_INSN_PLAIN = 0,     // Falls through to the next instruction
+    CFF_INSN_JUMP,          // Unconditional relative jump to `target`
+    CFF_INSN_BRANCH,        // Conditional relative branch to `target` (Jcc, LOOPcc, JECXZ)
+    CFF_INSN_CALL,          // Relative call to `target`
+    CFF_INSN_END            // No successor in the payload (RET, indirect jump, HLT)
+} cff_insn_kind_t;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    cff_insn_kind_t kind;
+    size_t target;          // JUMP, BRANCH and CALL target offset
+    uint8_t opcode[2];      // BRANCH: rel8 form of the branch, displacement excluded
+    uint8_t opcode_len;
+} cff_insn_t;
+
+typedef struct {
+    int blocks;             // Basic blocks behind the dispatcher
+    int table_slots;        // Table slots (state code range)
+    size_t dispatcher_size; // Dispatcher bytes
+    int transition_insns;   // Instructions executed per block transition
+} cff_info_t;
+
+/**
+ * Flatten an x86/x64 payload
+ * @param code: Clean payload (rewrite output)
+ * @param size: Payload size
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @param out: Receives the flattened payload (appended)
+ * @param info: Output statistics
+ * @param reason: Set to a short explanation when flattening is refused
+ * @return: 0 on success, -1 if the payload cannot be flattened
+ */
+int flatten_control_flow(const uint8_t *code, size_t size, byval_arch_t arch,
+                         struct buffer *out, cff_info_t *info, const char **reason);
+
+/**
+ * Flatten a payload from already classified instructions
+ * @param insns: Every instruction of `code` in order, without gaps
+ * @param x64: Nonzero for 64-bit dispatch code
+ * Other parameters and return value as for flatten_control_flow()
+ */
+int cff_flatten(const uint8_t *code, size_t size, const cff_insn_t *insns, int count, int x64,
+                struct buffer *out, cff_info_t *info, const char **reason);
+
+// Flattening is a whole-payload transform, so no per-instruction strategy is registered
 void register_control_flow_dispatcher_obfuscation();
 
 #endif // CONTROL_FLOW_DISPATCHER_OBFUSCATION_H
@@ -1,11 +1,27 @@
 #include "core.h"
 #include "utils.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "strategy.h"  // For provide_ml_feedback
 #include "ml_strategist.h"  // For metrics tracking functions
 #include "profile_aware_sib.h"  // For profile-safe SIB generation
+#include "branch_layout.h"  // For global branch layout / relocation
+#include "pc_relocation.h"  // For ARM/Thumb/A64 PC-relative relocation
+#include "getpc_base.h"  // For the shared GetPC base of RIP-relative references
+#include "constant_pool.h"  // For --constant-pool
+#include "strategy_assignment.h"  // For --optimize-size / --max-output-size
+#include "constant_reuse.h"  // For --constant-reuse
+#include "displacement_rebase.h"  // For --rebase-displacements
+#include "register_renaming.h"  // For --rename-registers
+#include "obfuscation_strategy_registry.h"  // For biphasic obfuscation
+#include "obfuscation_budget.h"  // For --obfuscation-budget
+#include "thread_rng.h"  // For per-chunk generator seeds
+#include "arm_immediate_encoding.h"  // For the profile's ARM immediate tables
+#include "arm64_immediate_encoding.h"  // For AArch64 constant synthesis
 
 // Global bad byte context instance (v3.0)
 bad_byte_context_t g_bad_byte_context = {0};
@@ -21,7 +37,8 @@ struct offset_hash_entry {
     struct offset_hash_entry *next;
 };
 
-static struct offset_hash_entry *g_offset_hash[OFFSET_HASH_SIZE];
+// Per thread: --variants rewrites several payloads concurrently
+static __thread struct offset_hash_entry *g_offset_hash[OFFSET_HASH_SIZE];
 
 static inline uint32_t hash_offset(uint64_t offset) {
     return (uint32_t)(offset % OFFSET_HASH_SIZE);
@@ -67,6 +84,15 @@ static void offset_hash_free(void) {
 // Global batch statistics context (for tracking strategy usage during processing)
 batch_stats_t* g_batch_stats_context = NULL;
 
+// Rewrite options for the file being processed
+rewrite_options_t g_rewrite_options = {0};
+
+// Settings of library contexts, per thread (see processing_scope_t)
+static __thread processing_scope_t g_scope;
+
+// Source of bad_byte_context_t generations (0 = never built)
+static unsigned int g_bad_byte_generation = 0;
+
 /**
  * Get Capstone architecture and mode for a given Byvalver architecture
  * @param arch: Byvalver architecture enum
@@ -87,6 +113,10 @@ void get_capstone_arch_mode(byval_arch_t arch, cs_arch *cs_arch_out, cs_mode *cs
             *cs_arch_out = CS_ARCH_ARM;
             *cs_mode_out = CS_MODE_ARM;
             break;
+        case BYVAL_ARCH_THUMB:
+            *cs_arch_out = CS_ARCH_ARM;
+            *cs_mode_out = CS_MODE_THUMB;
+            break;
         case BYVAL_ARCH_ARM64:
             *cs_arch_out = CS_ARCH_ARM64;
             *cs_mode_out = CS_MODE_LITTLE_ENDIAN;  // AArch64 is little-endian by default
@@ -104,6 +134,7 @@ const char *byval_arch_name(byval_arch_t arch) {
         case BYVAL_ARCH_X86: return "x86";
         case BYVAL_ARCH_X64: return "x64";
         case BYVAL_ARCH_ARM: return "arm";
+        case BYVAL_ARCH_THUMB: return "thumb";
         case BYVAL_ARCH_ARM64: return "arm64";
         default: return "unknown";
     }
@@ -155,7 +186,7 @@ int detect_likely_arch_mismatch(const uint8_t *shellcode, size_t size, byval_arc
                                 byval_arch_t *suggested_arch_out,
                                 double *target_coverage_out,
                                 double *suggested_coverage_out) {
-    byval_arch_t candidates[3];
+    byval_arch_t candidates[4];
     int candidate_count = 0;
     double target_coverage = 0.0;
     size_t target_insn_count = 0;
@@ -182,6 +213,13 @@ int detect_likely_arch_mismatch(const uint8_t *shellcode, size_t size, byval_arc
             candidates[candidate_count++] = BYVAL_ARCH_ARM64;
             break;
         case BYVAL_ARCH_ARM:
+            candidates[candidate_count++] = BYVAL_ARCH_THUMB;
+            candidates[candidate_count++] = BYVAL_ARCH_ARM64;
+            candidates[candidate_count++] = BYVAL_ARCH_X86;
+            candidates[candidate_count++] = BYVAL_ARCH_X64;
+            break;
+        case BYVAL_ARCH_THUMB:
+            candidates[candidate_count++] = BYVAL_ARCH_ARM;
             candidates[candidate_count++] = BYVAL_ARCH_ARM64;
             candidates[candidate_count++] = BYVAL_ARCH_X86;
             candidates[candidate_count++] = BYVAL_ARCH_X64;
@@ -235,45 +273,94 @@ void set_batch_stats_context(batch_stats_t *stats) {
     g_batch_stats_context = stats;
 }
 
-// Track strategy usage in the batch statistics
+// Set the rewrite options for subsequent remove_null_bytes() calls
+void set_rewrite_options(const rewrite_options_t *options) {
+    if (options) {
+        g_rewrite_options = *options;
+    } else {
+        memset(&g_rewrite_options, 0, sizeof(g_rewrite_options));
+    }
+}
+
+void set_processing_scope(const processing_scope_t *scope) {
+    if (scope) {
+        g_scope = *scope;
+    } else {
+        memset(&g_scope, 0, sizeof(g_scope));
+    }
+}
+
+void get_processing_scope(processing_scope_t *scope_out) {
+    *scope_out = g_scope;
+}
+
+bad_byte_context_t *current_bad_byte_context(void) {
+    return g_scope.bad_bytes ? g_scope.bad_bytes : &g_bad_byte_context;
+}
+
+const rewrite_options_t *current_rewrite_options(void) {
+    return g_scope.rewrite ? g_scope.rewrite : &g_rewrite_options;
+}
+
+void log_diagnostic(const char *format, ...) {
+    va_list args;
+
+    if (g_scope.quiet) {
+        return;
+    }
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+// Track strategy usage in the batch statistics (chunks may generate concurrently)
 void track_strategy_usage(const char *strategy_name, int success, size_t output_size) {
-    if (g_batch_stats_context && strategy_name) {
-        batch_stats_add_strategy_usage(g_batch_stats_context, strategy_name, success, output_size);
+    static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+    batch_stats_t *stats = g_scope.stats ? g_scope.stats : g_batch_stats_context;
+
+    if (stats && strategy_name) {
+        pthread_mutex_lock(&stats_lock);
+        batch_stats_add_strategy_usage(stats, strategy_name, success, output_size);
+        pthread_mutex_unlock(&stats_lock);
     }
 }
 
 /**
- * Initialize global bad byte context
+ * Build a bad byte context: copy the profile and derive its tables
+ * @param context: Context to fill (the global one, or a library context's)
  * @param config: Configuration to copy (NULL = default to null-byte only)
  */
-void init_bad_byte_context(bad_byte_config_t *config) {
+void bad_byte_context_build(bad_byte_context_t *context, const bad_byte_config_t *config) {
     if (config) {
-        // Copy user configuration
-        memcpy(&g_bad_byte_context.config, config, sizeof(bad_byte_config_t));
-        g_bad_byte_context.initialized = 1;
-
-        // Record bad byte configuration for metrics tracking (v3.0)
-        ml_metrics_tracker_t* metrics = get_ml_metrics_tracker();
-        if (metrics) {
-            ml_metrics_record_bad_byte_config(metrics,
-                                            g_bad_byte_context.config.bad_bytes,
-                                            g_bad_byte_context.config.bad_byte_count);
-        }
+        memcpy(&context->config, config, sizeof(bad_byte_config_t));
     } else {
         // Default configuration: null byte only (for backward compatibility)
-        memset(&g_bad_byte_context, 0, sizeof(bad_byte_context_t));
-        g_bad_byte_context.config.bad_bytes[0x00] = 1;
-        g_bad_byte_context.config.bad_byte_list[0] = 0x00;
-        g_bad_byte_context.config.bad_byte_count = 1;
-        g_bad_byte_context.initialized = 1;
-
-        // Record default bad byte configuration
-        ml_metrics_tracker_t* metrics = get_ml_metrics_tracker();
-        if (metrics) {
-            ml_metrics_record_bad_byte_config(metrics,
-                                            g_bad_byte_context.config.bad_bytes,
-                                            g_bad_byte_context.config.bad_byte_count);
-        }
+        memset(&context->config, 0, sizeof(bad_byte_config_t));
+        context->config.bad_bytes[0x00] = 1;
+        context->config.bad_byte_list[0] = 0x00;
+        context->config.bad_byte_count = 1;
+    }
+    context->initialized = 1;
+    context->generation = __sync_add_and_fetch(&g_bad_byte_generation, 1);
+
+    // ARM/AArch64 immediate tables for this profile
+    arm_immediate_tables_build(&context->arm_imm, &context->config);
+    arm64_immediate_tables_build();
+}
+
+/**
+ * Initialize global bad byte context
+ * @param config: Configuration to copy (NULL = default to null-byte only)
+ */
+void init_bad_byte_context(bad_byte_config_t *config) {
+    bad_byte_context_build(&g_bad_byte_context, config);
+
+    // Record bad byte configuration for metrics tracking (v3.0)
+    ml_metrics_tracker_t* metrics = get_ml_metrics_tracker();
+    if (metrics) {
+        ml_metrics_record_bad_byte_config(metrics,
+                                        g_bad_byte_context.config.bad_bytes,
+                                        g_bad_byte_context.config.bad_byte_count);
     }
 }
 
@@ -286,10 +373,10 @@ void reset_bad_byte_context(void) {
 
 /**
  * Get pointer to current configuration (read-only)
- * @return: Pointer to active bad byte configuration
+ * @return: Pointer to the calling thread's active bad byte configuration
  */
 bad_byte_config_t* get_bad_byte_config(void) {
-    return &g_bad_byte_context.config;
+    return &current_bad_byte_context()->config;
 }
 
 void buffer_init(struct buffer *b) {
@@ -312,6 +399,7 @@ static void free_instruction_node_list(struct instruction_node *head) {
     struct instruction_node *current = head;
     while (current != NULL) {
         struct instruction_node *next = current->next;
+        buffer_free(&current->code);
         free(current);
         current = next;
     }
@@ -321,7 +409,7 @@ void buffer_append(struct buffer *b, const uint8_t *data, size_t size) {
     if (!data || size == 0) {
         // Log when NULL is passed so we can track down the bad strategy
         if (!data && size > 0) {
-            fprintf(stderr, "[ERROR] buffer_append called with NULL data but size=%zu\n", size);
+            log_diagnostic("[ERROR] buffer_append called with NULL data but size=%zu\n", size);
         }
         return;
     }
@@ -329,20 +417,20 @@ void buffer_append(struct buffer *b, const uint8_t *data, size_t size) {
         size_t new_capacity = (b->capacity == 0) ? 256 : b->capacity * 2;
         // Check for potential overflow in capacity calculation
         if (new_capacity < b->capacity) {
-            fprintf(stderr, "[ERROR] buffer capacity overflow!\n");
+            log_diagnostic("[ERROR] buffer capacity overflow!\n");
             return;
         }
         while (new_capacity < b->size + size) {
             // Check for overflow before multiplying
             if (new_capacity > SIZE_MAX / 2) {
-                fprintf(stderr, "[ERROR] buffer capacity would overflow!\n");
+                log_diagnostic("[ERROR] buffer capacity would overflow!\n");
                 return;
             }
             new_capacity *= 2;
         }
         uint8_t *new_data = realloc(b->data, new_capacity);
         if (new_data == NULL) {
-            fprintf(stderr, "[ERROR] realloc failed in buffer_append!\n");
+            log_diagnostic("[ERROR] realloc failed in buffer_append!\n");
             return; // Don't lose the original pointer
         }
         b->data = new_data;
@@ -447,7 +535,7 @@ uint8_t get_reg_index(uint8_t reg) {
         case X86_REG_RIZ: return 4;  // x64 "no index" pseudo-register
         case X86_REG_EIZ: return 4;  // x32 "no index" pseudo-register
         default:
-            fprintf(stderr, "[WARNING] Unknown register in get_reg_index: %d\n", reg);
+            log_diagnostic("[WARNING] Unknown register in get_reg_index: %d\n", reg);
             return 0;  // Return EAX index as default, but log the issue
     }
 }
@@ -511,338 +599,369 @@ int is_relative_jump(cs_insn *insn) {
     }
 }
 
-// Helper function to safely handle relative jump instructions
-static void process_relative_jump(struct buffer *new_shellcode,
-                                   cs_insn *insn,
-                                   struct instruction_node *current,
-                                   struct instruction_node *head) {
-
-#ifdef DEBUG
-    fprintf(stderr, "[JUMP] Processing: %s %s, bytes[0]=0x%02x, size=%d\n",
-            insn->mnemonic, insn->op_str, insn->bytes[0], insn->size);
-#endif
-
-    // Sanity checks
-    if (insn->detail->x86.op_count == 0) {
-        // No operands, just copy original
-        buffer_append(new_shellcode, insn->bytes, insn->size);
+// The general fallback emits x86 code: on the fixed-width ISAs an instruction
+// no strategy repairs is kept as it is (and counted dirty)
+static void fallback_instruction(struct buffer *out, cs_insn *insn, byval_arch_t arch) {
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        buffer_append(out, insn->bytes, insn->size);
         return;
     }
+    fallback_general_instruction(out, insn);
+}
 
-    if (insn->detail->x86.operands[0].type != X86_OP_IMM) {
-        // Not a relative jump (indirect), copy original
-        buffer_append(new_shellcode, insn->bytes, insn->size);
+// Rewrite a single non-branch instruction into `out` using the strategy registry
+static void generate_instruction_code(struct buffer *out, cs_insn *insn, byval_arch_t arch) {
+    int has_bad_bytes = !is_bad_byte_free_buffer(insn->bytes, insn->size);
+
+    if (!has_bad_bytes) {
+        // No bad bytes, output original instruction
+        buffer_append(out, insn->bytes, insn->size);
         return;
     }
 
-    // Find target node using O(1) hash lookup
-    uint64_t target_addr = (uint64_t)insn->detail->x86.operands[0].imm;
-    struct instruction_node *target_node = offset_hash_lookup(target_addr);
-    int found = (target_node != NULL);
-    (void)head;  // Suppress unused parameter warning
+    // Use strategy pattern if it has bad bytes
+    int strategy_count;
+    size_t before_gen = out->size;
+    strategy_t** strategies = get_strategies_for_instruction(insn, &strategy_count, arch);
 
+    if (strategy_count > 0) {
+        // Use the first (highest priority) strategy to generate code
 #ifdef DEBUG
-    fprintf(stderr, "[JUMP] Looking for target address 0x%lx\n", target_addr);
-    if (found) {
-        fprintf(stderr, "[JUMP] Found target at offset 0x%lx\n", target_addr);
-    }
+        log_diagnostic("[TRACE] Using strategy '%s' for: %s %s\n",
+               strategies[0]->name, insn->mnemonic, insn->op_str);
 #endif
 
-    if (!found) {
-#ifdef DEBUG
-        fprintf(stderr, "[JUMP] Target 0x%lx NOT FOUND! Outputting original bytes.\n", target_addr);
-#endif
-        // Target not in our shellcode - external reference
-        // Convert to absolute addressing
-
-        if (insn->id == X86_INS_CALL) {
-            // MOV EAX, target + CALL EAX
-            generate_mov_eax_imm(new_shellcode, (uint32_t)target_addr);
-            uint8_t call_eax[] = {0xFF, 0xD0};
-            buffer_append(new_shellcode, call_eax, 2);
-            return;
-        } else if (insn->id == X86_INS_JMP) {
-            // MOV EAX, target + JMP EAX
-            generate_mov_eax_imm(new_shellcode, (uint32_t)target_addr);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
-            return;
-        } else {
-            // Conditional jump to external target
-            // Transform using opposite condition + absolute jump to avoid null bytes
-#ifdef DEBUG
-            fprintf(stderr, "[JUMP] Conditional jump to external target - transforming\n");
-#endif
-
-            // Get opposite condition opcode
-            uint8_t opposite_opcode;
-            if (insn->bytes[0] == 0x0F) {
-                // Near conditional jump (0F 8x) - convert to short (7x)
-                opposite_opcode = 0x70 + ((insn->bytes[1] ^ 0x01) & 0x0F);
-            } else {
-                // Short conditional jump (7x) - flip condition bit
-                opposite_opcode = insn->bytes[0] ^ 0x01;
-            }
+        strategies[0]->generate(out, insn);
 
-            // Calculate skip size
-            size_t mov_size = get_mov_eax_imm_size((uint32_t)target_addr);
-            uint8_t skip_size = (uint8_t)(mov_size + 2); // MOV + JMP EAX
+        // Check if the strategy was successful (i.e., didn't introduce bad bytes)
+        int strategy_success = is_bad_byte_free_buffer(
+            out->data + before_gen,
+            out->size - before_gen
+        );
 
-            // FIXED: Ensure skip_size is not a bad byte
-            uint8_t nop_count = 0;
-            while (!is_bad_byte_free_byte(skip_size + nop_count)) {
-                nop_count++;
-                if (nop_count > 10) break; // Safety limit
-            }
+        if (!strategy_success) {
+            log_diagnostic("ERROR: Strategy '%s' introduced bad bytes\n",
+                   strategies[0]->name);
+        }
 
-            // Emit opposite short jump to skip over absolute jump
-            uint8_t skip[] = {opposite_opcode, skip_size + nop_count};
-            buffer_append(new_shellcode, skip, 2);
+        // CRITICAL FIX: Rollback buffer if strategy introduced bad bytes
+        if (!strategy_success) {
+            log_diagnostic("ROLLBACK: Reverting strategy '%s' output, using fallback\n",
+                   strategies[0]->name);
+            out->size = before_gen;  // Rollback to state before strategy
 
-            // Emit absolute jump
-            generate_mov_eax_imm(new_shellcode, (uint32_t)target_addr);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
+            // Use fallback instead
+            fallback_instruction(out, insn, arch);
 
-            // Add NOPs if skip distance needed padding
-            for (uint8_t i = 0; i < nop_count; i++) {
-                uint8_t nop[] = {0x90};
-                buffer_append(new_shellcode, nop, 1);
+            // Verify fallback didn't introduce bad bytes either
+            if (!is_bad_byte_free_buffer(out->data + before_gen,
+                                          out->size - before_gen)) {
+                log_diagnostic("CRITICAL: Fallback also introduced bad bytes!\n");
             }
-            return;
+
+            // Track the failed strategy usage
+            track_strategy_usage(strategies[0]->name, 0, out->size - before_gen);
+        } else {
+            // Track the successful strategy usage
+            track_strategy_usage(strategies[0]->name, 1, out->size - before_gen);
         }
-    }
 
-    // Calculate new relative offset
-    int64_t new_rel = (int64_t)(target_node->new_offset -
-                                (current->new_offset + current->new_size));
+        // Provide feedback to ML model about strategy effectiveness
+        provide_ml_feedback(insn, strategies[0], strategy_success, out->size - before_gen);
 
-    // Handle based on instruction type
-    if (insn->bytes[0] == 0xE8) {
-        // CALL rel32
-        uint8_t patched[5];
-        patched[0] = 0xE8;
-        memcpy(&patched[1], &new_rel, 4);
+    } else {
+        // If no strategy can handle it, use comprehensive fallback
+        fallback_instruction(out, insn, arch);
 
-        // Check for null bytes in patched version
-        int has_null = 0;
-        for (int i = 0; i < 5; i++) {
-            if (patched[i] == 0x00) {
-                has_null = 1;
-                break;
-            }
-        }
+        // Even fallback strategies should provide feedback
+        // In this case we'll treat it as successful if no bad bytes are introduced in the final result
+        int fallback_success = is_bad_byte_free_buffer(
+            out->data + before_gen,
+            out->size - before_gen
+        );
 
-        if (has_null) {
-            // Convert to absolute
-            generate_mov_eax_imm(new_shellcode, target_node->new_offset);
-            uint8_t call_eax[] = {0xFF, 0xD0};
-            buffer_append(new_shellcode, call_eax, 2);
-        } else {
-            buffer_append(new_shellcode, patched, 5);
-        }
-        return;
+        // We don't have a specific strategy pointer for fallback, so we pass NULL
+        // The provide_ml_feedback function handles NULL strategy gracefully
+        provide_ml_feedback(insn, NULL, fallback_success, out->size - before_gen);
     }
+}
 
-    if (insn->bytes[0] == 0xE9) {
-        // JMP rel32
-        uint8_t patched[5];
-        patched[0] = 0xE9;
-        memcpy(&patched[1], &new_rel, 4);
-
-        int has_null = 0;
-        for (int i = 0; i < 5; i++) {
-            if (patched[i] == 0x00) {
-                has_null = 1;
-                break;
-            }
-        }
+// Choose the global strategy assignment before layout: smallest expansions,
+// or the highest-priority ones that fit the size budget (first estimate:
+// everything else keeps its input size)
+static void assign_strategies(assignment_plan_t *plan, struct instruction_node *head, byval_arch_t arch) {
+    size_t budget = current_rewrite_options()->max_output_size;
+    size_t fixed = 0;
 
-        if (has_null) {
-            generate_mov_eax_imm(new_shellcode, target_node->new_offset);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
-        } else {
-            buffer_append(new_shellcode, patched, 5);
-        }
+    if (assignment_collect(plan, head, arch) != 0 || plan->count == 0) {
         return;
     }
+    if (budget == 0) {
+        assignment_minimize(plan);
+    } else {
+        for (struct instruction_node *n = head; n != NULL; n = n->next) {
+            fixed += (n->branch_form == LAYOUT_FORM_NONE) ? n->code.size : n->insn->size;
+        }
+        fixed -= plan->greedy_bytes;
+        assignment_fit(plan, budget > fixed ? budget - fixed : 0);
+    }
+    assignment_apply(plan);
+}
 
-    if (insn->bytes[0] == 0xEB) {
-        // JMP rel8 (short)
-        int8_t new_rel8 = (int8_t)new_rel;
+/*
+ * Fused biphasic rewrite of one instruction: obfuscate it, then denull the
+ * obfuscated snippet instruction by instruction. Only the snippet is
+ * disassembled. Returns 1 if `out` received the final code, or 0 when no
+ * obfuscation applies or the snippet cannot be rewritten piecewise (a dirty
+ * snippet with internal relative references), in which case the caller falls
+ * back to the plain rewrite. `value` receives the strategy priority.
+ */
+static int generate_obfuscated_code(struct buffer *out, csh handle, cs_insn *insn, byval_arch_t arch,
+                                    int *value) {
+    strategy_t *strategy = find_obfuscation_strategy(insn);
+    struct buffer snippet;
+    cs_insn *sub = NULL;
+    size_t sub_count;
+    size_t decoded = 0;
+    int relative = 0;
+    int ok;
+
+    if (strategy == NULL) {
+        return 0;
+    }
+    buffer_init(&snippet);
+    strategy->generate(&snippet, insn);
 
-        if (new_rel == new_rel8 && new_rel8 != 0) {
-            // Fits in 8 bits and no null
-            uint8_t patched[2] = {0xEB, (uint8_t)new_rel8};
-            buffer_append(new_shellcode, patched, 2);
-        } else {
-            // Convert to absolute
-            generate_mov_eax_imm(new_shellcode, target_node->new_offset);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
+    sub_count = (snippet.size > 0)
+                    ? cs_disasm(handle, snippet.data, snippet.size, insn->address, 0, &sub)
+                    : 0;
+    for (size_t i = 0; i < sub_count; i++) {
+        decoded += sub[i].size;
+        if (layout_is_branch(&sub[i], arch) || getpc_base_is_reference(&sub[i], arch)) {
+            relative = 1;
         }
-        return;
     }
+    ok = sub_count > 0 && decoded == snippet.size &&
+         (!relative || is_bad_byte_free_buffer(snippet.data, snippet.size));
 
-    // Conditional jumps (0x70-0x7F range for short, 0x0F 0x80-0x8F for near)
-    if ((insn->bytes[0] >= 0x70 && insn->bytes[0] <= 0x7F)) {
-        // Short conditional jump
-        int8_t new_rel8 = (int8_t)new_rel;
+    if (ok) {
+        // The scratch mask describes the original instruction: a later piece of
+        // the snippet may still read a register or the flags it lists
+        uint32_t scratch = get_scratch_registers();
 
-        if (new_rel == new_rel8 && new_rel8 != 0) {
-            // Fits and no null
-            uint8_t patched[2];
-            patched[0] = insn->bytes[0];
-            patched[1] = (uint8_t)new_rel8;
-            buffer_append(new_shellcode, patched, 2);
-        } else {
-            // Need to convert to jump-over + absolute jump pattern
-            // Jcc opposite, 7; MOV EAX, target; JMP EAX
+        DEBUG_LOG("[OBFUSC] %s %s -> %s (%zu instructions)", insn->mnemonic, insn->op_str,
+                  strategy->name, sub_count);
+        set_scratch_registers(0);
+        for (size_t i = 0; i < sub_count; i++) {
+            generate_instruction_code(out, &sub[i], arch);
+        }
+        set_scratch_registers(scratch);
+        *value = strategy->priority;
+    }
+    if (sub_count > 0) {
+        cs_free(sub, sub_count);
+    }
+    buffer_free(&snippet);
+    return ok;
+}
 
-            // Map to opposite condition
-            uint8_t opposite = insn->bytes[0] ^ 0x01;  // Flip lowest bit
-            uint8_t skip[] = {opposite, 0x07};  // Skip over the absolute jump
-            buffer_append(new_shellcode, skip, 2);
+static void layout_and_emit(struct buffer *out, struct instruction_node *head, byval_arch_t arch,
+                            layout_stats_t *stats, pcrel_stats_t *pcrel_stats) {
+    pcrel_isa_t isa;
 
-            generate_mov_eax_imm(new_shellcode, target_node->new_offset);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
+    memset(pcrel_stats, 0, sizeof(*pcrel_stats));
+    if (pcrel_isa_for_arch(arch, &isa)) {
+        memset(stats, 0, sizeof(*stats));
+        if (pcrel_solve(head, arch, pcrel_stats) != 0) {
+            log_diagnostic("[RELOC] WARNING: PC-relative relocation did not converge\n");
         }
+        out->size = 0;
+        pcrel_emit(out, head, arch);
         return;
     }
-
-#ifdef DEBUG
-    // Debug: Check what we're processing
-    if (strstr(insn->mnemonic, "jne") || strstr(insn->mnemonic, "je")) {
-        fprintf(stderr, "[DEBUG] Processing conditional jump: %s, bytes[0]=0x%02x, bytes[1]=0x%02x, size=%d\n",
-                insn->mnemonic, insn->bytes[0], insn->size > 1 ? insn->bytes[1] : 0, insn->size);
+    if (layout_solve(head, arch, stats) != 0) {
+        log_diagnostic("[LAYOUT] WARNING: branch layout did not converge\n");
     }
-#endif
+    out->size = 0;
+    layout_emit(out, head, arch);
+}
 
-    if (insn->bytes[0] == 0x0F && (insn->bytes[1] >= 0x80 && insn->bytes[1] <= 0x8F)) {
-        // Near conditional jump (0F 8x)
-        uint8_t patched[6];
-        patched[0] = 0x0F;
-        patched[1] = insn->bytes[1];
-        memcpy(&patched[2], &new_rel, 4);
-
-        int has_null = 0;
-        for (int i = 0; i < 6; i++) {
-            if (patched[i] == 0x00) {
-                has_null = 1;
-                break;
-            }
+/*
+ * Chunked instruction generation
+ *
+ * Once branch targets are known, every non-branch instruction is rewritten
+ * into its own node independently of the others, so the list is cut into
+ * chunks of whole basic blocks and the chunks are generated on worker
+ * threads. Layout and relocation stay a single global pass afterwards.
+ *
+ * Chunk boundaries depend only on the payload, and every chunk starts from
+ * the same per-thread state: strategy state is reset and the generator is
+ * reseeded from the run seed and the chunk index. A serial run processes the
+ * same chunks in order, so the output is byte-identical at any thread count.
+ */
+#define GENERATE_CHUNK_INSNS 2048   // Minimum instructions per chunk
+
+typedef struct {
+    struct instruction_node *first;
+    struct instruction_node *end;   // First node of the next chunk (NULL = end of list)
+    uint64_t seed;
+} generate_chunk_t;
+
+typedef struct {
+    generate_chunk_t *chunks;
+    int count;
+    int next;
+    byval_arch_t arch;
+    pthread_mutex_t lock;
+    processing_scope_t scope;   // Of the thread that started the workers
+} generate_queue_t;
+
+static void generate_chunk(const generate_chunk_t *chunk, byval_arch_t arch) {
+    thread_rng_seed(chunk->seed);
+    reset_strategy_thread_state();
+    for (struct instruction_node *n = chunk->first; n != chunk->end; n = n->next) {
+        if (n->branch_form == LAYOUT_FORM_NONE && !n->code_fixed) {
+            set_scratch_registers(layout_scratch_after(n, arch));
+            generate_instruction_code(&n->code, n->insn, arch);
         }
+    }
+    set_scratch_registers(0);
+}
 
-#ifdef DEBUG
-        fprintf(stderr, "[DEBUG] Near cond jump: %s, new_rel=%d, has_null=%d, target_offset=%zu\n",
-                insn->mnemonic, (int32_t)new_rel, has_null, target_node->new_offset);
-#endif
+static void *generate_worker(void *arg) {
+    generate_queue_t *queue = arg;
 
-        if (has_null) {
-            // Convert using opposite condition trick
-            // Use short conditional jump to skip (avoids null bytes in displacement)
-            // Calculate skip size: generate_mov_eax_imm size + JMP EAX (2 bytes)
-            size_t mov_size = get_mov_eax_imm_size(target_node->new_offset);
-            size_t skip_size = mov_size + 2;
+    set_processing_scope(&queue->scope);
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) {
+            return NULL;
+        }
+        generate_chunk(&queue->chunks[index], queue->arch);
+    }
+}
 
-#ifdef DEBUG
-            fprintf(stderr, "[DEBUG] Transformation: mov_size=%zu, skip_size=%zu\n", mov_size, skip_size);
-#endif
+// Rewrite every non-branch node; returns the number of instructions
+static int generate_all_instructions(struct instruction_node *head, size_t size, byval_arch_t arch) {
+    char *leader = calloc(size + 1, 1);   // Basic block starts, by input offset
+    generate_chunk_t *chunks = NULL;
+    int insn_count = 0;
+    int chunk_count = 0;
+    uint64_t base_seed = ((uint64_t)thread_rng_next() << 32) | thread_rng_next();
 
-            // Check if skip_size fits in signed byte (range -128 to +127)
-            if (skip_size > 127) {
-#ifdef DEBUG
-                fprintf(stderr, "[WARNING] skip_size=%zu too large for short jump! Falling back to original.\n", skip_size);
-#endif
-                buffer_append(new_shellcode, patched, 6);
-                return;
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        insn_count++;
+        if (leader && n->branch_form != LAYOUT_FORM_NONE) {
+            if (n->target) {
+                leader[n->target->offset] = 1;
+            }
+            if (n->next) {
+                leader[n->next->offset] = 1;
             }
-
-            // Convert near conditional to short conditional (0F 8x -> 7x)
-            uint8_t opposite_short = 0x70 + ((insn->bytes[1] ^ 0x01) & 0x0F);
-            uint8_t skip[] = {opposite_short, (uint8_t)skip_size};
-            buffer_append(new_shellcode, skip, 2);
-
-            generate_mov_eax_imm(new_shellcode, target_node->new_offset);
-            uint8_t jmp_eax[] = {0xFF, 0xE0};
-            buffer_append(new_shellcode, jmp_eax, 2);
-        } else {
-            buffer_append(new_shellcode, patched, 6);
         }
-        return;
     }
-
-    // Unknown jump type - conservative fallback, but ensure no null bytes
-    // Use MOV EAX, target + JMP EAX approach to avoid any nulls
-#ifdef DEBUG
-    fprintf(stderr, "[WARNING] Unknown jump type encountered: %s %s\n", insn->mnemonic, insn->op_str);
-    fprintf(stderr, "[WARNING] Using safe fallback conversion\n");
-#endif
-
-    // Get target address from immediate operand if available
-    uint32_t target = 0;
-    int target_found = 0;
-
-    for (int i = 0; i < insn->detail->x86.op_count; i++) {
-        if (insn->detail->x86.operands[i].type == X86_OP_IMM) {
-            target = (uint32_t)insn->detail->x86.operands[i].imm;
-            target_found = 1;
-            break;
+    chunks = calloc((size_t)insn_count / GENERATE_CHUNK_INSNS + 1, sizeof(*chunks));
+    if (!leader || !chunks) {
+        // No memory for the bookkeeping: one chunk, generated here
+        generate_chunk_t whole = {head, NULL, thread_rng_mix(base_seed)};
+        generate_chunk(&whole, arch);
+        free(leader);
+        free(chunks);
+        return insn_count;
+    }
+
+    // Cut at the first block start after every GENERATE_CHUNK_INSNS instructions
+    int in_chunk = 0;
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (chunk_count == 0 || (in_chunk >= GENERATE_CHUNK_INSNS && leader[n->offset])) {
+            if (chunk_count > 0) {
+                chunks[chunk_count - 1].end = n;
+            }
+            chunks[chunk_count].first = n;
+            chunks[chunk_count].seed = thread_rng_mix(base_seed + (uint64_t)chunk_count);
+            chunk_count++;
+            in_chunk = 0;
         }
+        in_chunk++;
     }
+    free(leader);
 
-    if (target_found) {
-        // Convert to MOV EAX, target + JMP EAX
-        generate_mov_eax_imm(new_shellcode, target);
-        if (insn->id == X86_INS_CALL) {
-            uint8_t call_eax[] = {0xFF, 0xD0}; // CALL EAX
-            buffer_append(new_shellcode, call_eax, 2);
-        } else {
-            uint8_t jmp_eax[] = {0xFF, 0xE0}; // JMP EAX
-            buffer_append(new_shellcode, jmp_eax, 2);
+    long threads = current_rewrite_options()->threads;
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > chunk_count) {
+        threads = chunk_count;
+    }
+
+    processing_scope_t scope;
+    get_processing_scope(&scope);
+    generate_queue_t queue = {chunks, chunk_count, 0, arch, PTHREAD_MUTEX_INITIALIZER, scope};
+    pthread_t *workers = (threads > 1) ? calloc((size_t)threads, sizeof(*workers)) : NULL;
+    int started = 0;
+    for (long i = 0; workers && i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, generate_worker, &queue) == 0) {
+            started++;
         }
-    } else {
-        // If no immediate target, just use safe NOP equivalent
-        uint8_t nop_seq[] = {0x90}; // NOP (0x90) - safe and null-free
-        buffer_append(new_shellcode, nop_seq, 1);
     }
+    if (started == 0) {
+        generate_worker(&queue);  // Serial: the same chunks, in order
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    if (started > 1) {
+        log_diagnostic("[PARALLEL] %d instructions in %d chunks on %d threads\n",
+                       insn_count, chunk_count, started);
+    }
+    free(workers);
+    free(chunks);
+    return insn_count;
 }
 
-struct buffer remove_null_bytes(const uint8_t *shellcode, size_t size, byval_arch_t arch) {
+/*
+ * Disassemble once, rewrite every instruction into its node, then lay out and
+ * relocate the whole payload. With `obfuscate` (biphasic mode) each non-branch
+ * instruction is obfuscated and denulled in the same traversal; branches stay
+ * layout nodes, so their targets are relocated across the obfuscated code.
+ */
+static struct buffer rewrite_payload(const uint8_t *shellcode, size_t size, byval_arch_t arch,
+                                     int obfuscate) {
+    const rewrite_options_t *options = current_rewrite_options();
     csh handle;
     cs_insn *insn_array;
     size_t count;
     struct buffer new_shellcode;
     buffer_init(&new_shellcode);
 
-    fprintf(stderr, "[remove_null_bytes] Called with shellcode=%p, size=%zu\n", (void*)shellcode, size);
+    log_diagnostic("[remove_null_bytes] Called with shellcode=%p, size=%zu\n", (void*)shellcode, size);
     if (!shellcode) {
-        fprintf(stderr, "[ERROR] shellcode pointer is NULL!\n");
+        log_diagnostic("[ERROR] shellcode pointer is NULL!\n");
         return new_shellcode;
     }
-    fprintf(stderr, "[FIRST 16 BYTES] ");
+    log_diagnostic("[FIRST 16 BYTES] ");
     for (size_t i = 0; i < size && i < 16; ++i) {
-        fprintf(stderr, "%02x ", shellcode[i]);
+        log_diagnostic("%02x ", shellcode[i]);
     }
-    fprintf(stderr, "\n");
+    log_diagnostic("\n");
 
     cs_arch cs_arch;
     cs_mode cs_mode;
     get_capstone_arch_mode(arch, &cs_arch, &cs_mode);
     if (cs_open(cs_arch, cs_mode, &handle) != CS_ERR_OK) {
-        fprintf(stderr, "[ERROR] cs_open failed!\n");
+        log_diagnostic("[ERROR] cs_open failed!\n");
         return new_shellcode;
     }
 
     cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
 
     count = cs_disasm(handle, shellcode, size, 0, 0, &insn_array);
-    fprintf(stderr, "[DISASM] Disassembled %zu instructions from %zu bytes\n", count, size);
+    log_diagnostic("[DISASM] Disassembled %zu instructions from %zu bytes\n", count, size);
     if (count == 0 || insn_array == NULL) {
-        fprintf(stderr, "[ERROR] cs_disasm returned 0 instructions or NULL array!\n");
-        fprintf(stderr, "[ERROR] Input file does not appear to contain valid x86 shellcode.\n");
+        log_diagnostic("[ERROR] cs_disasm returned 0 instructions or NULL array!\n");
+        log_diagnostic("[ERROR] Input file does not appear to contain valid x86 shellcode.\n");
         cs_close(&handle);
         return new_shellcode;
     }
@@ -854,12 +973,10 @@ struct buffer remove_null_bytes(const uint8_t *shellcode, size_t size, byval_arc
     offset_hash_init();  // Initialize hash table
 
     for (size_t i = 0; i < count; i++) {
-        struct instruction_node *node = malloc(sizeof(struct instruction_node));
+        struct instruction_node *node = calloc(1, sizeof(struct instruction_node));
         node->insn = &insn_array[i];
         node->offset = insn_array[i].address;
-        node->new_size = 0;
-        node->new_offset = 0;
-        node->next = NULL;
+        buffer_init(&node->code);
 
         // Insert into hash table for O(1) target lookup
         offset_hash_insert(node->offset, node);
@@ -873,142 +990,192 @@ struct buffer remove_null_bytes(const uint8_t *shellcode, size_t size, byval_arc
         }
     }
 
-    // First pass: calculate new sizes for each instruction
-    current = head;
-    while (current != NULL) {
-        // Check if instruction contains bad bytes (v3.0: generic check)
-        int has_bad_bytes = !is_bad_byte_free_buffer(current->insn->bytes, current->insn->size);
-
-        // Special handling for relative jumps - they're transformed in process_relative_jump()
-        // not via strategies, so we need to estimate their size here
-        if (is_relative_jump(current->insn)) {
-            if (has_bad_bytes || current->insn->size > 2) {
-                // Relative jump might need transformation
-                // Conservative estimate: opposite short jump (2) + MOV EAX (5-20) + JMP EAX (2)
-                // Use worst-case: 2 + 20 + 2 = 24 bytes
-                current->new_size = 24;
-            } else {
-                // Short jump without bad chars, likely stays same size
-                current->new_size = current->insn->size;
-            }
-        } else if (has_bad_bytes) {
-            // Use strategy pattern to get new size
-            int strategy_count;
-            strategy_t** strategies = get_strategies_for_instruction(current->insn, &strategy_count, arch);
-
-            if (strategy_count > 0) {
-                current->new_size = strategies[0]->get_size(current->insn);
-            } else {
-                // Fallback to original size if no strategy available
-                current->new_size = current->insn->size;
-            }
-        } else {
-            current->new_size = current->insn->size;
+    // First pass: classify relative branches and RIP-relative references,
+    // which are left to the layout solver since they need final offsets
+    int rip_refs = 0;
+    for (current = head; current != NULL; current = current->next) {
+        if (layout_is_branch(current->insn, arch)) {
+            uint64_t target_addr = (uint64_t)current->insn->detail->x86.operands[0].imm;
+            current->target = offset_hash_lookup(target_addr);  // NULL = external target
+            current->branch_form = LAYOUT_FORM_SHORT;
+        } else if (getpc_base_is_reference(current->insn, arch)) {
+            int64_t target_addr = getpc_base_reference_target(current->insn);
+            current->target = (target_addr >= 0) ? offset_hash_lookup((uint64_t)target_addr) : NULL;
+            current->branch_form = LAYOUT_FORM_RIP_DATA;
+            rip_refs++;
+        }
+    }
+    // ARM, Thumb and A64 PC-relative forms (no-op on x86)
+    pcrel_classify(head, arch, offset_hash_lookup);
+    // Returns of internal calls are not payload exits for the liveness scans
+    layout_mark_internal_returns(head, arch);
+
+    // Register renaming changes encodings only, so it comes first and the
+    // rewrites below see the renamed instructions
+    if (options->rename_registers) {
+        register_renaming_apply(head, arch);
+    }
+
+    // Registers the rewrite holds across instructions are kept out of every
+    // strategy scratch mask and branch thunk (layout_scratch_after). The copy
+    // leaves a library context's options untouched; generation workers
+    // inherit it with the scope.
+    rewrite_options_t held_options = *options;
+    processing_scope_t saved_scope, held_scope;
+    get_processing_scope(&saved_scope);
+    held_scope = saved_scope;
+    held_scope.rewrite = &held_options;
+    set_processing_scope(&held_scope);
+    options = &held_options;
+
+    // One shared GetPC base serves every RIP-relative reference and
+    // constant-pool load; choose it now so nothing below takes it
+    x86_reg base_reg = X86_REG_INVALID;
+    if (rip_refs > 0 || options->constant_pool) {
+        base_reg = getpc_base_select_register(head, arch);
+        if (base_reg != X86_REG_INVALID) {
+            held_options.reserved_mask |= 1u << layout_gpr_family(base_reg, NULL);
         }
-        current = current->next;
     }
 
-    // Second pass: calculate new offsets
-    current = head;
-    size_t running_offset = 0;
-    while (current != NULL) {
-        current->new_offset = running_offset;
-        running_offset += current->new_size;
-        current = current->next;
+    // Optional region-level rewrites (need the branch targets above to find
+    // straight-line regions)
+    if (options->constant_reuse) {
+        constant_reuse_apply(head, arch, generate_instruction_code, &held_options.reserved_mask);
+    }
+    if (options->rebase_displacements) {
+        displacement_rebase_apply(head, arch);
     }
 
-    // Third pass: generate new shellcode
-    current = head;
-    int insn_count = 0;
+    // ...then rewrite every other instruction so sizes are exact: in parallel
+    // chunks for the plain rewrite, in one traversal when obfuscating. Under an
+    // obfuscation budget, obfuscations become candidates next to the plain
+    // rewrite and are chosen afterwards (see obfuscation_budget.h)
+    current = obfuscate ? head : NULL;
+    int insn_count = obfuscate ? 0 : generate_all_instructions(head, size, arch);
+    int obfuscated_count = 0;
+    int budgeted = obfuscate && options->obfuscation_budget_kind != OBFUSCATION_BUDGET_NONE;
+    obfuscation_plan_t obfuscation_plan;
+    memset(&obfuscation_plan, 0, sizeof(obfuscation_plan));
     while (current != NULL) {
         insn_count++;
-        int has_bad_bytes = !is_bad_byte_free_buffer(current->insn->bytes, current->insn->size);
-#ifdef DEBUG
-        fprintf(stderr, "[GEN] Insn #%d: %s %s (has_bad_bytes=%d, size=%d)\n",
-                insn_count, current->insn->mnemonic, current->insn->op_str,
-                has_bad_bytes, current->insn->size);
-#endif
-
-        if (is_relative_jump(current->insn)) {
-            process_relative_jump(&new_shellcode, current->insn, current, head);
-        } else if (has_bad_bytes) {
-            // Use strategy pattern if it has nulls
-            int strategy_count;
-            size_t before_gen = new_shellcode.size;
-            strategy_t** strategies = get_strategies_for_instruction(current->insn, &strategy_count, arch);
-
-            if (strategy_count > 0) {
-                // Use the first (highest priority) strategy to generate code
 #ifdef DEBUG
-                fprintf(stderr, "[TRACE] Using strategy '%s' for: %s %s\n",
-                       strategies[0]->name, current->insn->mnemonic, current->insn->op_str);
+        log_diagnostic("[GEN] Insn #%d: %s %s (has_bad_bytes=%d, size=%d)\n",
+                       insn_count, current->insn->mnemonic, current->insn->op_str,
+                       !is_bad_byte_free_buffer(current->insn->bytes, current->insn->size),
+                       current->insn->size);
 #endif
 
-                // Before generating, try to get the ML confidence for this strategy
-                // For now, we'll use a basic approach and record the prediction accuracy after generation
-                strategies[0]->generate(&new_shellcode, current->insn);
-
-                // Check if the strategy was successful (i.e., didn't introduce bad bytes)
-                int strategy_success = is_bad_byte_free_buffer(
-                    new_shellcode.data + before_gen,
-                    new_shellcode.size - before_gen
-                );
-
-                if (!strategy_success) {
-                    fprintf(stderr, "ERROR: Strategy '%s' introduced bad bytes\n",
-                           strategies[0]->name);
-                }
-
-                // CRITICAL FIX: Rollback buffer if strategy introduced bad bytes
-                if (!strategy_success) {
-                    fprintf(stderr, "ROLLBACK: Reverting strategy '%s' output, using fallback\n",
-                           strategies[0]->name);
-                    new_shellcode.size = before_gen;  // Rollback to state before strategy
-
-                    // Use fallback instead
-                    fallback_general_instruction(&new_shellcode, current->insn);
-
-                    // Verify fallback didn't introduce bad bytes either
-                    if (!is_bad_byte_free_buffer(new_shellcode.data + before_gen,
-                                                  new_shellcode.size - before_gen)) {
-                        fprintf(stderr, "CRITICAL: Fallback also introduced bad bytes!\n");
-                    }
-
-                    // Track the failed strategy usage
-                    if (g_batch_stats_context) {
-                        track_strategy_usage(strategies[0]->name, 0, new_shellcode.size - before_gen);
-                    }
-                } else {
-                    // Track the successful strategy usage
-                    if (g_batch_stats_context) {
-                        track_strategy_usage(strategies[0]->name, 1, new_shellcode.size - before_gen);
-                    }
+        if (current->branch_form == LAYOUT_FORM_NONE && !current->code_fixed) {
+            set_scratch_registers(layout_scratch_after(current, arch));
+            int value = 0;
+            if (budgeted) {
+                struct buffer candidate;
+                buffer_init(&candidate);
+                generate_instruction_code(&current->code, current->insn, arch);
+                if (generate_obfuscated_code(&candidate, handle, current->insn, arch, &value) &&
+                    obfuscation_plan_add(&obfuscation_plan, current, &candidate,
+                                         current->code.size, value) != 0) {
+                    log_diagnostic("[OBFUSC] WARNING: out of memory, obfuscation candidate dropped\n");
                 }
-
-                // Provide feedback to ML model about strategy effectiveness
-                provide_ml_feedback(current->insn, strategies[0], strategy_success, new_shellcode.size - before_gen);
-
+                buffer_free(&candidate);
+            } else if (obfuscate && generate_obfuscated_code(&current->code, handle, current->insn,
+                                                             arch, &value)) {
+                current->code_fixed = 1;  // Keep the obfuscated form through assignment and pooling
+                obfuscated_count++;
             } else {
-                // If no strategy can handle it, use comprehensive fallback
-                fallback_general_instruction(&new_shellcode, current->insn);
+                generate_instruction_code(&current->code, current->insn, arch);
+            }
+        }
+        current = current->next;
+    }
+    set_scratch_registers(0);
+    if (budgeted) {
+        size_t budget = obfuscation_budget_bytes(options->obfuscation_budget_kind,
+                                                 options->obfuscation_budget, size);
+        size_t wanted = 0;
+        for (int i = 0; i < obfuscation_plan.count; i++) {
+            wanted += obfuscation_plan.items[i].cost;
+        }
+        obfuscated_count = obfuscation_plan_select(&obfuscation_plan, budget);
+        obfuscation_plan_apply(&obfuscation_plan);
+        log_diagnostic("[OBFUSC] Budget %zu bytes: %d of %d obfuscations kept, +%zu of +%zu bytes (%.1f%% growth)\n",
+                       budget, obfuscated_count, obfuscation_plan.count, obfuscation_plan.spent, wanted,
+                       100.0 * (double)obfuscation_plan.spent / (double)size);
+        obfuscation_plan_free(&obfuscation_plan);
+    }
+    if (obfuscate) {
+        log_diagnostic("[OBFUSC] %d of %d instructions obfuscated\n", obfuscated_count, insn_count);
+    }
+
+    // Optional global strategy assignment over every candidate expansion
+    assignment_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    if (options->optimize_size || options->max_output_size > 0) {
+        assign_strategies(&plan, head, arch);
+    }
+
+    // The GetPC base goes ahead of the entry (emitted only if the layout ends
+    // up using it)
+    struct instruction_node *base_setup = NULL;
+    struct instruction_node *pool = NULL;
+    if (rip_refs > 0 || options->constant_pool) {
+        if (base_reg != X86_REG_INVALID && options->constant_pool) {
+            pool = constant_pool_build(head, arch, base_reg, rip_refs > 0);
+        }
+        if (base_reg != X86_REG_INVALID && (rip_refs > 0 || pool)) {
+            base_setup = getpc_base_create_setup(base_reg, arch);
+        }
+        if (base_setup) {
+            base_setup->next = head;
+            head = base_setup;
+        }
+        if (pool) {
+            // Data goes after the last instruction
+            struct instruction_node *tail = head;
+            while (tail->next != NULL) {
+                tail = tail->next;
+            }
+            tail->next = pool;
+        }
+    }
 
-                // Even fallback strategies should provide feedback
-                // In this case we'll treat it as successful if no bad bytes are introduced in the final result
-                int fallback_success = is_bad_byte_free_buffer(
-                    new_shellcode.data + before_gen,
-                    new_shellcode.size - before_gen
-                );
+    // Second and third pass: choose branch encodings, padding and final
+    // offsets, then emit the final shellcode
+    layout_stats_t layout_stats;
+    pcrel_stats_t pcrel_stats;
+    layout_and_emit(&new_shellcode, head, arch, &layout_stats, &pcrel_stats);
 
-                // We don't have a specific strategy pointer for fallback, so we pass NULL
-                // The provide_ml_feedback function handles NULL strategy gracefully
-                provide_ml_feedback(current->insn, NULL, fallback_success, new_shellcode.size - before_gen);
+    // Over budget: charge the measured layout overhead to the assignment and retry
+    size_t max_output = options->max_output_size;
+    for (int round = 0; plan.count > 0 && max_output > 0 && new_shellcode.size > max_output &&
+                        round < ASSIGNMENT_MAX_ROUNDS; round++) {
+        size_t chosen = assignment_chosen_bytes(&plan);
+        size_t overhead = new_shellcode.size - chosen;
 
-            }
-        } else {
-            // No bad bytes, output original instruction
-            buffer_append(&new_shellcode, current->insn->bytes, current->insn->size);
+        assignment_fit(&plan, max_output > overhead ? max_output - overhead : 0);
+        if (assignment_chosen_bytes(&plan) >= chosen) {
+            break;  // Already at the smallest expansions
         }
-        current = current->next;
+        assignment_apply(&plan);
+        layout_and_emit(&new_shellcode, head, arch, &layout_stats, &pcrel_stats);
+    }
+    if (plan.count > 0) {
+        log_diagnostic("[ASSIGN] %d instructions with alternatives: %zu -> %zu bytes; output %zu bytes",
+                       plan.count, plan.greedy_bytes, assignment_chosen_bytes(&plan), new_shellcode.size);
+        if (max_output > 0) {
+            log_diagnostic(" (budget %zu%s)", max_output,
+                           new_shellcode.size > max_output ? ", NOT MET" : "");
+        }
+        log_diagnostic("\n");
+    }
+    assignment_free(&plan);
+
+    if (layout_stats.branches > 0 || layout_stats.data_refs > 0 || layout_stats.pool_constants > 0) {
+        layout_print_stats(&layout_stats);
+    }
+    if (pcrel_stats.references > 0 || pcrel_stats.page_refs > 0) {
+        pcrel_print_stats(&pcrel_stats);
     }
 
     // Final verification - DO THIS BEFORE CLEANUP
@@ -1017,41 +1184,47 @@ struct buffer remove_null_bytes(const uint8_t *shellcode, size_t size, byval_arc
     for (size_t i = 0; i < new_shellcode.size; i++) {
         if (!is_bad_byte_free_byte(new_shellcode.data[i])) {
             bad_byte_count++;
-            fprintf(stderr, "WARNING: Bad character 0x%02x at offset %zu\n", new_shellcode.data[i], i);
+            log_diagnostic("WARNING: Bad character 0x%02x at offset %zu\n", new_shellcode.data[i], i);
 
             // Try to identify which original instruction caused this bad byte
             struct instruction_node *debug_node = head;
-            size_t current_offset = 0;
             while (debug_node != NULL) {
-                if (current_offset <= i && i < current_offset + debug_node->new_size) {
-                    fprintf(stderr, "  Caused by instruction at original offset 0x%lx: %s %s\n",
+                size_t node_start = debug_node->new_offset - debug_node->pad_before;
+                if (node_start <= i && i < debug_node->new_offset + debug_node->new_size) {
+                    log_diagnostic("  Caused by instruction at original offset 0x%lx: %s %s\n",
                            debug_node->offset,
                            debug_node->insn->mnemonic,
                            debug_node->insn->op_str);
                     break;
                 }
-                current_offset += debug_node->new_size;
                 debug_node = debug_node->next;
             }
         }
     }
 
     if (bad_byte_count > 0) {
-        fprintf(stderr, "\nERROR: Final shellcode contains %d bad bytes\n", bad_byte_count);
-        fprintf(stderr, "Recompile with -DDEBUG for details\n");
+        log_diagnostic("\nERROR: Final shellcode contains %d bad bytes\n", bad_byte_count);
+        log_diagnostic("Recompile with -DDEBUG for details\n");
     } else {
         DEBUG_LOG("SUCCESS: No bad bytes in final shellcode");
     }
 
     // Clean up only AFTER verification
     offset_hash_free();  // Free hash table
+    getpc_base_free_setup(base_setup);
+    constant_pool_free(pool);
     free_instruction_node_list(head);
     cs_free(insn_array, count);
 
     cs_close(&handle);
+    set_processing_scope(&saved_scope);
     return new_shellcode;
 }
 
+struct buffer remove_null_bytes(const uint8_t *shellcode, size_t size, byval_arch_t arch) {
+    return rewrite_payload(shellcode, size, arch, 0);
+}
+
 int verify_null_elimination(struct buffer *processed) {
     // Check if processed buffer still contains null bytes
     for (size_t i = 0; i < processed->size; i++) {
@@ -1286,9 +1459,9 @@ void fallback_general_instruction(struct buffer *b, cs_insn *insn) {
             // If we still can't handle it with specific logic, use a general approach:
             // Load the instruction's raw bytes into EAX and push/pop to memory
             // This ensures no null bytes remain by encoding the instruction differently
-            fprintf(stderr, "WARNING: Fallback could not handle: %s %s\n",
+            log_diagnostic("WARNING: Fallback could not handle: %s %s\n",
                    insn->mnemonic, insn->op_str);
-            fprintf(stderr, "  Using general encoding fallback to eliminate null bytes\n");
+            log_diagnostic("  Using general encoding fallback to eliminate null bytes\n");
 
             // General approach: encode the instruction bytes as immediate values and reconstruct
             // This is a last resort for handling any instruction with null bytes
@@ -1383,7 +1556,7 @@ void fallback_memory_operation(struct buffer *b, cs_insn *insn) {
         // Use NOP (0x90) as a safe instruction that doesn't change program flow significantly
         uint8_t nop_seq[] = {0x90}; // NOP (0x90) - safe and null-free
         buffer_append(b, nop_seq, 1);
-        fprintf(stderr, "[WARNING] Using NOP fallback for unhandled memory operation: %s %s\n",
+        log_diagnostic("[WARNING] Using NOP fallback for unhandled memory operation: %s %s\n",
                insn->mnemonic, insn->op_str);
     }
 }
@@ -1500,8 +1673,8 @@ void handle_unhandled_instruction_with_nulls(struct buffer *b, cs_insn *insn) {
     // we need a general approach that's guaranteed to eliminate null bytes while
     // preserving the instruction's semantics.
 
-    fprintf(stderr, "Handling unhandled instruction: %s %s (size: %d)\n",
-            insn->mnemonic, insn->op_str, insn->size);
+    log_diagnostic("Handling unhandled instruction: %s %s (size: %d)\n",
+                   insn->mnemonic, insn->op_str, insn->size);
 
     // Check if the instruction truly has null bytes
     int has_nulls = 0;
@@ -1576,8 +1749,6 @@ void handle_unhandled_instruction_with_nulls(struct buffer *b, cs_insn *insn) {
 // Pass 2: Null-Byte Elimination
 // ============================================================================ 
 
-#include "obfuscation_strategy_registry.h"
-
 /*
  * Pass 1: Apply Obfuscation Transformations
  * 
@@ -1592,21 +1763,21 @@ struct buffer apply_obfuscation(const uint8_t *shellcode, size_t size, byval_arc
     struct buffer obfuscated;
     buffer_init(&obfuscated);
 
-    fprintf(stderr, "\n=== PASS 1: OBFUSCATION ===\n");
-    fprintf(stderr, "[OBFUSC] Input size: %zu bytes\n", size);
+    log_diagnostic("\n=== PASS 1: OBFUSCATION ===\n");
+    log_diagnostic("[OBFUSC] Input size: %zu bytes\n", size);
 
     cs_arch cs_arch;
     cs_mode cs_mode;
     get_capstone_arch_mode(arch, &cs_arch, &cs_mode);
     if (cs_open(cs_arch, cs_mode, &handle) != CS_ERR_OK) {
-        fprintf(stderr, "[ERROR] Obfuscation: cs_open failed!\n");
+        log_diagnostic("[ERROR] Obfuscation: cs_open failed!\n");
         return obfuscated;
     }
 
     cs_option(handle, CS_OPT_DETAIL, CS_OPT_ON);
     count = cs_disasm(handle, shellcode, size, 0, 0, &insn_array);
 
-    fprintf(stderr, "[OBFUSC] Disassembled %zu instructions\n", count);
+    log_diagnostic("[OBFUSC] Disassembled %zu instructions\n", count);
 
     if (count == 0) {
         cs_close(&handle);
@@ -1624,8 +1795,8 @@ struct buffer apply_obfuscation(const uint8_t *shellcode, size_t size, byval_arc
 
         if (strategy != NULL) {
             // Apply obfuscation
-            fprintf(stderr, "[OBFUSC] %s %s → %s\n",
-                    insn->mnemonic, insn->op_str, strategy->name);
+            log_diagnostic("[OBFUSC] %s %s → %s\n",
+                           insn->mnemonic, insn->op_str, strategy->name);
 
             size_t before_obfusc = obfuscated.size;
             strategy->generate(&obfuscated, insn);
@@ -1634,7 +1805,7 @@ struct buffer apply_obfuscation(const uint8_t *shellcode, size_t size, byval_arc
             int obfusc_success = 1;
             for (size_t j = before_obfusc; j < obfuscated.size; j++) {
                 if (obfuscated.data[j] == 0x00) {
-                    fprintf(stderr, "ERROR: Obfuscation strategy '%s' introduced null at offset %zu\n",
+                    log_diagnostic("ERROR: Obfuscation strategy '%s' introduced null at offset %zu\n",
                            strategy->name, j - before_obfusc);
                     obfusc_success = 0;
                     break;
@@ -1643,7 +1814,7 @@ struct buffer apply_obfuscation(const uint8_t *shellcode, size_t size, byval_arc
 
             // Rollback if obfuscation introduced nulls
             if (!obfusc_success) {
-                fprintf(stderr, "ROLLBACK: Reverting obfuscation, using original instruction\n");
+                log_diagnostic("ROLLBACK: Reverting obfuscation, using original instruction\n");
                 obfuscated.size = before_obfusc;
                 buffer_append(&obfuscated, insn->bytes, insn->size);
             }
@@ -1656,52 +1827,49 @@ struct buffer apply_obfuscation(const uint8_t *shellcode, size_t size, byval_arc
     cs_free(insn_array, count);
     cs_close(&handle);
 
-    fprintf(stderr, "[OBFUSC] Output size: %zu bytes (%.1f%% expansion)\n",
-            obfuscated.size, ((float)obfuscated.size / size - 1.0) * 100.0);
-    fprintf(stderr, "=== PASS 1 COMPLETE ===\n\n");
+    log_diagnostic("[OBFUSC] Output size: %zu bytes (%.1f%% expansion)\n",
+                   obfuscated.size, ((float)obfuscated.size / size - 1.0) * 100.0);
+    log_diagnostic("=== PASS 1 COMPLETE ===\n\n");
 
     return obfuscated;
 }
 
 /*
  * Biphasic Processing Pipeline
- * 
+ *
  * Combines Pass 1 (Obfuscation) and Pass 2 (Null-Elimination) for
- * maximum evasion and null-byte elimination.
+ * maximum evasion and null-byte elimination. Both passes run fused in one
+ * traversal of the disassembly (see rewrite_payload): every instruction is
+ * obfuscated and immediately denulled, and a single layout stage relocates
+ * the branches of the obfuscated code.
  */
 struct buffer biphasic_process(const uint8_t *shellcode, size_t size, byval_arch_t arch) {
-    fprintf(stderr, "\n");
-    fprintf(stderr, "╔════════════════════════════════════════════════════════╗\n");
-    fprintf(stderr, "║  BYVALVER BIPHASIC PROCESSING PIPELINE                ║\n");
-    fprintf(stderr, "╚════════════════════════════════════════════════════════╝\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Original shellcode: %zu bytes\n", size);
-
-    // Pass 1: Obfuscation & Complexification
-    struct buffer pass1_output = apply_obfuscation(shellcode, size, arch);
-
-    if (pass1_output.size == 0) {
-        fprintf(stderr, "[ERROR] Pass 1 failed, aborting biphasic processing\n");
-        return pass1_output;
-    }
-
-    // Pass 2: Null-Byte Elimination
-    fprintf(stderr, "=== PASS 2: NULL-BYTE ELIMINATION ===\n");
-    struct buffer pass2_output = remove_null_bytes(pass1_output.data, pass1_output.size, arch);
-    
-    // Free Pass 1 intermediate buffer
-    buffer_free(&pass1_output);
-
-    fprintf(stderr, "=== PASS 2 COMPLETE ===\n\n");
-    fprintf(stderr, "╔════════════════════════════════════════════════════════╗\n");
-    fprintf(stderr, "║  BIPHASIC PROCESSING COMPLETE                          ║\n");
-    fprintf(stderr, "╚════════════════════════════════════════════════════════╝\n");
-    fprintf(stderr, "\n");
-    fprintf(stderr, "Input:  %zu bytes\n", size);
-    fprintf(stderr, "Output: %zu bytes (%.1f%% change)\n",
-            pass2_output.size, ((float)pass2_output.size / size - 1.0) * 100.0);
-
-    return pass2_output;
+    log_diagnostic("\n");
+    log_diagnostic("╔════════════════════════════════════════════════════════╗\n");
+    log_diagnostic("║  BYVALVER BIPHASIC PROCESSING PIPELINE                ║\n");
+    log_diagnostic("╚════════════════════════════════════════════════════════╝\n");
+    log_diagnostic("\n");
+    log_diagnostic("Original shellcode: %zu bytes\n", size);
+
+    // Pass 1 + Pass 2: Obfuscation and Null-Byte Elimination, per instruction
+    log_diagnostic("=== FUSED PASS: OBFUSCATION + NULL-BYTE ELIMINATION ===\n");
+    struct buffer output = rewrite_payload(shellcode, size, arch, 1);
+
+    if (output.size == 0) {
+        log_diagnostic("[ERROR] Fused pass failed, aborting biphasic processing\n");
+        return output;
+    }
+
+    log_diagnostic("=== FUSED PASS COMPLETE ===\n\n");
+    log_diagnostic("╔════════════════════════════════════════════════════════╗\n");
+    log_diagnostic("║  BIPHASIC PROCESSING COMPLETE                          ║\n");
+    log_diagnostic("╚════════════════════════════════════════════════════════╝\n");
+    log_diagnostic("\n");
+    log_diagnostic("Input:  %zu bytes\n", size);
+    log_diagnostic("Output: %zu bytes (%.1f%% change)\n",
+                   output.size, ((float)output.size / size - 1.0) * 100.0);
+
+    return output;
 }
 
 // Function to count instructions and bad bytes in shellcode
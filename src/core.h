@@ -8,6 +8,7 @@
 #include "strategy.h"
 #include "cli.h"  // For bad_byte_config_t
 #include "batch_processing.h"  // For batch_stats_t
+#include "arm_immediate_encoding.h"  // For arm_imm_table_t
 
 // Capstone architecture mode selector
 void get_capstone_arch_mode(byval_arch_t arch, cs_arch *cs_arch_out, cs_mode *cs_mode_out);
@@ -34,24 +35,86 @@ struct instruction_node {
     size_t new_offset;
     size_t new_size;
     struct instruction_node *next;
+
+    // Layout state (see branch_layout.h)
+    struct buffer code;                 // Rewritten bytes for non-branch instructions
+    struct instruction_node *target;    // In-payload branch target, NULL if external
+    int branch_form;                    // layout_form_t, 0 for non-branches
+    size_t pad_before;                  // Padding emitted ahead of this instruction
+    size_t pool_offset;                 // Constant-pool entry offset (LAYOUT_FORM_POOL_LOAD)
+    int pool_index;                     // Pool entry (POOL_LOAD), number of entries (POOL_DATA)
+    uint32_t pool_key;                  // XOR key of the pool entries (POOL_LOAD, POOL_DATA)
+    int pool_save_flags;                // POOL_LOAD: flags live after it, decode inside PUSHF/POPF
+    x86_reg base_reg;                   // Register a LAYOUT_FORM_BASE_SETUP node loads
+    int32_t base_disp;                  // Base value minus the address its GetPC yields
+    int code_fixed;                     // node->code depends on neighbouring nodes; keep it as is
+    struct instruction_node *island;    // Branch island hosted ahead of this node: JMP to `island`
+    int island_form;                    // layout_form_t of that JMP (rel8 or rel32)
+    struct instruction_node *via;       // Branch routed through the island hosted by this node
+    int pcrel_form;                     // Encoding form of a LAYOUT_FORM_PC_RELATIVE node
+    int in_callee;                      // Reachable from an internal CALL target (its RET returns inside)
 };
 
-// Global bad byte context (v3.0)
-// Thread-local in multi-threaded scenarios (future enhancement)
+// Bad byte context (v3.0): a profile plus the tables derived from it
 typedef struct {
     bad_byte_config_t config;     // Active configuration
     int initialized;               // 0 = uninitialized, 1 = ready
+    unsigned int generation;       // Unique per build; keys the per-thread memo caches
+    arm_imm_table_t arm_imm;       // Clean ARM modified immediates of this profile
 } bad_byte_context_t;
 
-// Global bad byte context instance
+// Global bad byte context instance (the CLI's profile)
 extern bad_byte_context_t g_bad_byte_context;
 
 // Global batch statistics context (for tracking strategy usage during processing)
 // This is used to track strategy usage and file complexity during processing
 extern batch_stats_t* g_batch_stats_context;
 
+// Rewrite options that reach past a single strategy (set per processed file)
+typedef struct {
+    int constant_pool;             // Pool dirty MOV immediates (see constant_pool.h)
+    int optimize_size;             // Smallest expansion per instruction (see strategy_assignment.h)
+    size_t max_output_size;        // Rewritten payload size budget, 0 = none
+    int constant_reuse;            // Serve repeated constants from registers (see constant_reuse.h)
+    int rebase_displacements;      // Share one base adjustment per run of bad displacements (see displacement_rebase.h)
+    int rename_registers;          // Whole-payload register permutation (see register_renaming.h)
+    uint32_t clobber_mask;         // Registers/flags the caller allows to be destroyed (CLOBBER_FLAGS)
+    int obfuscation_budget_kind;   // Biphasic growth limit, OBFUSCATION_BUDGET_* (see obfuscation_budget.h)
+    size_t obfuscation_budget;     // Bytes, or percent of the input size
+    int threads;                   // Instruction generation threads (0 = one per CPU, 1 = serial)
+    uint32_t reserved_mask;        // Families the rewrite itself holds (GetPC base, reuse holders); set by rewrite_payload
+} rewrite_options_t;
+
+extern rewrite_options_t g_rewrite_options;
+
+/*
+ * Processing scope of the calling thread
+ *
+ * The CLI sets the process-wide profile, rewrite options and statistics
+ * above once per run. A library context (lib_api.c) installs its own for the
+ * duration of a call instead, so contexts with different settings rewrite
+ * concurrently; NULL fields fall back to the process-wide ones. Generation
+ * workers inherit the scope of the thread that starts them.
+ */
+typedef struct {
+    bad_byte_context_t *bad_bytes;
+    const rewrite_options_t *rewrite;
+    batch_stats_t *stats;
+    int quiet;                     // Drop engine diagnostics (library contexts)
+} processing_scope_t;
+
+void set_processing_scope(const processing_scope_t *scope);   // NULL = process-wide settings
+void get_processing_scope(processing_scope_t *scope_out);
+bad_byte_context_t *current_bad_byte_context(void);
+const rewrite_options_t *current_rewrite_options(void);
+
+// Engine diagnostics ([DISASM], [LAYOUT], [RELOC], strategy warnings, ...):
+// printf-style to stderr, unless the calling thread's scope is quiet
+void log_diagnostic(const char *format, ...);
+
 // Bad byte context management functions
 void init_bad_byte_context(bad_byte_config_t *config);
+void bad_byte_context_build(bad_byte_context_t *context, const bad_byte_config_t *config);
 void reset_bad_byte_context(void);
 bad_byte_config_t* get_bad_byte_config(void);
 
@@ -59,6 +122,9 @@ bad_byte_config_t* get_bad_byte_config(void);
 void set_batch_stats_context(batch_stats_t *stats);
 void track_strategy_usage(const char *strategy_name, int success, size_t output_size);
 
+// Rewrite options management
+void set_rewrite_options(const rewrite_options_t *options);
+
 // Function to count instructions and bad bytes in shellcode
 void count_shellcode_stats(const uint8_t *shellcode, size_t size, int *instruction_count, int *bad_byte_count, byval_arch_t arch);
 
@@ -0,0 +1,564 @@
+/*
+ * Decoder stub generator (see decoder_stub.h)
+ *
+ * Each template of the target architecture is planned (keys, loop count and
+ * its mask), assembled by the emitter for that architecture and checked
+ * against the profile. The clean candidate with the smallest total output
+ * (stub plus padded payload) is encoded.
+ */
+
+#include "decoder_stub.h"
+#include "xor_key_search.h"
+#include "utils.h"
+#include <string.h>
+
+#define DECODER_STUB_SEED     0x5EEDC0DEu   // Fixed seed: identical input, identical output
+#define DECODER_STUB_VARIANTS 4             // Encoding alternatives tried per template
+#define ARM_NR_CACHEFLUSH     0x000F0002u   // __ARM_NR_cacheflush (EABI)
+
+typedef struct {
+    byval_arch_t arch;
+    decoder_stub_kind_t kind;
+    int width;                // Bytes per decoded word
+} stub_template_t;
+
+// In order of preference when total sizes tie
+static const stub_template_t stub_templates[] = {
+    {BYVAL_ARCH_X86,   DECODER_STUB_XOR,         4},
+    {BYVAL_ARCH_X86,   DECODER_STUB_ADD,         4},
+    {BYVAL_ARCH_X86,   DECODER_STUB_ROLLING_XOR, 4},
+    {BYVAL_ARCH_X64,   DECODER_STUB_XOR,         4},
+    {BYVAL_ARCH_X64,   DECODER_STUB_ADD,         4},
+    {BYVAL_ARCH_X64,   DECODER_STUB_ROLLING_XOR, 4},
+    {BYVAL_ARCH_X64,   DECODER_STUB_XOR,         8},
+    {BYVAL_ARCH_X64,   DECODER_STUB_ROLLING_XOR, 8},
+    {BYVAL_ARCH_ARM,   DECODER_STUB_XOR,         4},
+    {BYVAL_ARCH_ARM,   DECODER_STUB_ADD,         4},
+    {BYVAL_ARCH_ARM,   DECODER_STUB_ROLLING_XOR, 4},
+    {BYVAL_ARCH_ARM64, DECODER_STUB_XOR,         4},
+    {BYVAL_ARCH_ARM64, DECODER_STUB_ADD,         4},
+    {BYVAL_ARCH_ARM64, DECODER_STUB_ROLLING_XOR, 4},
+};
+
+#define STUB_TEMPLATE_COUNT (sizeof(stub_templates) / sizeof(stub_templates[0]))
+
+typedef struct {
+    const stub_template_t *tmpl;
+    uint64_t key[2];
+    size_t words;             // Padded payload size in words
+    uint32_t count;           // Loop count as the stub sees it
+    uint32_t mask;            // Count mask (x86: 0 = count is loaded directly)
+    uint32_t svc_imm;         // ARM: SVC immediate (ignored by EABI, must be clean)
+    int variant;              // x86: XCHG encoding; ARM/AArch64: register set
+} stub_plan_t;
+
+static int stub_period(const stub_template_t *t) {
+    return (t->kind == DECODER_STUB_ROLLING_XOR) ? 2 : 1;
+}
+
+// Payload alignment: ARM rolling loops decode a whole key period per iteration
+static size_t stub_align(const stub_template_t *t) {
+    int unrolled = (t->arch == BYVAL_ARCH_ARM || t->arch == BYVAL_ARCH_ARM64);
+    return (size_t)t->width * (size_t)(unrolled ? stub_period(t) : 1);
+}
+
+static uint32_t stub_rand(uint32_t *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// Random value whose `bytes` low bytes are all clean and non-zero
+static uint32_t stub_clean_value(uint32_t *state, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        uint8_t b;
+        int guard = 0;
+        do {
+            b = (uint8_t)stub_rand(state);
+        } while ((b == 0 || !is_bad_byte_free_byte(b)) && ++guard < 1024);
+        value |= (uint32_t)b << (i * 8);
+    }
+    return value;
+}
+
+static size_t stub_put(uint8_t *s, size_t n, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        s[n++] = (uint8_t)(value >> (i * 8));
+    }
+    return n;
+}
+
+// First clean byte, used as the encoded form of the tail filler
+static int stub_filler(void) {
+    for (int b = 0x90; b < 0x190; b++) {
+        if (is_bad_byte_free_byte((uint8_t)b)) {
+            return b & 0xFF;
+        }
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Key search                                                               */
+/* ------------------------------------------------------------------------ */
+
+// XOR keys straight from the lane search; -1 or the failing lane
+static int stub_search_xor(const uint8_t *payload, size_t size, int width, int period,
+                           uint64_t *key) {
+    uint8_t usable[256];
+
+    for (int lane = 0; lane < width * period; lane++) {
+        int k;
+        xor_key_lane_usable(payload, size, (size_t)lane, (size_t)(width * period), usable);
+        k = xor_key_pick_byte(usable);
+        if (k < 0) {
+            return lane;
+        }
+        key[lane / width] |= (uint64_t)k << ((lane % width) * 8);
+    }
+    return -1;
+}
+
+/*
+ * ADD key, low byte first: the payload is stored as word - key, so byte j of
+ * a word is p[j] - k[j] - borrow, where the borrow is already fixed by the
+ * lower key bytes. A key byte is usable if it is clean and every (p - borrow)
+ * value of the lane minus it is clean.
+ */
+static int stub_search_add(const uint8_t *payload, size_t size, int width, uint64_t *key) {
+    uint8_t bad[256];
+    int bad_count = 0;
+
+    for (int x = 0; x < 256; x++) {
+        if (!is_bad_byte_free_byte((uint8_t)x)) {
+            bad[bad_count++] = (uint8_t)x;
+        }
+    }
+
+    for (int lane = 0; lane < width; lane++) {
+        uint8_t present[256];
+        uint8_t usable[256];
+        uint64_t low_mask = (lane == 0) ? 0 : (~0ULL >> (64 - lane * 8));
+        int k;
+
+        memset(present, 0, sizeof(present));
+        for (size_t at = (size_t)lane; at < size; at += (size_t)width) {
+            uint64_t low = 0;
+            for (int b = 0; b < lane; b++) {
+                low |= (uint64_t)payload[at - (size_t)lane + (size_t)b] << (b * 8);
+            }
+            present[(uint8_t)(payload[at] - (low < (*key & low_mask)))] = 1;
+        }
+
+        for (int c = 0; c < 256; c++) {
+            usable[c] = (uint8_t)is_bad_byte_free_byte((uint8_t)c);
+        }
+        for (int v = 0; v < 256; v++) {
+            if (!present[v]) {
+                continue;
+            }
+            for (int j = 0; j < bad_count; j++) {
+                usable[(uint8_t)(v - bad[j])] = 0;
+            }
+        }
+
+        k = xor_key_pick_byte(usable);
+        if (k < 0) {
+            return lane;
+        }
+        *key |= (uint64_t)k << (lane * 8);
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Emitters                                                                 */
+/* ------------------------------------------------------------------------ */
+
+// x86/x64: JMP/CALL/POP, keys in EDX/EBX (RDX/RBX), count in ECX
+static size_t stub_emit_x86(const stub_plan_t *p, uint8_t *s) {
+    int qword = (p->tmpl->width == 8);
+    int rolling = (p->tmpl->kind == DECODER_STUB_ROLLING_XOR);
+    size_t n = 0;
+    size_t back, decode, get;
+
+    s[n++] = 0xEB;                       // JMP SHORT get
+    s[n++] = 0x00;
+    back = n;
+    s[n++] = 0x5E;                       // POP ESI
+    s[n++] = 0x56;                       // PUSH ESI (decoded entry for RET)
+    s[n++] = 0xFC;                       // CLD
+    s[n++] = 0xB9;                       // MOV ECX, imm32
+    n = stub_put(s, n, p->count ^ p->mask, 4);
+    if (p->mask) {
+        s[n++] = 0x81;                   // XOR ECX, imm32
+        s[n++] = 0xF1;
+        n = stub_put(s, n, p->mask, 4);
+    }
+    for (int i = 0; i < stub_period(p->tmpl); i++) {
+        if (qword) {
+            s[n++] = 0x48;               // MOV RDX/RBX, imm64
+        }
+        s[n++] = (uint8_t)(i ? 0xBB : 0xBA);   // MOV EDX/EBX, imm32
+        n = stub_put(s, n, p->key[i], qword ? 8 : 4);
+    }
+
+    decode = n;
+    if (qword) {
+        s[n++] = 0x48;
+    }
+    s[n++] = (p->tmpl->kind == DECODER_STUB_ADD) ? 0x01 : 0x31;   // ADD/XOR [ESI], EDX
+    s[n++] = 0x16;
+    if (qword) {
+        s[n++] = 0x48;
+    }
+    s[n++] = 0xAD;                       // LODSD / LODSQ: advance ESI
+    if (rolling) {
+        if (qword) {
+            s[n++] = 0x48;
+        }
+        s[n++] = 0x87;                   // XCHG EDX, EBX (two encodings)
+        s[n++] = (uint8_t)((p->variant & 1) ? 0xD3 : 0xDA);
+    }
+    s[n++] = 0xE2;                       // LOOP decode
+    s[n] = (uint8_t)(int8_t)((int)decode - (int)(n + 1));
+    n++;
+    s[n++] = 0xC3;                       // RET
+
+    get = n;
+    s[1] = (uint8_t)(get - 2);
+    s[n++] = 0xE8;                       // CALL back
+    n = stub_put(s, n, (uint32_t)(int32_t)((int)back - (int)(n + 4)), 4);
+    return n;
+}
+
+/*
+ * Register assignments for the ARM/AArch64 stubs, one per variant. Register
+ * numbers end up in instruction bytes, so a profile that bans e.g. 0x0A can
+ * rule out one set but not the others.
+ */
+typedef struct {
+    uint32_t base;            // Payload start (also the entry point)
+    uint32_t cur;             // Cursor
+    uint32_t key[2];
+    uint32_t count;
+    uint32_t mask;
+    uint32_t data;
+    uint32_t aux;             // AArch64: end pointer; ARM: unused
+    uint32_t prev;            // AArch64: word being decoded (cache maintenance)
+} stub_regs_t;
+
+// ARM: r0-r2 and r7 are fixed by the cacheflush call
+static const stub_regs_t arm_reg_sets[DECODER_STUB_VARIANTS] = {
+    { 9,  4, { 5, 11},  6,  8,  3, 0, 0},
+    {11,  5, { 4,  9},  8,  6, 12, 0, 0},
+    {12,  3, { 6,  8},  4,  5,  9, 0, 0},
+    {10,  6, { 3, 12},  5,  4,  8, 0, 0},
+};
+
+// AArch64: registers used as Rn are x8 and up, so the Rn field is never zero
+static const stub_regs_t arm64_reg_sets[DECODER_STUB_VARIANTS] = {
+    { 9, 10, { 5,  7}, 13, 14, 11, 12, 15},
+    {19, 20, { 3,  6}, 23, 24, 21, 22, 25},
+    {16, 17, { 4,  2}, 27, 28, 15, 26, 14},
+    {13, 11, { 1,  5}, 12, 15, 14,  9, 20},
+};
+
+/*
+ * ARM (A32): payload, cursor, keys, iteration count, mask and data in the
+ * variant's registers; r7 = syscall number, r2 = 0. Register moves are
+ * written as ADD rd, rn, r2, LSL #2 because MOV r0/r1 encodes a zero byte.
+ * Literal pool: key0 [key1] count^mask mask nr^mask, right before the payload.
+ */
+static size_t stub_emit_arm(const stub_plan_t *p, uint8_t *s) {
+    const stub_regs_t *r = &arm_reg_sets[p->variant];
+    int period = stub_period(p->tmpl);
+    uint32_t op = (p->tmpl->kind == DECODER_STUB_ADD) ? 0xE0800000u : 0xE0200000u;
+    uint32_t nlit = (uint32_t)period + 3;
+    size_t n = 4;                        // ADD base, pc, #imm is written last
+    size_t loop;
+
+    for (int i = 0; i < period; i++) {   // LDR key, [base, #-off]
+        n = stub_put(s, n, 0xE5100000u | (r->base << 16) | (r->key[i] << 12) | ((nlit - (uint32_t)i) * 4), 4);
+    }
+    n = stub_put(s, n, 0xE5100000u | (r->base << 16) | (r->count << 12) | ((nlit - (uint32_t)period) * 4), 4);
+    n = stub_put(s, n, 0xE5100000u | (r->base << 16) | (r->mask << 12) | ((nlit - (uint32_t)period - 1) * 4), 4);
+    n = stub_put(s, n, 0xE5107004u | (r->base << 16), 4);                          // LDR r7, [base, #-4]
+    n = stub_put(s, n, 0xE0200000u | (r->count << 16) | (r->count << 12) | r->mask, 4);   // EOR count, count, mask
+    n = stub_put(s, n, 0xE0277000u | r->mask, 4);                                  // EOR r7, r7, mask
+    n = stub_put(s, n, 0xE0222002u, 4);                                            // EOR r2, r2, r2
+    n = stub_put(s, n, 0xE0800102u | (r->base << 16) | (r->cur << 12), 4);         // ADD cur, base, r2, LSL #2
+
+    loop = n;
+    for (int i = 0; i < period; i++) {
+        n = stub_put(s, n, 0xE4900004u | (r->cur << 16) | (r->data << 12), 4);     // LDR data, [cur], #4
+        n = stub_put(s, n, op | (r->data << 16) | (r->data << 12) | r->key[i], 4); // EOR/ADD data, data, key
+        n = stub_put(s, n, 0xE5000004u | (r->cur << 16) | (r->data << 12), 4);     // STR data, [cur, #-4]
+    }
+    n = stub_put(s, n, 0xE2500001u | (r->count << 16) | (r->count << 12), 4);     // SUBS count, count, #1
+    n = stub_put(s, n, 0x1A000000u | ((uint32_t)(((int)loop - (int)(n + 8)) / 4) & 0x00FFFFFFu), 4);
+    n = stub_put(s, n, 0xE0800102u | (r->base << 16), 4);                          // ADD r0, base, r2, LSL #2
+    n = stub_put(s, n, 0xE0801102u | (r->cur << 16), 4);                           // ADD r1, cur, r2, LSL #2
+    n = stub_put(s, n, 0xEF000000u | (p->svc_imm & 0x00FFFFFFu), 4);              // SVC: cacheflush
+    n = stub_put(s, n, 0xE12FFF10u | r->base, 4);                                  // BX base
+
+    for (int i = 0; i < period; i++) {
+        n = stub_put(s, n, p->key[i], 4);
+    }
+    n = stub_put(s, n, p->count ^ p->mask, 4);
+    n = stub_put(s, n, p->mask, 4);
+    n = stub_put(s, n, ARM_NR_CACHEFLUSH ^ p->mask, 4);
+
+    if (n - 8 > 0xFF) {
+        return 0;
+    }
+    stub_put(s, 0, 0xE28F0000u | (r->base << 12) | (uint32_t)(n - 8), 4);   // ADD base, pc, #imm
+    return n;
+}
+
+/*
+ * AArch64: payload, cursor, end pointer, keys, byte count, mask and data in
+ * the variant's registers; `prev` keeps the address of the word just decoded
+ * for DC CVAU / IC IVAU. Literal pool: key0 [key1] count^mask mask.
+ */
+static size_t stub_emit_arm64(const stub_plan_t *p, uint8_t *s) {
+    const stub_regs_t *r = &arm64_reg_sets[p->variant];
+    int period = stub_period(p->tmpl);
+    uint32_t op = (p->tmpl->kind == DECODER_STUB_ADD) ? 0x0B000000u : 0x4A000000u;
+    uint32_t nlit = (uint32_t)period + 2;
+    size_t n = 0;
+    size_t loop;
+
+    n = stub_put(s, n, 0x10FFFFE0u | r->base, 4);   // ADR base, .-4 (a forward ADR has zero bytes)
+    n += 4;                                          // ADD base, base, #(payload + 4) is written last
+    for (int i = 0; i < period; i++) {               // LDUR key, [base, #-off]
+        n = stub_put(s, n, 0xB8400000u | ((-(nlit - (uint32_t)i) * 4) & 0x1FFu) << 12 |
+                               (r->base << 5) | r->key[i], 4);
+    }
+    n = stub_put(s, n, 0xB8400000u | ((-(nlit - (uint32_t)period) * 4) & 0x1FFu) << 12 |
+                           (r->base << 5) | r->count, 4);                          // LDUR count
+    n = stub_put(s, n, 0xB85FC000u | (r->base << 5) | r->mask, 4);                 // LDUR mask, [base, #-4]
+    n = stub_put(s, n, 0x4A000000u | (r->mask << 16) | (r->count << 5) | r->count, 4);   // EOR count, count, mask
+    n = stub_put(s, n, 0x8B000000u | (r->count << 16) | (r->base << 5) | r->aux, 4);     // ADD end, base, count
+    n = stub_put(s, n, 0xAA0003E0u | (r->base << 16) | r->cur, 4);                 // MOV cur, base
+
+    loop = n;
+    for (int i = 0; i < period; i++) {
+        n = stub_put(s, n, 0xAA0003E0u | (r->cur << 16) | r->prev, 4);            // MOV prev, cur
+        n = stub_put(s, n, 0xB8404400u | (r->cur << 5) | r->data, 4);             // LDR data, [cur], #4
+        n = stub_put(s, n, op | (r->key[i] << 16) | (r->data << 5) | r->data, 4); // EOR/ADD data, data, key
+        n = stub_put(s, n, 0xB81FC000u | (r->cur << 5) | r->data, 4);             // STUR data, [cur, #-4]
+        n = stub_put(s, n, 0xD50B7B20u | r->prev, 4);                             // DC CVAU, prev
+        n = stub_put(s, n, 0xD5033B9Fu, 4);                                       // DSB ISH
+        n = stub_put(s, n, 0xD50B7520u | r->prev, 4);                             // IC IVAU, prev
+    }
+    n = stub_put(s, n, 0xEB00001Fu | (r->aux << 16) | (r->cur << 5), 4);          // CMP cur, end
+    n = stub_put(s, n, 0x54000001u | (((uint32_t)(((int)loop - (int)n) / 4) & 0x7FFFFu) << 5), 4);
+    n = stub_put(s, n, 0xD5033B9Fu, 4);  // DSB ISH
+    n = stub_put(s, n, 0xD5033FDFu, 4);  // ISB
+    n = stub_put(s, n, 0xD61F0000u | (r->base << 5), 4);                          // BR base
+
+    for (int i = 0; i < period; i++) {
+        n = stub_put(s, n, p->key[i], 4);
+    }
+    n = stub_put(s, n, p->count ^ p->mask, 4);
+    n = stub_put(s, n, p->mask, 4);
+
+    if (n + 4 > 0xFFF) {
+        return 0;
+    }
+    stub_put(s, 4, 0x91000000u | (uint32_t)(n + 4) << 10 | (r->base << 5) | r->base, 4);   // ADD base, base, #imm12
+    return n;
+}
+
+static size_t stub_emit(const stub_plan_t *p, uint8_t *s) {
+    switch (p->tmpl->arch) {
+        case BYVAL_ARCH_X86:
+        case BYVAL_ARCH_X64:
+            return stub_emit_x86(p, s);
+        case BYVAL_ARCH_ARM:
+            return stub_emit_arm(p, s);
+        case BYVAL_ARCH_ARM64:
+            return stub_emit_arm64(p, s);
+        default:
+            return 0;
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+/* Planning and encoding                                                    */
+/* ------------------------------------------------------------------------ */
+
+/*
+ * Loop count and mask. x86 loads the count directly when it is clean; ARM
+ * and AArch64 always load count ^ mask and mask from the literal pool (ARM
+ * also the cacheflush number). Returns -1 if no mask works.
+ */
+static int stub_plan_count(stub_plan_t *p, uint32_t *state) {
+    const stub_template_t *t = p->tmpl;
+    int x86 = (t->arch == BYVAL_ARCH_X86 || t->arch == BYVAL_ARCH_X64);
+
+    if (t->arch == BYVAL_ARCH_ARM) {
+        p->count = (uint32_t)(p->words / (size_t)stub_period(t));
+    } else if (t->arch == BYVAL_ARCH_ARM64) {
+        p->count = (uint32_t)(p->words * (size_t)t->width);
+    } else {
+        p->count = (uint32_t)p->words;
+    }
+
+    p->mask = 0;
+    if (x86 && is_bad_byte_free(p->count)) {
+        return 0;
+    }
+    for (int i = 0; i < 1024; i++) {
+        uint32_t mask = stub_clean_value(state, 4);
+        if (is_bad_byte_free(mask) && is_bad_byte_free(p->count ^ mask) &&
+            (t->arch != BYVAL_ARCH_ARM || is_bad_byte_free(ARM_NR_CACHEFLUSH ^ mask))) {
+            p->mask = mask;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void stub_encode_payload(const stub_plan_t *p, const uint8_t *payload, size_t size,
+                                uint8_t filler, struct buffer *out) {
+    size_t width = (size_t)p->tmpl->width;
+    int period = stub_period(p->tmpl);
+
+    for (size_t w = 0; w < p->words; w++) {
+        uint64_t key = p->key[w % (size_t)period];
+        int borrow = 0;
+        for (size_t b = 0; b < width; b++) {
+            size_t at = w * width + b;
+            uint8_t kb = (uint8_t)(key >> (b * 8));
+            uint8_t byte;
+            if (at >= size) {
+                byte = filler;           // Decodes to garbage past the end, never executed
+            } else if (p->tmpl->kind == DECODER_STUB_ADD) {
+                int diff = (int)payload[at] - (int)kb - borrow;
+                borrow = (diff < 0);
+                byte = (uint8_t)diff;
+            } else {
+                byte = (uint8_t)(payload[at] ^ kb);
+            }
+            buffer_append(out, &byte, 1);
+        }
+    }
+}
+
+int decoder_stub_encode(const uint8_t *payload, size_t size, byval_arch_t arch,
+                        const uint32_t *fixed_key, struct buffer *out,
+                        decoder_stub_info_t *info) {
+    uint8_t stub[DECODER_STUB_MAX_SIZE];
+    uint8_t best_stub[DECODER_STUB_MAX_SIZE];
+    stub_plan_t best;
+    size_t best_stub_size = 0;
+    size_t best_total = 0;
+    int first_failed_lane = -1;
+    int filler = stub_filler();
+
+    memset(&best, 0, sizeof(best));
+    memset(info, 0, sizeof(*info));
+    info->failed_lane = -1;
+    if (size == 0 || filler < 0) {
+        return -1;
+    }
+    // The stub runs in ARM state and falls through into the decoded Thumb
+    // payload's entry stub
+    if (arch == BYVAL_ARCH_THUMB) {
+        arch = BYVAL_ARCH_ARM;
+    }
+
+    for (size_t t = 0; t < STUB_TEMPLATE_COUNT; t++) {
+        const stub_template_t *tmpl = &stub_templates[t];
+        size_t align = stub_align(tmpl);
+        uint32_t state = DECODER_STUB_SEED;
+        stub_plan_t plan;
+        size_t stub_size = 0;
+        size_t total;
+        int lane;
+
+        if (tmpl->arch != arch ||
+            (fixed_key && (tmpl->kind != DECODER_STUB_XOR || tmpl->width != 4))) {
+            continue;
+        }
+
+        memset(&plan, 0, sizeof(plan));
+        plan.tmpl = tmpl;
+        plan.words = ((size + align - 1) / align) * align / (size_t)tmpl->width;
+        if (plan.words * (size_t)tmpl->width > UINT32_MAX) {
+            continue;
+        }
+
+        if (fixed_key) {
+            plan.key[0] = *fixed_key;
+            lane = xor_key_check(payload, size, *fixed_key);
+            info->failed_lane = lane;
+        } else if (tmpl->kind == DECODER_STUB_ADD) {
+            lane = stub_search_add(payload, size, tmpl->width, &plan.key[0]);
+        } else {
+            lane = stub_search_xor(payload, size, tmpl->width, stub_period(tmpl), plan.key);
+        }
+        if (lane >= 0 && !fixed_key) {
+            if (first_failed_lane < 0) {
+                first_failed_lane = lane;
+            }
+            continue;
+        }
+        if (stub_plan_count(&plan, &state) != 0) {
+            continue;
+        }
+
+        for (plan.variant = 0; plan.variant < DECODER_STUB_VARIANTS; plan.variant++) {
+            plan.svc_imm = stub_clean_value(&state, 3);
+            stub_size = stub_emit(&plan, stub);
+            if (stub_size > 0 && is_bad_byte_free_buffer(stub, stub_size)) {
+                break;
+            }
+            stub_size = 0;
+        }
+        if (stub_size == 0) {
+            continue;   // Fixed opcode bytes (or offsets) are banned by the profile
+        }
+
+        total = stub_size + plan.words * (size_t)tmpl->width;
+        if (best_stub_size == 0 || total < best_total) {
+            best = plan;
+            memcpy(best_stub, stub, stub_size);
+            best_stub_size = stub_size;
+            best_total = total;
+        }
+    }
+
+    if (best_stub_size == 0) {
+        if (!fixed_key) {
+            info->failed_lane = first_failed_lane;
+        }
+        return -1;
+    }
+
+    buffer_append(out, best_stub, best_stub_size);
+    stub_encode_payload(&best, payload, size, (uint8_t)filler, out);
+
+    info->kind = best.tmpl->kind;
+    info->width = best.tmpl->width;
+    info->stub_size = best_stub_size;
+    info->padding = best.words * (size_t)best.tmpl->width - size;
+    info->key[0] = best.key[0];
+    info->key[1] = best.key[1];
+    return 0;
+}
+
+const char *decoder_stub_kind_name(decoder_stub_kind_t kind) {
+    switch (kind) {
+        case DECODER_STUB_XOR:
+            return "xor";
+        case DECODER_STUB_ADD:
+            return "add";
+        case DECODER_STUB_ROLLING_XOR:
+            return "rolling-xor";
+        default:
+            return "unknown";
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef DECODER_STUB_H
+#define DECODER_STUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+
+/**
+ * @file decoder_stub.h
+ * @brief Decoder stub generator for the XOR encoder (--xor-encode)
+ *
+ * Stubs are assembled in C from per-architecture templates, so no external
+ * assembler is needed. Every template decodes a whole word per iteration:
+ *
+ *   XOR          word ^= key
+ *   ADD          word += key (the payload is stored as word - key)
+ *   ROLLING_XOR  word ^= key[i & 1], two keys alternating from word to word
+ *
+ * x86/x64 stubs use JMP/CALL/POP with the keys as MOV immediates:
+ *
+ *     jmp short get
+ *   back:
+ *     pop esi / push esi / cld      ; ESI = payload, also the return address
+ *     mov ecx, words                ; (mov ecx, a / xor ecx, b if dirty)
+ *     mov edx, key0 [/ mov ebx, key1]
+ *   decode:
+ *     xor [esi], edx                ; (add [esi], edx)
+ *     lodsd                         ; ESI += 4 (lodsq: += 8)
+ *     [xchg edx, ebx]               ; rolling: switch keys
+ *     loop decode
+ *     ret                           ; into the decoded payload
+ *   get:
+ *     call back
+ *
+ * ARM and AArch64 stubs find the payload PC-relatively (ADD r9, pc / ADR),
+ * load keys and the masked count from a literal pool just before the payload,
+ * decode with post-indexed loads, make the new code visible to instruction
+ * fetch (cacheflush syscall / DC CVAU + IC IVAU) and branch to the payload.
+ * Rolling stubs decode two words per iteration, one per key.
+ *
+ * Key bytes are chosen per lane (payload offset modulo the key period) with
+ * the lane search of xor_key_search.h; ADD lanes are searched low byte first
+ * because the borrow into a lane depends on the bytes below it. The last word
+ * is padded with clean filler. Each template's stub is verified against the
+ * active profile, and the smallest clean result wins.
+ */
+
+#define DECODER_STUB_MAX_SIZE    160  // Largest generated stub, without padding
+#define DECODER_STUB_MAX_PADDING 7    // Filler bytes completing the last key period
+
+typedef enum {
+    DECODER_STUB_XOR = 0,
+    DECODER_STUB_ADD,
+    DECODER_STUB_ROLLING_XOR,
+    DECODER_STUB_KIND_COUNT
+} decoder_stub_kind_t;
+
+typedef struct {
+    decoder_stub_kind_t kind;
+    int width;                // Bytes decoded per word (4, or 8 for x64 qword loops)
+    size_t stub_size;         // Decoder bytes before the payload (literals included)
+    size_t padding;           // Filler bytes added after the payload
+    uint64_t key[2];          // key[1] is only used by ROLLING_XOR
+    int failed_lane;          // First lane without a usable key byte, else -1
+} decoder_stub_info_t;
+
+/**
+ * Encode a payload behind the smallest decoder stub that is clean
+ *
+ * With `fixed_key`, only the 4-byte XOR template is used with that key; the
+ * output is produced even if the key leaves bad bytes (reported in
+ * info->failed_lane) so the caller can warn and verify as before.
+ *
+ * @param payload: Payload to encode (not modified)
+ * @param size: Payload size
+ * @param arch: Target architecture (Thumb: ARM stub; the payload must start
+ *              with its ARM->Thumb entry stub, see thumb_entry_stub())
+ * @param fixed_key: User-supplied 4-byte key, or NULL to search keys
+ * @param out: Receives stub + encoded payload (appended)
+ * @param info: Output template, sizes and keys
+ * @return: 0 on success, -1 if no template works for this payload/profile
+ */
+int decoder_stub_encode(const uint8_t *payload, size_t size, byval_arch_t arch,
+                        const uint32_t *fixed_key, struct buffer *out,
+                        decoder_stub_info_t *info);
+
+/**
+ * Name of a stub template for diagnostics ("xor", "add", "rolling-xor")
+ */
+const char *decoder_stub_kind_name(decoder_stub_kind_t kind);
+
+#endif // DECODER_STUB_H
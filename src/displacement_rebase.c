@@ -0,0 +1,388 @@
+/*
+ * Shared Base-Register Adjustment for Bad Displacements
+ *
+ * PROBLEM: memory_displacement_strategies.c, mov_mem_disp_null_strategies.c
+ * and cmp_memory_disp_strategies.c each repair one [reg+disp32] at a time,
+ * rebuilding the address around every single access. Stack-frame-heavy
+ * payloads hit runs like
+ *     mov eax, [ebp+0x100]
+ *     mov ecx, [ebp+0x104]
+ *     add eax, [ebp+0x108]
+ * and pay 8-15 bytes for each.
+ *
+ * SOLUTION: Move the base once for the whole run:
+ *     lea ebp, [ebp+X]          ; X chosen so every disp-X is clean
+ *     mov eax, [ebp+0x100-X]    ; disp8 when it fits
+ *     mov ecx, [ebp+0x104-X]
+ *     add eax, [ebp+0x108-X]
+ *     lea ebp, [ebp-X]          ; omitted when ebp is dead here
+ * LEA does not touch the flags, and run members use the base only to address
+ * memory, so the adjusted value is never observed. Runs stop before anything
+ * else that touches the base, before branch targets and before any control
+ * transfer, so the base is back to its original value on every exit.
+ *
+ * The stack pointer is never adjusted (data below it may be clobbered
+ * asynchronously).
+ */
+
+#include "displacement_rebase.h"
+#include "branch_layout.h"
+#include "strategy.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    struct instruction_node *node;
+    int64_t disp;            // Original displacement
+    size_t modrm_at;         // Offset of the ModR/M byte
+    size_t disp_at;          // Offset of the displacement field (or where it would go)
+    size_t disp_size;        // Original displacement size: 0, 1 or 4
+    int dirty;               // Displacement field contains bad bytes
+    size_t greedy;           // Estimated size of the per-instruction rewrite
+    int restore_needed;      // Base is still live after this instruction
+} rebase_member_t;
+
+// Any use of the register family, explicit or implicit
+static int rebase_touches(cs_insn *insn, int fam) {
+    cs_detail *detail = insn->detail;
+
+    for (int i = 0; i < detail->regs_read_count; i++) {
+        if (layout_gpr_family(detail->regs_read[i], NULL) == fam) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < detail->regs_write_count; i++) {
+        if (layout_gpr_family(detail->regs_write[i], NULL) == fam) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < detail->x86.op_count; i++) {
+        cs_x86_op *op = &detail->x86.operands[i];
+        if (op->type == X86_OP_REG && layout_gpr_family(op->reg, NULL) == fam) {
+            return 1;
+        }
+        if (op->type == X86_OP_MEM && (layout_gpr_family(op->mem.base, NULL) == fam ||
+                                       layout_gpr_family(op->mem.index, NULL) == fam)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Base family of the single memory operand, or -1
+static int rebase_base_family(cs_insn *insn, int *mem_index) {
+    cs_x86 *x86 = &insn->detail->x86;
+    int found = -1;
+
+    for (int i = 0; i < x86->op_count; i++) {
+        if (x86->operands[i].type == X86_OP_MEM) {
+            if (found >= 0) {
+                return -1;
+            }
+            found = i;
+        }
+    }
+    if (found < 0) {
+        return -1;
+    }
+    *mem_index = found;
+    return layout_gpr_family(x86->operands[found].mem.base, NULL);
+}
+
+/*
+ * Can the instruction take part in a run on `fam`: it uses the register
+ * only as the base of its memory operand, and all of its bytes except the
+ * displacement are clean.
+ */
+static int rebase_analyze(struct instruction_node *n, byval_arch_t arch, int fam, rebase_member_t *m) {
+    cs_insn *insn = n->insn;
+    cs_x86 *x86 = &insn->detail->x86;
+    cs_x86_op *op;
+    int mem_index = -1;
+    uint8_t modrm;
+    int has_sib;
+
+    if (n->branch_form != LAYOUT_FORM_NONE || n->code_fixed ||
+        rebase_base_family(insn, &mem_index) != fam ||
+        x86->addr_size != (arch == BYVAL_ARCH_X64 ? 8 : 4)) {
+        return 0;
+    }
+    op = &x86->operands[mem_index];
+    if (layout_gpr_family(op->mem.index, NULL) == fam) {
+        return 0;
+    }
+    for (int i = 0; i < insn->detail->regs_read_count; i++) {
+        if (layout_gpr_family(insn->detail->regs_read[i], NULL) == fam) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < insn->detail->regs_write_count; i++) {
+        if (layout_gpr_family(insn->detail->regs_write[i], NULL) == fam) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < x86->op_count; i++) {
+        if (x86->operands[i].type == X86_OP_REG && layout_gpr_family(x86->operands[i].reg, NULL) == fam) {
+            return 0;
+        }
+    }
+
+    m->modrm_at = x86->encoding.modrm_offset;
+    if (m->modrm_at == 0 || m->modrm_at >= insn->size) {
+        return 0;
+    }
+    modrm = insn->bytes[m->modrm_at];
+    if ((modrm >> 6) == 3) {
+        return 0;
+    }
+    has_sib = ((modrm & 7) == 4);
+    m->disp_at = m->modrm_at + 1 + (size_t)has_sib;
+    m->disp_size = ((modrm >> 6) == 1) ? 1 : ((modrm >> 6) == 2) ? 4 : 0;
+    if (m->disp_at + m->disp_size > insn->size ||
+        !is_bad_byte_free_buffer(insn->bytes, m->disp_at) ||
+        !is_bad_byte_free_buffer(insn->bytes + m->disp_at + m->disp_size,
+                                 insn->size - m->disp_at - m->disp_size)) {
+        return 0;
+    }
+
+    m->node = n;
+    m->disp = op->mem.disp;
+    m->dirty = !is_bad_byte_free_buffer(insn->bytes + m->disp_at, m->disp_size);
+    m->greedy = insn->size;
+    if (m->dirty) {
+        int count = 0;
+        strategy_t **strategies = get_strategies_for_instruction(insn, &count, arch);
+        // No strategy at all: the run is the only clean rewrite
+        m->greedy = (count > 0) ? strategies[0]->get_size(insn) : (size_t)insn->size + 16;
+    }
+    m->restore_needed = !layout_reg_dead_at(n->next, fam, 2);
+    return 1;
+}
+
+/*
+ * Re-encode a member with displacement disp-X. Returns the new size, or 0 if
+ * no clean encoding exists.
+ */
+static size_t rebase_encode_member(const rebase_member_t *m, byval_arch_t arch, int fam,
+                                   int64_t adjust, uint8_t *out) {
+    cs_insn *insn = m->node->insn;
+    int64_t disp = m->disp - adjust;
+    uint8_t modrm = insn->bytes[m->modrm_at];
+    size_t rest = insn->size - m->disp_at - m->disp_size;
+    size_t len = m->disp_at;
+    uint8_t mod;
+
+    if (arch == BYVAL_ARCH_X64) {
+        if (disp != (int64_t)(int32_t)disp) {
+            return 0;
+        }
+    } else {
+        disp = (int32_t)(uint32_t)disp;  // 32-bit addressing wraps
+    }
+
+    memcpy(out, insn->bytes, m->disp_at);
+    if (disp == 0 && (fam & 7) != 5) {
+        mod = 0;
+    } else if (disp >= -128 && disp <= 127 && is_bad_byte_free_byte((uint8_t)disp)) {
+        mod = 1;
+        out[len++] = (uint8_t)disp;
+    } else {
+        uint32_t d32 = (uint32_t)disp;
+        mod = 2;
+        memcpy(out + len, &d32, 4);
+        len += 4;
+    }
+    out[m->modrm_at] = (uint8_t)((modrm & 0x3F) | (mod << 6));
+    memcpy(out + len, insn->bytes + m->disp_at + m->disp_size, rest);
+    len += rest;
+    return is_bad_byte_free_buffer(out, len) ? len : 0;
+}
+
+// LEA base, [base+disp]; returns the size, or 0 if not clean
+static size_t rebase_encode_lea(int fam, byval_arch_t arch, int64_t disp, uint8_t *out) {
+    size_t len = 0;
+    int r = fam & 7;
+
+    if (arch == BYVAL_ARCH_X64) {
+        out[len++] = (uint8_t)(0x48 | ((fam & 8) ? 0x05 : 0));
+    }
+    out[len++] = 0x8D;
+    if (disp >= -128 && disp <= 127) {
+        out[len++] = (uint8_t)(0x40 | (r << 3) | r);
+        if (r == 4) {
+            out[len++] = 0x24;
+        }
+        out[len++] = (uint8_t)disp;
+    } else {
+        uint32_t d32 = (uint32_t)disp;
+        out[len++] = (uint8_t)(0x80 | (r << 3) | r);
+        if (r == 4) {
+            out[len++] = 0x24;
+        }
+        memcpy(out + len, &d32, 4);
+        len += 4;
+    }
+    return is_bad_byte_free_buffer(out, len) ? len : 0;
+}
+
+typedef struct {
+    long saving;
+    int64_t adjust;
+    int count;                // Members covered, the last one dirty
+} rebase_choice_t;
+
+static void rebase_evaluate(const rebase_member_t *members, int count, byval_arch_t arch, int fam,
+                            int64_t adjust, rebase_choice_t *best) {
+    uint8_t scratch[32];
+    size_t adj_len;
+    size_t restore_len;
+    long cost;
+    long greedy = 0;
+
+    if (arch == BYVAL_ARCH_X64) {
+        if (adjust != (int64_t)(int32_t)adjust) {
+            return;
+        }
+    } else {
+        adjust = (int32_t)(uint32_t)adjust;
+    }
+    if (adjust == INT32_MIN) {
+        return;  // The restore, -adjust, has no disp32 encoding
+    }
+    adj_len = rebase_encode_lea(fam, arch, adjust, scratch);
+    restore_len = rebase_encode_lea(fam, arch, -adjust, scratch);
+    if (adj_len == 0 || adjust == 0) {
+        return;
+    }
+    cost = (long)adj_len;
+
+    for (int i = 0; i < count; i++) {
+        size_t size = rebase_encode_member(&members[i], arch, fam, adjust, scratch);
+        if (size == 0) {
+            return;
+        }
+        cost += (long)size;
+        greedy += (long)members[i].greedy;
+        if (members[i].dirty && (!members[i].restore_needed || restore_len > 0)) {
+            long total = cost + (members[i].restore_needed ? (long)restore_len : 0);
+            if (greedy - total > best->saving) {
+                best->saving = greedy - total;
+                best->adjust = adjust;
+                best->count = i + 1;
+            }
+        }
+    }
+}
+
+// Members following `start` on the same base, up to the end of the straight-line stretch
+static int rebase_collect(struct instruction_node *start, byval_arch_t arch, int fam,
+                          struct instruction_node **targets, size_t target_count,
+                          rebase_member_t *members) {
+    int count = 0;
+    struct instruction_node *m = start;
+
+    for (int steps = 0; m != NULL && steps < REBASE_WINDOW && count < REBASE_MAX_MEMBERS;
+         steps++, m = m->next) {
+        if (m != start && layout_is_branch_target(targets, target_count, m)) {
+            break;
+        }
+        if (layout_is_branch(m->insn, arch) || layout_is_opaque_transfer(m->insn)) {
+            break;
+        }
+        if (rebase_analyze(m, arch, fam, &members[count])) {
+            count++;
+        } else if (rebase_touches(m->insn, fam)) {
+            break;
+        }
+    }
+    return count;
+}
+
+static int rebase_take_run(rebase_member_t *members, int count, byval_arch_t arch, int fam) {
+    rebase_choice_t best = {0, 0, 0};
+    uint32_t seed = 0x9E3779B9u ^ (uint32_t)members[0].disp;
+    int dirty_seen = 0;
+    uint8_t bytes[32];
+    size_t len;
+
+    // Adjustments that turn some displacement into a clean disp8 (or none)...
+    for (int i = 0; i < count && dirty_seen < 8; i++) {
+        if (!members[i].dirty) {
+            continue;
+        }
+        dirty_seen++;
+        for (int t = -128; t <= 127; t++) {
+            rebase_evaluate(members, count, arch, fam, members[i].disp - t, &best);
+        }
+    }
+    // ...and arbitrary ones that only need every disp32 clean
+    for (int i = 0; i < REBASE_RANDOM_TRIES; i++) {
+        seed = seed * 1103515245u + 12345u;
+        rebase_evaluate(members, count, arch, fam, members[0].disp - (int32_t)seed, &best);
+    }
+    if (best.count == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < best.count; i++) {
+        struct buffer *code = &members[i].node->code;
+        code->size = 0;
+        if (i == 0) {
+            len = rebase_encode_lea(fam, arch, best.adjust, bytes);
+            buffer_append(code, bytes, len);
+        }
+        len = rebase_encode_member(&members[i], arch, fam, best.adjust, bytes);
+        buffer_append(code, bytes, len);
+        if (i == best.count - 1 && members[i].restore_needed) {
+            len = rebase_encode_lea(fam, arch, -best.adjust, bytes);
+            buffer_append(code, bytes, len);
+        }
+        members[i].node->code_fixed = 1;
+    }
+    return best.count;
+}
+
+int displacement_rebase_apply(struct instruction_node *head, byval_arch_t arch) {
+    rebase_member_t members[REBASE_MAX_MEMBERS];
+    struct instruction_node **targets = NULL;
+    size_t target_count = 0;
+    int runs = 0;
+    int rewritten = 0;
+
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        return 0;
+    }
+    if (layout_collect_branch_targets(head, arch, &targets, &target_count) != 0) {
+        return 0;
+    }
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        int mem_index;
+        int fam = rebase_base_family(n->insn, &mem_index);
+        int count;
+        int taken;
+
+        if (fam < 0 || fam == 4 || !rebase_analyze(n, arch, fam, &members[0]) || !members[0].dirty) {
+            continue;
+        }
+        count = rebase_collect(n, arch, fam, targets, target_count, members);
+        if (count < 2) {
+            continue;
+        }
+        taken = rebase_take_run(members, count, arch, fam);
+        if (taken > 0) {
+            runs++;
+            rewritten += taken;
+            n = members[taken - 1].node;
+        }
+    }
+
+    if (runs > 0) {
+        log_diagnostic("[REBASE] %d memory operands in %d runs share a base adjustment\n",
+                       rewritten, runs);
+    }
+    free(targets);
+    return rewritten;
+}
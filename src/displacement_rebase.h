@@ -0,0 +1,47 @@
+#ifndef DISPLACEMENT_REBASE_H
+#define DISPLACEMENT_REBASE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file displacement_rebase.h
+ * @brief Shared base-register adjustment for runs of bad displacements
+ *        (--rebase-displacements)
+ *
+ * The memory displacement strategies repair each [reg+disp32] with bad bytes
+ * on its own, wrapping every access in its own address computation. Stack
+ * frames produce long runs of such accesses off one base ([ebp+0x100],
+ * [ebp+0x104], ...). This pass finds those runs inside straight-line regions,
+ * moves the base once with LEA base, [base+X], re-encodes every access in the
+ * run with the clean displacement disp-X (disp8 where it fits) and moves the
+ * base back with LEA base, [base-X] after the last access - or not at all if
+ * the base is dead there. LEA leaves the flags alone, so nothing else in the
+ * run observes the adjustment.
+ *
+ * A run only contains instructions that use the base as a memory base and
+ * nothing else; anything else touching the base, a branch target, or any
+ * control transfer ends it. A run is only taken when it is smaller than the
+ * per-instruction strategies' estimated expansions.
+ */
+
+#define REBASE_MAX_MEMBERS   32   // Accesses sharing one adjustment
+#define REBASE_WINDOW        64   // Instructions scanned ahead for a run
+#define REBASE_RANDOM_TRIES 256   // Extra adjustment candidates beyond the disp8-targeted ones
+
+/**
+ * Rewrite runs of bad-displacement accesses through one base adjustment
+ *
+ * Must run after branch nodes are classified (branch_form and target set)
+ * and before the remaining nodes are rewritten. Nodes in a taken run get
+ * their final node->code and code_fixed = 1.
+ *
+ * @param head: First instruction node
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @return: Number of memory operands rewritten
+ */
+int displacement_rebase_apply(struct instruction_node *head, byval_arch_t arch);
+
+#endif // DISPLACEMENT_REBASE_H
@@ -60,9 +60,8 @@ void generate_register_chaining_immediate_enhanced(struct buffer *b, cs_insn *in
         if (temp_reg == dest_reg) temp_reg = X86_REG_ECX;
         if (temp_reg == dest_reg) temp_reg = X86_REG_EDX;
         
-        // Save temp register
-        uint8_t push_temp[] = {0x50 + get_reg_index(temp_reg)};
-        buffer_append(b, push_temp, 1);
+        // Save temp register (unless the caller declared it clobbered)
+        generate_temp_save(b, temp_reg);
         
         // MOV temp_reg, imm (null-free construction)
         generate_mov_eax_imm(b, imm);
@@ -78,8 +77,7 @@ void generate_register_chaining_immediate_enhanced(struct buffer *b, cs_insn *in
         buffer_append(b, mov_dest_temp, 2);
         
         // Restore temp register
-        uint8_t pop_temp[] = {0x58 + get_reg_index(temp_reg)};
-        buffer_append(b, pop_temp, 1);
+        generate_temp_restore(b, temp_reg);
     }
     // Handle arithmetic operations with null-containing immediates
     else if ((insn->id == X86_INS_ADD || insn->id == X86_INS_SUB || 
@@ -96,9 +94,8 @@ void generate_register_chaining_immediate_enhanced(struct buffer *b, cs_insn *in
         if (temp_reg == dest_reg) temp_reg = X86_REG_ECX;
         if (temp_reg == dest_reg) temp_reg = X86_REG_EDX;
         
-        // Save temp register
-        uint8_t push_temp[] = {0x50 + get_reg_index(temp_reg)};
-        buffer_append(b, push_temp, 1);
+        // Save temp register (unless the caller declared it clobbered)
+        generate_temp_save(b, temp_reg);
         
         // MOV temp_reg, imm (null-free construction)
         generate_mov_eax_imm(b, imm);
@@ -125,8 +122,7 @@ void generate_register_chaining_immediate_enhanced(struct buffer *b, cs_insn *in
         buffer_append(b, op_code_bytes, 2);
         
         // Restore temp register
-        uint8_t pop_temp[] = {0x58 + get_reg_index(temp_reg)};
-        buffer_append(b, pop_temp, 1);
+        generate_temp_restore(b, temp_reg);
     }
     else {
         // Fallback to original instruction
@@ -179,11 +175,9 @@ void generate_cross_register_operation_enhanced(struct buffer *b, cs_insn *insn)
         uint32_t imm = (uint32_t)insn->detail->x86.operands[1].imm;
         
         // Use a multi-register approach: EAX -> ECX -> dest_reg
-        // Save EAX and ECX
-        uint8_t push_eax[] = {0x50};
-        uint8_t push_ecx[] = {0x51};
-        buffer_append(b, push_eax, 1);
-        buffer_append(b, push_ecx, 1);
+        // Save EAX and ECX (unless the caller declared them clobbered)
+        generate_temp_save(b, X86_REG_EAX);
+        generate_temp_save(b, X86_REG_ECX);
         
         // MOV EAX, imm (null-free construction)
         generate_mov_eax_imm(b, imm);
@@ -198,10 +192,8 @@ void generate_cross_register_operation_enhanced(struct buffer *b, cs_insn *insn)
         buffer_append(b, mov_dest_ecx, 2);
         
         // Restore ECX and EAX
-        uint8_t pop_ecx[] = {0x59};
-        uint8_t pop_eax[] = {0x58};
-        buffer_append(b, pop_ecx, 1);
-        buffer_append(b, pop_eax, 1);
+        generate_temp_restore(b, X86_REG_ECX);
+        generate_temp_restore(b, X86_REG_EAX);
     }
     else {
         // Fallback
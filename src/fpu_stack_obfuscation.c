@@ -7,27 +7,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int fpu_counter = 0;
-static int fpu_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Strategy: Insert FPU NOPs and dead FPU operations
 // ============================================================================
 
 int can_handle_fpu_obfuscation(cs_insn *insn) {
-    // Initialize once
-    if (!fpu_initialized) {
-        srand((unsigned int)time(NULL) ^ 0x1234);
-        fpu_initialized = 1;
-    }
-
     // Skip control flow instructions
     if (insn->id == X86_INS_JMP || insn->id == X86_INS_CALL ||
         insn->id == X86_INS_RET || insn->id == X86_INS_RETF) {
@@ -45,8 +36,7 @@ int can_handle_fpu_obfuscation(cs_insn *insn) {
     }
 
     // Apply to approximately 10% of instructions
-    fpu_counter++;
-    return (fpu_counter % 10 == 0);
+    return thread_rng_below(10) == 0;
 }
 
 size_t get_fpu_obfuscation_size(cs_insn *insn) {
@@ -56,7 +46,7 @@ size_t get_fpu_obfuscation_size(cs_insn *insn) {
 
 void generate_fpu_obfuscation(struct buffer *b, cs_insn *insn) {
     // Insert FPU junk before instruction
-    int pattern = rand() % 4;
+    int pattern = (int)thread_rng_below(4);
 
     switch (pattern) {
         case 0:
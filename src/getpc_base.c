@@ -0,0 +1,405 @@
+/*
+ * Shared GetPC Base
+ *
+ * PROBLEM: Every position-dependent rewrite used to carry its own GetPC idiom
+ * (CALL/POP, or an equivalent), so a payload with twenty RIP-relative loads
+ * paid for twenty of them - in bytes and in call/return pairs.
+ *
+ * SOLUTION: Load the program counter once. A synthetic setup node ahead of the
+ * entry point (which dominates the whole payload) executes
+ *     x64: LEA base, [rip+disp]
+ *     x86: JMP +3; POP base; JMP +5; CALL -8; LEA base, [base+disp]
+ * into a register no instruction of the payload reads or writes, so the value
+ * stays valid everywhere. The layout solver then re-encodes every RIP-relative
+ * reference against the final offsets; those whose new displacement still
+ * contains bad bytes become [base+disp32], and the solver chooses `disp` (the
+ * base value) so that as many of them as possible come out clean. The setup
+ * is only emitted when at least one reference actually uses the base.
+ *
+ * RIP-relative references exist on x64 only; on x86 the base serves the
+ * constant pool.
+ */
+
+#include "getpc_base.h"
+#include "branch_layout.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Full-width register for each GPR family
+static const x86_reg getpc_base_family_regs[16] = {
+    X86_REG_RAX, X86_REG_RCX, X86_REG_RDX, X86_REG_RBX,
+    X86_REG_RSP, X86_REG_RBP, X86_REG_RSI, X86_REG_RDI,
+    X86_REG_R8,  X86_REG_R9,  X86_REG_R10, X86_REG_R11,
+    X86_REG_R12, X86_REG_R13, X86_REG_R14, X86_REG_R15
+};
+static const x86_reg getpc_base_family_regs32[8] = {
+    X86_REG_EAX, X86_REG_ECX, X86_REG_EDX, X86_REG_EBX,
+    X86_REG_ESP, X86_REG_EBP, X86_REG_ESI, X86_REG_EDI
+};
+
+// Caller-saved registers are preferred so a payload that returns leaves its
+// caller's state alone; if the payload calls out, only callee-saved registers
+// survive the call. RSP and R12 are never used ([reg+disp32] needs a SIB byte).
+static const int getpc_base_caller_saved[] = {6, 7, 8, 9, 10, 11};
+static const int getpc_base_callee_saved[] = {3, 5, 15, 14, 13};
+static const int getpc_base_caller_saved32[] = {2, 1};
+static const int getpc_base_callee_saved32[] = {3, 6, 7, 5};
+
+#define GETPC_BASE_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static int getpc_base_is_legacy_prefix(uint8_t b) {
+    switch (b) {
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x64: case 0x65: case 0x66: case 0x67:
+        case 0xF0: case 0xF2: case 0xF3:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Walk prefixes and opcode to the ModR/M byte. Returns its index, or -1 for
+ * encodings this module does not rewrite (VEX/EVEX).
+ */
+static int getpc_base_modrm_index(cs_insn *insn, int *rex_index) {
+    int i = 0;
+
+    *rex_index = -1;
+    while (i < insn->size && getpc_base_is_legacy_prefix(insn->bytes[i])) {
+        i++;
+    }
+    if (i < insn->size && (insn->bytes[i] & 0xF0) == 0x40) {
+        *rex_index = i++;
+    }
+    if (i >= insn->size) {
+        return -1;
+    }
+    if (insn->bytes[i] == 0xC4 || insn->bytes[i] == 0xC5 || insn->bytes[i] == 0x62) {
+        return -1;
+    }
+    if (insn->bytes[i] == 0x0F) {
+        i++;
+        if (i < insn->size && (insn->bytes[i] == 0x38 || insn->bytes[i] == 0x3A)) {
+            i++;
+        }
+    }
+    i++;  // Opcode
+    return (i < insn->size) ? i : -1;
+}
+
+static cs_x86_op *getpc_base_rip_operand(cs_insn *insn) {
+    cs_x86 *x86 = &insn->detail->x86;
+    for (int i = 0; i < x86->op_count; i++) {
+        if (x86->operands[i].type == X86_OP_MEM && x86->operands[i].mem.base == X86_REG_RIP) {
+            return &x86->operands[i];
+        }
+    }
+    return NULL;
+}
+
+int getpc_base_disp_offset(cs_insn *insn) {
+    cs_x86_op *op;
+    int rex;
+    int modrm;
+    int32_t disp;
+
+    if (!insn->detail || !(op = getpc_base_rip_operand(insn))) {
+        return -1;
+    }
+    modrm = getpc_base_modrm_index(insn, &rex);
+    if (modrm < 0 || (insn->bytes[modrm] & 0xC7) != 0x05 || modrm + 5 > insn->size) {
+        return -1;
+    }
+    memcpy(&disp, insn->bytes + modrm + 1, 4);
+    if ((int64_t)disp != op->mem.disp) {
+        return -1;
+    }
+    return modrm + 1;
+}
+
+int getpc_base_is_reference(cs_insn *insn, byval_arch_t arch) {
+    int disp_at;
+
+    if (arch != BYVAL_ARCH_X64) {
+        return 0;
+    }
+    disp_at = getpc_base_disp_offset(insn);
+    if (disp_at < 0) {
+        return 0;
+    }
+
+    // Only the displacement may be dirty, everything else is copied verbatim
+    for (int i = 0; i < insn->size; i++) {
+        if ((i < disp_at || i >= disp_at + 4) && !is_bad_byte_free_byte(insn->bytes[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int64_t getpc_base_reference_target(cs_insn *insn) {
+    cs_x86_op *op = getpc_base_rip_operand(insn);
+    return (int64_t)(insn->address + insn->size) + (op ? op->mem.disp : 0);
+}
+
+static void getpc_base_mark(uint32_t *used, unsigned int reg) {
+    int fam = layout_gpr_family(reg, NULL);
+    if (fam >= 0) {
+        *used |= 1u << fam;
+    }
+}
+
+x86_reg getpc_base_select_register(struct instruction_node *head, byval_arch_t arch) {
+    uint32_t used = 0;
+    int calls_out = 0;
+    size_t end = 0;
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        end = n->offset + n->insn->size;
+    }
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        cs_insn *insn = n->insn;
+        cs_detail *detail = insn->detail;
+        if (!detail) {
+            return X86_REG_INVALID;
+        }
+
+        for (int i = 0; i < detail->regs_read_count; i++) {
+            getpc_base_mark(&used, detail->regs_read[i]);
+        }
+        for (int i = 0; i < detail->regs_write_count; i++) {
+            getpc_base_mark(&used, detail->regs_write[i]);
+        }
+        for (int i = 0; i < detail->x86.op_count; i++) {
+            cs_x86_op *op = &detail->x86.operands[i];
+            if (op->type == X86_OP_REG) {
+                getpc_base_mark(&used, op->reg);
+            } else if (op->type == X86_OP_MEM) {
+                getpc_base_mark(&used, op->mem.base);
+                getpc_base_mark(&used, op->mem.index);
+            }
+        }
+
+        switch (insn->id) {
+            case X86_INS_SYSCALL:
+            case X86_INS_SYSENTER:
+                used |= (1u << 1) | (1u << 11);  // RCX and R11 are clobbered by the kernel
+                break;
+            case X86_INS_INT:
+            case X86_INS_LCALL:
+                calls_out = 1;
+                break;
+            case X86_INS_CALL: {
+                cs_x86_op *op = &detail->x86.operands[0];
+                if (detail->x86.op_count == 0 || op->type != X86_OP_IMM ||
+                    op->imm < 0 || (uint64_t)op->imm >= end) {
+                    calls_out = 1;  // Indirect or external callee may clobber scratch registers
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (arch == BYVAL_ARCH_X86) {
+        for (size_t i = 0; !calls_out && i < GETPC_BASE_COUNT(getpc_base_caller_saved32); i++) {
+            if (!(used & (1u << getpc_base_caller_saved32[i]))) {
+                return getpc_base_family_regs32[getpc_base_caller_saved32[i]];
+            }
+        }
+        for (size_t i = 0; i < GETPC_BASE_COUNT(getpc_base_callee_saved32); i++) {
+            if (!(used & (1u << getpc_base_callee_saved32[i]))) {
+                return getpc_base_family_regs32[getpc_base_callee_saved32[i]];
+            }
+        }
+        return X86_REG_INVALID;
+    }
+
+    for (size_t i = 0; !calls_out && i < GETPC_BASE_COUNT(getpc_base_caller_saved); i++) {
+        if (!(used & (1u << getpc_base_caller_saved[i]))) {
+            return getpc_base_family_regs[getpc_base_caller_saved[i]];
+        }
+    }
+    for (size_t i = 0; i < GETPC_BASE_COUNT(getpc_base_callee_saved); i++) {
+        if (!(used & (1u << getpc_base_callee_saved[i]))) {
+            return getpc_base_family_regs[getpc_base_callee_saved[i]];
+        }
+    }
+    return X86_REG_INVALID;
+}
+
+struct instruction_node *getpc_base_create_setup(x86_reg reg, byval_arch_t arch) {
+    struct instruction_node *node = calloc(1, sizeof(struct instruction_node));
+    cs_insn *insn = calloc(1, sizeof(cs_insn));
+    cs_detail *detail = calloc(1, sizeof(cs_detail));
+
+    if (!node || !insn || !detail) {
+        free(node);
+        free(insn);
+        free(detail);
+        return NULL;
+    }
+
+    // Zero-sized in the input: it does not shift any original offset
+    insn->id = X86_INS_LEA;
+    insn->size = 0;
+    insn->detail = detail;
+    strcpy(insn->mnemonic, "lea");
+    strcpy(insn->op_str, "<getpc base>, [rip]");
+
+    // The register and displacement live on the node; the record has no operands
+    node->insn = insn;
+    node->branch_form = LAYOUT_FORM_BASE_SETUP;
+    node->base_reg = reg;
+    buffer_init(&node->code);
+    getpc_base_set_disp(node, arch, 0);
+    return node;
+}
+
+void getpc_base_free_setup(struct instruction_node *node) {
+    if (!node || !node->insn) {
+        return;
+    }
+    free(node->insn->detail);
+    free(node->insn);
+    node->insn = NULL;
+}
+
+x86_reg getpc_base_setup_register(const struct instruction_node *node) {
+    return node->base_reg;
+}
+
+size_t getpc_base_setup_size(byval_arch_t arch) {
+    return (arch == BYVAL_ARCH_X64) ? GETPC_BASE_SETUP_SIZE_X64 : GETPC_BASE_SETUP_SIZE_X86;
+}
+
+void getpc_base_set_disp(struct instruction_node *node, byval_arch_t arch, int32_t disp) {
+    int fam = layout_gpr_family(getpc_base_setup_register(node), NULL);
+    uint8_t code[GETPC_BASE_SETUP_SIZE_X86];
+    size_t len = 0;
+
+    node->base_disp = disp;
+
+    if (arch == BYVAL_ARCH_X64) {
+        code[len++] = (uint8_t)(0x48 | ((fam & 8) ? 0x04 : 0));
+        code[len++] = 0x8D;
+        code[len++] = (uint8_t)(0x05 | ((fam & 7) << 3));
+    } else {
+        static const uint8_t getpc[] = {
+            0xEB, 0x03,                     // JMP +3 (to the CALL)
+            0x58,                           // POP base (patched below)
+            0xEB, 0x05,                     // JMP +5 (past the CALL)
+            0xE8, 0xF8, 0xFF, 0xFF, 0xFF    // CALL -8 (back to the POP)
+        };
+        memcpy(code, getpc, sizeof(getpc));
+        code[2] = (uint8_t)(0x58 | (fam & 7));
+        len = sizeof(getpc);
+        code[len++] = 0x8D;
+        code[len++] = (uint8_t)(0x80 | ((fam & 7) << 3) | (fam & 7));
+    }
+    memcpy(code + len, &disp, 4);
+    len += 4;
+
+    node->code.size = 0;
+    buffer_append(&node->code, code, len);
+}
+
+int64_t getpc_base_value(const struct instruction_node *node, byval_arch_t arch) {
+    int32_t disp = node->base_disp;
+    // x64: RIP after the LEA; x86: the return address popped (the LEA's offset)
+    size_t anchor = (arch == BYVAL_ARCH_X64) ? GETPC_BASE_SETUP_SIZE_X64 : GETPC_BASE_SETUP_SIZE_X86 - 6;
+    return (int64_t)(node->new_offset + anchor) + disp;
+}
+
+size_t getpc_base_encode_direct(cs_insn *insn, size_t at, int64_t target, uint8_t *out) {
+    int disp_at = getpc_base_disp_offset(insn);
+    int64_t disp = target - (int64_t)(at + insn->size);
+    int32_t disp32;
+
+    if (disp_at < 0 || disp < INT32_MIN || disp > INT32_MAX) {
+        return 0;
+    }
+    disp32 = (int32_t)disp;
+    memcpy(out, insn->bytes, insn->size);
+    memcpy(out + disp_at, &disp32, 4);
+    return insn->size;
+}
+
+// REX must be added when the base is R8-R15; that rules out AH/BH/CH/DH operands
+static int getpc_base_needs_rex(cs_insn *insn, x86_reg base, int *rex_index) {
+    int fam = layout_gpr_family(base, NULL);
+
+    getpc_base_modrm_index(insn, rex_index);
+    if (*rex_index >= 0 || !(fam & 8)) {
+        return 0;
+    }
+    for (int i = 0; i < insn->detail->x86.op_count; i++) {
+        cs_x86_op *op = &insn->detail->x86.operands[i];
+        if (op->type == X86_OP_REG &&
+            (op->reg == X86_REG_AH || op->reg == X86_REG_BH ||
+             op->reg == X86_REG_CH || op->reg == X86_REG_DH)) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+size_t getpc_base_based_size(cs_insn *insn, x86_reg base) {
+    int rex_index;
+    int add_rex = getpc_base_needs_rex(insn, base, &rex_index);
+
+    if (add_rex < 0 || getpc_base_disp_offset(insn) < 0) {
+        return 0;
+    }
+    return insn->size + (size_t)add_rex;
+}
+
+size_t getpc_base_encode_based(cs_insn *insn, x86_reg base, int64_t disp, uint8_t *out) {
+    int fam = layout_gpr_family(base, NULL);
+    int disp_at = getpc_base_disp_offset(insn);
+    int rex_index;
+    int add_rex = getpc_base_needs_rex(insn, base, &rex_index);
+    int modrm = disp_at - 1;
+    int32_t disp32 = (int32_t)disp;
+    size_t len = 0;
+
+    if (add_rex < 0 || disp_at < 0 || disp < INT32_MIN || disp > INT32_MAX) {
+        return 0;
+    }
+
+    // Prefixes up to the opcode, with REX.B selecting the base register
+    int opcode_at = (rex_index >= 0) ? rex_index + 1 : 0;
+    if (rex_index < 0) {
+        while (opcode_at < insn->size && getpc_base_is_legacy_prefix(insn->bytes[opcode_at])) {
+            opcode_at++;
+        }
+    }
+    for (int i = 0; i < opcode_at; i++) {
+        uint8_t b = insn->bytes[i];
+        if (i == rex_index) {
+            b = (uint8_t)((b & ~0x01) | ((fam & 8) ? 0x01 : 0));
+        }
+        out[len++] = b;
+    }
+    if (add_rex) {
+        out[len++] = 0x41;
+    }
+
+    // Opcode, then ModR/M switched from [rip+disp32] to [base+disp32]
+    for (int i = opcode_at; i < modrm; i++) {
+        out[len++] = insn->bytes[i];
+    }
+    out[len++] = (uint8_t)(0x80 | (insn->bytes[modrm] & 0x38) | (fam & 7));
+    memcpy(out + len, &disp32, 4);
+    len += 4;
+
+    // Trailing immediate, unchanged
+    for (int i = disp_at + 4; i < insn->size; i++) {
+        out[len++] = insn->bytes[i];
+    }
+    return len;
+}
@@ -0,0 +1,122 @@
+#ifndef GETPC_BASE_H
+#define GETPC_BASE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file getpc_base.h
+ * @brief Shared GetPC base for position-dependent rewrites
+ *
+ * Instead of a CALL/POP idiom per rewritten instruction, the payload gets a
+ * single base load at its entry into a register the payload never touches:
+ *   x64: LEA base, [rip+disp]
+ *   x86: JMP/CALL/POP (null-free GetPC), then LEA base, [base+disp]
+ * RIP-relative references whose re-encoded displacement contains bad bytes
+ * (x64) and constant-pool loads (see constant_pool.h) are then addressed as
+ * [base+disp32]; the layout solver picks `disp`, i.e. the base value, so that
+ * as many of them as possible come out clean. The entry dominates every
+ * instruction, and since the register is reserved the base stays valid for
+ * the whole payload.
+ */
+
+#define GETPC_BASE_SETUP_SIZE_X64 7    // LEA r64, [rip+disp32]
+#define GETPC_BASE_SETUP_SIZE_X86 16   // JMP/CALL/POP + LEA r32, [r32+disp32]
+
+/**
+ * Locate the disp32 of a RIP-relative ModR/M operand
+ * @param insn: Capstone instruction
+ * @return: Byte offset of the displacement in insn->bytes, or -1
+ */
+int getpc_base_disp_offset(cs_insn *insn);
+
+/**
+ * Check whether an instruction is a RIP-relative reference the layout solver
+ * can relocate (every byte except the displacement is already clean)
+ * @param insn: Capstone instruction
+ * @param arch: Target architecture
+ * @return: 1 if relocatable, 0 otherwise
+ */
+int getpc_base_is_reference(cs_insn *insn, byval_arch_t arch);
+
+/**
+ * Original payload offset a RIP-relative reference points at
+ * @param insn: Instruction accepted by getpc_base_is_reference()
+ * @return: Target offset (may lie outside the payload)
+ */
+int64_t getpc_base_reference_target(cs_insn *insn);
+
+/**
+ * Pick a register the payload never reads or writes to hold the base
+ * @param head: First instruction node
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @return: Full-width register id, or X86_REG_INVALID if none is free
+ */
+x86_reg getpc_base_select_register(struct instruction_node *head, byval_arch_t arch);
+
+/**
+ * Create the synthetic node that loads the base (placed ahead of the entry)
+ * @param reg: Register from getpc_base_select_register()
+ * @param arch: Target architecture
+ * @return: New node owning its own instruction record, or NULL on failure
+ */
+struct instruction_node *getpc_base_create_setup(x86_reg reg, byval_arch_t arch);
+
+/**
+ * Release the instruction record of a setup node (the node itself is freed
+ * with the rest of the list)
+ * @param node: Node from getpc_base_create_setup()
+ */
+void getpc_base_free_setup(struct instruction_node *node);
+
+/**
+ * Register held by a setup node
+ * @param node: Node from getpc_base_create_setup()
+ * @return: Full-width register id
+ */
+x86_reg getpc_base_setup_register(const struct instruction_node *node);
+
+/**
+ * Size of the base load for an architecture
+ * @return: GETPC_BASE_SETUP_SIZE_X64 or GETPC_BASE_SETUP_SIZE_X86
+ */
+size_t getpc_base_setup_size(byval_arch_t arch);
+
+/**
+ * Choose the base displacement and re-encode the setup node's code
+ * @param node: Node from getpc_base_create_setup()
+ * @param arch: Target architecture
+ * @param disp: Base value minus the address the GetPC yields
+ */
+void getpc_base_set_disp(struct instruction_node *node, byval_arch_t arch, int32_t disp);
+
+/**
+ * Runtime value of the base, as a payload offset (uses node->new_offset)
+ * @param node: Node from getpc_base_create_setup()
+ * @param arch: Target architecture
+ * @return: Output offset the base register points at
+ */
+int64_t getpc_base_value(const struct instruction_node *node, byval_arch_t arch);
+
+/**
+ * Re-encode a RIP-relative reference at output offset `at` pointing at `target`
+ * @return: Encoding length (always insn->size), 0 if out of range
+ */
+size_t getpc_base_encode_direct(cs_insn *insn, size_t at, int64_t target, uint8_t *out);
+
+/**
+ * Size of a reference rewritten as [base+disp32]
+ * @return: Encoding length, 0 if the instruction cannot use the base
+ */
+size_t getpc_base_based_size(cs_insn *insn, x86_reg base);
+
+/**
+ * Encode a reference as [base+disp32]
+ * @param disp: Target offset minus base value
+ * @return: Encoding length, 0 if the instruction cannot use the base
+ */
+size_t getpc_base_encode_based(cs_insn *insn, x86_reg base, int64_t disp, uint8_t *out);
+
+#endif // GETPC_BASE_H
@@ -14,9 +14,14 @@
 #include "core.h"
 #include "strategy.h"
 
-// Track last seen value for sequential detection
-static int last_reg = -1;
-static int last_value = -1;
+// Track last seen value for sequential detection (per thread: variants rewrite concurrently)
+static __thread int last_reg = -1;
+static __thread int last_value = -1;
+
+void reset_incremental_byte_register_tracking(void) {
+    last_reg = -1;
+    last_value = -1;
+}
 
 // ============================================================================
 // Helper: Check if value is sequential increment
@@ -137,7 +137,7 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
 
     if (mem_op_index == -1) {
         // No matching memory operand found, should not happen if can_handle passed
-        fprintf(stderr, "[ERROR] No memory operand found in generic_mem_null_disp for %s\n", insn->mnemonic);
+        log_diagnostic("[ERROR] No memory operand found in generic_mem_null_disp for %s\n", insn->mnemonic);
         return;
     }
 
@@ -160,7 +160,7 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
                     buffer_append(b, pop, 2);
                 }
             } else {
-                fprintf(stderr, "[ERROR] MOV with memory destination needs register source in generic_mem_null_disp\n");
+                log_diagnostic("[ERROR] MOV with memory destination needs register source in generic_mem_null_disp\n");
             }
         } else { // Source is memory [disp32]
             if (insn->detail->x86.operands[0].type == X86_OP_REG) {
@@ -174,7 +174,7 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
                     buffer_append(b, pop, 1);
                 }
             } else {
-                fprintf(stderr, "[ERROR] MOV with memory source needs register destination in generic_mem_null_disp\n");
+                log_diagnostic("[ERROR] MOV with memory source needs register destination in generic_mem_null_disp\n");
             }
         }
     } else if (insn->id == X86_INS_PUSH) {
@@ -216,7 +216,7 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
             uint8_t code[] = {0x3B, modrm, sib}; // CMP reg, [EAX] using SIB
             buffer_append(b, code, 3);
         } else {
-            fprintf(stderr, "[ERROR] CMP with unexpected operand types in generic_mem_null_disp\n");
+            log_diagnostic("[ERROR] CMP with unexpected operand types in generic_mem_null_disp\n");
         }
     } else if (insn->id == X86_INS_ADD || insn->id == X86_INS_SUB ||
                insn->id == X86_INS_AND || insn->id == X86_INS_OR ||
@@ -252,7 +252,7 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
             uint8_t code[] = {opcode, modrm, sib}; // op [EAX], reg using SIB
             buffer_append(b, code, 3);
         } else {
-            fprintf(stderr, "[ERROR] Arithmetic operation with insufficient operands in generic_mem_null_disp\n");
+            log_diagnostic("[ERROR] Arithmetic operation with insufficient operands in generic_mem_null_disp\n");
         }
     } else if (insn->id == X86_INS_NOP) {
         // NOP with null bytes in displacement - replace with equivalent no-op
@@ -271,8 +271,8 @@ void generate_generic_mem_null_disp(struct buffer *b, cs_insn *insn) {
         buffer_append(b, code, 3);
     } else {
         // For unsupported instructions, fall back to original behavior or emit warning
-        fprintf(stderr, "[WARN] Unsupported instruction in generic_mem_null_disp: %s\n",
-                insn->mnemonic);
+        log_diagnostic("[WARN] Unsupported instruction in generic_mem_null_disp: %s\n",
+                       insn->mnemonic);
         // As a fallback, we can try the original instruction - but this may still contain nulls
         // It's better to skip and let another strategy handle it
     }
@@ -3,34 +3,45 @@
  * @brief Implementation of byvalver public C API
  *
  * This file implements the public API defined in byvalver.h by wrapping
- * the internal null-byte elimination functions.
+ * the internal rewrite pipeline. A context owns its bad-byte context and
+ * rewrite options and installs them as the calling thread's processing
+ * scope for each transform (see processing_scope_t in core.h), so nothing
+ * process-wide is written after the strategy tables are built.
  */
 
-#include "../include/byvalver.h"
-#include "../include/core.h"
-#include "../include/strategy.h"
+#include "byvalver.h"
+#include "core.h"
+#include "strategy.h"
+#include "utils.h"
+#include "decoder_stub.h"
+#include "thumb_encoding.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
+#include <pthread.h>
 
-#define BYVAL_VERSION "1.0.0"
-
-/* Global initialization flag */
-static int g_strategies_initialized = 0;
+struct ByvalContext {
+    byval_arch_t arch;
+    ByvalOptions options;
+    bad_byte_context_t bad_bytes;   // Profile and the tables derived from it
+    rewrite_options_t rewrite;
+    pthread_mutex_t stats_lock;
+    ByvalStats stats;
+};
 
 /* ============================================================================
  * Internal Helper Functions
  * ============================================================================ */
 
-/**
- * @brief Ensure strategies are initialized (called once)
- */
-static void ensure_strategies_initialized(void) {
-    if (!g_strategies_initialized) {
-        init_strategies();
-        g_strategies_initialized = 1;
+static int map_arch(ByvalArch arch, byval_arch_t *arch_out) {
+    switch (arch) {
+        case BYVAL_TARGET_X86:   *arch_out = BYVAL_ARCH_X86;   return 1;
+        case BYVAL_TARGET_X64:   *arch_out = BYVAL_ARCH_X64;   return 1;
+        case BYVAL_TARGET_ARM:   *arch_out = BYVAL_ARCH_ARM;   return 1;
+        case BYVAL_TARGET_ARM64: *arch_out = BYVAL_ARCH_ARM64; return 1;
+        case BYVAL_TARGET_THUMB: *arch_out = BYVAL_ARCH_THUMB; return 1;
     }
+    return 0;
 }
 
 /**
@@ -46,6 +57,119 @@ static size_t count_null_bytes(const uint8_t *data, size_t size) {
     return count;
 }
 
+// Bad bytes of the active profile in a buffer (inside a context's scope)
+static size_t count_bad_bytes(const uint8_t *data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (!is_bad_byte_free_byte(data[i])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Same derivation as the CLI's apply_rewrite_options(): the size budget
+// leaves room for the stubs added after the rewrite
+static void context_rewrite_options(const ByvalOptions *options, byval_arch_t arch,
+                                    rewrite_options_t *rewrite) {
+    memset(rewrite, 0, sizeof(*rewrite));
+    rewrite->constant_pool = options->constant_pool;
+    rewrite->constant_reuse = options->constant_reuse;
+    rewrite->rebase_displacements = options->rebase_displacements;
+    rewrite->rename_registers = options->rename_registers;
+    rewrite->optimize_size = options->optimize_size;
+    rewrite->max_output_size = options->max_output_size;
+    rewrite->threads = options->threads;
+    if (options->xor_encode && rewrite->max_output_size > 0) {
+        size_t stub = DECODER_STUB_MAX_SIZE + DECODER_STUB_MAX_PADDING;
+        rewrite->max_output_size = (rewrite->max_output_size > stub)
+                                       ? rewrite->max_output_size - stub : 1;
+    }
+    if (arch == BYVAL_ARCH_THUMB && rewrite->max_output_size > 0 &&
+        (options->xor_encode || options->thumb_entry_stub)) {
+        rewrite->max_output_size = (rewrite->max_output_size > THUMB_ENTRY_MAX_SIZE)
+                                       ? rewrite->max_output_size - THUMB_ENTRY_MAX_SIZE : 1;
+    }
+}
+
+// Rewrite, then add the decoder stub and/or the Thumb entry stub as the CLI's
+// rewrite pipeline does. Runs inside the context's processing scope.
+static ByvalError run_pipeline(const ByvalContext *ctx, const uint8_t *input, size_t input_size,
+                               struct buffer *out) {
+    struct buffer rewritten = remove_null_bytes(input, input_size, ctx->arch);
+    struct buffer entered;
+    const uint8_t *payload = rewritten.data;
+    size_t payload_size = rewritten.size;
+    ByvalError err = BYVAL_SUCCESS;
+
+    if (rewritten.data == NULL) {
+        return BYVAL_ERROR_DISASSEMBLY_FAILED;
+    }
+
+    buffer_init(&entered);
+    if (ctx->arch == BYVAL_ARCH_THUMB && (ctx->options.xor_encode || ctx->options.thumb_entry_stub)) {
+        // Decoder stubs run in ARM state, so an encoded Thumb payload always has one
+        uint8_t stub[THUMB_ENTRY_MAX_SIZE];
+        size_t stub_size = thumb_entry_stub(stub);
+
+        if (stub_size == 0) {
+            err = BYVAL_ERROR_ENCODING_FAILED;
+            goto done;
+        }
+        buffer_append(&entered, stub, stub_size);
+        buffer_append(&entered, rewritten.data, rewritten.size);
+        payload = entered.data;
+        payload_size = entered.size;
+    }
+
+    if (ctx->options.xor_encode) {
+        decoder_stub_info_t info;
+        const uint32_t *fixed_key = ctx->options.xor_key ? &ctx->options.xor_key : NULL;
+
+        if (decoder_stub_encode(payload, payload_size, ctx->arch, fixed_key, out, &info) != 0) {
+            err = BYVAL_ERROR_ENCODING_FAILED;
+        }
+    } else {
+        buffer_append(out, payload, payload_size);
+    }
+
+done:
+    buffer_free(&entered);
+    buffer_free(&rewritten);
+    return err;
+}
+
+// The strategy tables are built on the first caller's thread; their
+// registration messages follow the same quiet rule as a transform
+static void init_strategies_quiet(byval_arch_t arch, int quiet) {
+    processing_scope_t scope, saved;
+
+    get_processing_scope(&saved);
+    scope = saved;
+    scope.quiet = quiet;
+    set_processing_scope(&scope);
+    init_strategies_once(arch);
+    set_processing_scope(&saved);
+}
+
+static void record_transform(ByvalContext *ctx, ByvalError err, size_t input_size,
+                             size_t output_size, const batch_stats_t *strategy_stats) {
+    pthread_mutex_lock(&ctx->stats_lock);
+    if (err == BYVAL_SUCCESS) {
+        ctx->stats.transforms++;
+        ctx->stats.input_bytes += input_size;
+        ctx->stats.output_bytes += output_size;
+    } else {
+        ctx->stats.failures++;
+    }
+    for (size_t i = 0; i < strategy_stats->strategy_count; i++) {
+        ctx->stats.strategies_applied += (unsigned long)strategy_stats->strategy_stats[i].success_count;
+        ctx->stats.strategy_rollbacks += (unsigned long)strategy_stats->strategy_stats[i].failure_count;
+    }
+    ctx->stats.last_error = err;
+    pthread_mutex_unlock(&ctx->stats_lock);
+}
+
 /* ============================================================================
  * Public API Implementation
  * ============================================================================ */
@@ -53,11 +177,14 @@ static size_t count_null_bytes(const uint8_t *data, size_t size) {
 void byval_init_options(ByvalOptions *options) {
     if (!options) return;
 
+    memset(options, 0, sizeof(*options));
     options->verbose = 0;
     options->verify_output = 1;  // Default to verifying output
     options->max_passes = 3;
     options->xor_encode = 0;
     options->xor_key = 0;
+    options->thumb_entry_stub = 1;
+    options->threads = 1;        // Callers parallelize across contexts
 }
 
 const char* byval_error_string(ByvalError error) {
@@ -73,16 +200,18 @@ const char* byval_error_string(ByvalError error) {
         case BYVAL_ERROR_MEMORY:
             return "Memory allocation failed";
         case BYVAL_ERROR_NULLS_REMAIN:
-            return "Null bytes remain after processing";
+            return "Bad bytes remain after processing";
         case BYVAL_ERROR_PROCESSING_FAILED:
             return "Processing failed";
+        case BYVAL_ERROR_ENCODING_FAILED:
+            return "No decoder or entry stub is clean under the bad-byte set";
         default:
             return "Unknown error";
     }
 }
 
 const char* byval_version(void) {
-    return BYVAL_VERSION;
+    return BYVALVER_VERSION_STRING;
 }
 
 void byval_free_result(ByvalResult *result) {
@@ -105,111 +234,148 @@ size_t byval_count_nulls(const uint8_t *data, size_t size) {
 }
 
 int byval_get_strategy_count(void) {
-    ensure_strategies_initialized();
-    // TODO: Implement actual strategy counting
-    return 70;  // Approximate number of strategies
+    init_strategies_quiet(BYVAL_ARCH_X64, 1);
+    return get_strategy_count(BYVAL_ARCH_X64);
 }
 
-ByvalError byval_clean(const uint8_t *input, size_t input_size,
-                       const ByvalOptions *options, ByvalResult *result) {
-    if (!input || input_size == 0 || !result) {
-        return BYVAL_ERROR_INVALID_INPUT;
-    }
-
-    // Initialize result structure
-    memset(result, 0, sizeof(ByvalResult));
+ByvalContext *byval_context_create(ByvalArch arch, const uint8_t *bad_bytes,
+                                   size_t bad_byte_count, const ByvalOptions *options) {
+    ByvalContext *ctx;
+    bad_byte_config_t config;
+    byval_arch_t internal_arch;
 
-    // Use default options if none provided
-    ByvalOptions default_opts;
-    if (!options) {
-        byval_init_options(&default_opts);
-        options = &default_opts;
+    if (!map_arch(arch, &internal_arch) || (bad_byte_count > 0 && !bad_bytes)) {
+        return NULL;
     }
 
-    // Ensure strategies are initialized
-    ensure_strategies_initialized();
+    ctx = (ByvalContext *)calloc(1, sizeof(ByvalContext));
+    if (!ctx) {
+        return NULL;
+    }
+    if (pthread_mutex_init(&ctx->stats_lock, NULL) != 0) {
+        free(ctx);
+        return NULL;
+    }
 
-    // Count original null bytes
-    size_t original_nulls = count_null_bytes(input, input_size);
+    ctx->arch = internal_arch;
+    if (options) {
+        ctx->options = *options;
+    } else {
+        byval_init_options(&ctx->options);
+    }
 
-    if (options->verbose) {
-        fprintf(stdout, "[byvalver] Input size: %zu bytes\n", input_size);
-        fprintf(stdout, "[byvalver] Original null bytes: %zu\n", original_nulls);
+    if (bad_byte_count == 0) {
+        bad_byte_context_build(&ctx->bad_bytes, NULL);
+    } else {
+        memset(&config, 0, sizeof(config));
+        for (size_t i = 0; i < bad_byte_count; i++) {
+            if (!config.bad_bytes[bad_bytes[i]]) {
+                config.bad_bytes[bad_bytes[i]] = 1;
+                config.bad_byte_list[config.bad_byte_count++] = bad_bytes[i];
+            }
+        }
+        bad_byte_context_build(&ctx->bad_bytes, &config);
     }
+    context_rewrite_options(&ctx->options, ctx->arch, &ctx->rewrite);
+    ctx->stats.last_error = BYVAL_SUCCESS;
 
-    // Process shellcode to remove null bytes
-    struct buffer processed = remove_null_bytes(input, input_size);
+    init_strategies_quiet(ctx->arch, !ctx->options.verbose);
+    return ctx;
+}
 
-    // Check if processing failed
-    if (processed.data == NULL || processed.size == 0) {
-        if (options->verbose) {
-            fprintf(stderr, "[byvalver] Processing failed\n");
-        }
-        return BYVAL_ERROR_PROCESSING_FAILED;
+ByvalError byval_transform(ByvalContext *ctx, const uint8_t *input, size_t input_size,
+                           ByvalResult *result) {
+    processing_scope_t scope, saved;
+    batch_stats_t strategy_stats;
+    struct buffer out;
+    size_t input_bad, output_bad;
+    ByvalError err;
+
+    if (!ctx || !input || input_size == 0 || !result) {
+        return BYVAL_ERROR_INVALID_INPUT;
     }
 
-    // Apply XOR encoding if requested
-    struct buffer final_output;
-    buffer_init(&final_output);
+    // Initialize result structure
+    memset(result, 0, sizeof(ByvalResult));
 
-    if (options->xor_encode && options->xor_key != 0) {
-        if (options->verbose) {
-            fprintf(stdout, "[byvalver] Applying XOR encoding with key 0x%08x\n", options->xor_key);
-        }
+    batch_stats_init(&strategy_stats);
+    buffer_init(&out);
+    scope.bad_bytes = &ctx->bad_bytes;
+    scope.rewrite = &ctx->rewrite;
+    scope.stats = &strategy_stats;
+    scope.quiet = !ctx->options.verbose;   // The host's stderr is not ours
+    get_processing_scope(&saved);
+    set_processing_scope(&scope);
+
+    err = run_pipeline(ctx, input, input_size, &out);
+    input_bad = count_bad_bytes(input, input_size);
+    output_bad = (err == BYVAL_SUCCESS) ? count_bad_bytes(out.data, out.size) : 0;
 
-        // For now, just XOR encode the data directly
-        // In the full implementation, this would include the decoder stub
-        buffer_append(&final_output, processed.data, processed.size);
+    set_processing_scope(&saved);
 
-        // XOR encode
-        for (size_t i = 0; i < final_output.size; i++) {
-            final_output.data[i] ^= ((uint8_t *)&options->xor_key)[i % 4];
+    if (err == BYVAL_SUCCESS && output_bad > 0 && ctx->options.verify_output) {
+        if (ctx->options.verbose) {
+            fprintf(stderr, "[byvalver] Warning: %zu bad bytes remain\n", output_bad);
         }
-    } else {
-        // No encoding, use processed data directly
-        buffer_append(&final_output, processed.data, processed.size);
+        err = BYVAL_ERROR_NULLS_REMAIN;
     }
-
-    // Verify null-byte elimination if requested
-    if (options->verify_output) {
-        size_t remaining_nulls = count_null_bytes(final_output.data, final_output.size);
-        if (remaining_nulls > 0) {
-            if (options->verbose) {
-                fprintf(stderr, "[byvalver] Warning: %zu null bytes remain\n", remaining_nulls);
+    if (err == BYVAL_SUCCESS) {
+        result->data = (uint8_t *)malloc(out.size);
+        if (!result->data) {
+            err = BYVAL_ERROR_MEMORY;
+        } else {
+            memcpy(result->data, out.data, out.size);
+            result->size = out.size;
+            result->nulls_removed = (int)input_bad;
+            result->passes_completed = 1;
+            for (size_t i = 0; i < strategy_stats.strategy_count; i++) {
+                result->strategies_applied += strategy_stats.strategy_stats[i].success_count;
             }
-            buffer_free(&processed);
-            buffer_free(&final_output);
-            return BYVAL_ERROR_NULLS_REMAIN;
         }
     }
 
-    // Allocate result buffer
-    result->data = (uint8_t *)malloc(final_output.size);
-    if (!result->data) {
-        buffer_free(&processed);
-        buffer_free(&final_output);
-        return BYVAL_ERROR_MEMORY;
+    if (err == BYVAL_SUCCESS && ctx->options.verbose) {
+        fprintf(stdout, "[byvalver] %zu -> %zu bytes, %zu bad bytes in input, %d strategies applied\n",
+                input_size, result->size, input_bad, result->strategies_applied);
     }
 
-    // Copy data to result
-    memcpy(result->data, final_output.data, final_output.size);
-    result->size = final_output.size;
-    result->nulls_removed = (int)original_nulls;
-    result->strategies_applied = 0;  // TODO: Track this in core
-    result->passes_completed = 1;
+    record_transform(ctx, err, input_size, result->size, &strategy_stats);
+    batch_stats_free(&strategy_stats);
+    buffer_free(&out);
+    return err;
+}
 
-    if (options->verbose) {
-        fprintf(stdout, "[byvalver] Output size: %zu bytes\n", result->size);
-        fprintf(stdout, "[byvalver] Removed %d null bytes\n", result->nulls_removed);
-        fprintf(stdout, "[byvalver] Size change: %+zd bytes\n", 
-                (ssize_t)result->size - (ssize_t)input_size);
-    }
+void byval_get_stats(ByvalContext *ctx, ByvalStats *stats) {
+    if (!ctx || !stats) return;
 
-    // Cleanup
-    buffer_free(&processed);
-    buffer_free(&final_output);
+    pthread_mutex_lock(&ctx->stats_lock);
+    *stats = ctx->stats;
+    pthread_mutex_unlock(&ctx->stats_lock);
+}
 
-    return BYVAL_SUCCESS;
+void byval_context_destroy(ByvalContext *ctx) {
+    if (!ctx) return;
+
+    pthread_mutex_destroy(&ctx->stats_lock);
+    free(ctx);
+}
+
+ByvalError byval_clean(const uint8_t *input, size_t input_size,
+                       const ByvalOptions *options, ByvalResult *result) {
+    ByvalContext *ctx;
+    ByvalError err;
+
+    if (!input || input_size == 0 || !result) {
+        return BYVAL_ERROR_INVALID_INPUT;
+    }
+
+    ctx = byval_context_create(BYVAL_TARGET_X64, NULL, 0, options);
+    if (!ctx) {
+        return BYVAL_ERROR_MEMORY;
+    }
+    err = byval_transform(ctx, input, input_size, result);
+    byval_context_destroy(ctx);
+    return err;
 }
 
 ByvalError byval_clean_to_file(const uint8_t *input, size_t input_size,
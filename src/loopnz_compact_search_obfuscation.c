@@ -9,15 +9,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int loopnz_counter = 0;
-static int loopnz_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Helper: Check if instruction is part of loop pattern
@@ -39,20 +36,13 @@ static int is_loop_decrement(cs_insn *insn) {
 // ============================================================================
 
 int can_handle_loopnz_compact_search(cs_insn *insn) {
-    // Initialize once
-    if (!loopnz_initialized) {
-        srand((unsigned int)time(NULL) ^ 0xDEAD);
-        loopnz_initialized = 1;
-    }
-
     // Look for DEC ECX instructions (common in loops)
     if (!is_loop_decrement(insn)) {
         return 0;
     }
 
     // Apply to approximately 15% of DEC ECX instructions
-    loopnz_counter++;
-    return (loopnz_counter % 7 == 0);
+    return thread_rng_below(7) == 0;
 }
 
 size_t get_loopnz_compact_search_size(cs_insn *insn) {
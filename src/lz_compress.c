@@ -0,0 +1,368 @@
+/*
+ * LZ compression stage (see lz_compress.h)
+ *
+ * Matches are found through hash chains over 3-byte prefixes with one step
+ * of lazy evaluation: a match is deferred by a literal when the match at the
+ * next position saves more bytes. The stream is decoded again in C before the
+ * decompressor is emitted, so a stream that does not round-trip is never
+ * shipped.
+ */
+
+#include "lz_compress.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH     3
+#define LZ_MAX_MATCH     (0x3F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS  0x80
+#define LZ_NEAR_WINDOW   0x100
+#define LZ_FAR_WINDOW    0x10000
+#define LZ_HASH_BITS     12
+#define LZ_CHAIN_LIMIT   256          // Candidates examined per position
+
+typedef struct {
+    size_t length;
+    size_t offset;
+} lz_match_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    int32_t head[1 << LZ_HASH_BITS];
+    int32_t *prev;
+} lz_state_t;
+
+static uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void lz_insert(lz_state_t *s, size_t pos) {
+    if (pos + LZ_MIN_MATCH > s->size) {
+        return;
+    }
+    uint32_t h = lz_hash(s->data + pos);
+    s->prev[pos] = s->head[h];
+    s->head[h] = (int32_t)pos;
+}
+
+static size_t lz_token_cost(size_t offset) {
+    return (offset <= LZ_NEAR_WINDOW) ? 2 : 3;
+}
+
+// Bytes saved by a match over emitting it as literals (0 if none)
+static size_t lz_gain(const lz_match_t *m) {
+    size_t cost = lz_token_cost(m->offset);
+    return (m->length > cost) ? m->length - cost : 0;
+}
+
+static lz_match_t lz_find(const lz_state_t *s, size_t pos) {
+    lz_match_t best = {0, 0};
+    size_t limit = s->size - pos;
+    int chain = 0;
+
+    if (limit < LZ_MIN_MATCH) {
+        return best;
+    }
+    if (limit > LZ_MAX_MATCH) {
+        limit = LZ_MAX_MATCH;
+    }
+    for (int32_t cand = s->head[lz_hash(s->data + pos)];
+         cand >= 0 && chain < LZ_CHAIN_LIMIT; cand = s->prev[cand], chain++) {
+        size_t offset = pos - (size_t)cand;
+        size_t len = 0;
+
+        if (offset > LZ_FAR_WINDOW) {
+            break;
+        }
+        while (len < limit && s->data[cand + len] == s->data[pos + len]) {
+            len++;
+        }
+        lz_match_t m = {len, offset};
+        if (len >= LZ_MIN_MATCH && lz_gain(&m) > lz_gain(&best)) {
+            best = m;
+            if (len == limit && offset <= LZ_NEAR_WINDOW) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+static void lz_flush_literals(struct buffer *out, const uint8_t *start, size_t count) {
+    while (count > 0) {
+        size_t run = (count > LZ_MAX_LITERALS) ? LZ_MAX_LITERALS : count;
+        uint8_t token = (uint8_t)(run - 1);
+
+        buffer_append(out, &token, 1);
+        buffer_append(out, start, run);
+        start += run;
+        count -= run;
+    }
+}
+
+static void lz_emit_match(struct buffer *out, const lz_match_t *m) {
+    uint8_t b[3];
+    size_t off = m->offset - 1;
+
+    if (m->offset <= LZ_NEAR_WINDOW) {
+        b[0] = (uint8_t)(0x80 | (m->length - LZ_MIN_MATCH));
+        b[1] = (uint8_t)off;
+        buffer_append(out, b, 2);
+    } else {
+        b[0] = (uint8_t)(0xC0 | (m->length - LZ_MIN_MATCH));
+        b[1] = (uint8_t)off;
+        b[2] = (uint8_t)(off >> 8);
+        buffer_append(out, b, 3);
+    }
+}
+
+static int lz_compress_stream(const uint8_t *data, size_t size, struct buffer *out,
+                              size_t *matches) {
+    lz_state_t *s = malloc(sizeof(*s));
+    size_t pos = 0;
+    size_t lit_start = 0;
+
+    if (!s) {
+        return -1;
+    }
+    s->data = data;
+    s->size = size;
+    s->prev = malloc(size * sizeof(*s->prev));
+    if (!s->prev) {
+        free(s);
+        return -1;
+    }
+    memset(s->head, 0xFF, sizeof(s->head));
+    *matches = 0;
+
+    while (pos < size) {
+        lz_match_t m = lz_find(s, pos);
+        lz_insert(s, pos);
+
+        if (lz_gain(&m) > 0 && pos + 1 < size) {
+            lz_match_t next = lz_find(s, pos + 1);
+            if (lz_gain(&next) > lz_gain(&m)) {
+                pos++;          // Lazy: take this byte as a literal
+                continue;
+            }
+        }
+        if (lz_gain(&m) == 0) {
+            pos++;
+            continue;
+        }
+
+        lz_flush_literals(out, data + lit_start, pos - lit_start);
+        lz_emit_match(out, &m);
+        (*matches)++;
+        for (size_t i = 1; i < m.length; i++) {
+            lz_insert(s, pos + i);
+        }
+        pos += m.length;
+        lit_start = pos;
+    }
+    lz_flush_literals(out, data + lit_start, size - lit_start);
+
+    free(s->prev);
+    free(s);
+    return 0;
+}
+
+// Reference decoder, mirroring the emitted decompressor
+static int lz_stream_matches(const uint8_t *stream, size_t stream_size,
+                             const uint8_t *expected, size_t size) {
+    uint8_t *out = malloc(size);
+    size_t in = 0;
+    size_t pos = 0;
+    int ok = 0;
+
+    if (!out) {
+        return 0;
+    }
+    while (in < stream_size && pos < size) {
+        uint8_t token = stream[in++];
+        if (token < 0x80) {
+            size_t run = (size_t)token + 1;
+            if (in + run > stream_size || pos + run > size) {
+                break;
+            }
+            memcpy(out + pos, stream + in, run);
+            in += run;
+            pos += run;
+            continue;
+        }
+
+        size_t len = (size_t)(token & 0x3F) + LZ_MIN_MATCH;
+        size_t offset;
+        if (token & 0x40) {
+            if (in + 2 > stream_size) {
+                break;
+            }
+            offset = ((size_t)stream[in] | ((size_t)stream[in + 1] << 8)) + 1;
+            in += 2;
+        } else {
+            if (in + 1 > stream_size) {
+                break;
+            }
+            offset = (size_t)stream[in++] + 1;
+        }
+        if (offset > pos || pos + len > size) {
+            break;
+        }
+        for (size_t i = 0; i < len; i++, pos++) {
+            out[pos] = out[pos - offset];    // Byte by byte, like REP MOVSB
+        }
+    }
+    ok = (in == stream_size && pos == size && memcmp(out, expected, size) == 0);
+    free(out);
+    return ok;
+}
+
+static size_t lz_put32(uint8_t *s, size_t n, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        s[n++] = (uint8_t)(v >> (8 * i));
+    }
+    return n;
+}
+
+/*
+ * x86/x64 decompressor (x64 adds REX.W and uses INC/DEC r/m, since 0x40-0x4F
+ * are REX prefixes there):
+ *
+ *     cld
+ *     jmp short get
+ *   back:
+ *     pop esi                     ; ESI = stream
+ *     mov edi, esi
+ *     add edi, stream_size        ; EDI = output, just past the stream
+ *     push edi                    ; return address
+ *     lea ebp, [edi + size]       ; end of output
+ *   next:
+ *     xor eax, eax
+ *     xor ecx, ecx
+ *     lodsb                       ; token
+ *     test al, al
+ *     js match
+ *     lea ecx, [eax + 1]          ; literal run
+ *     rep movsb
+ *     jmp short check
+ *   match:
+ *     mov cl, al
+ *     and cl, 0x3F
+ *     add cl, 3                   ; length
+ *     test al, 0x40
+ *     lodsb                       ; offset low byte (flags kept)
+ *     jz near
+ *     mov ah, [esi]               ; offset high byte
+ *     inc esi
+ *   near:
+ *     push esi
+ *     mov esi, edi
+ *     sub esi, eax
+ *     dec esi                     ; ESI = output - offset
+ *     rep movsb
+ *     pop esi
+ *   check:
+ *     cmp edi, ebp
+ *     jb next
+ *     ret                         ; into the expanded payload
+ *   get:
+ *     call back
+ */
+static size_t lz_emit_x86(int x64, size_t stream_size, size_t size, uint8_t *s) {
+    size_t n = 0;
+    size_t jmp_get, back, next, js_match, jmp_check, match, jz_near, check;
+
+    s[n++] = 0xFC;                                  // cld
+    s[n++] = 0xEB; jmp_get = n++;                   // jmp short get
+    back = n;
+    s[n++] = 0x5E;                                  // pop esi
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x89; s[n++] = 0xF7;                   // mov edi, esi
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x81; s[n++] = 0xC7;                   // add edi, imm32
+    n = lz_put32(s, n, (uint32_t)stream_size);
+    s[n++] = 0x57;                                  // push edi
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x8D; s[n++] = 0xAF;                   // lea ebp, [edi + disp32]
+    n = lz_put32(s, n, (uint32_t)size);
+
+    next = n;
+    s[n++] = 0x31; s[n++] = 0xC0;                   // xor eax, eax
+    s[n++] = 0x31; s[n++] = 0xC9;                   // xor ecx, ecx
+    s[n++] = 0xAC;                                  // lodsb
+    s[n++] = 0x84; s[n++] = 0xC0;                   // test al, al
+    s[n++] = 0x78; js_match = n++;                  // js match
+    s[n++] = 0x8D; s[n++] = 0x48; s[n++] = 0x01;    // lea ecx, [eax + 1]
+    s[n++] = 0xF3; s[n++] = 0xA4;                   // rep movsb
+    s[n++] = 0xEB; jmp_check = n++;                 // jmp short check
+
+    match = n;
+    s[n++] = 0x88; s[n++] = 0xC1;                   // mov cl, al
+    s[n++] = 0x80; s[n++] = 0xE1; s[n++] = 0x3F;    // and cl, 0x3F
+    s[n++] = 0x80; s[n++] = 0xC1; s[n++] = LZ_MIN_MATCH; // add cl, 3
+    s[n++] = 0xA8; s[n++] = 0x40;                   // test al, 0x40
+    s[n++] = 0xAC;                                  // lodsb
+    s[n++] = 0x74; jz_near = n++;                   // jz near
+    s[n++] = 0x8A; s[n++] = 0x26;                   // mov ah, [esi]
+    if (x64) {
+        s[n++] = 0x48; s[n++] = 0xFF; s[n++] = 0xC6; // inc rsi
+    } else {
+        s[n++] = 0x46;                              // inc esi
+    }
+    s[jz_near] = (uint8_t)(n - (jz_near + 1));
+    s[n++] = 0x56;                                  // push esi
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x89; s[n++] = 0xFE;                   // mov esi, edi
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x29; s[n++] = 0xC6;                   // sub esi, eax
+    if (x64) {
+        s[n++] = 0x48; s[n++] = 0xFF; s[n++] = 0xCE; // dec rsi
+    } else {
+        s[n++] = 0x4E;                              // dec esi
+    }
+    s[n++] = 0xF3; s[n++] = 0xA4;                   // rep movsb
+    s[n++] = 0x5E;                                  // pop esi
+
+    check = n;
+    if (x64) s[n++] = 0x48;
+    s[n++] = 0x39; s[n++] = 0xEF;                   // cmp edi, ebp
+    s[n++] = 0x72;                                  // jb next
+    s[n] = (uint8_t)(int8_t)((int)next - (int)(n + 1));
+    n++;
+    s[n++] = 0xC3;                                  // ret
+
+    s[jmp_get] = (uint8_t)(n - (jmp_get + 1));
+    s[js_match] = (uint8_t)(match - (js_match + 1));
+    s[jmp_check] = (uint8_t)(check - (jmp_check + 1));
+    s[n++] = 0xE8;                                  // call back
+    n = lz_put32(s, n, (uint32_t)((int32_t)back - (int32_t)(n + 4)));
+    return n;
+}
+
+int lz_pack(const uint8_t *payload, size_t size, byval_arch_t arch,
+            struct buffer *out, lz_pack_info_t *info) {
+    struct buffer stream;
+    uint8_t stub[LZ_STUB_MAX_SIZE];
+    int ok = 0;
+
+    memset(info, 0, sizeof(*info));
+    if ((arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) ||
+        size == 0 || size > 0x7FFFFFFF) {
+        return -1;
+    }
+
+    buffer_init(&stream);
+    if (lz_compress_stream(payload, size, &stream, &info->matches) == 0 &&
+        lz_stream_matches(stream.data, stream.size, payload, size)) {
+        info->stream_size = stream.size;
+        info->stub_size = lz_emit_x86(arch == BYVAL_ARCH_X64, stream.size, size, stub);
+        if (info->stub_size + info->stream_size < size) {
+            buffer_append(out, stub, info->stub_size);
+            buffer_append(out, stream.data, stream.size);
+            ok = 1;
+        }
+    }
+    buffer_free(&stream);
+    return ok ? 0 : -1;
+}
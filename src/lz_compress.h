@@ -0,0 +1,53 @@
+#ifndef LZ_COMPRESS_H
+#define LZ_COMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+
+/**
+ * @file lz_compress.h
+ * @brief LZ compression stage with a self-extracting decompressor (--compress)
+ *
+ * The payload is replaced by a small x86/x64 decompressor followed by an LZ
+ * stream. The pair is then encoded behind a decoder stub like any other
+ * payload, so the stream and the decompressor do not need to be clean
+ * themselves; only the outer decoder stub does.
+ *
+ * Stream format (one token byte, then operands):
+ *
+ *   0x00-0x7F  literal run: (token + 1) bytes follow
+ *   0x80-0xBF  near match:  length (token & 0x3F) + 3, offset byte + 1 (1-256)
+ *   0xC0-0xFF  far match:   length (token & 0x3F) + 3, offset word + 1 (1-65536)
+ *
+ * x86 code repeats mostly at short range (prologues, register setup, the
+ * idioms the rewrite strategies emit), so the near form carries most matches
+ * in two bytes.
+ *
+ * The decompressor writes the expanded payload directly after the stream and
+ * returns into it. The memory that follows the shellcode must therefore be
+ * writable and executable for the uncompressed size.
+ */
+
+#define LZ_STUB_MAX_SIZE 96   // Largest decompressor
+
+typedef struct {
+    size_t stub_size;         // Decompressor bytes
+    size_t stream_size;       // Compressed stream bytes
+    size_t matches;           // Match tokens in the stream
+} lz_pack_info_t;
+
+/**
+ * Compress a payload behind a self-extracting decompressor
+ * @param payload: Payload to compress (not modified)
+ * @param size: Payload size
+ * @param arch: Target architecture (x86 and x64 are supported)
+ * @param out: Receives decompressor + stream (appended)
+ * @param info: Output sizes
+ * @return: 0 on success, -1 if the architecture is unsupported or compression
+ *          does not make the payload smaller
+ */
+int lz_pack(const uint8_t *payload, size_t size, byval_arch_t arch,
+            struct buffer *out, lz_pack_info_t *info);
+
+#endif // LZ_COMPRESS_H
@@ -7,6 +7,8 @@
 #include <sys/stat.h>
 #include <unistd.h>  // For readlink
 #include <limits.h>  // For PATH_MAX
+#include <time.h>
+#include <pthread.h>  // For --variants worker threads
 #include "core.h"
 #include "obfuscation_strategy_registry.h"
 #include "pic_generation.h"
@@ -15,7 +17,13 @@
 #include "strategy.h"  // For cleanup_ml_strategist
 #include "utils.h"  // For create_parent_dirs
 #include "batch_processing.h"  // For batch directory processing
-#include "../decoder.h" // Include the generated decoder stub header
+#include "decoder_stub.h"  // For --xor-encode decoder stubs
+#include "pipeline_choice.h"  // For --pipeline auto decisions
+#include "lz_compress.h"  // For --compress
+#include "thread_rng.h"  // For --variants / --seed
+#include "obfuscation_budget.h"  // For --obfuscation-budget
+#include "control_flow_dispatcher_obfuscation.h"  // For --flatten
+#include "thumb_encoding.h"  // For the --arch thumb entry stub
 #include "processing.h"  // For process_single_file
 
 #ifdef TUI_ENABLED
@@ -105,8 +113,609 @@ static char* format_shellcode(const uint8_t *data, size_t size, const char *form
     return output;
 }
 
+// Encode `data` behind the smallest clean decoder stub (or the --xor-encode KEY stub)
+static int encode_with_stub(const uint8_t *data, size_t size, const byvalver_config_t *config,
+                            struct buffer *out, decoder_stub_info_t *info) {
+    const uint32_t *fixed_key = (config->encode_shellcode && !config->xor_key_auto)
+                                    ? &config->xor_key : NULL;
+
+    return decoder_stub_encode(data, size, config->target_arch, fixed_key, out, info);
+}
+
+static void report_stub_failure(const char *input_file, const decoder_stub_info_t *info) {
+    if (info->failed_lane >= 0) {
+        fprintf(stderr, "Error: No usable XOR key for '%s': no key byte keeps every payload byte of lane %d clean\n",
+                input_file, info->failed_lane);
+    } else {
+        fprintf(stderr, "Error: No decoder stub for '%s' is clean under the active bad-byte profile\n",
+                input_file);
+    }
+}
+
+static void log_decoder_stub(const byvalver_config_t *config, const decoder_stub_info_t *info) {
+    if (config->quiet) {
+        return;
+    }
+    if (config->encode_shellcode && !config->xor_key_auto && info->failed_lane >= 0) {
+        fprintf(stderr, "Warning: XOR key 0x%08x produces bad bytes in lane %d (try --xor-encode auto)\n",
+                config->xor_key, info->failed_lane);
+    }
+    fprintf(stderr, "[DECODER] %s-%d stub (%zu bytes, %zu padding), key 0x%llx",
+            decoder_stub_kind_name(info->kind), info->width * 8,
+            info->stub_size, info->padding, (unsigned long long)info->key[0]);
+    if (info->kind == DECODER_STUB_ROLLING_XOR) {
+        fprintf(stderr, "/0x%llx", (unsigned long long)info->key[1]);
+    }
+    fprintf(stderr, "\n");
+}
+
+/*
+ * --arch thumb: a payload entered in ARM state starts with the ARM->Thumb
+ * entry stub. Appends stub + data to `out`; returns 0, or -1 when no stub is
+ * clean under the active profile (reported if `report`).
+ */
+static int append_thumb_entry(const uint8_t *data, size_t size, const char *input_file,
+                              const byvalver_config_t *config, int report, struct buffer *out) {
+    uint8_t stub[THUMB_ENTRY_MAX_SIZE];
+    size_t stub_size = thumb_entry_stub(stub);
+
+    if (stub_size == 0) {
+        if (report && !config->quiet) {
+            fprintf(stderr, "Error: No ARM->Thumb entry stub for '%s' is clean under the active bad-byte profile\n",
+                    input_file);
+        }
+        return -1;
+    }
+    if (!config->quiet) {
+        fprintf(stderr, "[THUMB] %zu-byte ARM->Thumb entry stub\n", stub_size);
+    }
+    buffer_append(out, stub, stub_size);
+    buffer_append(out, data, size);
+    return 0;
+}
+
+/*
+ * Append `data` behind a generated decoder stub (--xor-encode, --pipeline
+ * encode). A user key (--xor-encode KEY) is used as given, otherwise keys are
+ * searched. With --compress, the LZ-packed payload (decompressor + stream) is
+ * encoded as well and the smaller result is kept. Returns 0, or -1 when no
+ * stub works (reported if `report`).
+ */
+static int append_encoded_payload(const uint8_t *data, size_t size, const char *input_file,
+                                  const byvalver_config_t *config, int report,
+                                  struct buffer *out) {
+    struct buffer packed, plain_out, packed_out;
+    decoder_stub_info_t plain_info, packed_info;
+    lz_pack_info_t lz_info;
+    int plain_ok, packed_ok = 0;
+
+    if (!config->compress_payload) {
+        if (encode_with_stub(data, size, config, out, &plain_info) != 0) {
+            if (report && !config->quiet) {
+                report_stub_failure(input_file, &plain_info);
+            }
+            return -1;
+        }
+        log_decoder_stub(config, &plain_info);
+        return 0;
+    }
+
+    buffer_init(&packed);
+    buffer_init(&plain_out);
+    buffer_init(&packed_out);
+    plain_ok = (encode_with_stub(data, size, config, &plain_out, &plain_info) == 0);
+    if (lz_pack(data, size, config->target_arch, &packed, &lz_info) == 0) {
+        packed_ok = (encode_with_stub(packed.data, packed.size, config, &packed_out,
+                                      &packed_info) == 0);
+    }
+
+    // Compare final sizes: each candidate includes its own decoder stub
+    int use_packed = packed_ok && (!plain_ok || packed_out.size < plain_out.size);
+    if (!config->quiet) {
+        if (lz_info.stream_size > 0) {
+            fprintf(stderr, "[COMPRESS] %zu -> %zu bytes (decompressor %zu + stream %zu, %zu matches)\n",
+                    size, lz_info.stub_size + lz_info.stream_size, lz_info.stub_size,
+                    lz_info.stream_size, lz_info.matches);
+        } else {
+            fprintf(stderr, "[COMPRESS] no gain for '%s' (x86/x64 only)\n", input_file);
+        }
+        fprintf(stderr, "[COMPRESS] encoded compressed: ");
+        if (packed_ok) {
+            fprintf(stderr, "%zu bytes", packed_out.size);
+        } else {
+            fprintf(stderr, "unusable");
+        }
+        fprintf(stderr, ", plain: ");
+        if (plain_ok) {
+            fprintf(stderr, "%zu bytes", plain_out.size);
+        } else {
+            fprintf(stderr, "unusable");
+        }
+        fprintf(stderr, " -> %s\n", use_packed ? "compressed" : "plain");
+    }
+
+    int status = 0;
+    if (use_packed) {
+        log_decoder_stub(config, &packed_info);
+        buffer_append(out, packed_out.data, packed_out.size);
+    } else if (plain_ok) {
+        log_decoder_stub(config, &plain_info);
+        buffer_append(out, plain_out.data, plain_out.size);
+    } else {
+        if (report && !config->quiet) {
+            report_stub_failure(input_file, &plain_info);
+        }
+        status = -1;
+    }
+    buffer_free(&packed);
+    buffer_free(&plain_out);
+    buffer_free(&packed_out);
+    return status;
+}
+
+// Decoder stubs run in ARM state, so a Thumb payload is always encoded with
+// its entry stub in front (--no-thumb-stub only applies to plain output)
+static int append_with_decoder_stub(const uint8_t *data, size_t size, const char *input_file,
+                                    const byvalver_config_t *config, int report,
+                                    struct buffer *out) {
+    struct buffer entered;
+    int status;
+
+    if (config->target_arch != BYVAL_ARCH_THUMB) {
+        return append_encoded_payload(data, size, input_file, config, report, out);
+    }
+    buffer_init(&entered);
+    status = append_thumb_entry(data, size, input_file, config, report, &entered);
+    if (status == 0) {
+        status = append_encoded_payload(entered.data, entered.size, input_file, config, report, out);
+    }
+    buffer_free(&entered);
+    return status;
+}
+
+// Rewrite options for every rewrite of this file; set once before any
+// pipeline runs, since --variants rewrites concurrently
+static void apply_rewrite_options(const byvalver_config_t *config) {
+    rewrite_options_t rewrite_opts = {0};
+    rewrite_opts.constant_pool = config->constant_pool;
+    rewrite_opts.constant_reuse = config->constant_reuse;
+    rewrite_opts.rebase_displacements = config->rebase_displacements;
+    rewrite_opts.rename_registers = config->rename_registers;
+    rewrite_opts.clobber_mask = config->clobber_mask;
+    rewrite_opts.optimize_size = config->optimize_size;
+    rewrite_opts.max_output_size = config->max_output_size;
+    rewrite_opts.obfuscation_budget_kind = config->obfuscation_budget_kind;
+    rewrite_opts.obfuscation_budget = config->obfuscation_budget;
+    // The ML model is shared; --variants already runs one rewrite per CPU
+    rewrite_opts.threads = (config->use_ml_strategist || config->variants > 0) ? 1 : config->threads;
+    if (config->encode_shellcode && rewrite_opts.max_output_size > 0) {
+        // Leave room for the largest decoder stub and its tail padding
+        size_t stub = DECODER_STUB_MAX_SIZE + DECODER_STUB_MAX_PADDING;
+        rewrite_opts.max_output_size = (rewrite_opts.max_output_size > stub)
+                                           ? rewrite_opts.max_output_size - stub : 1;
+    }
+    if (config->target_arch == BYVAL_ARCH_THUMB && rewrite_opts.max_output_size > 0 &&
+        (config->encode_shellcode || config->thumb_entry_stub)) {
+        // ...and for the ARM->Thumb entry stub
+        rewrite_opts.max_output_size = (rewrite_opts.max_output_size > THUMB_ENTRY_MAX_SIZE)
+                                           ? rewrite_opts.max_output_size - THUMB_ENTRY_MAX_SIZE : 1;
+    }
+    set_rewrite_options(&rewrite_opts);
+}
+
+// --flatten: replace the rewritten payload by its flattened form when possible
+static void flatten_rewritten_payload(struct buffer *payload, const char *input_file,
+                                      const byvalver_config_t *config) {
+    struct buffer flat;
+    cff_info_t info;
+    const char *reason = NULL;
+
+    buffer_init(&flat);
+    if (flatten_control_flow(payload->data, payload->size, config->target_arch,
+                             &flat, &info, &reason) != 0) {
+        if (!config->quiet) {
+            fprintf(stderr, "[FLATTEN] Skipped for '%s': %s\n", input_file, reason);
+        }
+        buffer_free(&flat);
+        return;
+    }
+    if (!config->quiet) {
+        fprintf(stderr, "[FLATTEN] %d blocks, %d-slot table (%.1f%% dense), %zu-byte dispatcher, "
+                        "%d instructions per transition; %zu -> %zu bytes\n",
+                info.blocks, info.table_slots, 100.0 * info.blocks / info.table_slots,
+                info.dispatcher_size, info.transition_insns, payload->size, flat.size);
+    }
+    buffer_free(payload);
+    *payload = flat;
+}
+
+// Rewrite pipeline: per-instruction rewriting, then --xor-encode if requested.
+// Appends the result to `final`; returns EXIT_SUCCESS or a reported error code.
+static int run_rewrite_pipeline(const uint8_t *shellcode, size_t size, const char *input_file,
+                                byvalver_config_t *config, struct buffer *final) {
+    struct buffer new_shellcode;
+
+    if (config->use_pic_generation) {
+        // Initialize PIC options
+        PICOptions pic_opts;
+        pic_init_options(&pic_opts);
+        pic_opts.use_jmp_call_pop = 1;
+        pic_opts.use_api_hashing = 1;
+        pic_opts.include_anti_debug = 0;
+
+        // Generate PIC shellcode
+        PICResult pic_result;
+        int pic_ret = pic_generate(shellcode, size, &pic_opts, &pic_result);
+        if (pic_ret != 0) {
+            if (!config->quiet) {
+                fprintf(stderr, "Error: PIC generation failed for '%s'\n", input_file);
+            }
+            return EXIT_PROCESSING_FAILED;
+        }
+
+        // Now apply null-byte elimination to the PIC shellcode
+        if (config->use_biphasic) {
+            new_shellcode = biphasic_process(pic_result.data, pic_result.size, config->target_arch);
+        } else {
+            new_shellcode = remove_null_bytes(pic_result.data, pic_result.size, config->target_arch);
+        }
+
+        // Free PIC result
+        pic_free_result(&pic_result);
+    } else if (config->use_biphasic) {
+        new_shellcode = biphasic_process(shellcode, size, config->target_arch);
+    } else {
+        new_shellcode = remove_null_bytes(shellcode, size, config->target_arch);
+    }
+
+    // Verify the shellcode was processed successfully
+    if (new_shellcode.data == NULL && new_shellcode.size == 0) {
+        if (!config->quiet) {
+            fprintf(stderr, "Error: Shellcode processing failed for '%s'\n", input_file);
+        }
+        return EXIT_PROCESSING_FAILED;
+    }
+
+    if (config->flatten_control_flow) {
+        flatten_rewritten_payload(&new_shellcode, input_file, config);
+    }
+
+    if (config->encode_shellcode) {
+        if (append_with_decoder_stub(new_shellcode.data, new_shellcode.size, input_file,
+                                     config, 1, final) != 0) {
+            buffer_free(&new_shellcode);
+            return EXIT_PROCESSING_FAILED;
+        }
+    } else if (config->target_arch == BYVAL_ARCH_THUMB && config->thumb_entry_stub) {
+        if (append_thumb_entry(new_shellcode.data, new_shellcode.size, input_file, config, 1,
+                               final) != 0) {
+            buffer_free(&new_shellcode);
+            return EXIT_PROCESSING_FAILED;
+        }
+    } else {
+        // If no XOR encoding, just append the new_shellcode directly
+        buffer_append(final, new_shellcode.data, new_shellcode.size);
+    }
+
+    buffer_free(&new_shellcode);
+    return EXIT_SUCCESS;
+}
+
+// Encoder pipeline: the unmodified input behind a generated decoder stub
+static int run_encode_pipeline(const uint8_t *shellcode, size_t size, const char *input_file,
+                               byvalver_config_t *config, int report, struct buffer *final) {
+    if (append_with_decoder_stub(shellcode, size, input_file, config, report, final) != 0) {
+        return EXIT_PROCESSING_FAILED;
+    }
+    return EXIT_SUCCESS;
+}
+
+// A pipeline result that can be written: clean and within --max-output-size
+static int pipeline_output_usable(const struct buffer *b, const byvalver_config_t *config) {
+    return is_bad_byte_free_buffer(b->data, b->size) &&
+           (config->max_output_size == 0 || b->size <= config->max_output_size);
+}
+
+/*
+ * --pipeline auto: run the encoder and the rewrite pipeline on the same input
+ * and keep the smaller usable result. The decision is cached per input hash,
+ * so repeated inputs in a batch run only the winner. If neither result is
+ * usable, the rewrite result goes on to the usual checks and error report.
+ */
+static int run_auto_pipeline(const uint8_t *shellcode, size_t size, const char *input_file,
+                             byvalver_config_t *config, struct buffer *final) {
+    uint64_t hash = pipeline_input_hash(shellcode, size);
+    pipeline_choice_t choice;
+    struct buffer encoded, rewritten;
+    int rewrite_status;
+    int encode_ok, rewrite_ok;
+    const char *reason;
+
+    if (pipeline_choice_lookup(hash, &choice)) {
+        if (!config->quiet) {
+            fprintf(stderr, "[PIPELINE] %s (cached decision for input %016llx)\n",
+                    pipeline_choice_name(choice), (unsigned long long)hash);
+        }
+        return (choice == PIPELINE_CHOICE_ENCODE)
+                   ? run_encode_pipeline(shellcode, size, input_file, config, 1, final)
+                   : run_rewrite_pipeline(shellcode, size, input_file, config, final);
+    }
+
+    buffer_init(&encoded);
+    buffer_init(&rewritten);
+    encode_ok = run_encode_pipeline(shellcode, size, input_file, config, 0, &encoded) == EXIT_SUCCESS &&
+                pipeline_output_usable(&encoded, config);
+    rewrite_status = run_rewrite_pipeline(shellcode, size, input_file, config, &rewritten);
+    rewrite_ok = rewrite_status == EXIT_SUCCESS && pipeline_output_usable(&rewritten, config);
+
+    if (encode_ok && (!rewrite_ok || encoded.size < rewritten.size)) {
+        choice = PIPELINE_CHOICE_ENCODE;
+        reason = rewrite_ok ? "smaller" : "rewrite output is not usable";
+    } else {
+        choice = PIPELINE_CHOICE_REWRITE;
+        reason = !rewrite_ok ? "neither output is usable"
+                 : encode_ok ? "smaller or equal" : "no usable decoder stub for this input";
+    }
+
+    if (!config->quiet) {
+        fprintf(stderr, "[PIPELINE] encode: ");
+        if (encode_ok) {
+            fprintf(stderr, "%zu bytes", encoded.size);
+        } else {
+            fprintf(stderr, "unusable");
+        }
+        fprintf(stderr, ", rewrite: ");
+        if (rewrite_ok) {
+            fprintf(stderr, "%zu bytes", rewritten.size);
+        } else {
+            fprintf(stderr, "unusable");
+        }
+        fprintf(stderr, " -> %s (%s)\n", pipeline_choice_name(choice), reason);
+    }
+    if (encode_ok || rewrite_ok) {
+        pipeline_choice_store(hash, choice);
+    }
+
+    buffer_free(final);
+    if (choice == PIPELINE_CHOICE_ENCODE) {
+        *final = encoded;
+        buffer_free(&rewritten);
+        return EXIT_SUCCESS;
+    }
+    *final = rewritten;
+    buffer_free(&encoded);
+    return rewrite_status;
+}
+
 // Process a single file with the given configuration
 // Returns EXIT_SUCCESS on success, or an error code on failure
+// Write `b` to `output_file` in the configured output format
+static int write_output_file(const char *output_file, const struct buffer *b,
+                             const byvalver_config_t *config) {
+    // First, create parent directories if needed
+    if (create_parent_dirs(output_file) != 0) {
+        if (!config->quiet) {
+            fprintf(stderr, "Error: Cannot create parent directories for output file '%s'\n",
+                    output_file);
+        }
+        return EXIT_OUTPUT_FILE_ERROR;
+    }
+
+    // Format and write output based on output_format
+    char *formatted_output = format_shellcode(b->data, b->size, config->output_format);
+
+    const char *write_mode = (formatted_output != NULL) ? "w" : "wb";
+    FILE *out_file = fopen(output_file, write_mode);
+    if (!out_file) {
+        if (!config->quiet) {
+            fprintf(stderr, "Error: Cannot open output file '%s': %s\n",
+                    output_file, strerror(errno));
+        }
+        if (formatted_output) free(formatted_output);
+        return EXIT_OUTPUT_FILE_ERROR;
+    }
+
+    if (formatted_output != NULL) {
+        // Write formatted text
+        fprintf(out_file, "%s", formatted_output);
+        free(formatted_output);
+    } else {
+        // Write raw binary
+        fwrite(b->data, 1, b->size, out_file);
+    }
+    fclose(out_file);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Polymorphic variants (--variants N --seed S)
+ *
+ * Every variant rewrites the same input with its own generator seed, derived
+ * from the base seed and the variant index, so a variant can be reproduced
+ * from (seed, index) alone. Workers claim variant indices from a shared
+ * counter and run the variants one after another. The rewrite keeps its
+ * per-run state in thread-local storage and every variant resets it first,
+ * so nothing carries over from one variant to the next whatever the
+ * scheduling. Each variant generates on its worker alone (threads = 1):
+ * the workers already use every CPU.
+ */
+typedef struct {
+    const uint8_t *shellcode;
+    size_t size;
+    const char *input_file;
+    byvalver_config_t *config;
+    uint64_t seed;
+    int index;
+    int status;
+    struct buffer output;
+} variant_job_t;
+
+typedef struct {
+    variant_job_t *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} variant_queue_t;
+
+static void *variant_main(void *arg) {
+    variant_job_t *job = arg;
+
+    // Workers run variant after variant: start each from the same
+    // per-thread state as a fresh thread
+    set_processing_scope(NULL);
+    reset_strategy_thread_state();
+    thread_rng_seed(job->seed);
+    job->status = run_rewrite_pipeline(job->shellcode, job->size, job->input_file,
+                                       job->config, &job->output);
+    if (job->status == EXIT_SUCCESS && !pipeline_output_usable(&job->output, job->config)) {
+        job->status = EXIT_PROCESSING_FAILED;
+    }
+    return NULL;
+}
+
+static void *variant_worker(void *arg) {
+    variant_queue_t *queue = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) {
+            break;
+        }
+        variant_main(&queue->jobs[index]);
+    }
+    return NULL;
+}
+
+// Smallest first, ties in variant order
+static int compare_variant_size(const void *a, const void *b) {
+    const variant_job_t *x = *(const variant_job_t *const *)a;
+    const variant_job_t *y = *(const variant_job_t *const *)b;
+
+    if (x->output.size != y->output.size) {
+        return (x->output.size < y->output.size) ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+// "out.bin" -> "out.007.bin"; the index goes before the extension, if any
+static void variant_output_path(char *path, size_t path_size, const char *output_file,
+                                int index, int width) {
+    const char *slash = strrchr(output_file, '/');
+    const char *name = slash ? slash + 1 : output_file;
+    const char *dot = strrchr(name, '.');
+
+    if (dot == NULL || dot == name) {
+        snprintf(path, path_size, "%s.%0*d", output_file, width, index);
+    } else {
+        snprintf(path, path_size, "%.*s.%0*d%s", (int)(dot - output_file), output_file,
+                 width, index, dot);
+    }
+}
+
+static int run_variants(const uint8_t *shellcode, size_t size, const char *input_file,
+                        const char *output_file, const byvalver_config_t *config,
+                        size_t *output_size_out) {
+    if (config->use_ml_strategist || config->batch_mode ||
+        config->pipeline_mode != PIPELINE_MODE_REWRITE) {
+        if (!config->quiet) {
+            fprintf(stderr, "Error: --variants works on a single input with the rewrite pipeline and without --ml\n");
+        }
+        return EXIT_INVALID_ARGUMENTS;
+    }
+
+    // Variants differ in their obfuscation, so the biphasic pass is always on
+    byvalver_config_t variant_config = *config;
+    if (!variant_config.use_biphasic && !config->quiet) {
+        fprintf(stderr, "[VARIANTS] Enabling --biphasic: variants differ in their obfuscation\n");
+    }
+    variant_config.use_biphasic = 1;
+
+    int count = (config->variants < BYVAL_MAX_VARIANTS) ? config->variants : BYVAL_MAX_VARIANTS;
+    variant_job_t *jobs = calloc((size_t)count, sizeof(*jobs));
+    variant_job_t **ok_jobs = calloc((size_t)count, sizeof(*ok_jobs));
+    if (!jobs || !ok_jobs) {
+        free(jobs);
+        free(ok_jobs);
+        return EXIT_GENERAL_ERROR;
+    }
+    uint64_t base_seed = config->variant_seed_set ? config->variant_seed : (uint64_t)time(NULL);
+    for (int i = 0; i < count; i++) {
+        jobs[i].shellcode = shellcode;
+        jobs[i].size = size;
+        jobs[i].input_file = input_file;
+        jobs[i].config = &variant_config;
+        jobs[i].seed = thread_rng_mix(base_seed + (uint64_t)i);
+        jobs[i].index = i;
+        buffer_init(&jobs[i].output);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t worker_count = (cpus > 0 && cpus < count) ? (size_t)cpus : (size_t)count;
+    pthread_t *workers = calloc(worker_count, sizeof(*workers));
+    variant_queue_t queue = {jobs, count, 0, PTHREAD_MUTEX_INITIALIZER};
+    int started = 0;
+
+    for (size_t i = 0; workers && i < worker_count; i++) {
+        if (pthread_create(&workers[started], NULL, variant_worker, &queue) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        variant_worker(&queue);  // No worker threads: generate in this thread
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    // Rank usable variants and write all of them, or the K smallest
+    int ok_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].status == EXIT_SUCCESS) {
+            ok_jobs[ok_count++] = &jobs[i];
+        }
+    }
+    qsort(ok_jobs, (size_t)ok_count, sizeof(*ok_jobs), compare_variant_size);
+    int keep = (config->keep_smallest > 0 && config->keep_smallest < ok_count)
+                   ? config->keep_smallest : ok_count;
+
+    if (!config->quiet) {
+        fprintf(stderr, "[VARIANTS] %d of %d variants usable on %d threads (seed 0x%016llx)",
+                ok_count, count, started > 0 ? started : 1, (unsigned long long)base_seed);
+        if (ok_count > 0) {
+            fprintf(stderr, ", %zu-%zu bytes", ok_jobs[0]->output.size,
+                    ok_jobs[ok_count - 1]->output.size);
+        }
+        fprintf(stderr, "; writing %d\n", keep);
+    }
+
+    int width = 3;
+    for (int n = count - 1; n >= 1000; n /= 10) {
+        width++;
+    }
+    int status = (ok_count > 0) ? EXIT_SUCCESS : EXIT_PROCESSING_FAILED;
+    for (int i = 0; i < keep && status == EXIT_SUCCESS; i++) {
+        char path[PATH_MAX];
+        variant_output_path(path, sizeof(path), output_file, ok_jobs[i]->index, width);
+        status = write_output_file(path, &ok_jobs[i]->output, config);
+        if (status == EXIT_SUCCESS && config->verbose) {
+            fprintf(stderr, "[VARIANTS] %s: %zu bytes\n", path, ok_jobs[i]->output.size);
+        }
+    }
+    if (output_size_out && ok_count > 0) {
+        *output_size_out = ok_jobs[0]->output.size;
+    }
+
+    for (int i = 0; i < count; i++) {
+        buffer_free(&jobs[i].output);
+    }
+    free(ok_jobs);
+    free(jobs);
+    return status;
+}
+
 int process_single_file(const char *input_file, const char *output_file,
                         byvalver_config_t *config, size_t *input_size_out,
                         size_t *output_size_out) {
@@ -207,90 +816,56 @@ int process_single_file(const char *input_file, const char *output_file,
         if (config->bad_bytes) {
             fprintf(stderr, "Bad Bytes: %d distinct values\n", config->bad_bytes->bad_byte_count);
         }
-        if (config->target_arch == BYVAL_ARCH_ARM || config->target_arch == BYVAL_ARCH_ARM64) {
+        if (config->target_arch == BYVAL_ARCH_ARM || config->target_arch == BYVAL_ARCH_THUMB ||
+            config->target_arch == BYVAL_ARCH_ARM64) {
             fprintf(stderr, "Warning: %s mode is experimental and may not cover all rewrite families.\n", arch_name);
             fprintf(stderr, "  recommendation: run --dry-run first, then verify with verify_denulled.py and verify_functionality.py.\n");
             fprintf(stderr, "  fallback: if mismatch warnings appear, retry with explicit --arch x86 or --arch x64.\n");
         }
-        fprintf(stderr, "\n");
-    }
-
-    // Process shellcode
-    struct buffer new_shellcode;
-    if (config->use_pic_generation) {
-        // Initialize PIC options
-        PICOptions pic_opts;
-        pic_init_options(&pic_opts);
-        pic_opts.use_jmp_call_pop = 1;
-        pic_opts.use_api_hashing = 1;
-        pic_opts.include_anti_debug = 0;
-
-        // Generate PIC shellcode
-        PICResult pic_result;
-        int pic_ret = pic_generate(shellcode, file_size, &pic_opts, &pic_result);
-        if (pic_ret != 0) {
-            if (!config->quiet) {
-                fprintf(stderr, "Error: PIC generation failed for '%s'\n", input_file);
-            }
-            free(shellcode);
-            return EXIT_PROCESSING_FAILED;
+        if (config->compress_payload && !config->encode_shellcode &&
+            config->pipeline_mode == PIPELINE_MODE_REWRITE) {
+            fprintf(stderr, "Warning: --compress only applies behind a decoder stub (--xor-encode or --pipeline encode/auto).\n");
         }
-
-        // Now apply null-byte elimination to the PIC shellcode
-        if (config->use_biphasic) {
-            new_shellcode = biphasic_process(pic_result.data, pic_result.size, config->target_arch);
-        } else {
-            new_shellcode = remove_null_bytes(pic_result.data, pic_result.size, config->target_arch);
+        if (config->flatten_control_flow && config->pipeline_mode == PIPELINE_MODE_ENCODE) {
+            fprintf(stderr, "Warning: --flatten only applies to the rewrite pipeline.\n");
         }
-
-        // Free PIC result
-        pic_free_result(&pic_result);
-    } else if (config->use_biphasic) {
-        new_shellcode = biphasic_process(shellcode, file_size, config->target_arch);
-    } else {
-        new_shellcode = remove_null_bytes(shellcode, file_size, config->target_arch);
+        if (config->obfuscation_budget_kind != OBFUSCATION_BUDGET_NONE && !config->use_biphasic &&
+            config->variants == 0) {
+            fprintf(stderr, "Warning: --obfuscation-budget only applies with --biphasic or --variants.\n");
+        }
+        fprintf(stderr, "\n");
     }
 
-    // Verify the shellcode was processed successfully
-    if (new_shellcode.data == NULL && new_shellcode.size == 0) {
-        if (!config->quiet) {
-            fprintf(stderr, "Error: Shellcode processing failed for '%s'\n", input_file);
-        }
+    apply_rewrite_options(config);
+
+    if (config->variants > 0) {
+        int variant_status = run_variants(shellcode, (size_t)file_size, input_file, output_file,
+                                          config, output_size_out);
         free(shellcode);
-        return EXIT_PROCESSING_FAILED;
+        return variant_status;
+    }
+    if (config->variant_seed_set) {
+        thread_rng_seed(thread_rng_mix(config->variant_seed));  // Reproducible single output
     }
 
     struct buffer final_shellcode;
     buffer_init(&final_shellcode);
 
-    if (config->encode_shellcode) {
-        uint8_t *decoder_stub = decoder_bin;
-        size_t decoder_len = decoder_bin_len;
-
-        // Append the decoder stub to the final shellcode buffer
-        buffer_append(&final_shellcode, decoder_stub, decoder_len);
-
-        // Append the 4-byte key
-        buffer_append(&final_shellcode, (uint8_t *)&config->xor_key, 4);
-
-        // Define the null-free XOR key for the length
-        const uint32_t NULL_FREE_LENGTH_XOR_KEY = 0x11223344;
-        // Calculate the XOR-encoded length
-        uint32_t encoded_length = new_shellcode.size ^ NULL_FREE_LENGTH_XOR_KEY;
-        // Append the 4-byte XOR-encoded length of the *original* shellcode (before XOR encoding)
-        buffer_append(&final_shellcode, (uint8_t *)&encoded_length, 4);
-
-        // XOR encode the new_shellcode.data with the 4-byte key
-        for (size_t i = 0; i < new_shellcode.size; i++) {
-            new_shellcode.data[i] ^= ((uint8_t *)&config->xor_key)[i % 4];
-        }
-
-        // Append the XOR-encoded shellcode to the final shellcode buffer
-        buffer_append(&final_shellcode, new_shellcode.data, new_shellcode.size);
-
+    int status;
+    if (config->pipeline_mode == PIPELINE_MODE_ENCODE) {
+        status = run_encode_pipeline(shellcode, (size_t)file_size, input_file, config, 1,
+                                     &final_shellcode);
+    } else if (config->pipeline_mode == PIPELINE_MODE_AUTO) {
+        status = run_auto_pipeline(shellcode, (size_t)file_size, input_file, config,
+                                   &final_shellcode);
     } else {
-        // If no XOR encoding, just append the new_shellcode directly
-        buffer_append(&final_shellcode, new_shellcode.data, new_shellcode.size);
+        status = run_rewrite_pipeline(shellcode, (size_t)file_size, input_file, config,
+                                      &final_shellcode);
+    }
+    if (status != EXIT_SUCCESS) {
+        free(shellcode);
+        buffer_free(&final_shellcode);
+        return status;
     }
 
     if (output_size_out) {
@@ -325,57 +900,26 @@ int process_single_file(const char *input_file, const char *output_file,
             fprintf(stderr, "\n");
         }
         free(shellcode);
-        buffer_free(&new_shellcode);
         buffer_free(&final_shellcode);
         return EXIT_PROCESSING_FAILED;  // Return failure when bad bytes remain
     }
 
-    // Write modified shellcode to output file
-    // First, create parent directories if needed
-    if (create_parent_dirs(output_file) != 0) {
-        if (!config->quiet) {
-            fprintf(stderr, "Error: Cannot create parent directories for output file '%s'\n",
-                    output_file);
-        }
-        free(shellcode);
-        buffer_free(&new_shellcode);
-        buffer_free(&final_shellcode);
-        return EXIT_OUTPUT_FILE_ERROR;
-    }
-
-    // Format and write output based on output_format
-    char *formatted_output = format_shellcode(final_shellcode.data, final_shellcode.size,
-                                              config->output_format);
-
-    const char *write_mode = (formatted_output != NULL) ? "w" : "wb";
-    FILE *out_file = fopen(output_file, write_mode);
-    if (!out_file) {
+    if (config->max_output_size > 0 && final_shellcode.size > config->max_output_size) {
         if (!config->quiet) {
-            fprintf(stderr, "Error: Cannot open output file '%s': %s\n",
-                    output_file, strerror(errno));
+            fprintf(stderr, "Error: Output is %zu bytes, over the --max-output-size limit of %zu\n",
+                    final_shellcode.size, config->max_output_size);
         }
         free(shellcode);
-        buffer_free(&new_shellcode);
         buffer_free(&final_shellcode);
-        if (formatted_output) free(formatted_output);
-        return EXIT_OUTPUT_FILE_ERROR;
+        return EXIT_PROCESSING_FAILED;
     }
 
-    if (formatted_output != NULL) {
-        // Write formatted text
-        fprintf(out_file, "%s", formatted_output);
-        free(formatted_output);
-    } else {
-        // Write raw binary
-        fwrite(final_shellcode.data, 1, final_shellcode.size, out_file);
-    }
-    fclose(out_file);
+    status = write_output_file(output_file, &final_shellcode, config);
 
     free(shellcode);
-    buffer_free(&new_shellcode);
     buffer_free(&final_shellcode);
 
-    return EXIT_SUCCESS;
+    return status;
 }
 
 int main(int argc, char *argv[]) {
@@ -768,7 +1312,11 @@ int main(int argc, char *argv[]) {
     }
 
     if (config->encode_shellcode && !config->quiet) {
-        printf("Encoding shellcode with XOR key: 0x%08x\n", config->xor_key);
+        if (config->xor_key_auto) {
+            printf("Encoding shellcode with XOR key: auto\n");
+        } else {
+            printf("Encoding shellcode with XOR key: 0x%08x\n", config->xor_key);
+        }
     }
 
     // Initialize bad byte context for single-file processing
@@ -664,7 +664,7 @@ static void generate_general_mem_disp_null(struct buffer *b, cs_insn *insn) {
 
     if (!mem_op) {
         // No memory operand, shouldn't happen
-        fprintf(stderr, "[ERROR] No memory operand in general_mem_disp_null\n");
+        log_diagnostic("[ERROR] No memory operand in general_mem_disp_null\n");
         return;
     }
 
@@ -766,8 +766,8 @@ static void generate_general_mem_disp_null(struct buffer *b, cs_insn *insn) {
             case X86_INS_TEST: opcode = 0x85; break;
             default:
                 // Use fallback for unsupported instructions
-                fprintf(stderr, "[WARN] Unsupported instruction in general_mem_disp_null: %s\n",
-                        insn->mnemonic);
+                log_diagnostic("[WARN] Unsupported instruction in general_mem_disp_null: %s\n",
+                               insn->mnemonic);
                 opcode = 0x03;
                 break;
         }
@@ -7,16 +7,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-// Static counter for applying junk insertion selectively
-static int junk_counter = 0;
-static int initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Opaque Predicate Patterns
@@ -91,12 +87,6 @@ static void insert_dead_operations(struct buffer *b) {
 // ============================================================================
 
 int can_handle_mutated_junk(cs_insn *insn) {
-    // Initialize random seed once
-    if (!initialized) {
-        srand((unsigned int)time(NULL));
-        initialized = 1;
-    }
-
     // Skip jumps and calls to avoid breaking control flow
     if (insn->id == X86_INS_JMP || insn->id == X86_INS_CALL ||
         insn->id == X86_INS_RET || insn->id == X86_INS_RETF) {
@@ -109,8 +99,7 @@ int can_handle_mutated_junk(cs_insn *insn) {
     }
 
     // Apply to approximately 15% of instructions
-    junk_counter++;
-    return (junk_counter % 7 == 0);
+    return thread_rng_below(7) == 0;
 }
 
 size_t get_mutated_junk_size(cs_insn *insn) {
@@ -120,7 +109,7 @@ size_t get_mutated_junk_size(cs_insn *insn) {
 
 void generate_mutated_junk(struct buffer *b, cs_insn *insn) {
     // Randomly select an opaque predicate pattern
-    int pattern = rand() % 3;
+    int pattern = (int)thread_rng_below(3);
     uint8_t junk_size = 6;  // Size of junk code block
 
     // Insert opaque predicate that jumps over junk code
@@ -143,7 +132,7 @@ void generate_mutated_junk(struct buffer *b, cs_insn *insn) {
         insert_int3_junk(b, 6);
     } else {
         // Always-taken path: insert harmless junk that will be skipped
-        int junk_type = rand() % 3;
+        int junk_type = (int)thread_rng_below(3);
         switch (junk_type) {
             case 0:
                 insert_int3_junk(b, 6);
@@ -0,0 +1,132 @@
+/*
+ * Obfuscation Expansion Budget (see obfuscation_budget.h)
+ *
+ * Greedy by value density: a candidate worth priority p at c extra bytes is
+ * ranked by p / c, compared exactly as p1 * c2 > p2 * c1. Candidates are
+ * taken in that order while they fit; one that does not fit is skipped and
+ * smaller ones further down may still be taken. Ties keep payload order, so
+ * the choice is deterministic for a given set of candidates.
+ */
+
+#include "obfuscation_budget.h"
+#include <stdlib.h>
+#include <string.h>
+
+int obfuscation_budget_parse(const char *text, int *kind, size_t *amount) {
+    char *end;
+    unsigned long long value;
+
+    if (!text || text[0] == '\0' || text[0] == '-') {
+        return -1;
+    }
+    value = strtoull(text, &end, 10);
+    if (end == text) {
+        return -1;
+    }
+    if (end[0] == '%' && end[1] == '\0') {
+        *kind = OBFUSCATION_BUDGET_PERCENT;
+    } else if (end[0] == '\0') {
+        *kind = OBFUSCATION_BUDGET_BYTES;
+    } else {
+        return -1;
+    }
+    *amount = (size_t)value;
+    return 0;
+}
+
+size_t obfuscation_budget_bytes(int kind, size_t amount, size_t input_size) {
+    switch (kind) {
+        case OBFUSCATION_BUDGET_BYTES:
+            return amount;
+        case OBFUSCATION_BUDGET_PERCENT:
+            return (size_t)(((unsigned long long)input_size * amount) / 100u);
+        default:
+            return (size_t)-1;
+    }
+}
+
+int obfuscation_plan_add(obfuscation_plan_t *plan, struct instruction_node *node,
+                         struct buffer *code, size_t plain_size, int value) {
+    obfuscation_candidate_t *c;
+
+    if (plan->count == plan->capacity) {
+        int capacity = plan->capacity ? plan->capacity * 2 : 64;
+        obfuscation_candidate_t *items = realloc(plan->items, (size_t)capacity * sizeof(*items));
+        if (!items) {
+            return -1;
+        }
+        plan->items = items;
+        plan->capacity = capacity;
+    }
+    c = &plan->items[plan->count++];
+    c->node = node;
+    c->code = *code;
+    c->cost = (code->size > plain_size) ? code->size - plain_size : 0;
+    c->value = (value > 0) ? value : 1;
+    c->chosen = 0;
+    buffer_init(code);
+    return 0;
+}
+
+// Higher value per byte first (free candidates before everything else), then payload order
+static int compare_density(const void *pa, const void *pb) {
+    const obfuscation_candidate_t *a = *(const obfuscation_candidate_t *const *)pa;
+    const obfuscation_candidate_t *b = *(const obfuscation_candidate_t *const *)pb;
+    unsigned long long lhs = (unsigned long long)a->value * b->cost;
+    unsigned long long rhs = (unsigned long long)b->value * a->cost;
+
+    if (lhs != rhs) {
+        return (lhs > rhs) ? -1 : 1;
+    }
+    return (a < b) ? -1 : (a > b);
+}
+
+int obfuscation_plan_select(obfuscation_plan_t *plan, size_t budget) {
+    obfuscation_candidate_t **order;
+    int chosen = 0;
+
+    plan->spent = 0;
+    if (plan->count == 0) {
+        return 0;
+    }
+    order = malloc((size_t)plan->count * sizeof(*order));
+    if (!order) {
+        return 0;   // Nothing chosen: plain rewrites everywhere
+    }
+    for (int i = 0; i < plan->count; i++) {
+        order[i] = &plan->items[i];
+    }
+    qsort(order, (size_t)plan->count, sizeof(*order), compare_density);
+
+    for (int k = 0; k < plan->count; k++) {
+        obfuscation_candidate_t *c = order[k];
+        if (c->cost <= budget - plan->spent) {
+            c->chosen = 1;
+            plan->spent += c->cost;
+            chosen++;
+        }
+    }
+    free(order);
+    return chosen;
+}
+
+void obfuscation_plan_apply(obfuscation_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        obfuscation_candidate_t *c = &plan->items[i];
+        if (!c->chosen) {
+            continue;
+        }
+        buffer_free(&c->node->code);
+        c->node->code = c->code;
+        c->node->code_fixed = 1;
+        buffer_init(&c->code);
+    }
+}
+
+void obfuscation_plan_free(obfuscation_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        buffer_free(&plan->items[i].code);
+    }
+    free(plan->items);
+    memset(plan, 0, sizeof(*plan));
+}
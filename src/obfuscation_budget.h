@@ -0,0 +1,74 @@
+#ifndef OBFUSCATION_BUDGET_H
+#define OBFUSCATION_BUDGET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+
+/**
+ * @file obfuscation_budget.h
+ * @brief Expansion budget for the biphasic obfuscation pass (--obfuscation-budget)
+ *
+ * Without a budget every instruction that some obfuscation strategy claims is
+ * obfuscated, and the broad high-priority strategies claim nearly all of
+ * them. With a budget, each obfuscation becomes a candidate with a cost (bytes
+ * above the plain rewrite of the same instruction) and a value (the strategy
+ * priority). Candidates are taken in order of value per byte while they fit.
+ * Free candidates (cost 0) always fit. The rest of the instructions keep
+ * their plain rewrite.
+ */
+
+#define OBFUSCATION_BUDGET_NONE    0   // Obfuscate everything that applies
+#define OBFUSCATION_BUDGET_BYTES   1   // Absolute growth in bytes
+#define OBFUSCATION_BUDGET_PERCENT 2   // Growth in percent of the input size
+
+typedef struct {
+    struct instruction_node *node;
+    struct buffer code;       // Obfuscated, bad-byte-free expansion
+    size_t cost;              // Bytes above the plain rewrite (0 if not larger)
+    int value;                // Strategy priority
+    int chosen;
+} obfuscation_candidate_t;
+
+typedef struct {
+    obfuscation_candidate_t *items;
+    int count;
+    int capacity;
+    size_t spent;             // Cost of the chosen candidates
+} obfuscation_plan_t;
+
+/**
+ * Parse a budget: "150%" (percent of the input size) or "2048" (bytes)
+ * @return: 0 on success, -1 on invalid input
+ */
+int obfuscation_budget_parse(const char *text, int *kind, size_t *amount);
+
+/**
+ * Budget in bytes for an input of `input_size` bytes
+ */
+size_t obfuscation_budget_bytes(int kind, size_t amount, size_t input_size);
+
+/**
+ * Add a candidate; `code` is moved into the plan (left empty)
+ * @return: 0 on success, -1 on allocation failure
+ */
+int obfuscation_plan_add(obfuscation_plan_t *plan, struct instruction_node *node,
+                         struct buffer *code, size_t plain_size, int value);
+
+/**
+ * Choose candidates by value per byte within `budget` extra bytes
+ * @return: Number of chosen candidates
+ */
+int obfuscation_plan_select(obfuscation_plan_t *plan, size_t budget);
+
+/**
+ * Move the chosen expansions into their nodes (marked code_fixed)
+ */
+void obfuscation_plan_apply(obfuscation_plan_t *plan);
+
+/**
+ * Release all candidate buffers
+ */
+void obfuscation_plan_free(obfuscation_plan_t *plan);
+
+#endif // OBFUSCATION_BUDGET_H
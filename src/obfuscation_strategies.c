@@ -15,6 +15,7 @@
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
+#include "thread_rng.h"
 
 // ============================================================================
 // Strategy 1: TEST → AND Transformation (Priority 80)
@@ -190,10 +191,8 @@ void register_arithmetic_negation_obfuscation() {
 
 int can_handle_junk_code(cs_insn *insn) {
     (void)insn;  // Avoid unused parameter warning
-    // Insert junk before every 5th instruction (20% of the time)
-    static int insn_counter = 0;
-    insn_counter++;
-    return (insn_counter % 5 == 0);
+    // Insert junk before about every 5th instruction (20% of the time)
+    return thread_rng_below(5) == 0;
 }
 
 size_t get_junk_code_size(cs_insn *insn) {
@@ -248,9 +247,7 @@ int can_handle_opaque_predicate(cs_insn *insn) {
         return 0;  // Skip jumps for now
     }
 
-    static int counter = 0;
-    counter++;
-    return (counter % 10 == 0);  // Apply to 10% of instructions
+    return thread_rng_below(10) == 0;  // Apply to 10% of instructions
 }
 
 size_t get_opaque_predicate_size(cs_insn *insn) {
@@ -526,7 +523,7 @@ int can_handle_nop_insertion(cs_insn *insn) {
 size_t get_nop_insertion_size(cs_insn *insn) {
     (void)insn;
     // Original instruction size + random NOP size (1-3 bytes)
-    return insn->size + (rand() % 3 + 1);
+    return insn->size + (thread_rng_below(3) + 1);
 }
 
 void generate_nop_insertion(struct buffer *b, cs_insn *insn) {
@@ -534,7 +531,7 @@ void generate_nop_insertion(struct buffer *b, cs_insn *insn) {
     buffer_append(b, insn->bytes, insn->size);
 
     // Then insert a random NOP equivalent
-    int nop_type = rand() % 4;
+    int nop_type = (int)thread_rng_below(4);
     switch (nop_type) {
         case 0: // Standard NOP
             buffer_append(b, (uint8_t[]){0x90}, 1);
@@ -28,8 +28,8 @@ void register_obfuscation_strategy(strategy_t *strategy) {
         DEBUG_LOG("Registered obfuscation strategy: %s (priority %d)",
                   strategy->name, strategy->priority);
     } else {
-        fprintf(stderr, "[ERROR] Obfuscation strategy registry full! Maximum of %d strategies.\n",
-                MAX_OBFUSCATION_STRATEGIES);
+        log_diagnostic("[ERROR] Obfuscation strategy registry full! Maximum of %d strategies.\n",
+                       MAX_OBFUSCATION_STRATEGIES);
     }
 }
 
@@ -91,7 +91,7 @@ void init_obfuscation_strategies() {
 
     // MEDIUM PRIORITY: Syscall & control flow (79-70)
     register_syscall_instruction_substitution();      // Priority 79-78 - Syscall substitution
-    register_control_flow_dispatcher_obfuscation();   // Priority 77 - CFG flattening (STUB)
+    register_control_flow_dispatcher_obfuscation();   // Priority 77 - CFG flattening (whole payload, --flatten)
     register_loopnz_compact_search_obfuscation();     // Priority 76 - LOOPNZ compact search patterns
     register_mov_push_pop_obfuscation();              // Priority 75 - MOV → PUSH/POP
     register_mixed_arithmetic_base_obfuscation();     // Priority 73 - Constant hiding
@@ -136,11 +136,11 @@ int get_obfuscation_strategy_count() {
 
 // List all registered obfuscation strategies (for debugging)
 void list_obfuscation_strategies() {
-    fprintf(stderr, "\n=== Pass 1: Obfuscation Strategies (%d registered) ===\n",
-            obfuscation_strategy_count);
+    log_diagnostic("\n=== Pass 1: Obfuscation Strategies (%d registered) ===\n",
+                   obfuscation_strategy_count);
     for (int i = 0; i < obfuscation_strategy_count; i++) {
         strategy_t *s = obfuscation_strategies[i];
-        fprintf(stderr, "  [%2d] Priority %3d: %s\n", i, s->priority, s->name);
+        log_diagnostic("  [%2d] Priority %3d: %s\n", i, s->priority, s->name);
     }
-    fprintf(stderr, "===================================================\n\n");
+    log_diagnostic("===================================================\n\n");
 }
\ No newline at end of file
@@ -9,27 +9,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int hash16_counter = 0;
-static int hash16_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Strategy: 16-bit Partial Hash Comparison
 // ============================================================================
 
 int can_handle_partial_16bit_hash(cs_insn *insn) {
-    // Initialize once
-    if (!hash16_initialized) {
-        srand((unsigned int)time(NULL) ^ 0xBEEF);
-        hash16_initialized = 1;
-    }
-
     // Target XOR and ROR instructions used in hash computation
     if (insn->id != X86_INS_XOR && insn->id != X86_INS_ROR) {
         return 0;
@@ -51,8 +42,7 @@ int can_handle_partial_16bit_hash(cs_insn *insn) {
     }
 
     // Apply to approximately 10% of hash-related instructions
-    hash16_counter++;
-    return (hash16_counter % 10 == 0);
+    return thread_rng_below(10) == 0;
 }
 
 size_t get_partial_16bit_hash_size(cs_insn *insn) {
@@ -29,7 +29,7 @@ static uint8_t get_reg_index_8bit(x86_reg reg) {
         case X86_REG_DH: return 6;
         case X86_REG_BH: return 7;
         default:
-            fprintf(stderr, "[WARNING] Invalid 8-bit register: %d\n", reg);
+            log_diagnostic("[WARNING] Invalid 8-bit register: %d\n", reg);
             return 0;
     }
 }
@@ -0,0 +1,563 @@
+/*
+ * PC-relative relocation solver (see pc_relocation.h)
+ *
+ * Fixed-width ISAs leave the layout problem much smaller than on x86: a node
+ * has at most a few forms, padding comes in whole instruction units and
+ * there is no scratch register to find. The solver follows the same plan as
+ * branch_layout.c: sizes are only ever increased (forms move forward,
+ * padding is only added), so relaxation terminates, and a repair trial is
+ * kept only if it lowers the number of dirty nodes.
+ *
+ * The last encoding of every node is cached against (form, at, target),
+ * because the split forms search thousands of immediate pairs and most
+ * trials leave most nodes where they were.
+ */
+
+#include "pc_relocation.h"
+#include "branch_layout.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PCREL_NODE_NO_PAD   1   // Padding must not separate the node from its predecessor
+#define PCREL_NODE_LITERAL  2   // Read by a literal load
+#define PCREL_NODE_IN_IT    4   // Conditioned by a Thumb IT instruction
+
+typedef struct {
+    struct instruction_node *node;
+    size_t index;                      // Position of the node in the list
+    pcrel_insn_t insn;
+    int form_count;                    // node->pcrel_form == form_count: emitted unchanged
+    struct instruction_node *anchor;   // Target = anchor->new_offset + delta (NULL: see past_end)
+    int64_t delta;
+    int past_end;                      // Target = new_end + delta
+    // Encoding cache
+    int cached_form;
+    int64_t cached_at;
+    int64_t cached_target;
+    size_t cached_len;
+    uint8_t cached[PCREL_MAX_ENCODING];
+} pcrel_entry_t;
+
+typedef struct {
+    const pcrel_isa_ops_t *ops;
+    pcrel_entry_t *entries;
+    int count;
+    struct instruction_node **nodes;
+    uint8_t *flags;                    // PCREL_NODE_* per node
+    size_t node_count;
+    uint8_t nop[4];
+    size_t nop_len;                    // 0 if no clean no-op exists
+    size_t old_end;
+    size_t new_end;
+    size_t pad_total;
+    unsigned long work;
+} pcrel_ctx_t;
+
+int pcrel_isa_for_arch(byval_arch_t arch, pcrel_isa_t *isa) {
+    switch (arch) {
+        case BYVAL_ARCH_ARM:   *isa = PCREL_ISA_A32; return 1;
+        case BYVAL_ARCH_THUMB: *isa = PCREL_ISA_T32; return 1;
+        case BYVAL_ARCH_ARM64: *isa = PCREL_ISA_A64; return 1;
+        default:               return 0;
+    }
+}
+
+int pcrel_decode(pcrel_isa_t isa, const uint8_t *bytes, size_t size, uint64_t address,
+                 pcrel_insn_t *out) {
+    return pcrel_isa_ops(isa)->decode(bytes, size, address, out);
+}
+
+int pcrel_classify(struct instruction_node *head, byval_arch_t arch,
+                   struct instruction_node *(*lookup)(uint64_t offset)) {
+    pcrel_isa_t isa;
+    pcrel_insn_t rel;
+    int count = 0;
+
+    if (!pcrel_isa_for_arch(arch, &isa)) {
+        return 0;
+    }
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (!pcrel_decode(isa, n->insn->bytes, n->insn->size, n->offset, &rel) ||
+            rel.kind == PCREL_KIND_PAGE) {
+            continue;
+        }
+        int64_t target = (int64_t)n->offset + rel.disp;
+        n->target = (target >= 0) ? lookup((uint64_t)target) : NULL;
+        n->branch_form = LAYOUT_FORM_PC_RELATIVE;
+        count++;
+    }
+
+    // Literal words are data: keep them verbatim, even if they decode as branches
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (n->branch_form != LAYOUT_FORM_PC_RELATIVE || !n->target ||
+            !pcrel_decode(isa, n->insn->bytes, n->insn->size, n->offset, &rel) ||
+            rel.kind != PCREL_KIND_LITERAL) {
+            continue;
+        }
+        size_t end = n->target->offset + rel.data_size;
+        for (struct instruction_node *m = n->target; m != NULL && m->offset < end; m = m->next) {
+            if (m->branch_form == LAYOUT_FORM_PC_RELATIVE) {
+                m->branch_form = LAYOUT_FORM_NONE;
+                m->target = NULL;
+                count--;
+            }
+            if (!m->code_fixed) {
+                m->code_fixed = 1;
+                m->code.size = 0;
+                buffer_append(&m->code, m->insn->bytes, m->insn->size);
+            }
+        }
+    }
+    return count;
+}
+
+// ============================================================================
+// Context
+// ============================================================================
+
+static size_t pcrel_entry_size(const pcrel_ctx_t *ctx, const pcrel_entry_t *e, int form) {
+    return (form >= e->form_count) ? e->insn.size : ctx->ops->form_size(&e->insn, form);
+}
+
+static void pcrel_set_form(pcrel_ctx_t *ctx, pcrel_entry_t *e, int form) {
+    e->node->pcrel_form = form;
+    e->node->new_size = pcrel_entry_size(ctx, e, form);
+}
+
+static int64_t pcrel_target(const pcrel_ctx_t *ctx, const pcrel_entry_t *e) {
+    if (e->past_end) {
+        return (int64_t)ctx->new_end + e->delta;
+    }
+    return e->anchor ? (int64_t)e->anchor->new_offset + e->delta : e->delta;
+}
+
+// Form whose size matches the original instruction, or -1
+static int pcrel_same_size_form(const pcrel_ctx_t *ctx, const pcrel_entry_t *e) {
+    int count = e->form_count;
+
+    for (int form = 0; form < count; form++) {
+        if (ctx->ops->form_size(&e->insn, form) == e->insn.size) {
+            return form;
+        }
+    }
+    return -1;
+}
+
+static void pcrel_free_context(pcrel_ctx_t *ctx) {
+    free(ctx->entries);
+    free(ctx->nodes);
+    free(ctx->flags);
+}
+
+// Node containing input offset `at` (nodes are sorted by offset)
+static size_t pcrel_find_node(const pcrel_ctx_t *ctx, size_t at) {
+    size_t lo = 0, hi = ctx->node_count;
+
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (ctx->nodes[mid]->offset <= at) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Collect nodes and entries. With `fresh` every node starts over (smallest
+ * form, no padding); otherwise the solved state is kept for emission.
+ */
+static int pcrel_build_context(pcrel_ctx_t *ctx, struct instruction_node *head, byval_arch_t arch,
+                               int fresh, pcrel_stats_t *stats) {
+    pcrel_isa_t isa;
+    pcrel_insn_t rel;
+    size_t i = 0;
+
+    memset(ctx, 0, sizeof(*ctx));
+    if (!pcrel_isa_for_arch(arch, &isa)) {
+        return -1;
+    }
+    ctx->ops = pcrel_isa_ops(isa);
+    ctx->nop_len = ctx->ops->nop(ctx->nop);
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        ctx->node_count++;
+        ctx->count += (n->branch_form == LAYOUT_FORM_PC_RELATIVE);
+        ctx->old_end = n->offset + n->insn->size;
+    }
+    ctx->nodes = calloc(ctx->node_count + 1, sizeof(*ctx->nodes));
+    ctx->flags = calloc(ctx->node_count + 1, 1);
+    ctx->entries = calloc((size_t)ctx->count + 1, sizeof(*ctx->entries));
+    if (!ctx->nodes || !ctx->flags || !ctx->entries) {
+        pcrel_free_context(ctx);
+        return -1;
+    }
+
+    int count = 0;
+    for (struct instruction_node *n = head; n != NULL; n = n->next, i++) {
+        int span = ctx->ops->it_span ? ctx->ops->it_span(n->insn->bytes, n->insn->size) : 0;
+
+        ctx->nodes[i] = n;
+        // Nothing may come between an IT and the instructions it covers
+        if (span > 0) {
+            ctx->flags[i] |= PCREL_NODE_NO_PAD;
+            for (size_t j = i + 1; j <= i + (size_t)span && j < ctx->node_count; j++) {
+                ctx->flags[j] |= PCREL_NODE_NO_PAD | PCREL_NODE_IN_IT;
+            }
+        }
+        if (n->branch_form != LAYOUT_FORM_PC_RELATIVE) {
+            if (fresh) {
+                n->new_size = n->code.size;
+                n->pad_before = 0;
+            }
+            if (stats && pcrel_decode(isa, n->insn->bytes, n->insn->size, n->offset, &rel) &&
+                rel.kind == PCREL_KIND_PAGE) {
+                stats->page_refs++;
+            }
+            continue;
+        }
+        pcrel_entry_t *e = &ctx->entries[count++];
+        e->node = n;
+        e->index = i;
+        pcrel_decode(isa, n->insn->bytes, n->insn->size, n->offset, &e->insn);
+        e->form_count = ctx->ops->form_count(&e->insn);
+        e->cached_form = -1;
+        int first = 0;
+        if (ctx->flags[i] & PCREL_NODE_IN_IT) {
+            // One instruction of the original size, or none: the forms after
+            // it are unavailable
+            first = pcrel_same_size_form(ctx, e);
+            e->form_count = (first >= 0) ? first + 1 : 0;
+            first = (first >= 0) ? first : 0;
+            if (stats) {
+                stats->in_it_block++;
+            }
+        }
+        if (fresh) {
+            n->pad_before = 0;
+            pcrel_set_form(ctx, e, first);
+        }
+    }
+
+    // Resolve targets that are not instruction starts of the payload
+    for (int k = 0; k < ctx->count; k++) {
+        pcrel_entry_t *e = &ctx->entries[k];
+        int64_t target = (int64_t)e->node->offset + e->insn.disp;
+
+        if (e->node->target) {
+            e->anchor = e->node->target;
+        } else if (target >= (int64_t)ctx->old_end) {
+            e->past_end = 1;
+            e->delta = target - (int64_t)ctx->old_end;
+        } else if (target >= 0) {
+            e->anchor = ctx->nodes[pcrel_find_node(ctx, (size_t)target)];
+            e->delta = target - (int64_t)e->anchor->offset;
+        } else {
+            e->delta = target;
+        }
+
+        // Padding must not split the words a literal load reads
+        if (e->insn.kind == PCREL_KIND_LITERAL && e->node->target) {
+            size_t first = pcrel_find_node(ctx, e->node->target->offset);
+            size_t end = e->node->target->offset + e->insn.data_size;
+            for (size_t j = first; j < ctx->node_count && ctx->nodes[j]->offset < end; j++) {
+                ctx->flags[j] |= PCREL_NODE_LITERAL | ((j > first) ? PCREL_NODE_NO_PAD : 0);
+            }
+        }
+    }
+    for (i = 0; stats && i < ctx->node_count; i++) {
+        stats->literal_words += (ctx->flags[i] & PCREL_NODE_LITERAL) != 0;
+    }
+    return 0;
+}
+
+// ============================================================================
+// Offsets, encoding and relaxation
+// ============================================================================
+
+static void pcrel_assign_offsets(pcrel_ctx_t *ctx) {
+    size_t at = 0;
+
+    for (size_t i = 0; i < ctx->node_count; i++) {
+        struct instruction_node *n = ctx->nodes[i];
+        at += n->pad_before;
+        n->new_offset = at;
+        at += n->new_size;
+    }
+    ctx->new_end = at;
+    ctx->work += ctx->node_count;
+}
+
+// Encode an entry at its current offset; returns 0 if its form cannot reach the target
+static size_t pcrel_encode_entry(pcrel_ctx_t *ctx, pcrel_entry_t *e, const uint8_t **bytes) {
+    struct instruction_node *n = e->node;
+    int64_t at = (int64_t)n->new_offset;
+    int64_t target = pcrel_target(ctx, e);
+
+    if (n->pcrel_form >= e->form_count) {
+        *bytes = n->insn->bytes;
+        return n->insn->size;
+    }
+    if (e->cached_form != n->pcrel_form || e->cached_at != at || e->cached_target != target) {
+        e->cached_form = n->pcrel_form;
+        e->cached_at = at;
+        e->cached_target = target;
+        e->cached_len = ctx->ops->encode(&e->insn, n->pcrel_form, at, target, e->cached);
+    }
+    *bytes = e->cached;
+    return e->cached_len;
+}
+
+static int pcrel_entry_dirty(pcrel_ctx_t *ctx, pcrel_entry_t *e) {
+    const uint8_t *bytes;
+    size_t len = pcrel_encode_entry(ctx, e, &bytes);
+    return len == 0 || !is_bad_byte_free_buffer(bytes, len);
+}
+
+static int pcrel_count_dirty(pcrel_ctx_t *ctx) {
+    int dirty = 0;
+    for (int i = 0; i < ctx->count; i++) {
+        dirty += pcrel_entry_dirty(ctx, &ctx->entries[i]);
+    }
+    return dirty;
+}
+
+// Move every entry whose form cannot reach its target to the next form
+static int pcrel_relax(pcrel_ctx_t *ctx, int *passes) {
+    for (int pass = 0; pass < PCREL_MAX_RELAX_PASSES; pass++) {
+        int changed = 0;
+        const uint8_t *bytes;
+
+        pcrel_assign_offsets(ctx);
+        (*passes)++;
+        for (int i = 0; i < ctx->count; i++) {
+            pcrel_entry_t *e = &ctx->entries[i];
+            if (e->node->pcrel_form < e->form_count && pcrel_encode_entry(ctx, e, &bytes) == 0) {
+                pcrel_set_form(ctx, e, e->node->pcrel_form + 1);
+                changed = 1;
+            }
+        }
+        if (!changed) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// ============================================================================
+// Repair of dirty encodings
+// ============================================================================
+
+typedef struct {
+    size_t cost;
+    int form;          // Form to switch to, or -1 for padding
+    size_t pad;        // Padding bytes (form == -1)
+} pcrel_trial_t;
+
+static int pcrel_trial_cmp(const void *a, const void *b) {
+    const pcrel_trial_t *x = a, *y = b;
+    if (x->cost != y->cost) {
+        return (x->cost < y->cost) ? -1 : 1;
+    }
+    return (x->form < y->form) ? -1 : (x->form > y->form);
+}
+
+/*
+ * Padding on the side that faces the target changes the displacement:
+ * ahead of the node for a backward target, behind it for a forward one
+ */
+static struct instruction_node *pcrel_pad_site(const pcrel_ctx_t *ctx, const pcrel_entry_t *e) {
+    size_t site = e->index;
+
+    if (pcrel_target(ctx, e) > (int64_t)e->node->new_offset) {
+        site++;
+    }
+    if (site >= ctx->node_count || (ctx->flags[site] & PCREL_NODE_NO_PAD)) {
+        return NULL;
+    }
+    return ctx->nodes[site];
+}
+
+static void pcrel_repair(pcrel_ctx_t *ctx, pcrel_stats_t *stats) {
+    int *saved = malloc(((size_t)ctx->count + 1) * sizeof(*saved));
+
+    if (!saved) {
+        return;
+    }
+    for (int i = 0; i < ctx->count && ctx->work < PCREL_SEARCH_WORK_LIMIT; i++) {
+        pcrel_entry_t *e = &ctx->entries[i];
+        pcrel_trial_t trials[PCREL_PAD_MAX_UNITS + PCREL_MAX_FORMS];
+        int trial_count = 0;
+
+        if (e->node->pcrel_form >= e->form_count || !pcrel_entry_dirty(ctx, e)) {
+            continue;
+        }
+        struct instruction_node *site = ctx->nop_len ? pcrel_pad_site(ctx, e) : NULL;
+        for (size_t k = 1; site && k <= PCREL_PAD_MAX_UNITS; k++) {
+            size_t pad = k * ctx->nop_len;
+            if (ctx->pad_total + pad <= PCREL_PAD_BUDGET) {
+                trials[trial_count++] = (pcrel_trial_t){pad, -1, pad};
+            }
+        }
+        size_t size = e->node->new_size;
+        for (int f = e->node->pcrel_form + 1; f < e->form_count && f < PCREL_MAX_FORMS; f++) {
+            size_t grown = pcrel_entry_size(ctx, e, f);
+            trials[trial_count++] = (pcrel_trial_t){grown > size ? grown - size : 0, f, 0};
+        }
+        qsort(trials, (size_t)trial_count, sizeof(*trials), pcrel_trial_cmp);
+
+        int before = pcrel_count_dirty(ctx);
+        for (int t = 0; t < trial_count && ctx->work < PCREL_SEARCH_WORK_LIMIT; t++) {
+            int passes = 0;
+            for (int j = 0; j < ctx->count; j++) {
+                saved[j] = ctx->entries[j].node->pcrel_form;
+            }
+            if (trials[t].form < 0) {
+                site->pad_before += trials[t].pad;
+            } else {
+                pcrel_set_form(ctx, e, trials[t].form);
+            }
+            if (pcrel_relax(ctx, &passes) == 0 && pcrel_count_dirty(ctx) < before) {
+                if (trials[t].form < 0) {
+                    ctx->pad_total += trials[t].pad;
+                    stats->padded++;
+                }
+                break;
+            }
+            // Undo
+            if (trials[t].form < 0) {
+                site->pad_before -= trials[t].pad;
+            }
+            for (int j = 0; j < ctx->count; j++) {
+                pcrel_set_form(ctx, &ctx->entries[j], saved[j]);
+            }
+            pcrel_assign_offsets(ctx);
+        }
+    }
+    free(saved);
+}
+
+// ============================================================================
+// Public entry points
+// ============================================================================
+
+int pcrel_solve(struct instruction_node *head, byval_arch_t arch, pcrel_stats_t *stats) {
+    pcrel_ctx_t ctx;
+    pcrel_stats_t local;
+    int result = 0;
+
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (pcrel_build_context(&ctx, head, arch, 1, stats) != 0) {
+        return -1;
+    }
+
+    // 1. Range relaxation from the smallest forms
+    if (pcrel_relax(&ctx, &stats->relax_passes) != 0) {
+        result = -1;
+    }
+
+    // 2. Padding or a larger form for every dirty encoding
+    if (result == 0) {
+        pcrel_repair(&ctx, stats);
+        if (pcrel_relax(&ctx, &stats->relax_passes) != 0) {
+            result = -1;
+        }
+    }
+
+    stats->pad_bytes = ctx.pad_total;
+    for (int i = 0; i < ctx.count; i++) {
+        pcrel_entry_t *e = &ctx.entries[i];
+        struct instruction_node *n = e->node;
+
+        stats->references++;
+        switch (e->insn.kind) {
+            case PCREL_KIND_ADDRESS: stats->addresses++; break;
+            case PCREL_KIND_LITERAL: stats->literals++; break;
+            default:                 stats->branches++; break;
+        }
+        stats->external += (n->target == NULL);
+        if (n->pcrel_form >= e->form_count) {
+            stats->unresolved++;
+            log_diagnostic("[RELOC] WARNING: %s %s at 0x%zx cannot reach its target, left unchanged\n",
+                           n->insn->mnemonic, n->insn->op_str, n->offset);
+            if (ctx.flags[e->index] & PCREL_NODE_IN_IT) {
+                result = -1;  // Its IT block cannot take a longer sequence
+            }
+        } else if (n->new_size > e->insn.size) {
+            stats->expanded++;
+        }
+        stats->dirty += pcrel_entry_dirty(&ctx, e);
+    }
+
+    pcrel_free_context(&ctx);
+    return result;
+}
+
+void pcrel_emit(struct buffer *out, struct instruction_node *head, byval_arch_t arch) {
+    pcrel_ctx_t ctx;
+    int k = 0;
+
+    if (pcrel_build_context(&ctx, head, arch, 0, NULL) != 0) {
+        return;
+    }
+    if (ctx.node_count > 0) {
+        struct instruction_node *last = ctx.nodes[ctx.node_count - 1];
+        ctx.new_end = last->new_offset + last->new_size;
+    }
+
+    for (size_t i = 0; i < ctx.node_count; i++) {
+        struct instruction_node *n = ctx.nodes[i];
+        size_t before = out->size;
+
+        for (size_t pad = 0; ctx.nop_len && pad < n->pad_before; pad += ctx.nop_len) {
+            buffer_append(out, ctx.nop, ctx.nop_len);
+        }
+        if (n->branch_form != LAYOUT_FORM_PC_RELATIVE) {
+            buffer_append(out, n->code.data, n->code.size);
+        } else {
+            pcrel_entry_t *e = &ctx.entries[k++];
+            const uint8_t *bytes;
+            size_t len = pcrel_encode_entry(&ctx, e, &bytes);
+            if (len == 0) {
+                bytes = n->insn->bytes;
+                len = n->insn->size;
+            }
+            buffer_append(out, bytes, len);
+        }
+
+        if (out->size - before != n->pad_before + n->new_size) {
+            log_diagnostic("[RELOC] WARNING: %s %s emitted %zu bytes, planned %zu\n",
+                           n->insn->mnemonic, n->insn->op_str, out->size - before,
+                           n->pad_before + n->new_size);
+        }
+    }
+    pcrel_free_context(&ctx);
+}
+
+void pcrel_print_stats(const pcrel_stats_t *stats) {
+    log_diagnostic("[RELOC] %d PC-relative references (%d branches, %d ADR, %d literal loads), "
+                   "%d external; %d expanded, %d repaired by padding (%zu pad bytes), %d relax passes\n",
+                   stats->references, stats->branches, stats->addresses, stats->literals,
+                   stats->external, stats->expanded, stats->padded, stats->pad_bytes, stats->relax_passes);
+    if (stats->literal_words > 0) {
+        log_diagnostic("[RELOC] %d literal words kept verbatim\n", stats->literal_words);
+    }
+    if (stats->in_it_block > 0) {
+        log_diagnostic("[RELOC] %d references inside IT blocks kept at their original size\n",
+                       stats->in_it_block);
+    }
+    if (stats->unresolved > 0 || stats->dirty > 0) {
+        log_diagnostic("[RELOC] WARNING: %d references out of reach, %d still contain bad bytes\n",
+                       stats->unresolved, stats->dirty);
+    }
+    if (stats->page_refs > 0) {
+        log_diagnostic("[RELOC] WARNING: %d ADRP instructions left unchanged "
+                       "(they depend on the load address)\n", stats->page_refs);
+    }
+}
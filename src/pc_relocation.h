@@ -0,0 +1,179 @@
+#ifndef PC_RELOCATION_H
+#define PC_RELOCATION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+
+/**
+ * @file pc_relocation.h
+ * @brief PC-relative relocation for the fixed-width ISAs (ARM, Thumb, AArch64)
+ *
+ * The x86 layout solver (branch_layout.h) owns rel8/rel32 branches and
+ * RIP-relative operands. Every other PC-relative form goes through this layer
+ * instead: B/BL/BLX, B.cond, CBZ/CBNZ, TBZ/TBNZ, ADR and literal loads.
+ *
+ * Such instructions become layout nodes (LAYOUT_FORM_PC_RELATIVE). They are
+ * re-encoded once every other instruction has been rewritten. The solver is
+ * architecture-neutral: each ISA supplies a table of encoding forms per
+ * reference kind, ordered by size (see pcrel_isa_ops_t). Relaxation starts
+ * every node in its smallest form and moves it to a later form when the
+ * target is out of range. A node whose encoding contains bad bytes is then
+ * repaired with the cheapest fix that lowers the number of dirty nodes:
+ * clean no-op padding on the side that faces the target, or a larger form
+ * that encodes the displacement differently. Larger forms include:
+ *
+ *   conditional branch   inverted branch over an unconditional B
+ *   A32 literal load     ADD/SUB Rt, PC, #hi ; LDR Rt, [Rt, #lo]
+ *   A64 literal load     ADR Xt, #hi ; LDR Wt/Xt/LDRSW, [Xt, #lo]
+ *   ADR                  ADR (or ADD Rd, PC) followed by ADD/SUB Rd, Rd, #rest
+ *
+ * The split forms search for a clean pair of immediates.
+ *
+ * The words a literal load reads are data, so they are marked code_fixed and
+ * copied verbatim, never rewritten. A64 ADRP depends on the load address
+ * modulo 4 KiB; it is left alone and reported. Targets outside the payload
+ * keep their distance from the nearest end of the payload. A node that no
+ * form can reach is emitted unchanged and reported.
+ *
+ * Thumb IT blocks condition the next one to four instructions by position,
+ * so nothing may be inserted between an IT and the instructions it covers:
+ * those nodes get no padding and keep a form of their original size (always
+ * a single instruction). A covered node that form cannot fix fails the
+ * relocation.
+ */
+
+#define PCREL_PAD_MAX_UNITS     8            // Largest no-op padding tried per node
+#define PCREL_PAD_BUDGET        256          // Total padding bytes the solver may insert
+#define PCREL_MAX_RELAX_PASSES  64           // Relaxation iterations before giving up
+#define PCREL_SEARCH_WORK_LIMIT 20000000UL   // Node visits spent on repair trials
+#define PCREL_MAX_FORMS         4            // Encoding forms per reference kind
+#define PCREL_MAX_ENCODING      8            // Largest encoding of any form
+
+typedef enum {
+    PCREL_ISA_A32 = 0,     // ARM state, PC reads 8 bytes ahead
+    PCREL_ISA_T32,         // Thumb-2, PC reads 4 bytes ahead
+    PCREL_ISA_A64          // AArch64, PC is the instruction address
+} pcrel_isa_t;
+
+typedef enum {
+    PCREL_KIND_NONE = 0,
+    PCREL_KIND_BRANCH,     // B, B<cond>, B.cond
+    PCREL_KIND_CALL,       // BL, BLX <imm>
+    PCREL_KIND_COMPARE,    // CBZ/CBNZ
+    PCREL_KIND_TEST,       // TBZ/TBNZ (A64)
+    PCREL_KIND_ADDRESS,    // ADR (A32: ADD/SUB Rd, PC, #imm)
+    PCREL_KIND_LITERAL,    // Literal (PC-relative) load
+    PCREL_KIND_PAGE        // A64 ADRP: load-address dependent, not relocatable
+} pcrel_kind_t;
+
+// One decoded PC-relative instruction
+typedef struct {
+    pcrel_isa_t isa;
+    pcrel_kind_t kind;
+    uint32_t word;         // Original encoding (T32 32-bit forms: first halfword in bits 15:0)
+    uint8_t size;          // Original encoding size
+    int64_t disp;          // Target minus instruction address
+    uint8_t cond;          // Condition (0xE = always)
+    uint8_t reg;           // Rt/Rd/Rn
+    uint8_t negate;        // CBNZ/TBNZ
+    uint8_t bit;           // TBZ/TBNZ bit number
+    uint8_t exchange;      // BLX <imm>: target is in the other instruction set
+    uint8_t load;          // LITERAL: ISA-specific load class
+    uint8_t data_size;     // LITERAL: bytes read at the target (0 for prefetches)
+} pcrel_insn_t;
+
+// Encoders for one ISA
+typedef struct {
+    pcrel_isa_t isa;
+    size_t unit;           // Instruction alignment (and no-op size)
+    // Decode a PC-relative instruction at input offset `address`; returns 1
+    // and fills `out` if it is one
+    int (*decode)(const uint8_t *bytes, size_t size, uint64_t address, pcrel_insn_t *out);
+    // Number of forms available for an instruction
+    int (*form_count)(const pcrel_insn_t *insn);
+    // Size of a form (independent of the displacement)
+    size_t (*form_size)(const pcrel_insn_t *insn, int form);
+    // Encode a form at `at` reaching `target`; returns its size, or 0 if the
+    // form cannot reach it. Split forms prefer bad-byte-free immediates
+    size_t (*encode)(const pcrel_insn_t *insn, int form, int64_t at, int64_t target, uint8_t *out);
+    // Write a bad-byte-free no-op; returns its size (`unit`), 0 if none is clean
+    size_t (*nop)(uint8_t *out);
+    // Instructions a conditional-execution prefix (Thumb IT) covers, 0 if
+    // `bytes` is not one; NULL for ISAs without such prefixes
+    int (*it_span)(const uint8_t *bytes, size_t size);
+} pcrel_isa_ops_t;
+
+// Result summary for one relocation run
+typedef struct {
+    int references;        // PC-relative instructions relocated
+    int branches;          // ...branches (B/BL/BLX/B.cond/CBZ/TBZ)
+    int addresses;         // ...ADR
+    int literals;          // ...literal loads
+    int external;          // ...with a target outside the payload
+    int expanded;          // Moved to a larger form (range or bad bytes)
+    int padded;            // Repaired by padding
+    size_t pad_bytes;      // Padding bytes inserted
+    int unresolved;        // Out of reach of every form, emitted unchanged
+    int dirty;             // Still containing bad bytes
+    int literal_words;     // Instructions kept verbatim as literal data
+    int in_it_block;       // References inside Thumb IT blocks (same-size forms only)
+    int page_refs;         // A64 ADRP left unchanged
+    int relax_passes;      // Relaxation iterations used
+} pcrel_stats_t;
+
+/**
+ * Select the relocation ISA for an architecture
+ * @param arch: Target architecture
+ * @param isa: Output ISA
+ * @return: 1 if this layer relocates the architecture, 0 otherwise (x86)
+ */
+int pcrel_isa_for_arch(byval_arch_t arch, pcrel_isa_t *isa);
+
+/**
+ * Encoders of an ISA (implemented in arm_pc_relocation.c)
+ */
+const pcrel_isa_ops_t *pcrel_isa_ops(pcrel_isa_t isa);
+
+/**
+ * Decode a PC-relative instruction
+ * @param address: Input offset of the instruction (Thumb literal forms are word-aligned)
+ * @return: 1 if `bytes` hold one of the forms this layer understands
+ */
+int pcrel_decode(pcrel_isa_t isa, const uint8_t *bytes, size_t size, uint64_t address,
+                 pcrel_insn_t *out);
+
+/**
+ * Classify every PC-relative node and protect literal data
+ *
+ * Sets branch_form = LAYOUT_FORM_PC_RELATIVE and resolves node->target
+ * (NULL when the target is not an instruction boundary of the payload).
+ * Nodes covered by a literal load become code_fixed with their original
+ * bytes; a literal word that happens to decode as a branch stays data.
+ *
+ * @param head: First instruction node
+ * @param arch: Target architecture
+ * @param lookup: Maps an input offset to its node (NULL if none)
+ * @return: Number of relocated nodes
+ */
+int pcrel_classify(struct instruction_node *head, byval_arch_t arch,
+                   struct instruction_node *(*lookup)(uint64_t offset));
+
+/**
+ * Choose forms, padding and final offsets for every node
+ * (the equivalent of layout_solve() for the fixed-width ISAs)
+ * @return: 0 on success, -1 if relaxation did not converge
+ */
+int pcrel_solve(struct instruction_node *head, byval_arch_t arch, pcrel_stats_t *stats);
+
+/**
+ * Emit the solved layout into an output buffer
+ */
+void pcrel_emit(struct buffer *out, struct instruction_node *head, byval_arch_t arch);
+
+/**
+ * Print a summary of a relocation run to stderr
+ */
+void pcrel_print_stats(const pcrel_stats_t *stats);
+
+#endif // PC_RELOCATION_H
@@ -9,27 +9,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int fingerprint_counter = 0;
-static int fingerprint_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Strategy: PEB Module Name Length Fingerprinting
 // ============================================================================
 
 int can_handle_peb_namelength_fingerprint(cs_insn *insn) {
-    // Initialize once
-    if (!fingerprint_initialized) {
-        srand((unsigned int)time(NULL) ^ 0xABCD);
-        fingerprint_initialized = 1;
-    }
-
     // This strategy adds length-based checking patterns for CMP instructions
     // that might be used in PEB traversal
     if (insn->id != X86_INS_CMP) {
@@ -42,8 +33,7 @@ int can_handle_peb_namelength_fingerprint(cs_insn *insn) {
     }
 
     // Apply to approximately 8% of CMP instructions to add variety
-    fingerprint_counter++;
-    return (fingerprint_counter % 12 == 0);
+    return thread_rng_below(12) == 0;
 }
 
 size_t get_peb_namelength_fingerprint_size(cs_insn *insn) {
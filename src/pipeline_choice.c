@@ -0,0 +1,58 @@
+/*
+ * Per-input cache of --pipeline auto decisions (see pipeline_choice.h)
+ *
+ * A small direct-mapped table: the slot is picked by the low hash bits and a
+ * collision simply replaces the older decision, which only costs one extra
+ * run of both pipelines.
+ */
+
+#include "pipeline_choice.h"
+
+#define PIPELINE_CHOICE_SLOTS 1024   // Power of two
+
+typedef struct {
+    uint64_t hash;
+    pipeline_choice_t choice;
+    int used;
+} pipeline_choice_entry_t;
+
+static pipeline_choice_entry_t choice_table[PIPELINE_CHOICE_SLOTS];
+
+uint64_t pipeline_input_hash(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;   // FNV-1a offset basis
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;            // FNV-1a prime
+    }
+    return hash;
+}
+
+int pipeline_choice_lookup(uint64_t hash, pipeline_choice_t *choice) {
+    const pipeline_choice_entry_t *e = &choice_table[hash & (PIPELINE_CHOICE_SLOTS - 1)];
+
+    if (!e->used || e->hash != hash) {
+        return 0;
+    }
+    *choice = e->choice;
+    return 1;
+}
+
+void pipeline_choice_store(uint64_t hash, pipeline_choice_t choice) {
+    pipeline_choice_entry_t *e = &choice_table[hash & (PIPELINE_CHOICE_SLOTS - 1)];
+
+    e->hash = hash;
+    e->choice = choice;
+    e->used = 1;
+}
+
+const char *pipeline_choice_name(pipeline_choice_t choice) {
+    switch (choice) {
+        case PIPELINE_CHOICE_REWRITE:
+            return "rewrite";
+        case PIPELINE_CHOICE_ENCODE:
+            return "encode";
+        default:
+            return "unknown";
+    }
+}
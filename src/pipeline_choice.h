@@ -0,0 +1,47 @@
+#ifndef PIPELINE_CHOICE_H
+#define PIPELINE_CHOICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file pipeline_choice.h
+ * @brief Remembered rewrite-versus-encode decisions for --pipeline auto
+ *
+ * --pipeline auto runs both the rewrite pipeline and the encoder pipeline
+ * (whole payload behind a generated decoder stub) and keeps the smaller clean
+ * result. Batch runs often contain the same payload several times; the
+ * decision is stored per input hash so repeats only run the winning
+ * pipeline. The configuration is fixed for the lifetime of the process, so
+ * the input bytes alone identify a decision.
+ */
+
+typedef enum {
+    PIPELINE_CHOICE_REWRITE = 0,
+    PIPELINE_CHOICE_ENCODE
+} pipeline_choice_t;
+
+/**
+ * 64-bit FNV-1a hash of an input payload
+ */
+uint64_t pipeline_input_hash(const uint8_t *data, size_t size);
+
+/**
+ * Look up the decision for an input
+ * @param hash: From pipeline_input_hash()
+ * @param choice: Output decision
+ * @return: 1 if a decision is cached, 0 otherwise
+ */
+int pipeline_choice_lookup(uint64_t hash, pipeline_choice_t *choice);
+
+/**
+ * Remember the decision for an input (replaces a colliding older entry)
+ */
+void pipeline_choice_store(uint64_t hash, pipeline_choice_t choice);
+
+/**
+ * Name of a pipeline for diagnostics ("rewrite", "encode")
+ */
+const char *pipeline_choice_name(pipeline_choice_t choice);
+
+#endif // PIPELINE_CHOICE_H
@@ -4,13 +4,18 @@
 #include <string.h>
 
 // Global statistics
-sib_encoding_stats_t g_sib_stats = {0};
+__thread sib_encoding_stats_t g_sib_stats = {0};
 
-// Cache for SIB encoding decisions
-static sib_encoding_result_t cached_encoding = {0};
-static bool cache_valid = false;
-static x86_reg cached_base = X86_REG_INVALID;
-static x86_reg cached_dst = X86_REG_INVALID;
+// Cache for SIB encoding decisions (per thread: variants rewrite concurrently),
+// keyed by the bad-byte context it was validated against
+static __thread sib_encoding_result_t cached_encoding = {0};
+static __thread unsigned int cached_generation = 0;   // 0 = empty
+static __thread x86_reg cached_base = X86_REG_INVALID;
+static __thread x86_reg cached_dst = X86_REG_INVALID;
+
+static bool sib_cache_current(void) {
+    return cached_generation != 0 && cached_generation == current_bad_byte_context()->generation;
+}
 
 /**
  * @brief Check if a specific SIB byte is safe to use
@@ -42,7 +47,7 @@ sib_encoding_result_t select_sib_encoding_for_eax(x86_reg dst_reg) {
     uint8_t dst_idx = get_reg_index(dst_reg);
 
     // Check cache
-    if (cache_valid && cached_base == X86_REG_EAX && cached_dst == dst_reg) {
+    if (sib_cache_current() && cached_base == X86_REG_EAX && cached_dst == dst_reg) {
         return cached_encoding;
     }
 
@@ -60,7 +65,7 @@ sib_encoding_result_t select_sib_encoding_for_eax(x86_reg dst_reg) {
         cached_encoding = result;
         cached_base = X86_REG_EAX;
         cached_dst = dst_reg;
-        cache_valid = true;
+        cached_generation = current_bad_byte_context()->generation;
 
         return result;
     }
@@ -89,7 +94,7 @@ sib_encoding_result_t select_sib_encoding_for_eax(x86_reg dst_reg) {
             cached_encoding = result;
             cached_base = X86_REG_EAX;
             cached_dst = dst_reg;
-            cache_valid = true;
+            cached_generation = current_bad_byte_context()->generation;
 
             return result;
         }
@@ -104,7 +109,7 @@ sib_encoding_result_t select_sib_encoding_for_eax(x86_reg dst_reg) {
     cached_encoding = result;
     cached_base = X86_REG_EAX;
     cached_dst = dst_reg;
-    cache_valid = true;
+    cached_generation = current_bad_byte_context()->generation;
 
     return result;
 }
@@ -123,7 +128,7 @@ sib_encoding_result_t select_sib_encoding_for_reg(x86_reg base_reg, x86_reg dst_
     }
 
     // Check cache
-    if (cache_valid && cached_base == base_reg && cached_dst == dst_reg) {
+    if (sib_cache_current() && cached_base == base_reg && cached_dst == dst_reg) {
         return cached_encoding;
     }
 
@@ -140,7 +145,7 @@ sib_encoding_result_t select_sib_encoding_for_reg(x86_reg base_reg, x86_reg dst_
         cached_encoding = result;
         cached_base = base_reg;
         cached_dst = dst_reg;
-        cache_valid = true;
+        cached_generation = current_bad_byte_context()->generation;
 
         return result;
     }
@@ -168,7 +173,7 @@ sib_encoding_result_t select_sib_encoding_for_reg(x86_reg base_reg, x86_reg dst_
             cached_encoding = result;
             cached_base = base_reg;
             cached_dst = dst_reg;
-            cache_valid = true;
+            cached_generation = current_bad_byte_context()->generation;
 
             return result;
         }
@@ -183,7 +188,7 @@ sib_encoding_result_t select_sib_encoding_for_reg(x86_reg base_reg, x86_reg dst_
     cached_encoding = result;
     cached_base = base_reg;
     cached_dst = dst_reg;
-    cache_valid = true;
+    cached_generation = current_bad_byte_context()->generation;
 
     return result;
 }
@@ -381,7 +386,7 @@ int generate_safe_lea_reg_mem(struct buffer *b, x86_reg dst_reg, x86_reg base_re
  * @brief Invalidate SIB encoding cache
  */
 void invalidate_sib_cache(void) {
-    cache_valid = false;
+    cached_generation = 0;
     cached_base = X86_REG_INVALID;
     cached_dst = X86_REG_INVALID;
     memset(&cached_encoding, 0, sizeof(cached_encoding));
@@ -90,7 +90,8 @@ int generate_safe_mov_mem_reg(struct buffer *b, x86_reg base_reg, x86_reg src_re
 int generate_safe_lea_reg_mem(struct buffer *b, x86_reg dst_reg, x86_reg base_reg);
 
 /**
- * @brief Invalidate SIB encoding cache (call when bad byte profile changes)
+ * @brief Empty the SIB encoding cache of the calling thread (entries are also
+ *        keyed by the bad byte context generation, so a profile change needs no call)
  */
 void invalidate_sib_cache(void);
 
@@ -103,7 +104,7 @@ typedef struct {
     uint32_t pushpop_count;
 } sib_encoding_stats_t;
 
-extern sib_encoding_stats_t g_sib_stats;
+extern __thread sib_encoding_stats_t g_sib_stats;  // Per thread (--variants)
 
 /**
  * @brief Print SIB encoding statistics
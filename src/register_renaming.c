@@ -0,0 +1,555 @@
+/*
+ * Whole-Payload Register Renaming
+ *
+ * PROBLEM: Register numbers end up in ModR/M, SIB and opcode+r bytes. Under
+ * http-newline, "mov ecx, [edx]" is 8B 0A; under http-whitespace,
+ * "and [eax], esp"-style pairs produce 0x20. The ModR/M / reg-to-reg
+ * strategies repair each such instruction with an XCHG or PUSH/POP wrapper,
+ * although the program would have been just as correct with different
+ * registers.
+ *
+ * SOLUTION: Rename registers once, for the whole payload:
+ *   1. Decode the register fields of every instruction whose encoding is
+ *      understood (ALU/MOV/LEA/TEST/IMUL/CMOVcc/MOVZX/... with ModR/M, and
+ *      PUSH/POP/MOV imm/INC/DEC/BSWAP with opcode+r). Every other register use
+ *      pins the register to its own number, as do the stack pointer, registers
+ *      live at entry, registers live at any exit (RET, indirect or external
+ *      transfer, the payload end) and the system-call ABI registers.
+ *   2. Hill-climb over swaps of free registers, scoring a permutation by the
+ *      number of instructions left with bad bytes (then by bad-byte count).
+ *   3. Patch the register fields of the winning permutation in place.
+ * A consistent permutation preserves the program's behaviour on every internal
+ * path; the pinned registers cover everything observed from outside.
+ */
+
+#include "register_renaming.h"
+#include "branch_layout.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    RENAME_CLASS_NONE = 0,
+    RENAME_CLASS_MODRM_REG,    // ModR/M, reg field is a register
+    RENAME_CLASS_MODRM_EXT,    // ModR/M, reg field is an opcode extension
+    RENAME_CLASS_PLUS_R        // Register in the low opcode bits
+} rename_class_t;
+
+typedef struct {
+    struct instruction_node *node;
+    uint8_t modrm_at;          // 0 if no ModR/M
+    uint8_t sib_at;            // 0 if no SIB
+    uint8_t plus_at;           // Opcode byte carrying +r, 0 if none
+    int8_t reg_fam;            // ModR/M.reg register, -1 if none
+    int8_t rm_fam;             // ModR/M.rm register (mod == 3), -1 if none
+    int8_t base_fam;           // Memory base, -1 if none
+    int8_t index_fam;          // Memory index, -1 if none
+    int8_t plus_fam;           // opcode+r register, -1 if none
+} rename_insn_t;
+
+static const char *rename_names32[16] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+static const char *rename_names64[16] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static rename_class_t rename_classify(uint8_t op, int two_byte, byval_arch_t arch) {
+    if (two_byte) {
+        if ((op >= 0x40 && op <= 0x4F) || op == 0xAF || op == 0xB6 || op == 0xB7 || op == 0xBE ||
+            op == 0xBF || op == 0xA3 || op == 0xAB || op == 0xB3 || op == 0xBB || op == 0xBC ||
+            op == 0xBD || op == 0xA4 || op == 0xA5 || op == 0xAC || op == 0xAD || op == 0xB0 ||
+            op == 0xB1 || op == 0xC0 || op == 0xC1) {
+            return RENAME_CLASS_MODRM_REG;
+        }
+        if (op == 0xBA) {
+            return RENAME_CLASS_MODRM_EXT;
+        }
+        if (op >= 0xC8 && op <= 0xCF) {
+            return RENAME_CLASS_PLUS_R;
+        }
+        return RENAME_CLASS_NONE;
+    }
+
+    if (op < 0x40 && (op & 7) < 4) {
+        return RENAME_CLASS_MODRM_REG;          // ADD/OR/ADC/SBB/AND/SUB/XOR/CMP r/m forms
+    }
+    if ((op >= 0x40 && op <= 0x4F && arch == BYVAL_ARCH_X86) || (op >= 0x50 && op <= 0x5F) ||
+        (op >= 0x91 && op <= 0x97) || (op >= 0xB8 && op <= 0xBF)) {
+        return RENAME_CLASS_PLUS_R;
+    }
+    if ((op == 0x63 && arch == BYVAL_ARCH_X64) || op == 0x69 || op == 0x6B ||
+        (op >= 0x84 && op <= 0x8B) || op == 0x8D) {
+        return RENAME_CLASS_MODRM_REG;
+    }
+    switch (op) {
+        case 0x80: case 0x81: case 0x83: case 0x8F: case 0xC0: case 0xC1: case 0xC6: case 0xC7:
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3: case 0xF6: case 0xF7: case 0xFE: case 0xFF:
+            return RENAME_CLASS_MODRM_EXT;
+        default:
+            return RENAME_CLASS_NONE;
+    }
+}
+
+static int rename_is_legacy_prefix(uint8_t b) {
+    switch (b) {
+        case 0x66: case 0xF2: case 0xF3: case 0xF0:
+        case 0x2E: case 0x36: case 0x3E: case 0x26: case 0x64: case 0x65:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int rename_has_field(const rename_insn_t *r, int fam) {
+    return fam >= 0 && (r->reg_fam == fam || r->rm_fam == fam || r->base_fam == fam ||
+                        r->index_fam == fam || r->plus_fam == fam);
+}
+
+/*
+ * Locate the register fields of an instruction. Returns 1 only if every
+ * explicit GPR operand maps to exactly the decoded fields.
+ */
+static int rename_parse(cs_insn *insn, byval_arch_t arch, rename_insn_t *r) {
+    const uint8_t *b = insn->bytes;
+    cs_x86 *x86 = &insn->detail->x86;
+    size_t pos = 0;
+    uint8_t rex = 0;
+    uint8_t op;
+    int two_byte = 0;
+    rename_class_t cls;
+    int fields[5];
+
+    memset(r, 0, sizeof(*r));
+    r->reg_fam = r->rm_fam = r->base_fam = r->index_fam = r->plus_fam = -1;
+
+    while (pos < insn->size && rename_is_legacy_prefix(b[pos])) {
+        pos++;
+    }
+    if (pos < insn->size && b[pos] == 0x67) {
+        return 0;  // Address-size override changes the ModR/M meaning
+    }
+    if (arch == BYVAL_ARCH_X64 && pos < insn->size && (b[pos] & 0xF0) == 0x40) {
+        rex = b[pos++];
+    }
+    if (pos >= insn->size) {
+        return 0;
+    }
+    op = b[pos];
+    if (op == 0x0F) {
+        if (++pos >= insn->size) {
+            return 0;
+        }
+        op = b[pos];
+        two_byte = 1;
+    }
+    cls = rename_classify(op, two_byte, arch);
+    if (cls == RENAME_CLASS_NONE) {
+        return 0;
+    }
+
+    if (cls == RENAME_CLASS_PLUS_R) {
+        r->plus_at = (uint8_t)pos;
+        r->plus_fam = (int8_t)((op & 7) | ((rex & 1) << 3));
+    } else {
+        uint8_t modrm, mod, rm;
+        if (pos + 1 >= insn->size) {
+            return 0;
+        }
+        r->modrm_at = (uint8_t)(pos + 1);
+        modrm = b[r->modrm_at];
+        mod = modrm >> 6;
+        rm = modrm & 7;
+        if (cls == RENAME_CLASS_MODRM_REG) {
+            r->reg_fam = (int8_t)(((modrm >> 3) & 7) | ((rex & 4) << 1));
+        }
+        if (mod == 3) {
+            r->rm_fam = (int8_t)(rm | ((rex & 1) << 3));
+        } else if (rm == 4) {
+            uint8_t sib, base, index;
+            if ((size_t)r->modrm_at + 1 >= insn->size) {
+                return 0;
+            }
+            r->sib_at = (uint8_t)(r->modrm_at + 1);
+            sib = b[r->sib_at];
+            base = sib & 7;
+            index = (uint8_t)(((sib >> 3) & 7) | ((rex & 2) << 2));
+            if (!(base == 5 && mod == 0)) {
+                r->base_fam = (int8_t)(base | ((rex & 1) << 3));
+            }
+            if (index != 4) {
+                r->index_fam = (int8_t)index;
+            }
+        } else if (!(rm == 5 && mod == 0)) {
+            r->base_fam = (int8_t)(rm | ((rex & 1) << 3));
+        }
+    }
+
+    // Explicit operands and decoded fields must agree exactly
+    fields[0] = r->reg_fam;
+    fields[1] = r->rm_fam;
+    fields[2] = r->base_fam;
+    fields[3] = r->index_fam;
+    fields[4] = r->plus_fam;
+    for (int i = 0; i < x86->op_count; i++) {
+        cs_x86_op *o = &x86->operands[i];
+        if (o->type == X86_OP_REG) {
+            int fam = layout_gpr_family(o->reg, NULL);
+            if (fam >= 0 && (o->size == 1 || !rename_has_field(r, fam))) {
+                return 0;  // 8-bit registers (AH..BH) or an implicit register operand
+            }
+        } else if (o->type == X86_OP_MEM) {
+            int base = layout_gpr_family(o->mem.base, NULL);
+            int index = layout_gpr_family(o->mem.index, NULL);
+            if (base != r->base_fam || index != r->index_fam) {
+                return 0;
+            }
+        }
+    }
+    for (int f = 0; f < 5; f++) {
+        int found = (fields[f] < 0);
+        for (int i = 0; i < x86->op_count && !found; i++) {
+            cs_x86_op *o = &x86->operands[i];
+            found = (o->type == X86_OP_REG && layout_gpr_family(o->reg, NULL) == fields[f]) ||
+                    (o->type == X86_OP_MEM && (layout_gpr_family(o->mem.base, NULL) == fields[f] ||
+                                               layout_gpr_family(o->mem.index, NULL) == fields[f]));
+        }
+        if (!found) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Re-encode under `perm`. Returns 0 if a renamed base would need a different
+ * addressing form (no SIB for RSP/R12-style bases, no disp for RBP/R13).
+ */
+static int rename_encode(const rename_insn_t *r, const int *perm, uint8_t *out) {
+    cs_insn *insn = r->node->insn;
+
+    memcpy(out, insn->bytes, insn->size);
+    if (r->plus_fam >= 0) {
+        out[r->plus_at] = (uint8_t)((out[r->plus_at] & 0xF8) | (perm[r->plus_fam] & 7));
+    }
+    if (r->modrm_at) {
+        uint8_t modrm = out[r->modrm_at];
+        if (r->reg_fam >= 0) {
+            modrm = (uint8_t)((modrm & 0xC7) | ((perm[r->reg_fam] & 7) << 3));
+        }
+        if (r->rm_fam >= 0) {
+            modrm = (uint8_t)((modrm & 0xF8) | (perm[r->rm_fam] & 7));
+        }
+        if (r->base_fam >= 0) {
+            int base = perm[r->base_fam] & 7;
+            if ((base == 5 && (modrm >> 6) == 0) || (base == 4 && !r->sib_at)) {
+                return 0;
+            }
+            if (r->sib_at) {
+                out[r->sib_at] = (uint8_t)((out[r->sib_at] & 0xF8) | base);
+            } else {
+                modrm = (uint8_t)((modrm & 0xF8) | base);
+            }
+        }
+        if (r->index_fam >= 0) {
+            if (perm[r->index_fam] == 4) {
+                return 0;
+            }
+            out[r->sib_at] = (uint8_t)((out[r->sib_at] & 0xC7) | ((perm[r->index_fam] & 7) << 3));
+        }
+        out[r->modrm_at] = modrm;
+    }
+    return 1;
+}
+
+static int rename_bad_count(const uint8_t *data, size_t size) {
+    int count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += !is_bad_byte_free_byte(data[i]);
+    }
+    return count;
+}
+
+// Instructions left dirty weigh far more than individual bad bytes
+static long rename_cost(const rename_insn_t *list, int count, const int *perm) {
+    long cost = 0;
+    uint8_t enc[16];
+
+    for (int i = 0; i < count; i++) {
+        int bad;
+        if (!rename_encode(&list[i], perm, enc)) {
+            return -1;
+        }
+        bad = rename_bad_count(enc, list[i].node->insn->size);
+        if (bad > 0) {
+            cost += 64 + bad;
+        }
+    }
+    return cost;
+}
+
+static void rename_fix_list(int *fixed, const int *fams, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        fixed[fams[i]] = 1;
+    }
+}
+
+// Every GPR family the instruction mentions, explicitly or implicitly
+static void rename_mark(cs_insn *insn, int *marks) {
+    cs_detail *detail = insn->detail;
+    int fam;
+
+    for (int i = 0; i < detail->regs_read_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_read[i], NULL)) >= 0) {
+            marks[fam] = 1;
+        }
+    }
+    for (int i = 0; i < detail->regs_write_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_write[i], NULL)) >= 0) {
+            marks[fam] = 1;
+        }
+    }
+    for (int i = 0; i < detail->x86.op_count; i++) {
+        cs_x86_op *op = &detail->x86.operands[i];
+        if (op->type == X86_OP_REG && (fam = layout_gpr_family(op->reg, NULL)) >= 0) {
+            marks[fam] = 1;
+        } else if (op->type == X86_OP_MEM) {
+            if ((fam = layout_gpr_family(op->mem.base, NULL)) >= 0) {
+                marks[fam] = 1;
+            }
+            if ((fam = layout_gpr_family(op->mem.index, NULL)) >= 0) {
+                marks[fam] = 1;
+            }
+        }
+    }
+}
+
+// Registers the code outside may read at an exit: everything the liveness
+// scan cannot prove dead there (at most the --clobber set survives)
+static void rename_fix_live_out(struct instruction_node *exit, byval_arch_t arch, int *fixed) {
+    for (int fam = 0; fam < ((arch == BYVAL_ARCH_X64) ? 16 : 8); fam++) {
+        if (!layout_reg_dead_at(exit, fam, 2)) {
+            fixed[fam] = 1;
+        }
+    }
+}
+
+// Registers whose number is observable outside the register fields
+static void rename_fix_implicit(cs_insn *insn, int *fixed) {
+    static const int all_low[] = {0, 1, 2, 3, 5, 6, 7};
+    static const int eax_edx[] = {0, 2};
+    static const int eax_to_ebx[] = {0, 1, 2, 3};
+    static const int eax_ebx[] = {0, 3};
+    static const int ebp[] = {5};
+    cs_detail *detail = insn->detail;
+    int fam;
+
+    for (int i = 0; i < detail->regs_read_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_read[i], NULL)) >= 0) {
+            fixed[fam] = 1;
+        }
+    }
+    for (int i = 0; i < detail->regs_write_count; i++) {
+        if ((fam = layout_gpr_family(detail->regs_write[i], NULL)) >= 0) {
+            fixed[fam] = 1;
+        }
+    }
+    switch (insn->id) {
+        case X86_INS_PUSHAL: case X86_INS_POPAL:
+            rename_fix_list(fixed, all_low, sizeof(all_low) / sizeof(all_low[0]));
+            break;
+        case X86_INS_CPUID:
+            rename_fix_list(fixed, eax_to_ebx, 4);
+            break;
+        case X86_INS_RDTSC:
+            rename_fix_list(fixed, eax_edx, 2);
+            break;
+        case X86_INS_XLATB:
+            rename_fix_list(fixed, eax_ebx, 2);
+            break;
+        case X86_INS_ENTER: case X86_INS_LEAVE:
+            rename_fix_list(fixed, ebp, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+int register_renaming_apply(struct instruction_node *head, byval_arch_t arch) {
+    static const int syscall_x86[] = {0, 1, 2, 3, 5, 6, 7};
+    static const int abi_x64[] = {0, 1, 2, 6, 7, 8, 9, 10, 11};
+    const char **names = (arch == BYVAL_ARCH_X64) ? rename_names64 : rename_names32;
+    int fixed[16] = {0};
+    int used[16] = {0};
+    int perm[16];
+    int free_fams[16];
+    int free_count = 0;
+    int has_syscall = 0;
+    struct instruction_node *last = NULL;
+    rename_insn_t *list;
+    int count = 0;
+    int capacity = 0;
+    long best;
+    long before;
+    int dirty_before = 0, dirty_after = 0;
+    int changed = 0;
+
+    if (arch != BYVAL_ARCH_X86 && arch != BYVAL_ARCH_X64) {
+        return 0;
+    }
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        capacity++;
+    }
+    list = calloc((size_t)(capacity ? capacity : 1), sizeof(rename_insn_t));
+    if (!list) {
+        return 0;
+    }
+
+    // 1. Classify every instruction and collect the pinned registers
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        cs_insn *insn = n->insn;
+        cs_x86 *x86 = &insn->detail->x86;
+        int exit = 0;
+
+        last = n;
+        rename_mark(insn, used);
+        switch (insn->id) {
+            case X86_INS_RET: case X86_INS_RETF: case X86_INS_IRET:
+            case X86_INS_LJMP: case X86_INS_LCALL:
+                exit = 1;
+                break;
+            case X86_INS_SYSCALL: case X86_INS_SYSENTER: case X86_INS_INT:
+                has_syscall = 1;
+                break;
+            case X86_INS_CALL: case X86_INS_JMP:
+                // Indirect (may leave the payload) or to an external target
+                exit = (x86->op_count > 0 && x86->operands[0].type != X86_OP_IMM) ||
+                       (n->branch_form != LAYOUT_FORM_NONE && !n->target);
+                break;
+            default:
+                break;
+        }
+        if (exit) {
+            rename_fix_live_out(n, arch, fixed);
+        }
+
+        // Register-indirect transfers keep their register: it is the handoff
+        if (n->branch_form == LAYOUT_FORM_NONE && !n->code_fixed && !layout_is_opaque_transfer(insn) &&
+            rename_parse(insn, arch, &list[count])) {
+            list[count++].node = n;
+            rename_fix_implicit(insn, fixed);
+        } else {
+            rename_mark(insn, fixed);
+        }
+    }
+
+    // Falling off the end is an exit too
+    if (last && last->insn->id != X86_INS_JMP && last->insn->id != X86_INS_RET &&
+        last->insn->id != X86_INS_RETF && last->insn->id != X86_INS_IRET &&
+        last->insn->id != X86_INS_HLT) {
+        rename_fix_live_out(NULL, arch, fixed);
+    }
+
+    fixed[4] = 1;
+    if (has_syscall) {
+        if (arch == BYVAL_ARCH_X64) {
+            rename_fix_list(fixed, abi_x64, sizeof(abi_x64) / sizeof(abi_x64[0]));
+        } else {
+            rename_fix_list(fixed, syscall_x86, sizeof(syscall_x86) / sizeof(syscall_x86[0]));
+        }
+    }
+    for (int fam = 0; fam < 16; fam++) {
+        perm[fam] = fam;
+        if (arch != BYVAL_ARCH_X64 && fam >= 8) {
+            continue;
+        }
+        if (used[fam] && !fixed[fam] && !layout_reg_dead_at(head, fam, 2)) {
+            fixed[fam] = 1;     // Possibly live at entry
+        }
+        if (!fixed[fam]) {
+            free_fams[free_count++] = fam;
+        }
+    }
+
+    if (count == 0 || free_count < 2) {
+        free(list);
+        return 0;
+    }
+
+    // 2. Hill-climb over swaps within the same REX half
+    best = rename_cost(list, count, perm);
+    before = best;
+    for (int round = 0; round < RENAME_MAX_ROUNDS && best > 0; round++) {
+        int improved = 0;
+        for (int i = 0; i < free_count; i++) {
+            for (int j = i + 1; j < free_count; j++) {
+                int a = free_fams[i], b = free_fams[j];
+                int tmp;
+                long cost;
+                if ((a & 8) != (b & 8)) {
+                    continue;
+                }
+                tmp = perm[a]; perm[a] = perm[b]; perm[b] = tmp;
+                cost = rename_cost(list, count, perm);
+                if (cost >= 0 && cost < best) {
+                    best = cost;
+                    improved = 1;
+                } else {
+                    tmp = perm[a]; perm[a] = perm[b]; perm[b] = tmp;
+                }
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    if (best >= before) {
+        free(list);
+        return 0;
+    }
+
+    // 3. Apply
+    for (int i = 0; i < count; i++) {
+        cs_insn *insn = list[i].node->insn;
+        cs_x86 *x86 = &insn->detail->x86;
+        uint8_t enc[16];
+
+        dirty_before += !is_bad_byte_free_buffer(insn->bytes, insn->size);
+        rename_encode(&list[i], perm, enc);
+        dirty_after += !is_bad_byte_free_buffer(enc, insn->size);
+        if (memcmp(enc, insn->bytes, insn->size) == 0) {
+            continue;
+        }
+        memcpy(insn->bytes, enc, insn->size);
+        for (int o = 0; o < x86->op_count; o++) {
+            cs_x86_op *op = &x86->operands[o];
+            int fam;
+            if (op->type == X86_OP_REG && (fam = layout_gpr_family(op->reg, NULL)) >= 0) {
+                op->reg = (x86_reg)layout_gpr_alias(op->reg, perm[fam]);
+            } else if (op->type == X86_OP_MEM) {
+                if ((fam = layout_gpr_family(op->mem.base, NULL)) >= 0) {
+                    op->mem.base = (x86_reg)layout_gpr_alias(op->mem.base, perm[fam]);
+                }
+                if ((fam = layout_gpr_family(op->mem.index, NULL)) >= 0) {
+                    op->mem.index = (x86_reg)layout_gpr_alias(op->mem.index, perm[fam]);
+                }
+            }
+        }
+        changed++;
+    }
+
+    log_diagnostic("[RENAME]");
+    for (int fam = 0; fam < 16; fam++) {
+        if (perm[fam] != fam) {
+            log_diagnostic(" %s->%s", names[fam], names[perm[fam]]);
+        }
+    }
+    log_diagnostic(": %d -> %d instructions with bad bytes (%d re-encoded)\n",
+                   dirty_before, dirty_after, changed);
+
+    free(list);
+    return changed;
+}
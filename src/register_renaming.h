@@ -0,0 +1,55 @@
+#ifndef REGISTER_RENAMING_H
+#define REGISTER_RENAMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+
+/**
+ * @file register_renaming.h
+ * @brief Whole-payload register renaming (--rename-registers)
+ *
+ * ModR/M, SIB and opcode+r bytes are functions of register numbers, so the
+ * same program written with other registers can avoid bad bytes such as
+ * 0x0a/0x0d (http-newline) or 0x20 (http-whitespace) altogether. This pass
+ * searches for one permutation of the general-purpose registers, applied
+ * consistently to the whole payload, that minimizes the number of
+ * instructions still containing bad bytes, then re-encodes them in place
+ * (sizes never change). Instructions it improves no longer need the
+ * per-instruction XCHG / PUSH-POP wrappers of modrm_sib_badbyte_strategies.c
+ * and reg_to_reg_badbyte_strategies.c.
+ *
+ * A register keeps its number when:
+ *   - it is the stack pointer;
+ *   - it may be live at entry (read before being written);
+ *   - an instruction uses it implicitly or in an encoding the pass does not
+ *     re-encode (short accumulator forms, 8-bit operands, CL shift counts,
+ *     string operations, MUL/DIV, PUSHAD, RIP-relative and branch nodes...);
+ *   - it belongs to the system-call ABI (payload contains SYSCALL/INT/SYSENTER);
+ *   - it may be live at an exit - a RET, an indirect or external JMP/CALL,
+ *     a far transfer, or the end of the payload - where the code outside can
+ *     read it (return values, handles passed to a next stage). Only registers
+ *     in the --clobber set are dead there;
+ *   - it is the target register of an indirect JMP/CALL.
+ * On x64 registers only trade places within R0-R7 or within R8-R15, so REX
+ * prefixes stay unchanged.
+ *
+ * Only instruction bytes and operand register ids are rewritten; insn->op_str
+ * keeps the original text (it is only used for diagnostics).
+ */
+
+#define RENAME_MAX_ROUNDS 64   // Hill-climbing rounds over register swaps
+
+/**
+ * Find and apply a register permutation that minimizes bad-byte encodings
+ *
+ * Must run after branch nodes are classified and before any other rewrite.
+ *
+ * @param head: First instruction node
+ * @param arch: BYVAL_ARCH_X86 or BYVAL_ARCH_X64
+ * @return: Number of instructions re-encoded (0 if identity is best)
+ */
+int register_renaming_apply(struct instruction_node *head, byval_arch_t arch);
+
+#endif // REGISTER_RENAMING_H
@@ -7,15 +7,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
 #include <capstone/capstone.h>
 #include "utils.h"
 #include "core.h"
 #include "strategy.h"
 #include "obfuscation_strategy_registry.h"
-
-static int shuffle_counter = 0;
-static int shuffle_initialized = 0;
+#include "thread_rng.h"
 
 // ============================================================================
 // Helper: Generate XCHG instruction
@@ -42,12 +39,6 @@ static void generate_xchg_regs(struct buffer *b, uint8_t reg1_idx, uint8_t reg2_
 // ============================================================================
 
 int can_handle_register_shuffle(cs_insn *insn) {
-    // Initialize once
-    if (!shuffle_initialized) {
-        srand((unsigned int)time(NULL) ^ 0x5678);
-        shuffle_initialized = 1;
-    }
-
     // Skip control flow instructions
     if (insn->id == X86_INS_JMP || insn->id == X86_INS_CALL ||
         insn->id == X86_INS_RET || insn->id == X86_INS_RETF) {
@@ -65,8 +56,7 @@ int can_handle_register_shuffle(cs_insn *insn) {
     }
 
     // Apply to approximately 12% of instructions
-    shuffle_counter++;
-    return (shuffle_counter % 8 == 0);
+    return thread_rng_below(8) == 0;
 }
 
 size_t get_register_shuffle_size(cs_insn *insn) {
@@ -85,7 +75,7 @@ void generate_register_shuffle(struct buffer *b, cs_insn *insn) {
     uint8_t reg2_idx = 7;  // EDI
 
     // Randomly pick register pair
-    int pair = rand() % 3;
+    int pair = (int)thread_rng_below(3);
     switch (pair) {
         case 0:
             reg1_idx = 1;  // ECX
@@ -19,6 +19,11 @@
  *     add ecx, 0x44DD                    (83 C1 DD - 3 bytes if null-free, or construct value)  
  *     mov rax, [rcx]                     (48 8B 00 - 2 bytes)
  *   Total: ~11-15 bytes depending on how offset is constructed
+ *
+ * NOTE: In the main rewrite pass (remove_null_bytes) RIP-relative references
+ * whose only bad bytes are in the displacement are relocated by the layout
+ * solver against one shared GetPC base (getpc_base.c) instead of a CALL/POP
+ * per instruction; this strategy only sees the remaining cases.
  */
 
 #include "strategy.h"
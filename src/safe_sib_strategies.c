@@ -552,7 +552,7 @@ static void generate_safe_sib_null(struct buffer *b, cs_insn *insn) {
             // we'll need to backtrack and use a different approach
 
             // For now, this is just a safety check that helps us identify potential issues
-            fprintf(stderr, "[SAFE_SIB] Warning: Null byte introduced at offset %zu in output for instruction %s %s\n",
+            log_diagnostic("[SAFE_SIB] Warning: Null byte introduced at offset %zu in output for instruction %s %s\n",
                    i - initial_size,
                    insn->mnemonic,
                    insn->op_str);
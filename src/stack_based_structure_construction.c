@@ -317,7 +317,7 @@ void generate_stack_structure_construction_null_free(struct buffer *b, cs_insn *
     // Verify that no null bytes were introduced by this strategy
     for (size_t i = initial_size; i < b->size; i++) {
         if (b->data[i] == 0x00) {
-            fprintf(stderr, "ERROR: Stack structure strategy introduced null at offset %zu (relative offset %zu) in instruction: %s %s\n",
+            log_diagnostic("ERROR: Stack structure strategy introduced null at offset %zu (relative offset %zu) in instruction: %s %s\n",
                    i, i - initial_size, insn->mnemonic, insn->op_str);
         }
     }
@@ -25,6 +25,8 @@ typedef struct {
 void register_strategy(strategy_t *strategy);
 strategy_t** get_strategies_for_instruction(cs_insn *insn, int *count, byval_arch_t arch);
 void init_strategies(int use_ml, byval_arch_t arch);
+void init_strategies_once(byval_arch_t arch);   // Thread-safe, no ML (library contexts)
+int get_strategy_count(byval_arch_t arch);
 
 // Strategy registration functions for different instruction types
 void register_mov_strategies();
@@ -56,4 +58,9 @@ int provide_ml_feedback(cs_insn* original_insn,
 void cleanup_ml_strategist(void);
 int save_ml_model(const char* path);
 
+// Forget per-thread strategy state carried from one instruction to the next:
+// register tracking, the SIB cache and the scratch mask (used at chunk
+// boundaries of parallel generation and at the start of every variant)
+void reset_strategy_thread_state(void);
+
 #endif
\ No newline at end of file
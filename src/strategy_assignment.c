@@ -0,0 +1,260 @@
+/*
+ * Global Strategy Assignment
+ *
+ * PROBLEM: Strategy choice is greedy per instruction - the highest-priority
+ * applicable strategy always wins, whatever it costs in bytes. Exploit
+ * buffers have hard size limits, so fitting a payload meant trying flag
+ * combinations by hand.
+ *
+ * SOLUTION: Expansions are independent of each other except through branch
+ * displacements, which the layout solver resolves afterwards. So every
+ * applicable strategy is generated into a scratch buffer, and one expansion
+ * per instruction is chosen for the whole payload:
+ *   - minimum size is a per-instruction minimum;
+ *   - a size budget is a multiple-choice knapsack: dp[e] is the best summed
+ *     priority using at most `e` bytes above the per-instruction minimums.
+ * The caller measures the real layout overhead (branches, padding, pool) and
+ * calls assignment_fit() again with a tightened budget until the output fits.
+ */
+
+#include "strategy_assignment.h"
+#include "branch_layout.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t assignment_min_index(const assignment_slot_t *slot) {
+    size_t best = 0;
+    for (int c = 1; c < slot->count; c++) {
+        if (slot->code[c].size < slot->code[best].size ||
+            (slot->code[c].size == slot->code[best].size && slot->value[c] > slot->value[best])) {
+            best = (size_t)c;
+        }
+    }
+    return best;
+}
+
+static int assignment_has_size(const assignment_slot_t *slot, size_t size, int value) {
+    for (int c = 0; c < slot->count; c++) {
+        if (slot->code[c].size == size && slot->value[c] >= value) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int assignment_collect(assignment_plan_t *plan, struct instruction_node *head, byval_arch_t arch) {
+    int capacity = 0;
+
+    memset(plan, 0, sizeof(*plan));
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        if (n->branch_form == LAYOUT_FORM_NONE && n->code.size > 0 && !n->code_fixed &&
+            !is_bad_byte_free_buffer(n->insn->bytes, n->insn->size)) {
+            capacity++;
+        }
+    }
+    if (capacity == 0) {
+        return 0;
+    }
+    plan->slots = calloc((size_t)capacity, sizeof(assignment_slot_t));
+    if (!plan->slots) {
+        return -1;
+    }
+
+    for (struct instruction_node *n = head; n != NULL; n = n->next) {
+        strategy_t *applicable[ASSIGNMENT_MAX_CANDIDATES];
+        strategy_t **found;
+        int found_count = 0;
+        assignment_slot_t *slot;
+
+        if (n->branch_form != LAYOUT_FORM_NONE || n->code.size == 0 || n->code_fixed ||
+            is_bad_byte_free_buffer(n->insn->bytes, n->insn->size)) {
+            continue;
+        }
+
+        // The registry hands out a static array; strategies may query it again
+        found = get_strategies_for_instruction(n->insn, &found_count, arch);
+        if (found_count > ASSIGNMENT_MAX_CANDIDATES) {
+            found_count = ASSIGNMENT_MAX_CANDIDATES;
+        }
+        memcpy(applicable, found, (size_t)found_count * sizeof(strategy_t *));
+
+        slot = &plan->slots[plan->count];
+        slot->node = n;
+
+        // Candidate 0: what the first pass emitted. It carries the top
+        // strategy's priority only if that strategy's output is clean; when
+        // the first pass rolled it back, candidate 0 is the fallback (value 0)
+        buffer_init(&slot->code[0]);
+        buffer_append(&slot->code[0], n->code.data, n->code.size);
+        slot->value[0] = 0;
+        slot->count = 1;
+
+        set_scratch_registers(layout_scratch_after(n, arch));
+        for (int i = 0; i < found_count && slot->count < ASSIGNMENT_MAX_CANDIDATES; i++) {
+            struct buffer *cand = &slot->code[slot->count];
+            buffer_init(cand);
+            applicable[i]->generate(cand, n->insn);
+            if (cand->size == 0 || !is_bad_byte_free_buffer(cand->data, cand->size)) {
+                buffer_free(cand);
+                continue;
+            }
+            if (i == 0) {
+                slot->value[0] = applicable[0]->priority;
+                buffer_free(cand);
+                continue;
+            }
+            if (assignment_has_size(slot, cand->size, applicable[i]->priority)) {
+                buffer_free(cand);
+                continue;
+            }
+            slot->value[slot->count++] = applicable[i]->priority;
+        }
+
+        if (slot->count > 1) {
+            plan->greedy_bytes += slot->code[0].size;
+            plan->count++;
+        } else {
+            buffer_free(&slot->code[0]);
+            memset(slot, 0, sizeof(*slot));
+        }
+    }
+    set_scratch_registers(0);
+    return 0;
+}
+
+void assignment_minimize(assignment_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        plan->slots[i].chosen = (int)assignment_min_index(&plan->slots[i]);
+    }
+}
+
+size_t assignment_chosen_bytes(const assignment_plan_t *plan) {
+    size_t total = 0;
+    for (int i = 0; i < plan->count; i++) {
+        total += plan->slots[i].code[plan->slots[i].chosen].size;
+    }
+    return total;
+}
+
+// Huge budgets: upgrade slots in order to their best affordable candidate
+static void assignment_first_fit(assignment_plan_t *plan, size_t extra) {
+    for (int i = 0; i < plan->count; i++) {
+        assignment_slot_t *slot = &plan->slots[i];
+        size_t min_size = slot->code[slot->chosen].size;
+        int best = slot->chosen;
+
+        for (int c = 0; c < slot->count; c++) {
+            if (slot->code[c].size - min_size <= extra && slot->value[c] > slot->value[best]) {
+                best = c;
+            }
+        }
+        extra -= slot->code[best].size - min_size;
+        slot->chosen = best;
+    }
+}
+
+int assignment_fit(assignment_plan_t *plan, size_t budget) {
+    size_t min_total = 0;
+    size_t max_extra = 0;
+    size_t extra;
+    long *dp;
+    long *next;
+    uint8_t *choice;
+
+    assignment_minimize(plan);
+    for (int i = 0; i < plan->count; i++) {
+        assignment_slot_t *slot = &plan->slots[i];
+        size_t min_size = slot->code[slot->chosen].size;
+        size_t widest = 0;
+        for (int c = 0; c < slot->count; c++) {
+            if (slot->code[c].size - min_size > widest) {
+                widest = slot->code[c].size - min_size;
+            }
+        }
+        min_total += min_size;
+        max_extra += widest;
+    }
+    if (budget < min_total) {
+        return -1;
+    }
+    extra = budget - min_total;
+    if (extra > max_extra) {
+        extra = max_extra;
+    }
+    if (plan->count == 0) {
+        return 0;
+    }
+
+    if ((size_t)plan->count * (extra + 1) > ASSIGNMENT_DP_CELL_LIMIT) {
+        assignment_first_fit(plan, extra);
+        return 0;
+    }
+
+    dp = calloc(extra + 1, sizeof(long));
+    next = calloc(extra + 1, sizeof(long));
+    choice = malloc((size_t)plan->count * (extra + 1));
+    if (!dp || !next || !choice) {
+        free(dp);
+        free(next);
+        free(choice);
+        assignment_first_fit(plan, extra);
+        return 0;
+    }
+
+    // dp[e]: best summed priority of the slots so far using at most e extra bytes
+    for (int i = 0; i < plan->count; i++) {
+        assignment_slot_t *slot = &plan->slots[i];
+        size_t min_size = slot->code[slot->chosen].size;
+        uint8_t *row = choice + (size_t)i * (extra + 1);
+
+        for (size_t e = 0; e <= extra; e++) {
+            long best = 0;
+            int best_c = -1;
+            for (int c = 0; c < slot->count; c++) {
+                size_t cost = slot->code[c].size - min_size;
+                if (cost <= e && (best_c < 0 || dp[e - cost] + slot->value[c] > best)) {
+                    best = dp[e - cost] + slot->value[c];
+                    best_c = c;
+                }
+            }
+            next[e] = best;
+            row[e] = (uint8_t)best_c;
+        }
+        memcpy(dp, next, (extra + 1) * sizeof(long));
+    }
+
+    // Walk back from the full budget
+    for (int i = plan->count - 1; i >= 0; i--) {
+        assignment_slot_t *slot = &plan->slots[i];
+        size_t min_size = plan->slots[i].code[assignment_min_index(slot)].size;
+        int c = choice[(size_t)i * (extra + 1) + extra];
+        slot->chosen = c;
+        extra -= slot->code[c].size - min_size;
+    }
+
+    free(dp);
+    free(next);
+    free(choice);
+    return 0;
+}
+
+void assignment_apply(assignment_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        assignment_slot_t *slot = &plan->slots[i];
+        struct buffer *src = &slot->code[slot->chosen];
+        slot->node->code.size = 0;
+        buffer_append(&slot->node->code, src->data, src->size);
+    }
+}
+
+void assignment_free(assignment_plan_t *plan) {
+    for (int i = 0; i < plan->count; i++) {
+        for (int c = 0; c < plan->slots[i].count; c++) {
+            buffer_free(&plan->slots[i].code[c]);
+        }
+    }
+    free(plan->slots);
+    memset(plan, 0, sizeof(*plan));
+}
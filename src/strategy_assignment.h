@@ -0,0 +1,89 @@
+#ifndef STRATEGY_ASSIGNMENT_H
+#define STRATEGY_ASSIGNMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <capstone/capstone.h>
+#include "core.h"
+#include "strategy.h"
+
+/**
+ * @file strategy_assignment.h
+ * @brief Global strategy assignment (--optimize-size, --max-output-size)
+ *
+ * The first rewrite pass picks the highest-priority applicable strategy for
+ * each instruction on its own. This module generates every applicable
+ * strategy's expansion into scratch buffers and then chooses one expansion
+ * per instruction for the whole payload at once:
+ *   - minimum size: the smallest clean expansion everywhere;
+ *   - size budget: a knapsack DP that keeps the total within the budget while
+ *     maximizing the summed strategy priority (i.e. staying as close to the
+ *     greedy choice as the budget allows).
+ * Branch sizes depend on the result through offsets; the caller re-runs the
+ * layout solver and tightens the budget by the measured overhead until the
+ * output fits.
+ */
+
+#define ASSIGNMENT_MAX_CANDIDATES 16          // Expansions kept per instruction
+#define ASSIGNMENT_MAX_ROUNDS     8           // Budget/layout iterations
+#define ASSIGNMENT_DP_CELL_LIMIT  (32u << 20) // DP choice table entries before the first-fit fallback
+
+// Candidate expansions of one instruction
+typedef struct {
+    struct instruction_node *node;
+    int count;
+    int chosen;
+    struct buffer code[ASSIGNMENT_MAX_CANDIDATES];
+    int value[ASSIGNMENT_MAX_CANDIDATES];           // Strategy priority
+} assignment_slot_t;
+
+typedef struct {
+    assignment_slot_t *slots;       // Instructions with more than one clean expansion
+    int count;
+    size_t greedy_bytes;            // Slot bytes as chosen by the first pass
+} assignment_plan_t;
+
+/**
+ * Enumerate the expansions of every rewritten instruction
+ *
+ * Must run after the first pass: node->code holds the greedy expansion,
+ * which becomes candidate 0 of its slot.
+ *
+ * @param plan: Plan to fill (released with assignment_free)
+ * @param head: First instruction node
+ * @param arch: Target architecture
+ * @return: 0 on success, -1 on allocation failure
+ */
+int assignment_collect(assignment_plan_t *plan, struct instruction_node *head, byval_arch_t arch);
+
+/**
+ * Choose the smallest clean expansion of every slot (ties keep the higher priority)
+ */
+void assignment_minimize(assignment_plan_t *plan);
+
+/**
+ * Choose expansions whose total size stays within `budget`, maximizing the
+ * summed strategy priority
+ * @param plan: Collected plan
+ * @param budget: Bytes allowed for all slots together
+ * @return: 0 if the budget is met, -1 if even the smallest expansions exceed
+ *          it (those are chosen then)
+ */
+int assignment_fit(assignment_plan_t *plan, size_t budget);
+
+/**
+ * Total size of the currently chosen expansions
+ */
+size_t assignment_chosen_bytes(const assignment_plan_t *plan);
+
+/**
+ * Copy the chosen expansions into their nodes' code buffers
+ */
+void assignment_apply(assignment_plan_t *plan);
+
+/**
+ * Release all candidate buffers
+ */
+void assignment_free(assignment_plan_t *plan);
+
+#endif // STRATEGY_ASSIGNMENT_H
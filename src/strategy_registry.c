@@ -10,6 +10,7 @@
 #include "remaining_null_elimination_strategies.h"
 #include "ml_strategist.h"
 #include "ml_strategy_registry.h"
+#include "profile_aware_sib.h"  // For invalidate_sib_cache
 #include "call_pop_immediate_strategies.h"
 #include "peb_api_hashing_strategies.h"
 #include "shift_value_construction_strategies.h"
@@ -74,6 +75,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h> // Added for debug prints
+#include <pthread.h>
 // #include <stdio.h> // Removed for printf
 
 #define MAX_STRATEGIES 400
@@ -132,14 +134,22 @@ static ml_strategist_t g_ml_strategist;
 static int g_ml_initialized = 0;
 static int g_ml_in_progress = 0; // Recursion guard
 
-static strategy_t* strategies[MAX_STRATEGIES];
-static int strategy_count = 0;
+// One table per architecture, so library contexts of different architectures
+// rewrite side by side. A table is filled once under registry_lock and only
+// read afterwards; register_strategy() appends to the one being filled.
+static strategy_t* strategies[BYVAL_ARCH_COUNT][MAX_STRATEGIES];
+static int strategy_count[BYVAL_ARCH_COUNT];
+static int strategies_ready[BYVAL_ARCH_COUNT];
+static byval_arch_t registering_arch = BYVAL_ARCH_X86;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void register_strategy(strategy_t *strategy) {
-    if (strategy_count < MAX_STRATEGIES) {
-        strategies[strategy_count++] = strategy;
+    int *count = &strategy_count[registering_arch];
+
+    if (*count < MAX_STRATEGIES) {
+        strategies[registering_arch][(*count)++] = strategy;
     } else {
-        fprintf(stderr, "[ERROR] Strategy registry full! Maximum of %d strategies supported.\n", MAX_STRATEGIES);
+        log_diagnostic("[ERROR] Strategy registry full! Maximum of %d strategies supported.\n", MAX_STRATEGIES);
     }
 }
 
@@ -310,34 +320,21 @@ void register_segment_register_load_pointer_construction_strategies(); // Forwar
 void register_vex_prefix_encoding_remap_for_avx_instructions_strategies(); // Forward declaration - vex_prefix_encoding_remap_for_avx_instructions
 void register_vex_escape_badbyte_evasion_strategies(); // Forward declaration - vex_escape_badbyte_evasion
 void register_vex_avx512_immediate_construction_strategies(); // Forward declaration - vex_avx512_immediate_construction
-void init_strategies(int use_ml, byval_arch_t arch) {
-    #ifdef DEBUG
-    fprintf(stderr, "[DEBUG] Initializing strategies\n");
-    #endif
 
-    strategy_count = 0;
+// Fill the table of `arch` (caller holds registry_lock)
+static void register_arch_strategies(byval_arch_t arch) {
+    static int advanced_transformations_ready = 0;
 
-    // Initialize ML strategist if ML is enabled
-    if (use_ml && !g_ml_initialized) {
-        int ml_init_result = ml_strategist_init(&g_ml_strategist, "./ml_models/byvalver_ml_model.bin");
-        if (ml_init_result != 0) {
-            // If model file doesn't exist, initialize without loading a specific model
-            ml_strategist_init(&g_ml_strategist, ""); // Empty path initializes with default weights
-        }
-        g_ml_initialized = 1;
-        #ifdef DEBUG
-        fprintf(stderr, "[DEBUG] ML Strategist initialized\n");
-        #endif
-    } else if (!use_ml) {
-        #ifdef DEBUG
-        fprintf(stderr, "[DEBUG] ML Strategist disabled by configuration\n");
-        #endif
-    }
+    registering_arch = arch;
+    strategy_count[arch] = 0;
 
     // Register strategies based on target architecture
     if (arch == BYVAL_ARCH_X86 || arch == BYVAL_ARCH_X64) {
         register_advanced_transformations();  // Register advanced transformations (highest priority)
-    init_advanced_transformations();      // Initialize the can_handle functions
+    if (!advanced_transformations_ready) {
+        init_advanced_transformations();  // Initialize the can_handle functions
+        advanced_transformations_ready = 1;
+    }
     register_indirect_call_strategies();  // Register indirect CALL/JMP strategies (priority 100)
     register_sldt_replacement_strategy();  // Register SLDT replacement strategy (priority 95)
 
@@ -520,42 +517,88 @@ void init_strategies(int use_ml, byval_arch_t arch) {
         register_arm_strategies();
     }
 
+    else if (arch == BYVAL_ARCH_THUMB) {
+        #include "thumb_strategies.h"
+        register_thumb_strategies();
+    }
+
     else if (arch == BYVAL_ARCH_ARM64) {
         #include "arm64_strategies.h"
         register_arm64_strategies();
     }
 
     #ifdef DEBUG
-    fprintf(stderr, "[DEBUG] Registered %d strategies\n", strategy_count);
+    log_diagnostic("[DEBUG] Registered %d strategies\n", strategy_count[arch]);
+    #endif
+    strategies_ready[arch] = 1;
+}
+
+void init_strategies(int use_ml, byval_arch_t arch) {
+    #ifdef DEBUG
+    log_diagnostic("[DEBUG] Initializing strategies\n");
     #endif
-    // printf("init_strategies: Registered %d strategies.\n", strategy_count); // Removed debug print
+
+    // Initialize ML strategist if ML is enabled
+    if (use_ml && !g_ml_initialized) {
+        int ml_init_result = ml_strategist_init(&g_ml_strategist, "./ml_models/byvalver_ml_model.bin");
+        if (ml_init_result != 0) {
+            // If model file doesn't exist, initialize without loading a specific model
+            ml_strategist_init(&g_ml_strategist, ""); // Empty path initializes with default weights
+        }
+        g_ml_initialized = 1;
+        #ifdef DEBUG
+        log_diagnostic("[DEBUG] ML Strategist initialized\n");
+        #endif
+    } else if (!use_ml) {
+        #ifdef DEBUG
+        log_diagnostic("[DEBUG] ML Strategist disabled by configuration\n");
+        #endif
+    }
+
+    pthread_mutex_lock(&registry_lock);
+    register_arch_strategies(arch);
+    pthread_mutex_unlock(&registry_lock);
 
     // Initialize ML strategy registry if ML is enabled
     if (use_ml && g_ml_initialized) {
-        if (ml_strategy_registry_init(strategies, strategy_count) == 0) {
-            printf("[ML] Strategy registry initialized with %d strategies\n", strategy_count);
+        if (ml_strategy_registry_init(strategies[arch], strategy_count[arch]) == 0) {
+            printf("[ML] Strategy registry initialized with %d strategies\n", strategy_count[arch]);
         } else {
-            fprintf(stderr, "[ML] WARNING: Failed to initialize strategy registry\n");
+            log_diagnostic("[ML] WARNING: Failed to initialize strategy registry\n");
         }
     }
 }
 
+// Build the table of `arch` unless it exists; never enables ML (library contexts)
+void init_strategies_once(byval_arch_t arch) {
+    pthread_mutex_lock(&registry_lock);
+    if (!strategies_ready[arch]) {
+        register_arch_strategies(arch);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int get_strategy_count(byval_arch_t arch) {
+    return strategy_count[arch];
+}
+
 strategy_t** get_strategies_for_instruction(cs_insn *insn, int *count, byval_arch_t arch) {
     DEBUG_LOG("get_strategies_for_instruction called for instruction ID: 0x%x", insn->id);
     DEBUG_LOG("Instruction: %s %s", insn->mnemonic, insn->op_str);
 
-    static strategy_t* applicable_strategies[MAX_STRATEGIES];
+    static __thread strategy_t* applicable_strategies[MAX_STRATEGIES];  // Per thread (--variants)
+    strategy_t **table = strategies[arch];
     int applicable_count = 0;
 
-    for (int i = 0; i < strategy_count; i++) {
+    for (int i = 0; i < strategy_count[arch]; i++) {
         // Filter by target architecture (using compatibility check for x86/x64)
-        if (!is_strategy_arch_compatible(strategies[i], arch)) {
+        if (!is_strategy_arch_compatible(table[i], arch)) {
             continue;
         }
-        DEBUG_LOG("  Trying strategy: %s", strategies[i]->name);
-        if (strategies[i]->can_handle(insn)) {
-            applicable_strategies[applicable_count++] = strategies[i];
-            DEBUG_LOG("    Strategy %s can handle this instruction", strategies[i]->name);
+        DEBUG_LOG("  Trying strategy: %s", table[i]->name);
+        if (table[i]->can_handle(insn)) {
+            applicable_strategies[applicable_count++] = table[i];
+            DEBUG_LOG("    Strategy %s can handle this instruction", table[i]->name);
         }
     }
 
@@ -647,6 +690,14 @@ int provide_ml_feedback(cs_insn* original_insn,
     return result;
 }
 
+void reset_incremental_byte_register_tracking(void);
+
+void reset_strategy_thread_state(void) {
+    reset_incremental_byte_register_tracking();
+    invalidate_sib_cache();
+    set_scratch_registers(0);
+}
+
 /**
  * @brief Cleanup the ML strategist resources
  */
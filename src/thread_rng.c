@@ -0,0 +1,39 @@
+/*
+ * Per-thread SplitMix64 generator (see thread_rng.h)
+ */
+
+#include "thread_rng.h"
+#include <time.h>
+
+static __thread uint64_t rng_state;
+static __thread int rng_seeded = 0;
+
+#define RNG_GAMMA 0x9E3779B97F4A7C15ULL
+
+static uint64_t rng_finalize(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t thread_rng_mix(uint64_t value) {
+    return rng_finalize(value + RNG_GAMMA);
+}
+
+void thread_rng_seed(uint64_t seed) {
+    rng_state = seed;
+    rng_seeded = 1;
+}
+
+uint32_t thread_rng_next(void) {
+    if (!rng_seeded) {
+        // Unseeded thread: distinct per thread and per run
+        thread_rng_seed((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&rng_state);
+    }
+    rng_state += RNG_GAMMA;
+    return (uint32_t)(rng_finalize(rng_state) >> 32);
+}
+
+uint32_t thread_rng_below(uint32_t bound) {
+    return (uint32_t)(((uint64_t)thread_rng_next() * bound) >> 32);
+}
@@ -0,0 +1,36 @@
+#ifndef THREAD_RNG_H
+#define THREAD_RNG_H
+
+#include <stdint.h>
+
+/**
+ * @file thread_rng.h
+ * @brief Per-thread random source for obfuscation choices (--variants, --seed)
+ *
+ * Each thread owns its own generator state, so variants generated
+ * concurrently never share a sequence and every variant is reproducible from
+ * its seed. A thread that is never seeded seeds itself from the clock on
+ * first use, which keeps single runs as varied as before.
+ */
+
+/**
+ * Seed the calling thread's generator
+ */
+void thread_rng_seed(uint64_t seed);
+
+/**
+ * Next 32-bit value from the calling thread's generator
+ */
+uint32_t thread_rng_next(void);
+
+/**
+ * Uniform value in [0, bound) (bound > 0)
+ */
+uint32_t thread_rng_below(uint32_t bound);
+
+/**
+ * SplitMix64 step: derives independent seeds (one per variant) from a base seed
+ */
+uint64_t thread_rng_mix(uint64_t value);
+
+#endif // THREAD_RNG_H
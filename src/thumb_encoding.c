@@ -0,0 +1,575 @@
+/*
+ * Thumb-2 Encoding Helpers
+ */
+
+#include <string.h>
+#include "thumb_encoding.h"
+#include "arm_immediate_encoding.h"  // encode_arm_immediate_word() for the entry stub
+#include "utils.h"
+
+// Flag behaviour required of an instruction
+typedef enum {
+    T_FLAGS_KEEP = 0,      // Must not set flags
+    T_FLAGS_SET,           // Must set N and Z from its result
+    T_FLAGS_ANY            // Either (an early instruction of a flag-setting sequence)
+} t_flags_t;
+
+// One instruction; a 32-bit encoding holds its first halfword in bits 31:16
+typedef struct {
+    uint32_t enc;
+    uint8_t size;
+} t_insn_t;
+
+// Data-processing (modified immediate) opcodes
+#define T_DP_ORR  2        // MOV when Rn = PC
+#define T_DP_ORN  3        // MVN when Rn = PC
+#define T_DP_EOR  4
+#define T_DP_ADD  8
+#define T_DP_SUB  13
+
+// Plain binary immediate forms (first halfword, i = 0 and Rn = 0)
+#define T_ADDW    0xF200
+#define T_SUBW    0xF2A0
+#define T_MOVW    0xF240
+#define T_MOVT    0xF2C0
+
+#define T_REG_SP  13
+#define T_REG_PC  15
+#define T_MOD_MAX 5        // Encodings of one value: four replicated patterns and a rotation
+
+static t_insn_t t16(uint32_t hw) {
+    t_insn_t i = {hw & 0xFFFF, 2};
+    return i;
+}
+
+static t_insn_t t32(uint32_t hw1, uint32_t hw2) {
+    t_insn_t i = {(hw1 & 0xFFFF) << 16 | (hw2 & 0xFFFF), 4};
+    return i;
+}
+
+static int t_clean(t_insn_t i) {
+    if (i.size == 2) {
+        return is_bad_byte_free_byte((uint8_t)i.enc) && is_bad_byte_free_byte((uint8_t)(i.enc >> 8));
+    }
+    return is_bad_byte_free(i.enc);
+}
+
+static int t_ok(t_insn_t i, t_insn_t *out) {
+    if (!t_clean(i)) {
+        return 0;
+    }
+    *out = i;
+    return 1;
+}
+
+static int seq_append(thumb_seq_t *seq, t_insn_t i) {
+    if (seq->size + i.size > THUMB_SEQ_MAX_BYTES) {
+        return 0;
+    }
+    if (i.size == 4) {
+        seq->bytes[seq->size++] = (uint8_t)(i.enc >> 16);
+        seq->bytes[seq->size++] = (uint8_t)(i.enc >> 24);
+    }
+    seq->bytes[seq->size++] = (uint8_t)i.enc;
+    seq->bytes[seq->size++] = (uint8_t)(i.enc >> 8);
+    return 1;
+}
+
+// Keep `seq` if it is shorter than `best` (or `best` is empty)
+static void seq_keep(thumb_seq_t *best, const thumb_seq_t *seq) {
+    if (seq->size > 0 && (best->size == 0 || seq->size < best->size)) {
+        *best = *seq;
+    }
+}
+
+// ============================================================================
+// Immediates
+// ============================================================================
+
+int thumb_expand_immediate(uint16_t imm12, uint32_t *value_out) {
+    uint32_t imm8 = imm12 & 0xFF;
+
+    if ((imm12 & 0xC00) != 0) {
+        uint32_t unrot = 0x80 | (imm12 & 0x7F);
+        unsigned rot = (imm12 >> 7) & 0x1F;
+        *value_out = (unrot >> rot) | (unrot << (32 - rot));
+        return 1;
+    }
+    switch ((imm12 >> 8) & 3) {
+        case 0:
+            *value_out = imm8;
+            return 1;
+        case 1:
+            *value_out = imm8 << 16 | imm8;
+            break;
+        case 2:
+            *value_out = imm8 << 24 | imm8 << 8;
+            break;
+        default:
+            *value_out = imm8 * 0x01010101U;
+            break;
+    }
+    return imm8 != 0;
+}
+
+// Every imm12 that expands to `value`; returns their number
+static int t_mod_encodings(uint32_t value, uint16_t out[T_MOD_MAX]) {
+    uint32_t b0 = value & 0xFF;
+    uint32_t b1 = (value >> 8) & 0xFF;
+    int n = 0;
+
+    if (value <= 0xFF) {
+        out[n++] = (uint16_t)value;
+    }
+    if (b0 && value == (b0 << 16 | b0)) {
+        out[n++] = (uint16_t)(0x100 | b0);
+    }
+    if (b1 && value == (b1 << 24 | b1 << 8)) {
+        out[n++] = (uint16_t)(0x200 | b1);
+    }
+    if (b0 && value == b0 * 0x01010101U) {
+        out[n++] = (uint16_t)(0x300 | b0);
+    }
+    // 1bcdefgh rotated right by 8..31: at most one rotation fits
+    for (unsigned rot = 8; rot < 32; rot++) {
+        uint32_t unrot = (value << rot) | (value >> (32 - rot));
+        if (unrot >= 0x80 && unrot <= 0xFF) {
+            out[n++] = (uint16_t)(rot << 7 | (unrot & 0x7F));
+            break;
+        }
+    }
+    return n;
+}
+
+static t_insn_t t_dp_mod(int op, int s, uint8_t rn, uint8_t rd, uint16_t imm12) {
+    return t32(0xF000U | (uint32_t)(imm12 >> 11 & 1) << 10 | (uint32_t)op << 5 | (uint32_t)s << 4 | rn,
+               (uint32_t)(imm12 >> 8 & 7) << 12 | (uint32_t)rd << 8 | (imm12 & 0xFF));
+}
+
+static t_insn_t t_plain(uint32_t base, uint8_t rn, uint8_t rd, uint16_t imm12) {
+    return t32(base | (uint32_t)(imm12 >> 11 & 1) << 10 | rn,
+               (uint32_t)(imm12 >> 8 & 7) << 12 | (uint32_t)rd << 8 | (imm12 & 0xFF));
+}
+
+// MOVW/MOVT Rd, #imm16 (imm4:i:imm3:imm8)
+static t_insn_t t_move_wide(uint32_t base, uint8_t rd, uint16_t imm16) {
+    return t_plain(base, (uint8_t)(imm16 >> 12), rd, (uint16_t)(imm16 & 0xFFF));
+}
+
+// Modified-immediate data-processing instruction with its first clean encoding
+static int t_dp_clean(int op, int s, uint8_t rn, uint8_t rd, uint32_t value, t_insn_t *out) {
+    uint16_t enc[T_MOD_MAX];
+    int n = t_mod_encodings(value, enc);
+
+    for (int i = 0; i < n; i++) {
+        if (t_ok(t_dp_mod(op, s, rn, rd, enc[i]), out)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// S bits allowed by a flag mode: KEEP 0, SET 1, ANY 0 then 1
+#define T_S_FIRST(mode) ((mode) == T_FLAGS_SET ? 1 : 0)
+#define T_S_LAST(mode)  ((mode) == T_FLAGS_KEEP ? 0 : 1)
+
+// The instructions before the last one of a sequence
+static t_flags_t t_head_flags(t_flags_t last) {
+    return (last == T_FLAGS_KEEP) ? T_FLAGS_KEEP : T_FLAGS_ANY;
+}
+
+// One clean instruction writing `value` to Rd, smallest first
+static int t_write(uint8_t rd, uint32_t value, t_flags_t mode, t_insn_t *out) {
+    if (mode != T_FLAGS_KEEP && rd < 8) {
+        if (value <= 0xFF && t_ok(t16(0x2000U | (uint32_t)rd << 8 | value), out)) {
+            return 1;   // MOVS Rd, #imm8
+        }
+        if (value == 0 && t_ok(t16(0x4040U | (uint32_t)rd << 3 | rd), out)) {
+            return 1;   // EORS Rd, Rd
+        }
+    }
+    for (int s = T_S_FIRST(mode); s <= T_S_LAST(mode); s++) {
+        if (t_dp_clean(T_DP_ORR, s, T_REG_PC, rd, value, out) ||
+            t_dp_clean(T_DP_ORN, s, T_REG_PC, rd, ~value, out)) {
+            return 1;   // MOV{S}.W / MVN{S}.W
+        }
+    }
+    return mode != T_FLAGS_SET && value <= 0xFFFF &&
+           t_ok(t_move_wide(T_MOVW, rd, (uint16_t)value), out);
+}
+
+// One clean instruction computing Rd = Rn + t (mod 2^32), smallest first
+static int t_add(uint8_t rd, uint8_t rn, uint32_t t, t_flags_t mode, t_insn_t *out) {
+    uint32_t neg = 0U - t;
+
+    if (mode != T_FLAGS_KEEP && rd < 8 && rn < 8) {
+        if (rd == rn && t <= 0xFF && t_ok(t16(0x3000U | (uint32_t)rd << 8 | t), out)) {
+            return 1;   // ADDS Rdn, #imm8
+        }
+        if (rd == rn && neg <= 0xFF && t_ok(t16(0x3800U | (uint32_t)rd << 8 | neg), out)) {
+            return 1;   // SUBS Rdn, #imm8
+        }
+        if (t <= 7 && t_ok(t16(0x1C00U | t << 6 | (uint32_t)rn << 3 | rd), out)) {
+            return 1;   // ADDS Rd, Rn, #imm3
+        }
+        if (neg <= 7 && t_ok(t16(0x1E00U | neg << 6 | (uint32_t)rn << 3 | rd), out)) {
+            return 1;   // SUBS Rd, Rn, #imm3
+        }
+    }
+    for (int s = T_S_FIRST(mode); s <= T_S_LAST(mode); s++) {
+        if (t_dp_clean(T_DP_ADD, s, rn, rd, t, out) || t_dp_clean(T_DP_SUB, s, rn, rd, neg, out)) {
+            return 1;   // ADD{S}.W / SUB{S}.W
+        }
+    }
+    if (mode == T_FLAGS_SET) {
+        return 0;
+    }
+    return (t <= 0xFFF && t_ok(t_plain(T_ADDW, rn, rd, (uint16_t)t), out)) ||
+           (neg <= 0xFFF && t_ok(t_plain(T_SUBW, rn, rd, (uint16_t)neg), out));
+}
+
+// ============================================================================
+// Sequence search
+// ============================================================================
+
+/*
+ * Two-part search: a head leaves `need` in Rd, then one correcting
+ * instruction Rd = Rd op k finishes the job. Every clean correction is
+ * tried and the shortest complete sequence wins.
+ */
+typedef struct t_search t_search_t;
+struct t_search {
+    uint8_t rd;
+    uint8_t rn;
+    t_flags_t mode;        // Flags of the correction (the last instruction)
+    int eor;               // EOR corrections (the head writes the exact prior value)
+    int high_only;         // Only corrections of the top halfword (MOVT)
+    int (*head)(const t_search_t *s, uint32_t need, thumb_seq_t *out);
+};
+
+static void t_try(const t_search_t *s, uint32_t need, t_insn_t fix, thumb_seq_t *best) {
+    thumb_seq_t seq;
+
+    if (best->size > 0 && best->size <= (size_t)fix.size + 2) {
+        return;   // No head is shorter than 2 bytes
+    }
+    if (!t_clean(fix)) {
+        return;
+    }
+    seq.size = 0;
+    if (s->head(s, need, &seq) && seq_append(&seq, fix)) {
+        seq_keep(best, &seq);
+    }
+}
+
+static int t_search_correction(const t_search_t *s, uint32_t target, thumb_seq_t *best) {
+    uint8_t rd = s->rd;
+
+    best->size = 0;
+    for (uint16_t imm12 = 0; imm12 < 0x1000; imm12++) {
+        uint32_t k;
+        if (!thumb_expand_immediate(imm12, &k) || (s->high_only && (k & 0xFFFF) != 0)) {
+            continue;
+        }
+        for (int sb = T_S_FIRST(s->mode); sb <= T_S_LAST(s->mode); sb++) {
+            t_try(s, target - k, t_dp_mod(T_DP_ADD, sb, rd, rd, imm12), best);
+            t_try(s, target + k, t_dp_mod(T_DP_SUB, sb, rd, rd, imm12), best);
+            if (s->eor) {
+                t_try(s, target ^ k, t_dp_mod(T_DP_EOR, sb, rd, rd, imm12), best);
+            }
+        }
+    }
+    if (s->high_only) {
+        return best->size != 0;
+    }
+    if (s->mode != T_FLAGS_SET) {
+        for (uint16_t k = 0; k < 0x1000; k++) {
+            t_try(s, target - k, t_plain(T_ADDW, rd, rd, k), best);
+            t_try(s, target + k, t_plain(T_SUBW, rd, rd, k), best);
+        }
+    }
+    if (s->mode != T_FLAGS_KEEP && rd < 8) {
+        for (uint32_t k = 0; k <= 0xFF; k++) {
+            t_try(s, target - k, t16(0x3000U | (uint32_t)rd << 8 | k), best);
+            t_try(s, target + k, t16(0x3800U | (uint32_t)rd << 8 | k), best);
+            if (k <= 7) {
+                t_try(s, target - k, t16(0x1C00U | k << 6 | (uint32_t)rd << 3 | rd), best);
+                t_try(s, target + k, t16(0x1E00U | k << 6 | (uint32_t)rd << 3 | rd), best);
+            }
+        }
+    }
+    return best->size != 0;
+}
+
+static int head_write(const t_search_t *s, uint32_t need, thumb_seq_t *out) {
+    t_insn_t i;
+    return t_write(s->rd, need, t_head_flags(s->mode), &i) && seq_append(out, i);
+}
+
+static int head_add(const t_search_t *s, uint32_t need, thumb_seq_t *out) {
+    t_insn_t i;
+    return t_add(s->rd, s->rn, need, t_head_flags(s->mode), &i) && seq_append(out, i);
+}
+
+static int head_movw_movt(const t_search_t *s, uint32_t need, thumb_seq_t *out) {
+    t_insn_t lo = t_move_wide(T_MOVW, s->rd, (uint16_t)need);
+    t_insn_t hi = t_move_wide(T_MOVT, s->rd, (uint16_t)(need >> 16));
+    return t_clean(lo) && t_clean(hi) && seq_append(out, lo) && seq_append(out, hi);
+}
+
+static int head_movt(const t_search_t *s, uint32_t need, thumb_seq_t *out) {
+    t_insn_t i;
+    return t_ok(t_move_wide(T_MOVT, s->rd, (uint16_t)(need >> 16)), &i) && seq_append(out, i);
+}
+
+/*
+ * Rd = value: one write; a write and a correction; the low halfword (one
+ * instruction or two) followed by MOVT; MOVW, MOVT and a correction.
+ */
+static int t_constant(uint8_t rd, uint32_t value, t_flags_t mode, thumb_seq_t *best) {
+    t_search_t s = {rd, rd, mode, 1, 0, head_write};
+    thumb_seq_t seq;
+    t_insn_t i;
+
+    best->size = 0;
+    if (t_write(rd, value, mode, &i)) {
+        return seq_append(best, i);
+    }
+    t_search_correction(&s, value, best);
+
+    if (mode != T_FLAGS_SET) {
+        t_insn_t movt = t_move_wide(T_MOVT, rd, (uint16_t)(value >> 16));
+        uint32_t lo = value & 0xFFFF;
+        uint32_t low_forms[3] = {lo, lo | 0xFFFF0000U, lo << 16 | lo};
+
+        if (t_clean(movt)) {
+            for (int f = 0; f < 3; f++) {
+                seq.size = 0;
+                if (t_write(rd, low_forms[f], T_FLAGS_KEEP, &i) && seq_append(&seq, i) &&
+                    seq_append(&seq, movt)) {
+                    seq_keep(best, &seq);
+                }
+            }
+            if (best->size == 0 && t_search_correction(&s, lo, &seq) && seq_append(&seq, movt)) {
+                seq_keep(best, &seq);
+            }
+        }
+    }
+    if (best->size == 0) {
+        s.head = head_movw_movt;
+        if (t_search_correction(&s, value, &seq)) {
+            seq_keep(best, &seq);
+        }
+    }
+    return best->size != 0;
+}
+
+/*
+ * Rd = Rn + t: one ADD/SUB; an ADD/SUB and a correction; or, when Rd is not
+ * Rn, the addend built in Rd followed by ADD Rd, Rn, Rd.
+ */
+static int t_addsub(uint8_t rd, uint8_t rn, uint32_t t, t_flags_t mode, thumb_seq_t *best) {
+    t_search_t s = {rd, rn, mode, 0, 0, head_add};
+    thumb_seq_t seq;
+    t_insn_t i;
+
+    best->size = 0;
+    if (t_add(rd, rn, t, mode, &i)) {
+        return seq_append(best, i);
+    }
+    if (t_search_correction(&s, t, best)) {
+        return 1;
+    }
+    if (rd != rn && t_constant(rd, t, t_head_flags(mode), &seq)) {
+        int found = mode != T_FLAGS_KEEP && rd < 8 && rn < 8 &&
+                    t_ok(t16(0x1800U | (uint32_t)rd << 6 | (uint32_t)rn << 3 | rd), &i);   // ADDS Rd, Rn, Rd
+        for (int sb = T_S_FIRST(mode); !found && sb <= T_S_LAST(mode); sb++) {
+            found = t_ok(t32(0xEB00U | (uint32_t)sb << 4 | rn, (uint32_t)rd << 8 | rd), &i);   // ADD{S}.W
+        }
+        if (found && seq_append(&seq, i)) {
+            *best = seq;
+        }
+    }
+    return best->size != 0;
+}
+
+int thumb_synthesize(const thumb_imm_insn_t *insn, thumb_seq_t *seq_out) {
+    t_flags_t mode = insn->setflags ? T_FLAGS_SET : T_FLAGS_KEEP;
+
+    seq_out->size = 0;
+    switch (insn->kind) {
+        case THUMB_IMM_MOV:
+            return t_constant(insn->rd, insn->value, mode, seq_out);
+        case THUMB_IMM_ADD:
+            return t_addsub(insn->rd, insn->rn, insn->value, mode, seq_out);
+        case THUMB_IMM_MOVT: {
+            // MOVT of a nearby halfword, then ADD/SUB/EOR of the difference
+            // (a modified immediate with a clear low halfword)
+            t_search_t s = {insn->rd, insn->rd, T_FLAGS_KEEP, 1, 1, head_movt};
+            return t_search_correction(&s, insn->value << 16, seq_out);
+        }
+        default:
+            return 0;
+    }
+}
+
+// ============================================================================
+// Decoding
+// ============================================================================
+
+static int decode_thumb16(uint16_t hw, thumb_imm_insn_t *out) {
+    out->setflags = 1;
+    if ((hw & 0xF800) == 0x2000) {              // MOVS Rd, #imm8
+        out->kind = THUMB_IMM_MOV;
+        out->rd = (uint8_t)(hw >> 8 & 7);
+        out->value = hw & 0xFF;
+    } else if ((hw & 0xF000) == 0x3000) {       // ADDS/SUBS Rdn, #imm8
+        out->kind = THUMB_IMM_ADD;
+        out->rd = out->rn = (uint8_t)(hw >> 8 & 7);
+        out->value = (hw & 0x0800) ? 0U - (hw & 0xFFU) : (hw & 0xFFU);
+    } else if ((hw & 0xFC00) == 0x1C00) {       // ADDS/SUBS Rd, Rn, #imm3
+        out->kind = THUMB_IMM_ADD;
+        out->rd = (uint8_t)(hw & 7);
+        out->rn = (uint8_t)(hw >> 3 & 7);
+        out->value = (hw & 0x0200) ? 0U - (hw >> 6 & 7U) : (hw >> 6 & 7U);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int decode_thumb32(uint16_t hw1, uint16_t hw2, thumb_imm_insn_t *out) {
+    uint16_t imm12 = (uint16_t)((hw1 >> 10 & 1) << 11 | (hw2 >> 12 & 7) << 8 | (hw2 & 0xFF));
+    uint8_t rn = hw1 & 0xF;
+    uint32_t value;
+
+    if ((hw2 & 0x8000) != 0) {
+        return 0;
+    }
+    out->rd = (uint8_t)(hw2 >> 8 & 0xF);
+    out->rn = rn;
+    out->setflags = (uint8_t)(hw1 >> 4 & 1);
+    if ((hw1 & 0xFA00) == 0xF000) {             // Data processing, modified immediate
+        if (!thumb_expand_immediate(imm12, &value)) {
+            return 0;
+        }
+        switch (hw1 >> 5 & 0xF) {
+            case T_DP_ORR:
+            case T_DP_ORN:
+                if (rn != T_REG_PC) {
+                    return 0;
+                }
+                out->kind = THUMB_IMM_MOV;
+                out->rn = 0;
+                out->value = ((hw1 >> 5 & 0xF) == T_DP_ORN) ? ~value : value;
+                return 1;
+            case T_DP_ADD:
+            case T_DP_SUB:
+                out->kind = THUMB_IMM_ADD;
+                out->value = ((hw1 >> 5 & 0xF) == T_DP_SUB) ? 0U - value : value;
+                return 1;
+            default:
+                return 0;
+        }
+    }
+    if ((hw1 & 0xFA00) == 0xF200) {             // Plain binary immediate
+        out->setflags = 0;
+        switch (hw1 & 0xFBF0) {
+            case T_ADDW:
+            case T_SUBW:
+                out->kind = THUMB_IMM_ADD;
+                out->value = ((hw1 & 0xFBF0) == T_SUBW) ? 0U - imm12 : imm12;
+                return 1;
+            case T_MOVW:
+            case T_MOVT:
+                out->kind = ((hw1 & 0xFBF0) == T_MOVT) ? THUMB_IMM_MOVT : THUMB_IMM_MOV;
+                out->value = (uint32_t)rn << 12 | imm12;
+                out->rn = 0;
+                return 1;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+int decode_thumb_immediate(const uint8_t *bytes, size_t size, thumb_imm_insn_t *out) {
+    uint16_t hw1;
+    int ok;
+
+    if (size < 2) {
+        return 0;
+    }
+    memset(out, 0, sizeof(*out));
+    hw1 = (uint16_t)(bytes[0] | bytes[1] << 8);
+    if ((hw1 & 0xE000) == 0xE000 && (hw1 & 0x1800) != 0) {
+        ok = size == 4 && decode_thumb32(hw1, (uint16_t)(bytes[2] | bytes[3] << 8), out);
+    } else {
+        ok = size == 2 && decode_thumb16(hw1, out);
+    }
+    // SP and PC destinations and PC-relative (ADR) forms are left alone
+    return ok && out->rd < T_REG_SP && (out->kind != THUMB_IMM_ADD || out->rn != T_REG_PC);
+}
+
+// ============================================================================
+// ARM -> Thumb entry stub
+// ============================================================================
+
+static void put_arm_word(uint8_t *p, uint32_t word) {
+    p[0] = (uint8_t)word;
+    p[1] = (uint8_t)(word >> 8);
+    p[2] = (uint8_t)(word >> 16);
+    p[3] = (uint8_t)(word >> 24);
+}
+
+// Filler for the bytes the stub branches over (never executed)
+static int entry_filler(void) {
+    for (int b = 0x90; b < 0x190; b++) {
+        if (is_bad_byte_free_byte((uint8_t)b)) {
+            return b & 0xFF;
+        }
+    }
+    return -1;
+}
+
+size_t thumb_entry_stub(uint8_t out[THUMB_ENTRY_MAX_SIZE]) {
+    // IP first (the intra-procedure scratch register), then the argument registers
+    static const uint8_t scratch[] = {12, 3, 2, 1, 0, 11, 10, 9, 8, 7, 6, 5, 4};
+    int filler = entry_filler();
+    uint32_t add;
+
+    for (size_t r = 0; r < sizeof(scratch); r++) {
+        uint32_t bx = 0xE12FFF10U | scratch[r];   // BX Rm
+
+        for (uint32_t pad = 0; is_bad_byte_free(bx) && pad <= THUMB_ENTRY_MAX_PAD; pad += 4) {
+            if (pad > 0 && filler < 0) {
+                break;
+            }
+            // ADD Rm, PC, #(1 + pad): PC reads 8 ahead, bit 0 selects Thumb
+            if (encode_arm_immediate_word(0xE28F0000U | (uint32_t)scratch[r] << 12, 1 + pad, &add) &&
+                is_bad_byte_free(add)) {
+                put_arm_word(out, add);
+                put_arm_word(out + 4, bx);
+                memset(out + 8, filler, pad);
+                return 8 + pad;
+            }
+        }
+        if (r > 0) {
+            continue;
+        }
+        // ARMv7 ALU writes to PC interwork: SUB PC, PC, #3 enters Thumb
+        // right after itself, ADD PC, PC, #(1 + pad) after filler
+        if (is_bad_byte_free(0xE24FF003U)) {
+            put_arm_word(out, 0xE24FF003U);
+            return 4;
+        }
+        for (uint32_t pad = 0; filler >= 0 && pad <= THUMB_ENTRY_MAX_PAD - 4; pad += 4) {
+            if (encode_arm_immediate_word(0xE28FF000U, 1 + pad, &add) && is_bad_byte_free(add)) {
+                put_arm_word(out, add);
+                memset(out + 4, filler, 4 + pad);
+                return 8 + pad;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Thumb-2 Encoding Helpers
+ *
+ * Thumb-2 (T32) mixes 16-bit encodings with 32-bit ones made of two
+ * halfwords. Constants come from 8-bit moves, the modified immediates of
+ * ThumbExpandImm (an 8-bit value rotated, or replicated across the word) and
+ * the 16-bit MOVW/MOVT and 12-bit ADDW/SUBW plain immediates. The search
+ * combines them into the shortest sequence whose bytes are all clean.
+ *
+ * A Thumb payload entered from ARM state needs an interworking branch first;
+ * thumb_entry_stub() builds one.
+ */
+
+#ifndef THUMB_ENCODING_H
+#define THUMB_ENCODING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define THUMB_SEQ_MAX_BYTES   16                          // Longest replacement
+#define THUMB_ENTRY_MAX_PAD   32                          // Filler the entry stub may skip
+#define THUMB_ENTRY_MAX_SIZE  (8 + THUMB_ENTRY_MAX_PAD)   // Largest entry stub
+
+typedef enum {
+    THUMB_IMM_MOV = 0,     // MOVS/MOV.W/MVN.W/MOVW Rd, #value
+    THUMB_IMM_ADD,         // ADD/SUB/ADDW/SUBW Rd, Rn, #imm (value = addend mod 2^32)
+    THUMB_IMM_MOVT         // MOVT Rd, #value (top halfword)
+} thumb_imm_kind_t;
+
+// One decoded immediate instruction
+typedef struct {
+    thumb_imm_kind_t kind;
+    uint8_t rd;
+    uint8_t rn;            // THUMB_IMM_ADD only
+    uint8_t setflags;      // Sets N and Z (outside IT blocks, every 16-bit form does)
+    uint32_t value;
+} thumb_imm_insn_t;
+
+// A replacement sequence, in memory order
+typedef struct {
+    size_t size;
+    uint8_t bytes[THUMB_SEQ_MAX_BYTES];
+} thumb_seq_t;
+
+// Expand a 12-bit modified immediate (i:imm3:imm8).
+// Returns 0 for the UNPREDICTABLE replicated forms with a zero byte.
+int thumb_expand_immediate(uint16_t imm12, uint32_t *value_out);
+
+// Decode a constant write or ADD/SUB immediate. Rd must be R0-R12 and Rn
+// must not be PC (ADR is a PC-relative form). Returns 1 if `bytes` hold one.
+int decode_thumb_immediate(const uint8_t *bytes, size_t size, thumb_imm_insn_t *out);
+
+/*
+ * Shortest bad-byte-free sequence with the effect of `insn`. Instructions
+ * other than the last never set flags unless the original does; a
+ * flag-setting original ends with a flag-setting instruction, so N and Z
+ * match while C and V may differ. Returns 1 and fills seq_out if one exists.
+ */
+int thumb_synthesize(const thumb_imm_insn_t *insn, thumb_seq_t *seq_out);
+
+/*
+ * ARM-state stub that continues in Thumb state at the byte following it:
+ *
+ *   ADD ip, pc, #(1 + pad) ; BX ip ; pad filler bytes
+ *
+ * Falls back to ADD/SUB pc, pc (an interworking branch on ARMv7) and then
+ * to other scratch registers. The size is a multiple of 4, so the payload
+ * keeps its word alignment. Returns the size, or 0 if no stub is clean.
+ */
+size_t thumb_entry_stub(uint8_t out[THUMB_ENTRY_MAX_SIZE]);
+
+#endif /* THUMB_ENCODING_H */
@@ -0,0 +1,112 @@
+/*
+ * Thumb Strategy Implementations
+ *
+ * Immediate moves and ADD/SUB immediates are decoded from their 16- or
+ * 32-bit encoding (decode_thumb_immediate) and rebuilt by thumb_synthesize().
+ * Branches, ADR and literal loads are relocated by pc_relocation.c
+ * (PCREL_ISA_T32) and never reach these strategies.
+ */
+
+#include "thumb_strategies.h"
+#include "thumb_encoding.h"
+#include "utils.h"
+#include <capstone/capstone.h>
+
+// Instructions inside an IT block are conditional, and their 16-bit forms do
+// not set flags: they are left alone
+static int thumb_outside_it_block(cs_insn *insn) {
+    return insn->detail->arm.cc == ARM_CC_AL || insn->detail->arm.cc == ARM_CC_INVALID;
+}
+
+// Clean replacement for a dirty immediate instruction of the given kinds
+static int thumb_immediate_seq(cs_insn *insn, int want_add, thumb_seq_t *seq) {
+    thumb_imm_insn_t imm;
+
+    if (is_bad_byte_free_buffer(insn->bytes, insn->size) || !thumb_outside_it_block(insn)) {
+        return 0;
+    }
+    if (!decode_thumb_immediate(insn->bytes, insn->size, &imm) ||
+        (imm.kind == THUMB_IMM_ADD) != want_add) {
+        return 0;
+    }
+    return thumb_synthesize(&imm, seq);
+}
+
+static void generate_thumb_seq(struct buffer *b, cs_insn *insn, int want_add) {
+    thumb_seq_t seq;
+
+    if (!thumb_immediate_seq(insn, want_add, &seq)) {
+        buffer_append(b, insn->bytes, insn->size);
+        return;
+    }
+    buffer_append(b, seq.bytes, seq.size);
+}
+
+// ============================================================================
+// Thumb MOV Strategies
+// ============================================================================
+
+/**
+ * Strategy: Thumb constant synthesis
+ * Rewrite MOVS/MOV.W/MVN.W/MOVW/MOVT with bad bytes as the shortest clean
+ * sequence of 8-bit, modified and 16-bit immediates plus an ADD/SUB/EOR fix
+ */
+static int can_handle_thumb_mov_synth(cs_insn *insn) {
+    thumb_seq_t seq;
+    return thumb_immediate_seq(insn, 0, &seq);
+}
+
+static size_t get_size_thumb_mov_synth(cs_insn *insn) {
+    thumb_seq_t seq;
+    return thumb_immediate_seq(insn, 0, &seq) ? seq.size : 0;
+}
+
+static void generate_thumb_mov_synth(struct buffer *b, cs_insn *insn) {
+    generate_thumb_seq(b, insn, 0);
+}
+
+static strategy_t thumb_mov_synth_strategy = {
+    .name = "thumb_mov_synth",
+    .can_handle = can_handle_thumb_mov_synth,
+    .get_size = get_size_thumb_mov_synth,
+    .generate = generate_thumb_mov_synth,
+    .priority = 12,
+    .target_arch = BYVAL_ARCH_THUMB
+};
+
+// ============================================================================
+// Thumb ADD/SUB Strategies
+// ============================================================================
+
+/**
+ * Strategy: Thumb ADD/SUB split
+ * Rewrite ADD/SUB/ADDW/SUBW Rd, Rn, #imm with bad bytes as another single
+ * encoding, two clean immediates, or the addend built in Rd and added
+ */
+static int can_handle_thumb_add_sub_synth(cs_insn *insn) {
+    thumb_seq_t seq;
+    return thumb_immediate_seq(insn, 1, &seq);
+}
+
+static size_t get_size_thumb_add_sub_synth(cs_insn *insn) {
+    thumb_seq_t seq;
+    return thumb_immediate_seq(insn, 1, &seq) ? seq.size : 0;
+}
+
+static void generate_thumb_add_sub_synth(struct buffer *b, cs_insn *insn) {
+    generate_thumb_seq(b, insn, 1);
+}
+
+static strategy_t thumb_add_sub_synth_strategy = {
+    .name = "thumb_add_sub_synth",
+    .can_handle = can_handle_thumb_add_sub_synth,
+    .get_size = get_size_thumb_add_sub_synth,
+    .generate = generate_thumb_add_sub_synth,
+    .priority = 12,
+    .target_arch = BYVAL_ARCH_THUMB
+};
+
+void register_thumb_strategies(void) {
+    register_strategy(&thumb_mov_synth_strategy);
+    register_strategy(&thumb_add_sub_synth_strategy);
+}
@@ -0,0 +1,15 @@
+/*
+ * Thumb Strategy Declarations
+ *
+ * Bad-byte elimination strategies for Thumb-2 (--arch thumb).
+ */
+
+#ifndef THUMB_STRATEGIES_H
+#define THUMB_STRATEGIES_H
+
+#include "strategy.h"
+
+// Register all Thumb strategies
+void register_thumb_strategies(void);
+
+#endif /* THUMB_STRATEGIES_H */
@@ -1665,7 +1665,11 @@ int show_processing_screen(byvalver_config_t *config) {
             }
             if (config->encode_shellcode) {
                 attron(COLOR_PAIR(4));
-                mvprintw(left_row++, left_col, "  XOR Encoding: ON (key: 0x%08X)", config->xor_key);
+                if (config->xor_key_auto) {
+                    mvprintw(left_row++, left_col, "  XOR Encoding: ON (key: auto)");
+                } else {
+                    mvprintw(left_row++, left_col, "  XOR Encoding: ON (key: 0x%08X)", config->xor_key);
+                }
                 attroff(COLOR_PAIR(4));
             }
             if (config->use_ml_strategist) {
@@ -2027,7 +2031,11 @@ int show_processing_screen(byvalver_config_t *config) {
         }
         if (config->encode_shellcode) {
             attron(COLOR_PAIR(4));
-            mvprintw(row++, 5, "  XOR Encoding: ON (key: 0x%08X)", config->xor_key);
+            if (config->xor_key_auto) {
+                mvprintw(row++, 5, "  XOR Encoding: ON (key: auto)");
+            } else {
+                mvprintw(row++, 5, "  XOR Encoding: ON (key: 0x%08X)", config->xor_key);
+            }
             attroff(COLOR_PAIR(4));
         }
         if (config->use_ml_strategist) {
@@ -2,6 +2,8 @@
 #include "utils.h"
 #include "core.h"
 #include "profile_aware_sib.h"  // For profile-safe SIB generation
+#include "branch_layout.h"  // For layout_gpr_family (scratch registers)
+#include "thread_rng.h"  // For per-thread random searches
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -250,13 +252,13 @@ size_t get_mov_reg_imm_size(cs_insn *insn) {
 
 void generate_mov_reg_imm(struct buffer *b, cs_insn *insn) {
     if (!b || !insn || !insn->detail) {
-        fprintf(stderr, "[ERROR] Invalid parameters in generate_mov_reg_imm\n");
+        log_diagnostic("[ERROR] Invalid parameters in generate_mov_reg_imm\n");
         return;
     }
 
     // Check that we have the expected number of operands
     if (insn->detail->x86.op_count < 2) {
-        fprintf(stderr, "[ERROR] Not enough operands in generate_mov_reg_imm\n");
+        log_diagnostic("[ERROR] Not enough operands in generate_mov_reg_imm\n");
         return;
     }
 
@@ -867,8 +869,8 @@ int find_addsub_key(uint32_t target, uint32_t *val1, uint32_t *val2, int *is_add
 
     // Fall back to random search for remaining cases
     for (int i = 0; i < 5000; i++) {  // Increased from 1000
-        // Use a local random approach to avoid global state issues
-        uint32_t temp_val2 = (uint32_t)rand() | 0x01010101; // Ensure no zero bytes by ORing with pattern
+        // Per-thread generator: concurrent variants stay independent and seeded
+        uint32_t temp_val2 = thread_rng_next() | 0x01010101; // Ensure no zero bytes by ORing with pattern
         if (!is_bad_byte_free(temp_val2)) continue;
 
         uint32_t temp_val1 = target + temp_val2;
@@ -1140,17 +1142,19 @@ int has_null_bytes_in_encoding(const uint8_t *data, size_t size) {
 
 /**
  * Check if a single byte is free of bad bytes
- * Uses global bad byte context for O(1) lookup
+ * Uses the calling thread's bad byte context for O(1) lookup
  * @param byte: Byte to check
  * @return: 1 if ok, 0 if bad
  */
 int is_bad_byte_free_byte(uint8_t byte) {
+    const bad_byte_context_t *context = current_bad_byte_context();
+
     // If context uninitialized, default to null-byte checking only
-    if (!g_bad_byte_context.initialized) {
+    if (!context->initialized) {
         return byte != 0x00;
     }
     // O(1) bitmap lookup
-    return g_bad_byte_context.config.bad_bytes[byte] == 0;
+    return context->config.bad_bytes[byte] == 0;
 }
 
 /**
@@ -1265,7 +1269,7 @@ int find_arithmetic_equivalent(uint32_t target, uint32_t *base, uint32_t *offset
 static inline void verify_no_nulls(struct buffer *b, size_t start, const char* func_name) {
     for (size_t i = start; i < b->size; i++) {
         if (b->data[i] == 0x00) {
-            fprintf(stderr, "ERROR: Null byte detected at offset %zu (function: %s)\n", i - start, func_name);
+            log_diagnostic("ERROR: Null byte detected at offset %zu (function: %s)\n", i - start, func_name);
         }
     }
 }
@@ -1658,6 +1662,15 @@ void generate_mov_reg_imm64(struct buffer *b, x86_reg reg, uint64_t imm) {
         return;
     }
 
+    // A scratch RAX (--clobber) needs no preservation
+    if (is_scratch_register(X86_REG_RAX)) {
+        generate_mov_rax_imm64(b, imm);
+        uint8_t mov_reg_rax[] = {(uint8_t)(is_extended ? 0x49 : 0x48), 0x89,
+                                 (uint8_t)(0xC0 + (reg_idx & 0x07))};  // MOV reg, RAX
+        buffer_append(b, mov_reg_rax, 3);
+        return;
+    }
+
     // Use RAX as intermediary
     // PUSH RAX
     uint8_t push_rax[] = {0x50};
@@ -1688,3 +1701,54 @@ void generate_mov_reg_imm64(struct buffer *b, x86_reg reg, uint64_t imm) {
     buffer_append(b, add_rsp, 4);
 }
 
+
+// ============================================================================
+// Scratch Registers (--clobber)
+// ============================================================================
+
+// Scratch mask of the instruction currently being rewritten (per thread: variants rewrite concurrently)
+static __thread uint32_t g_scratch_mask = 0;
+
+void set_scratch_registers(uint32_t mask) {
+    g_scratch_mask = mask;
+}
+
+uint32_t get_scratch_registers(void) {
+    return g_scratch_mask;
+}
+
+int is_scratch_register(x86_reg reg) {
+    int fam = layout_gpr_family(reg, NULL);
+    return fam >= 0 && ((g_scratch_mask >> fam) & 1);
+}
+
+int is_scratch_flags(void) {
+    return (g_scratch_mask & CLOBBER_FLAGS) != 0;
+}
+
+void generate_temp_save(struct buffer *b, x86_reg reg) {
+    if (is_scratch_register(reg)) {
+        return;
+    }
+    if (is_extended_register(reg)) {
+        buffer_write_byte(b, 0x41);  // REX.B
+    }
+    buffer_write_byte(b, 0x50 + (get_reg_index(reg) & 0x07));  // PUSH reg
+}
+
+void generate_temp_restore(struct buffer *b, x86_reg reg) {
+    if (is_scratch_register(reg)) {
+        return;
+    }
+    if (is_extended_register(reg)) {
+        buffer_write_byte(b, 0x41);  // REX.B
+    }
+    buffer_write_byte(b, 0x58 + (get_reg_index(reg) & 0x07));  // POP reg
+}
+
+size_t get_temp_save_restore_size(x86_reg reg) {
+    if (is_scratch_register(reg)) {
+        return 0;
+    }
+    return is_extended_register(reg) ? 4 : 2;
+}
@@ -155,6 +155,7 @@ void generate_mov_rax_imm64(struct buffer *b, uint64_t imm);
 
 /**
  * Generate MOVABS reg, imm64 for any 64-bit register
+ * (RAX is preserved unless it is a scratch register, see set_scratch_registers())
  * @param b: Buffer to write to
  * @param reg: Target register (RAX-R15)
  * @param imm: 64-bit immediate value
@@ -182,4 +183,54 @@ int is_bad_byte_free_qword(uint64_t val);
  */
 void buffer_write_qword(struct buffer *b, uint64_t qword);
 
+// ============================================================================
+// Scratch Registers (--clobber)
+// ============================================================================
+
+/**
+ * Set the registers the instruction being rewritten may destroy
+ * @param mask: From layout_scratch_after(); 0 outside per-node generation
+ */
+void set_scratch_registers(uint32_t mask);
+
+/**
+ * Scratch mask set by the last set_scratch_registers() on this thread
+ * @return: Bit per GPR family, CLOBBER_FLAGS
+ */
+uint32_t get_scratch_registers(void);
+
+/**
+ * Check if a register may be destroyed without saving it
+ * @param reg: Any alias of a general-purpose register
+ * @return: 1 if its whole register is scratch for the current instruction
+ */
+int is_scratch_register(x86_reg reg);
+
+/**
+ * Check if the flags may be destroyed without PUSHFD/POPFD
+ * @return: 1 if the flags are scratch for the current instruction
+ */
+int is_scratch_flags(void);
+
+/**
+ * Save a temporary register around a rewrite (PUSH reg, nothing if scratch)
+ * @param b: Buffer to write to
+ * @param reg: 32- or 64-bit register
+ */
+void generate_temp_save(struct buffer *b, x86_reg reg);
+
+/**
+ * Restore a register saved by generate_temp_save() (POP reg, nothing if scratch)
+ * @param b: Buffer to write to
+ * @param reg: Same register as the matching save
+ */
+void generate_temp_restore(struct buffer *b, x86_reg reg);
+
+/**
+ * Size of a generate_temp_save() / generate_temp_restore() pair
+ * @param reg: Register
+ * @return: 0 if scratch, otherwise the PUSH+POP size
+ */
+size_t get_temp_save_restore_size(x86_reg reg);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+ * XOR encoder key search
+ *
+ * Works lane by lane: each key byte is chosen independently from the byte
+ * values occurring in its lane (see xor_key_search.h).
+ */
+
+#include "xor_key_search.h"
+#include "utils.h"
+#include <string.h>
+
+// Candidates are visited in a fixed order (odd stride = all 256 values) so
+// results are reproducible and keys are not trivially small
+#define XOR_KEY_FIRST_CANDIDATE 0x5A
+#define XOR_KEY_STRIDE          0x3B
+
+int xor_key_lane_usable(const uint8_t *payload, size_t size, size_t start, size_t stride,
+                        uint8_t *usable) {
+    uint8_t present[256];
+    uint8_t bad[256];
+    int bad_count = 0;
+    int count = 0;
+
+    for (int x = 0; x < 256; x++) {
+        if (!is_bad_byte_free_byte((uint8_t)x)) {
+            bad[bad_count++] = (uint8_t)x;
+        }
+    }
+
+    memset(present, 0, sizeof(present));
+    for (size_t i = start; i < size; i += stride) {
+        present[payload[i]] = 1;
+    }
+
+    for (int k = 0; k < 256; k++) {
+        usable[k] = (uint8_t)is_bad_byte_free_byte((uint8_t)k);
+    }
+    for (int b = 0; b < 256; b++) {
+        if (!present[b]) {
+            continue;
+        }
+        for (int j = 0; j < bad_count; j++) {
+            usable[b ^ bad[j]] = 0;
+        }
+    }
+    for (int k = 0; k < 256; k++) {
+        count += usable[k];
+    }
+    return count;
+}
+
+int xor_key_pick_byte(const uint8_t *usable) {
+    int k = XOR_KEY_FIRST_CANDIDATE;
+    for (int i = 0; i < 256; i++, k = (k + XOR_KEY_STRIDE) & 0xFF) {
+        if (k != 0 && usable[k]) {
+            return k;
+        }
+    }
+    return usable[0] ? 0 : -1;
+}
+
+int xor_key_check(const uint8_t *payload, size_t size, uint32_t key) {
+    uint8_t usable[256];
+
+    for (int lane = 0; lane < 4; lane++) {
+        xor_key_lane_usable(payload, size, (size_t)lane, 4, usable);
+        if (!usable[(key >> (lane * 8)) & 0xFF]) {
+            return lane;
+        }
+    }
+    return -1;
+}
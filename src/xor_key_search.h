@@ -0,0 +1,49 @@
+#ifndef XOR_KEY_SEARCH_H
+#define XOR_KEY_SEARCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file xor_key_search.h
+ * @brief Profile-aware lane search for XOR encoder keys
+ *
+ * With a key period of P bytes, payload byte i is XORed with key byte
+ * i % P, so each key byte only has to keep its lane (bytes start,
+ * start + P, ...) clean. A key byte works if it is clean itself and maps
+ * every payload byte of the lane to a clean byte. One pass per lane records
+ * which byte values occur; a candidate k is then rejected exactly when
+ * k = b ^ x for an occurring b and a bad x, which leaves the set of usable
+ * bytes per lane in O(256 * bad bytes). decoder_stub.c builds its keys from
+ * these lanes.
+ */
+
+/**
+ * Check a given 4-byte key against the payload (for user-supplied keys)
+ * @param payload: Payload to be encoded
+ * @param size: Payload size
+ * @param key: 4-byte key
+ * @return: -1 if the key keeps every lane clean, else the first failing lane
+ */
+int xor_key_check(const uint8_t *payload, size_t size, uint32_t key);
+
+/**
+ * Key bytes usable for one lane (payload bytes start, start + stride, ...)
+ * @param payload: Payload to be encoded
+ * @param size: Payload size
+ * @param start: First byte of the lane
+ * @param stride: Distance between the lane's bytes (key period in bytes)
+ * @param usable: Output, usable[k] = 1 if k is clean and keeps the lane clean
+ * @return: Number of usable key bytes
+ */
+int xor_key_lane_usable(const uint8_t *payload, size_t size, size_t start, size_t stride,
+                        uint8_t *usable);
+
+/**
+ * Preferred usable key byte (fixed visiting order, 0 only as a last resort)
+ * @param usable: From xor_key_lane_usable()
+ * @return: Key byte, or -1 if the lane has none
+ */
+int xor_key_pick_byte(const uint8_t *usable);
+
+#endif // XOR_KEY_SEARCH_H
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+BYVALVER Feature Test - ARM/AArch64 decoder stub check
+tests/features/check_decoder_stub.py
+
+Checks an --xor-encode output for ARM or AArch64 against the plain rewrite
+of the same input:
+1. The stub (the first STUB_SIZE bytes) is disassembled with llvm-objdump;
+   every instruction up to its final BX/BR must decode
+2. The stub's first instructions must point the base register at the
+   payload (ADD rB, pc, #imm on ARM; ADR + ADD on AArch64)
+3. Keys and the masked loop count are read from the literal pool in front
+   of the payload, the payload is decoded the way the stub's loop does it,
+   and the result must start with the plain rewrite
+
+STUB_SIZE and the template come from the CLI's "[DECODER] kind-32 stub
+(N bytes, ...)" line.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+TRIPLES = {
+    "arm": ("armv7", "elf32-littlearm"),
+    "arm64": ("aarch64", "elf64-littleaarch64"),
+}
+
+LINE_RE = re.compile(r"^\s*([0-9a-f]+):\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*(.*)$")
+
+
+def disassemble(data, arch):
+    """Return [(address, mnemonic, operands)] for raw bytes."""
+    triple, elf_format = TRIPLES[arch]
+    with tempfile.TemporaryDirectory() as tmp:
+        raw = os.path.join(tmp, "stub.bin")
+        obj = os.path.join(tmp, "stub.o")
+        with open(raw, "wb") as handle:
+            handle.write(data)
+        subprocess.run(["llvm-objcopy", "-I", "binary", "-O", elf_format, raw, obj],
+                       check=True, capture_output=True)
+        listing = subprocess.run(["llvm-objdump", "-d", "-z", "-j", ".data",
+                                  "--triple=" + triple, obj],
+                                 check=True, capture_output=True, text=True).stdout
+
+    insns = []
+    for line in listing.splitlines():
+        match = LINE_RE.match(line)
+        if match:
+            operands = match.group(3).split("@")[0].split("//")[0].strip()
+            insns.append((int(match.group(1), 16), match.group(2), operands))
+    return insns
+
+
+def stub_base(insns, arch):
+    """Offset the stub's base register points at, or None."""
+    if arch == "arm":
+        match = re.match(r"(r\d+), pc, #(\d+)$", insns[0][2]) if insns[0][1] == "add" else None
+        return (8 + int(match.group(2)), match.group(1)) if match else (None, None)
+
+    adr = re.match(r"(x\d+), #(-?\d+)$", insns[0][2]) if insns[0][1] == "adr" else None
+    add = re.match(r"(x\d+), (x\d+), #(\d+)$", insns[1][2]) if insns[1][1] == "add" else None
+    if not adr or not add or not (adr.group(1) == add.group(1) == add.group(2)):
+        return None, None
+    return int(adr.group(2)) + int(add.group(3)), adr.group(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check an ARM/AArch64 decoder stub against the plain rewrite")
+    parser.add_argument("--arch", required=True, choices=sorted(TRIPLES))
+    parser.add_argument("--kind", required=True, choices=["xor", "add", "rolling-xor"])
+    parser.add_argument("--stub-size", required=True, type=int)
+    parser.add_argument("plain")
+    parser.add_argument("encoded")
+    args = parser.parse_args()
+
+    for tool in ("llvm-objcopy", "llvm-objdump"):
+        if not shutil.which(tool):
+            print(f"[ERROR] {tool} not found")
+            return 2
+
+    with open(args.plain, "rb") as handle:
+        plain = handle.read()
+    with open(args.encoded, "rb") as handle:
+        encoded = handle.read()
+    stub_size = args.stub_size
+    if stub_size % 4 or stub_size >= len(encoded) or (len(encoded) - stub_size) % 4:
+        print(f"[FAIL] stub size {stub_size} does not split the {len(encoded)}-byte output into words")
+        return 1
+
+    # 1. The code part of the stub decodes up to its branch into the payload
+    insns = disassemble(encoded[:stub_size], args.arch)
+    branch = "bx" if args.arch == "arm" else "br"
+    end = next((i for i, insn in enumerate(insns) if insn[1] == branch), None)
+    if end is None:
+        print(f"[FAIL] no {branch} in the stub")
+        return 1
+    for address, mnemonic, operands in insns[:end + 1]:
+        if mnemonic.startswith("<unknown>"):
+            print(f"[FAIL] stub instruction at 0x{address:x} does not decode")
+            return 1
+
+    # 2. The base register points at the payload and the stub branches there
+    base, reg = stub_base(insns, args.arch)
+    if base != stub_size:
+        print(f"[FAIL] stub base is {base}, the payload starts at {stub_size}")
+        return 1
+    if insns[end][2] != reg:
+        print(f"[FAIL] stub branches to {insns[end][2]}, the payload base is in {reg}")
+        return 1
+
+    # 3. Decode with the keys and count from the literal pool
+    period = 2 if args.kind == "rolling-xor" else 1
+    literals = period + (3 if args.arch == "arm" else 2)
+    pool = struct.unpack_from("<%dI" % literals, encoded, stub_size - literals * 4)
+    keys = pool[:period]
+    count = pool[period] ^ pool[period + 1]
+    words = count * period if args.arch == "arm" else count // 4
+    if stub_size + words * 4 != len(encoded):
+        print(f"[FAIL] loop count covers {words} words, the payload has {(len(encoded) - stub_size) // 4}")
+        return 1
+
+    decoded = bytearray()
+    for index, word in enumerate(struct.unpack_from("<%dI" % words, encoded, stub_size)):
+        key = keys[index % period]
+        word = (word + key) & 0xFFFFFFFF if args.kind == "add" else word ^ key
+        decoded += struct.pack("<I", word)
+
+    if bytes(decoded[:len(plain)]) != plain:
+        first = next(i for i in range(len(plain)) if i >= len(decoded) or decoded[i] != plain[i])
+        print(f"[FAIL] decoded payload differs from the plain rewrite at byte {first}")
+        return 1
+
+    print(f"[OK] {args.kind} stub ({stub_size} bytes) decodes {len(plain)} payload bytes")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
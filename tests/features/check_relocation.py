@@ -0,0 +1,249 @@
+#!/usr/bin/env python3
+"""
+BYVALVER Feature Test - PC-relative relocation equivalence
+tests/features/check_relocation.py
+
+Checks that a rewritten ARM, Thumb or AArch64 payload is the input with
+padding inserted and PC-relative instructions relocated:
+1. Both files are disassembled with llvm-objdump
+2. Padding (NOP and register-to-itself MOV) is dropped from both listings
+3. Every branch target is replaced by the index of the first kept
+   instruction at or after it, so moved code compares equal
+4. Runs of immediate moves and arithmetic (MOV/MVN, MOVZ/MOVN/MOVK,
+   ADD/SUB and ORR/EOR/AND with an immediate, and the stack save/restore
+   around them) are executed from a fixed register state and replaced by
+   the registers they change, so a constant rebuilt from another sequence
+   compares equal to the original
+5. The two listings must then match instruction for instruction
+
+Branch width suffixes (.n/.w) are ignored: relocation may pick a wider form.
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+TRIPLES = {
+    "arm": ("armv7", "elf32-littlearm"),
+    "thumb": ("thumbv7", "elf32-littlearm"),
+    "arm64": ("aarch64", "elf64-littleaarch64"),
+}
+
+LINE_RE = re.compile(r"^\s*([0-9a-f]+):\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*(.*)$")
+TARGET_RE = re.compile(r"0x([0-9a-f]+) <[^>]*>")
+IMM_RE = re.compile(r"#(-?(?:0x[0-9a-f]+|\d+))(?:, (?:lsl )?#(\d+))?$")
+STACK_RE = re.compile(r"\[sp(?:, #(-?\d+))?\](!?)(?:, #(-?\d+))?$")
+
+
+def disassemble(path, arch):
+    """Return [(address, mnemonic, operands)] for a raw binary."""
+    triple, elf_format = TRIPLES[arch]
+    with tempfile.TemporaryDirectory() as tmp:
+        obj = os.path.join(tmp, "payload.o")
+        subprocess.run(["llvm-objcopy", "-I", "binary", "-O", elf_format, path, obj],
+                       check=True, capture_output=True)
+        listing = subprocess.run(["llvm-objdump", "-d", "-z", "-j", ".data",
+                                  "--triple=" + triple, obj],
+                                 check=True, capture_output=True, text=True).stdout
+
+    insns = []
+    for line in listing.splitlines():
+        match = LINE_RE.match(line)
+        if not match:
+            continue
+        operands = match.group(3).split("@")[0].split("//")[0].strip()
+        insns.append((int(match.group(1), 16), match.group(2), operands))
+    return insns
+
+
+def is_padding(mnemonic, operands):
+    if mnemonic in ("nop", "nop.w"):
+        return True
+    if mnemonic in ("mov", "mov.w"):
+        regs = [op.strip() for op in operands.split(",")]
+        return len(regs) == 2 and regs[0] == regs[1]
+    return False
+
+
+def register(name, arch):
+    """(index, width) of a general register, None for PC and anything else."""
+    if arch == "arm64":
+        if name in ("sp", "wsp"):
+            return 31, 32 if name == "wsp" else 64
+        if name in ("xzr", "wzr"):
+            return "zr", 32 if name == "wzr" else 64
+        match = re.match(r"([xw])(\d+)$", name)
+        return (int(match.group(2)), 64 if match.group(1) == "x" else 32) if match else None
+    if name in ("sp", "lr"):
+        return 13 if name == "sp" else 14, 32
+    match = re.match(r"r(\d+)$", name)
+    return (int(match.group(1)), 32) if match and int(match.group(1)) < 13 else None
+
+
+def immediate(text, arch):
+    """Value of '#imm', '#imm, lsl #n' (AArch64) or '#imm8, #rot' (ARM)."""
+    match = IMM_RE.match(text)
+    if not match:
+        return None
+    value = int(match.group(1), 0)
+    if match.group(2):
+        amount = int(match.group(2))
+        if arch != "arm64":
+            value = ((value >> amount) | (value << (32 - amount))) & 0xFFFFFFFF
+        else:
+            value <<= amount
+    return value
+
+
+class Machine:
+    """Registers and stack for the straight-line immediate code of one run."""
+
+    def __init__(self, arch):
+        self.arch = arch
+        self.seed = {index: ((index + 1) * 0x9E3779B97F4A7C15) & (2 ** (64 if arch == "arm64" else 32) - 1)
+                     for index in range(32 if arch == "arm64" else 15)}
+        self.regs = dict(self.seed)
+        self.stack = {}
+
+    def read(self, reg):
+        index, width = reg
+        return 0 if index == "zr" else self.regs[index] & (2 ** width - 1)
+
+    def write(self, reg, value):
+        index, width = reg
+        if index != "zr":
+            self.regs[index] = value & (2 ** width - 1)   # W writes clear the top half
+
+    def step(self, mnemonic, operands):
+        """Execute one instruction; False if it is not immediate code."""
+        mnemonic = re.sub(r"\.[nw]$", "", mnemonic)
+        parts = [part.strip() for part in operands.split(",", 2)]
+        dest = register(parts[0], self.arch) if parts else None
+        if dest is None or len(parts) < 2:
+            return False
+
+        if mnemonic in ("str", "ldr") and self.arch == "arm64":
+            return self.stack_access(mnemonic, dest, operands.split(",", 1)[1].strip())
+        source = register(parts[1], self.arch)
+        if mnemonic in ("mov", "mvn") and len(parts) == 2:
+            value = self.read(source) if source else immediate(parts[1], self.arch)
+            if value is None:
+                return False
+            self.write(dest, ~value if mnemonic == "mvn" else value)
+            return True
+        if mnemonic in ("movz", "movn", "movk") and source is None:
+            value = immediate(", ".join(parts[1:]), self.arch)
+            if value is None:
+                return False
+            if mnemonic == "movk":
+                shift = int(parts[2].split("#")[1]) if len(parts) > 2 else 0
+                value |= self.read(dest) & ~(0xFFFF << shift)
+            self.write(dest, ~value if mnemonic == "movn" else value)
+            return True
+        if mnemonic in ("add", "sub", "orr", "eor", "and") and source and len(parts) == 3:
+            value = immediate(parts[2], self.arch)
+            if value is None:
+                return False
+            ops = {"add": lambda a, b: a + b, "sub": lambda a, b: a - b,
+                   "orr": lambda a, b: a | b, "eor": lambda a, b: a ^ b, "and": lambda a, b: a & b}
+            self.write(dest, ops[mnemonic](self.read(source), value))
+            return True
+        return False
+
+    def stack_access(self, mnemonic, reg, address):
+        """STR/LDR Xt, [SP, #imm]{!} or [SP], #imm, as the scratch save uses them."""
+        match = STACK_RE.match(address)
+        if not match or reg[1] != 64:
+            return False
+        sp = self.regs[31]
+        pre = int(match.group(1) or 0)
+        post = int(match.group(3) or 0)
+        slot = sp + pre
+        if mnemonic == "str":
+            self.stack[slot] = self.read(reg)
+        elif slot in self.stack:
+            self.write(reg, self.stack[slot])
+        else:
+            return False
+        if match.group(2) or match.group(3):
+            self.regs[31] = (slot + post) & (2 ** 64 - 1)
+        return True
+
+    def changes(self):
+        names = {31: "sp"} if self.arch == "arm64" else {13: "sp", 14: "lr"}
+        prefix = "x" if self.arch == "arm64" else "r"
+        return " ".join("%s=0x%x" % (names.get(index, prefix + str(index)), value)
+                        for index, value in sorted(self.regs.items()) if value != self.seed[index])
+
+
+def fold_immediates(kept, arch):
+    """Replace each run of immediate code by one entry listing its effect."""
+    targets = {int(m.group(1), 16) for _, _, operands in kept for m in TARGET_RE.finditer(operands)}
+    result = []
+    index = 0
+    while index < len(kept):
+        machine = Machine(arch)
+        end = index
+        while end < len(kept) and (end == index or kept[end][0] not in targets) and \
+                machine.step(kept[end][1], kept[end][2]):
+            end += 1
+        if end == index:
+            result.append(kept[index])
+            index += 1
+            continue
+        if machine.changes():
+            result.append((kept[index][0], "=", machine.changes()))
+        index = end
+    return result
+
+
+def normalize(insns, arch):
+    """Drop padding, fold immediate code and express branch targets as instruction indexes."""
+    kept = fold_immediates([insn for insn in insns if not is_padding(insn[1], insn[2])], arch)
+
+    def index_of(target):
+        for index, (address, _, _) in enumerate(kept):
+            if address >= target:
+                return index
+        return len(kept)
+
+    result = []
+    for _, mnemonic, operands in kept:
+        mnemonic = re.sub(r"\.[nw]$", "", mnemonic)
+        operands = TARGET_RE.sub(lambda m: "@%d" % index_of(int(m.group(1), 16)), operands)
+        result.append((mnemonic, operands))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare a relocated ARM/Thumb/AArch64 payload with its input")
+    parser.add_argument("--arch", required=True, choices=sorted(TRIPLES))
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    for tool in ("llvm-objcopy", "llvm-objdump"):
+        if not shutil.which(tool):
+            print(f"[ERROR] {tool} not found")
+            return 2
+
+    expected = normalize(disassemble(args.input, args.arch), args.arch)
+    actual = normalize(disassemble(args.output, args.arch), args.arch)
+
+    for index in range(max(len(expected), len(actual))):
+        want = expected[index] if index < len(expected) else None
+        got = actual[index] if index < len(actual) else None
+        if want != got:
+            print(f"[FAIL] instruction {index}: expected {want}, got {got}")
+            return 1
+
+    print(f"[OK] {len(expected)} instructions match after relocation")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,74 @@
+/*
+ * Library link-and-call smoke test
+ *
+ * Usage: lib_smoke input.bin output.bin
+ *
+ * Rewrites an x64 payload through the context API of libbyvalver with the
+ * default options, checks that no null bytes remain and that the context
+ * counted the transform, and writes the result for payload_runner. With
+ * verbose off the library prints nothing, so any output from a successful
+ * run is an error; run_tests.sh checks for that.
+ */
+
+#include "byvalver.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s input.bin output.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 2;
+    }
+    uint8_t input[65536];
+    size_t size = fread(input, 1, sizeof(input), file);
+    fclose(file);
+    if (size == 0) {
+        fprintf(stderr, "%s: empty payload\n", argv[1]);
+        return 2;
+    }
+
+    ByvalContext *ctx = byval_context_create(BYVAL_TARGET_X64, NULL, 0, NULL);
+    if (!ctx) {
+        fprintf(stderr, "byval_context_create failed\n");
+        return 1;
+    }
+
+    ByvalResult result;
+    ByvalError err = byval_transform(ctx, input, size, &result);
+    if (err != BYVAL_SUCCESS) {
+        fprintf(stderr, "byval_transform: %s\n", byval_error_string(err));
+        byval_context_destroy(ctx);
+        return 1;
+    }
+
+    int status = 0;
+    ByvalStats stats;
+    byval_get_stats(ctx, &stats);
+    if (byval_count_nulls(result.data, result.size) != 0) {
+        fprintf(stderr, "%zu null bytes remain\n", byval_count_nulls(result.data, result.size));
+        status = 1;
+    } else if (stats.transforms != 1 || stats.input_bytes != size ||
+               stats.output_bytes != result.size) {
+        fprintf(stderr, "stats do not match the transform\n");
+        status = 1;
+    } else {
+        file = fopen(argv[2], "wb");
+        if (!file || fwrite(result.data, 1, result.size, file) != result.size) {
+            perror(argv[2]);
+            status = 1;
+        }
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    byval_free_result(&result);
+    byval_context_destroy(ctx);
+    return status;
+}
@@ -0,0 +1,141 @@
+/*
+ * Library concurrency test
+ *
+ * Usage: lib_threads input.bin
+ *
+ * Rewrites an x64 payload from several threads at once: one thread on each
+ * of two private contexts, and SHARED_THREADS threads on one shared context,
+ * every thread ROUNDS times. Every output must be free of null bytes and
+ * identical to every other, and the shared context must have counted each
+ * of its transforms. CI builds the library and this test with
+ * -fsanitize=thread, so a data race fails the run as well.
+ */
+
+#include "byvalver.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PRIVATE_THREADS 2
+#define SHARED_THREADS  4
+#define ROUNDS          8
+
+typedef struct {
+    ByvalContext *ctx;
+    const uint8_t *input;
+    size_t size;
+    ByvalResult first;      // Output of the first round
+    ByvalError err;
+    int dirty;              // A round left null bytes
+    int unstable;           // A later round differed from the first
+} job_t;
+
+static void *transform_thread(void *arg) {
+    job_t *job = (job_t *)arg;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        ByvalResult result;
+        ByvalResult *out = (round == 0) ? &job->first : &result;
+
+        job->err = byval_transform(job->ctx, job->input, job->size, out);
+        if (job->err != BYVAL_SUCCESS) {
+            break;
+        }
+        if (byval_count_nulls(out->data, out->size) != 0) {
+            job->dirty = 1;
+        }
+        if (round > 0) {
+            if (result.size != job->first.size || memcmp(result.data, job->first.data, result.size) != 0) {
+                job->unstable = 1;
+            }
+            byval_free_result(&result);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    enum { JOBS = PRIVATE_THREADS + SHARED_THREADS };
+    ByvalContext *contexts[PRIVATE_THREADS + 1];
+    pthread_t threads[JOBS];
+    job_t jobs[JOBS];
+    ByvalStats stats;
+    int status = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s input.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 2;
+    }
+    uint8_t input[65536];
+    size_t size = fread(input, 1, sizeof(input), file);
+    fclose(file);
+    if (size == 0) {
+        fprintf(stderr, "%s: empty payload\n", argv[1]);
+        return 2;
+    }
+
+    // contexts[0..PRIVATE_THREADS-1] are private, the last one is shared
+    for (int i = 0; i <= PRIVATE_THREADS; i++) {
+        contexts[i] = byval_context_create(BYVAL_TARGET_X64, NULL, 0, NULL);
+        if (!contexts[i]) {
+            fprintf(stderr, "byval_context_create failed\n");
+            return 1;
+        }
+    }
+
+    memset(jobs, 0, sizeof(jobs));
+    for (int i = 0; i < JOBS; i++) {
+        jobs[i].ctx = contexts[i < PRIVATE_THREADS ? i : PRIVATE_THREADS];
+        jobs[i].input = input;
+        jobs[i].size = size;
+        if (pthread_create(&threads[i], NULL, transform_thread, &jobs[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < JOBS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < JOBS && status == 0; i++) {
+        const char *kind = (i < PRIVATE_THREADS) ? "private" : "shared";
+
+        if (jobs[i].err != BYVAL_SUCCESS) {
+            fprintf(stderr, "thread %d (%s context): byval_transform: %s\n",
+                    i, kind, byval_error_string(jobs[i].err));
+            status = 1;
+        } else if (jobs[i].dirty) {
+            fprintf(stderr, "thread %d (%s context): null bytes remain\n", i, kind);
+            status = 1;
+        } else if (jobs[i].unstable) {
+            fprintf(stderr, "thread %d (%s context): rounds differ\n", i, kind);
+            status = 1;
+        } else if (jobs[i].first.size != jobs[0].first.size ||
+                   memcmp(jobs[i].first.data, jobs[0].first.data, jobs[0].first.size) != 0) {
+            fprintf(stderr, "thread %d (%s context): output differs from thread 0\n", i, kind);
+            status = 1;
+        }
+    }
+
+    byval_get_stats(contexts[PRIVATE_THREADS], &stats);
+    if (status == 0 && stats.transforms != SHARED_THREADS * ROUNDS) {
+        fprintf(stderr, "shared context counted %lu transforms, expected %d\n",
+                stats.transforms, SHARED_THREADS * ROUNDS);
+        status = 1;
+    }
+
+    for (int i = 0; i < JOBS; i++) {
+        byval_free_result(&jobs[i].first);
+    }
+    for (int i = 0; i <= PRIVATE_THREADS; i++) {
+        byval_context_destroy(contexts[i]);
+    }
+    return status;
+}
@@ -0,0 +1,86 @@
+/*
+ * Feature-test payload runner (x86-64 Linux)
+ *
+ * Usage: payload_runner payload.bin
+ *
+ * Copies a flat payload into RWX memory, calls it and prints the value it
+ * returns in RAX in hex. Decoder stubs decode in place and the LZ
+ * decompressor expands its stream into the memory behind it, so the mapping
+ * leaves PAYLOAD_SLACK spare bytes after the payload.
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define PAYLOAD_SLACK (1u << 20)
+
+uint64_t call_payload(void *entry);
+
+// A decoder stub is not a SysV function: keep the callee-saved registers
+// and the stack pointer out of its reach and realign the stack for it.
+__asm__(
+    ".text\n"
+    ".globl call_payload\n"
+    "call_payload:\n"
+    "    push %rbx\n"
+    "    push %rbp\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov %rsp, %rbp\n"
+    "    and $-16, %rsp\n"
+    "    push %rbp\n"
+    "    push %rbp\n"
+    "    call *%rdi\n"
+    "    mov 8(%rsp), %rbp\n"
+    "    mov %rbp, %rsp\n"
+    "    pop %r15\n"
+    "    pop %r14\n"
+    "    pop %r13\n"
+    "    pop %r12\n"
+    "    pop %rbp\n"
+    "    pop %rbx\n"
+    "    ret\n");
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s payload.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 2;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0) {
+        fprintf(stderr, "%s: empty payload\n", argv[1]);
+        fclose(file);
+        return 2;
+    }
+
+    uint8_t *memory = mmap(NULL, (size_t)size + PAYLOAD_SLACK,
+                           PROT_READ | PROT_WRITE | PROT_EXEC,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        fclose(file);
+        return 2;
+    }
+    if (fread(memory, 1, (size_t)size, file) != (size_t)size) {
+        fprintf(stderr, "%s: short read\n", argv[1]);
+        fclose(file);
+        return 2;
+    }
+    fclose(file);
+
+    printf("0x%llx\n", (unsigned long long)call_payload(memory));
+    return 0;
+}
@@ -0,0 +1,79 @@
+; Feature-test payload for x86-64 (tests/run_tests.sh, section 5)
+;
+; A SysV function that returns a checksum in RAX (0x5240a). Each block gives
+; one rewrite feature work to do:
+;   [rcx] with ModR/M 0x09       --rename-registers (run with bad bytes 00,09)
+;   repeated dirty constants     --constant-pool (the 64-bit ones), --constant-reuse
+;   [rsp+disp32] accesses        --rebase-displacements
+;   RIP-relative LEA             the shared GetPC base
+;   forward rel32 CALL and JMP   the RIP-indirect form: with 0x00 bad no
+;                                padding cleans their high displacement bytes
+;   JNZ over 200 bytes           a branch island
+;   caller-saved scratch         --clobber
+;   400 bytes of NOPs            --compress
+;
+; Build: nasm -f bin x64_features.asm -o x64_features.bin
+
+BITS 64
+DEFAULT REL
+
+entry:
+    push rbx
+    sub rsp, 0x208
+
+    lea rcx, [rsp + 0x10]
+    mov dword [rcx], 7
+    mov ecx, [rcx]
+    mov ebx, ecx
+
+    xor eax, eax
+    mov ecx, 0x100
+    mov edx, 0x100
+    mov [rsp + 0x100], ecx
+    mov [rsp + 0x104], edx
+    mov [rsp + 0x108], ecx
+    add eax, [rsp + 0x100]
+    add eax, [rsp + 0x104]
+    add eax, [rsp + 0x108]
+    add eax, ebx
+    mov ebx, 0x100
+    add eax, ebx
+
+    mov rdx, 0x10000000100
+    mov rsi, 0x10000000100
+    mov rdi, 0x10000000100
+    add rdx, rsi
+    add rdx, rdi
+    shr rdx, 40
+    add eax, edx
+
+    lea rsi, [helper]
+    call rsi
+    call helper
+
+    ; No rel8 reaches .far and every rel32 to it holds 0x00, so the JNZ
+    ; needs an island in the dead bytes after the JMP
+    test ebx, ebx
+    jnz .far
+    times 100 nop
+    jmp .far
+    times 100 int3
+.far:
+
+    mov ecx, 5
+.loop:
+    add eax, 0x10000
+    dec ecx
+    jnz .loop
+    jmp .done
+
+    times 400 nop
+
+.done:
+    add rsp, 0x208
+    pop rbx
+    ret
+
+helper:
+    add eax, 0x1000
+    ret
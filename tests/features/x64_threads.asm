@@ -0,0 +1,33 @@
+; Threaded-generation payload for x86-64 (tests/run_tests.sh, section 5)
+;
+; About 5000 instructions in short basic blocks. The generator cuts a chunk
+; at the first block start after every GENERATE_CHUNK_INSNS (2048)
+; instructions, so this makes three chunks and --threads has work to split. The JMPs between the head and the tail cross every
+; chunk. Returns 0xbb801 in RAX.
+;
+; Build: nasm -f bin x64_threads.asm -o x64_threads.bin
+
+BITS 64
+
+%macro block 0
+    add eax, 0x100
+    mov ecx, 0x200
+    jnz %%next
+    add eax, 0x10000
+%%next:
+    add eax, ecx
+%endmacro
+
+entry:
+    xor eax, eax
+    jmp work
+
+done:
+    inc eax
+    ret
+
+work:
+%rep 1000
+    block
+%endrep
+    jmp done
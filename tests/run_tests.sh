@@ -1133,7 +1133,7 @@ echo ""
 # ----------------------------------------------------------
 # 0. Preflight checks
 # ----------------------------------------------------------
-echo "[0/4] Preflight checks"
+echo "[0/5] Preflight checks"
 if preflight_check; then
   :
 else
@@ -1144,7 +1144,7 @@ fi
 
 if [[ "$MODE" == "verify-denulled" || "$MODE" == "verify-equivalence" || "$MODE" == "verify-parity" || "$MODE" == "release-gate" ]]; then
   echo ""
-  echo "[1/4] Verification-mode prerequisites"
+  echo "[1/5] Verification-mode prerequisites"
   if [[ "$MODE" != "verify-parity" && "$MODE" != "release-gate" ]]; then
     if verify_binary_available; then
       :
@@ -1194,7 +1194,7 @@ fi
 # ----------------------------------------------------------
 # 1. Build verification
 # ----------------------------------------------------------
-echo "[1/4] Build verification"
+echo "[1/5] Build verification"
 if run_cmd make -C "$PROJECT_ROOT" clean && run_cmd make -C "$PROJECT_ROOT"; then
   log_pass "make clean && make succeeded"
 else
@@ -1215,7 +1215,7 @@ fi
 # 2. CLI smoke tests
 # ----------------------------------------------------------
 echo ""
-echo "[2/4] CLI smoke tests"
+echo "[2/5] CLI smoke tests"
 
 if run_cmd "$BIN" --help; then
   log_pass "--help exits successfully"
@@ -1239,7 +1239,7 @@ fi
 # 3. Transformation tests on fixtures
 # ----------------------------------------------------------
 echo ""
-echo "[3/4] Transformation tests"
+echo "[3/5] Transformation tests"
 
 if [[ "$ARCH" == "all" ]]; then
   TARGET_ARCHES=(x86 x64 arm)
@@ -1302,7 +1302,7 @@ fi
 # 4. Batch processing test (full mode only)
 # ----------------------------------------------------------
 echo ""
-echo "[4/4] Batch processing test"
+echo "[4/5] Batch processing test"
 
 if [[ "$MODE" == "baseline" ]]; then
   log_skip "batch processing skipped in baseline mode"
@@ -1321,6 +1321,328 @@ else
   fi
 fi
 
+# ----------------------------------------------------------
+# 5. Feature tests
+# ----------------------------------------------------------
+echo ""
+echo "[5/5] Feature tests"
+
+FEATURES="$PROJECT_ROOT/tests/features"
+feature_dir="$TMPDIR/features"
+mkdir -p "$feature_dir"
+
+# Execution needs an x86-64 Linux host; elsewhere only bad bytes are checked
+can_execute_x64=0
+if [[ "$(uname -s)" == "Linux" && "$(uname -m)" == "x86_64" ]]; then
+  can_execute_x64=1
+fi
+
+# Relocation equivalence needs the LLVM disassembler for ARM targets
+can_compare_arm=0
+if command -v llvm-objdump > /dev/null 2>&1 && command -v llvm-objcopy > /dev/null 2>&1; then
+  can_compare_arm=1
+fi
+
+x64_payload="$feature_dir/x64_features.bin"
+runner="$feature_dir/payload_runner"
+x64_expected=""
+
+if ! run_cmd nasm -f bin -o "$x64_payload" "$FEATURES/x64_features.asm"; then
+  log_fail "x64 feature payload does not assemble"
+  x64_payload=""
+elif [[ "$can_execute_x64" -eq 1 ]]; then
+  if run_cmd gcc -O2 -o "$runner" "$FEATURES/payload_runner.c"; then
+    x64_expected=$("$runner" "$x64_payload" 2>/dev/null) || x64_expected=""
+  fi
+  if [[ -z "$x64_expected" ]]; then
+    log_fail "payload runner cannot execute the x64 feature payload"
+    x64_payload=""
+  fi
+fi
+
+# check_x64_output NAME BAD_BYTES OUTPUT [EXPECTED]
+# Checks OUTPUT for BAD_BYTES and, where it can run, that it returns what
+# the input returns (EXPECTED, default: the feature payload's value).
+check_x64_output() {
+  local name="$1" bad="$2" output="$3" expected="${4:-$x64_expected}" got
+
+  if ! run_cmd python3 "$PROJECT_ROOT/verify_denulled.py" --bad-chars "$bad" "$output"; then
+    log_fail "x64 $name -- bad bytes remain"
+    return
+  fi
+  if [[ "$can_execute_x64" -eq 0 ]]; then
+    log_pass "x64 $name -- bad-byte free (execution skipped: host is not x86-64 Linux)"
+    return
+  fi
+  got=$("$runner" "$output" 2>/dev/null) || got="a crash"
+  if [[ "$got" == "$expected" ]]; then
+    log_pass "x64 $name -- bad-byte free, returns $got like the input"
+  else
+    log_fail "x64 $name -- returns $got, the input returns $expected"
+  fi
+}
+
+# run_x64_feature NAME BAD_BYTES [byvalver options...]
+run_x64_feature() {
+  local name="$1" bad="$2"
+  shift 2
+  local output="$feature_dir/x64_$name.bin"
+
+  if [[ -z "$x64_payload" ]]; then
+    log_skip "x64 $name -- no feature payload"
+    return
+  fi
+  if ! run_cmd_logged "$feature_dir/x64_$name.log" "$BIN" --arch x64 --bad-bytes "$bad" "$@" "$x64_payload" "$output"; then
+    log_fail "x64 $name -- transformation failed"
+    return
+  fi
+  check_x64_output "$name" "$bad" "$output"
+}
+
+# check_x64_log NAME PATTERN WHAT
+# Checks that the log of run_x64_feature NAME has a line matching PATTERN
+# (grep -E), i.e. that the feature reported doing WHAT.
+check_x64_log() {
+  local name="$1" pattern="$2" what="$3"
+  local log_file="$feature_dir/x64_$name.log"
+
+  if [[ ! -s "$feature_dir/x64_$name.bin" ]]; then
+    log_skip "x64 $name -- no output to check for $what"
+  elif grep -Eq "$pattern" "$log_file"; then
+    log_pass "x64 $name -- $what"
+  else
+    log_fail "x64 $name -- no $what in the --verbose summary"
+  fi
+}
+
+# run_relocation_feature ARCH HEX_FILE [byvalver options...]
+# The *_branch inputs carry one branch whose offset holds 0x0a; with 0x0a bad
+# the rewrite must relocate it without changing the instruction stream. The
+# *_immediate inputs carry constants whose encodings hold 0x0a; their rewrites
+# must leave every register with the value the input gives it.
+run_relocation_feature() {
+  local arch="$1" hex="$2"
+  shift 2
+  local input="$feature_dir/${hex%.hex}.bin"
+  local output="$feature_dir/${hex%.hex}.out.bin"
+  local log_file="$feature_dir/${hex%.hex}.check.log"
+  local name="${hex%.hex}"
+
+  if ! xxd -r -p "$FEATURES/$hex" > "$input"; then
+    log_fail "$name -- cannot build input from $hex"
+    return
+  fi
+  if ! run_cmd "$BIN" --arch "$arch" --bad-bytes 0a "$@" "$input" "$output"; then
+    log_fail "$name -- transformation failed"
+    return
+  fi
+  if ! run_cmd python3 "$PROJECT_ROOT/verify_denulled.py" --bad-chars 0a "$output"; then
+    log_fail "$name -- bad bytes remain"
+    return
+  fi
+  if [[ "$can_compare_arm" -eq 0 ]]; then
+    log_pass "$name -- bad-byte free (disassembly check skipped: llvm-objdump not found)"
+    return
+  fi
+  if run_cmd_logged "$log_file" python3 "$FEATURES/check_relocation.py" --arch "$arch" "$input" "$output"; then
+    log_pass "$name -- bad-byte free, disassembly matches the input"
+  else
+    log_fail "$name -- disassembly differs from the input ($(tail -n 1 "$log_file"))"
+  fi
+}
+
+# run_stub_feature ARCH HEX_FILE
+# Puts the 0x0a-free rewrite of an input behind an --xor-encode auto stub
+# and checks the stub and the payload it decodes against the plain rewrite.
+run_stub_feature() {
+  local arch="$1" hex="$2"
+  local input="$feature_dir/${hex%.hex}.bin"
+  local plain="$feature_dir/${hex%.hex}.plain.bin"
+  local output="$feature_dir/${hex%.hex}.xor.bin"
+  local log_file="$feature_dir/${hex%.hex}.xor.log"
+  local check_log="$feature_dir/${hex%.hex}.xor.check.log"
+  local stub
+
+  if ! xxd -r -p "$FEATURES/$hex" > "$input" ||
+     ! run_cmd "$BIN" --arch "$arch" --bad-bytes 0a "$input" "$plain"; then
+    log_fail "$arch decoder stub -- plain rewrite failed"
+    return
+  fi
+  if ! run_cmd_logged "$log_file" "$BIN" --arch "$arch" --bad-bytes 0a --xor-encode auto "$input" "$output"; then
+    log_fail "$arch decoder stub -- transformation failed"
+    return
+  fi
+  if ! run_cmd python3 "$PROJECT_ROOT/verify_denulled.py" --bad-chars 0a "$output"; then
+    log_fail "$arch decoder stub -- bad bytes remain"
+    return
+  fi
+  if [[ "$can_compare_arm" -eq 0 ]]; then
+    log_pass "$arch decoder stub -- bad-byte free (disassembly check skipped: llvm-objdump not found)"
+    return
+  fi
+  stub=$(sed -n 's/.*\[DECODER\] \([a-z-]*\)-32 stub (\([0-9]*\) bytes.*/--kind \1 --stub-size \2/p' "$log_file")
+  if [[ -z "$stub" ]]; then
+    log_fail "$arch decoder stub -- no [DECODER] summary in the output"
+    return
+  fi
+  if run_cmd_logged "$check_log" python3 "$FEATURES/check_decoder_stub.py" --arch "$arch" $stub "$plain" "$output"; then
+    log_pass "$arch decoder stub -- bad-byte free, stub decodes to the plain rewrite"
+  else
+    log_fail "$arch decoder stub -- $(tail -n 1 "$check_log")"
+  fi
+}
+
+run_x64_feature "layout-islands-getpc" "00" --verbose
+check_x64_log "layout-islands-getpc" '\[LAYOUT\] [1-9][0-9]* branch islands .* serve [1-9]' "branch island"
+check_x64_log "layout-islands-getpc" '\[LAYOUT\] [0-9]+ branches: .*, [1-9][0-9]* rip-indirect' "RIP-indirect branch"
+check_x64_log "layout-islands-getpc" '\[LAYOUT\] [0-9]+ RIP-relative references: [1-9][0-9]* via shared GetPC base' "GetPC-based reference"
+run_x64_feature "constant-pool" "00" --constant-pool --verbose
+check_x64_log "constant-pool" '\[LAYOUT\] constant pool: [1-9][0-9]* constants .*, [1-9][0-9]* pooled loads' "pooled load"
+run_x64_feature "size-budget" "00" --optimize-size --max-output-size 4096
+run_x64_feature "constant-reuse" "00" --constant-reuse --verbose
+check_x64_log "constant-reuse" '\[REUSE\] [0-9]+ constant uses served from registers, [0-9]+ cached' "constant served from a register"
+run_x64_feature "rebase-displacements" "00" --rebase-displacements --verbose
+check_x64_log "rebase-displacements" '\[REBASE\] [1-9][0-9]* memory operands in [1-9][0-9]* runs' "rebased memory operand"
+
+x64_clobber="rcx,rdx,rsi,rdi,r8,r9,r10,r11,flags"
+run_x64_feature "rename-registers" "00,09" --rename-registers --clobber "$x64_clobber" --verbose
+check_x64_log "rename-registers" '\[RENAME\] [a-z0-9]+->[a-z0-9]+' "register renaming"
+run_x64_feature "clobber" "00" --clobber "$x64_clobber"
+
+run_x64_feature "decoder-stub" "00" --xor-encode auto
+run_x64_feature "decoder-stub-wide" "00,0a,0d,20,ff" --xor-encode auto
+run_x64_feature "encode-pipeline" "00" --pipeline encode
+run_x64_feature "lz-compress" "00" --pipeline encode --compress
+run_x64_feature "biphasic" "00" --biphasic --seed 1
+run_x64_feature "obfuscation-budget" "00" --biphasic --obfuscation-budget 50% --seed 1
+run_x64_feature "flatten" "00" --flatten
+
+# --variants: a variant depends only on (seed, index), so two runs, and a
+# run with fewer variants, must write the same files; --keep-smallest K
+# writes only the K smallest of them
+variants_ok=1
+if [[ -z "$x64_payload" ]]; then
+  log_skip "x64 variants -- no feature payload"
+  variants_ok=0
+else
+  for run in a b c d; do
+    mkdir -p "$feature_dir/variants_$run"
+  done
+  if ! run_cmd "$BIN" --arch x64 --variants 4 --seed 1 "$x64_payload" "$feature_dir/variants_a/v.bin" ||
+     ! run_cmd "$BIN" --arch x64 --variants 4 --seed 1 "$x64_payload" "$feature_dir/variants_b/v.bin" ||
+     ! run_cmd "$BIN" --arch x64 --variants 2 --seed 1 "$x64_payload" "$feature_dir/variants_c/v.bin" ||
+     ! run_cmd "$BIN" --arch x64 --variants 4 --seed 1 --keep-smallest 2 "$x64_payload" "$feature_dir/variants_d/v.bin"; then
+    log_fail "x64 variants -- transformation failed"
+    variants_ok=0
+  fi
+fi
+
+if [[ "$variants_ok" -eq 1 ]]; then
+  variant_files=("$feature_dir"/variants_a/v.*.bin)
+  kept_files=("$feature_dir"/variants_d/v.*.bin)
+  if [[ ${#variant_files[@]} -ne 4 ]]; then
+    log_fail "x64 variants -- --variants 4 wrote ${#variant_files[@]} files"
+  else
+    variants_same=1
+    for variant in "${variant_files[@]}"; do
+      name=$(basename "$variant")
+      if ! cmp -s "$variant" "$feature_dir/variants_b/$name"; then
+        variants_same=0
+      fi
+      if [[ "$name" == "v.000.bin" || "$name" == "v.001.bin" ]] &&
+         ! cmp -s "$variant" "$feature_dir/variants_c/$name"; then
+        variants_same=0
+      fi
+    done
+    if [[ "$variants_same" -eq 1 ]]; then
+      log_pass "x64 variants -- same seed and index, same variant"
+    else
+      log_fail "x64 variants -- a variant changed between runs with the same seed"
+    fi
+    for variant in "${variant_files[@]}"; do
+      check_x64_output "variant $(basename "$variant" .bin)" "00" "$variant"
+    done
+  fi
+
+  # The two smallest of run a, in size order, ties by index
+  smallest=$(for variant in "${variant_files[@]}"; do
+               printf "%s %s\n" "$(wc -c < "$variant")" "$(basename "$variant")"
+             done | sort -k1,1n -k2,2 | head -n 2 | awk '{print $2}' | sort | tr '\n' ' ')
+  kept=$(for variant in "${kept_files[@]}"; do basename "$variant"; done | sort | tr '\n' ' ')
+  kept_same=1
+  for variant in "${kept_files[@]}"; do
+    if ! cmp -s "$variant" "$feature_dir/variants_a/$(basename "$variant")"; then
+      kept_same=0
+    fi
+  done
+  if [[ ${#kept_files[@]} -eq 2 && "$kept" == "$smallest" && "$kept_same" -eq 1 ]]; then
+    log_pass "x64 --keep-smallest 2 -- wrote the two smallest variants"
+  else
+    log_fail "x64 --keep-smallest 2 -- wrote ${kept:-nothing}, expected $smallest"
+  fi
+fi
+
+# --threads: a payload of several generation chunks must come out
+# byte-identical on one thread and on four
+threads_payload="$feature_dir/x64_threads.bin"
+threads_expected=""
+if ! run_cmd nasm -f bin -o "$threads_payload" "$FEATURES/x64_threads.asm"; then
+  log_fail "x64 threads -- payload does not assemble"
+elif [[ "$can_execute_x64" -eq 1 ]] &&
+     ! threads_expected=$("$runner" "$threads_payload" 2>/dev/null); then
+  log_fail "x64 threads -- payload runner cannot execute the input"
+elif ! run_cmd "$BIN" --arch x64 --threads 1 "$threads_payload" "$feature_dir/x64_threads.1.bin" ||
+     ! run_cmd "$BIN" --arch x64 --threads 4 "$threads_payload" "$feature_dir/x64_threads.4.bin"; then
+  log_fail "x64 threads -- transformation failed"
+elif ! cmp -s "$feature_dir/x64_threads.1.bin" "$feature_dir/x64_threads.4.bin"; then
+  log_fail "x64 threads -- --threads 1 and --threads 4 outputs differ"
+else
+  check_x64_output "threads" "00" "$feature_dir/x64_threads.4.bin" "$threads_expected"
+fi
+
+run_relocation_feature arm "arm_branch.hex"
+run_relocation_feature arm64 "arm64_branch.hex"
+run_relocation_feature thumb "thumb_it_branch.hex" --no-thumb-stub
+run_relocation_feature arm "arm_immediate.hex"
+run_relocation_feature arm64 "arm64_immediate.hex"
+
+run_stub_feature arm "arm_branch.hex"
+run_stub_feature arm64 "arm64_branch.hex"
+
+# make lib: link the static library into a host and call it
+if [[ -z "$x64_payload" ]]; then
+  log_skip "make lib smoke test -- no feature payload"
+elif ! run_cmd make -C "$PROJECT_ROOT" lib; then
+  log_fail "make lib failed"
+else
+  lib_smoke="$feature_dir/lib_smoke"
+  lib_output="$feature_dir/x64_lib.bin"
+  lib_log="$feature_dir/lib_smoke.log"
+  capstone_libs=$(pkg-config --libs capstone 2>/dev/null || echo "-lcapstone")
+
+  if ! run_cmd gcc -I"$PROJECT_ROOT/src" -o "$lib_smoke" "$FEATURES/lib_smoke.c" \
+      "$PROJECT_ROOT/bin/libbyvalver.a" $capstone_libs -lm -pthread; then
+    log_fail "make lib smoke test -- cannot link against bin/libbyvalver.a"
+  elif ! "$lib_smoke" "$x64_payload" "$lib_output" > "$lib_log" 2>&1; then
+    log_fail "make lib smoke test -- $(tail -n 1 "$lib_log")"
+  elif [[ -s "$lib_log" ]]; then
+    log_fail "make lib smoke test -- library printed output with verbose off"
+  else
+    check_x64_output "libbyvalver" "00" "$lib_output"
+  fi
+
+  lib_threads="$feature_dir/lib_threads"
+  lib_threads_log="$feature_dir/lib_threads.log"
+  if ! run_cmd gcc -I"$PROJECT_ROOT/src" -o "$lib_threads" "$FEATURES/lib_threads.c" \
+      "$PROJECT_ROOT/bin/libbyvalver.a" $capstone_libs -lm -pthread; then
+    log_fail "make lib threads test -- cannot link against bin/libbyvalver.a"
+  elif "$lib_threads" "$x64_payload" > "$lib_threads_log" 2>&1; then
+    log_pass "make lib threads test -- private and shared contexts give the same clean output"
+  else
+    log_fail "make lib threads test -- $(tail -n 1 "$lib_threads_log")"
+  fi
+fi
+
 # ----------------------------------------------------------
 # Summary
 # ----------------------------------------------------------